@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <cache.h>
+#include <pci.h>
+#include <transport.h>
+
+/**
+ * DOC: cache
+ *
+ * What is slow to read from a device and rarely changes is kept across
+ * invocations in $CXL_APP_CACHE_DIR, /var/cache/cxl_app by default. A
+ * file per device and kind of data, named after the device serial
+ * number, so a device moved to another slot or swapped for another one
+ * does not inherit the wrong data.
+ */
+
+static int cxl_memdev_serial(const char *memdev, u64 *serial)
+{
+	char path[PATH_MAX];
+	unsigned long long val;
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "/sys/bus/cxl/devices/%s/serial", memdev);
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+
+	ret = fscanf(f, "%llx", &val) == 1 ? 0 : -EINVAL;
+	fclose(f);
+	*serial = val;
+	return ret;
+}
+
+/**
+ * cache_key() - Name the cache files of a device
+ * @key: filled in
+ * @len: room in @key
+ * @t: transport to the device, or NULL
+ * @memdev: memN, for the serial in sysfs when @t cannot read the
+ *	    config space
+ *
+ * Return: 0, or -errno when the device has no serial number
+ */
+int cache_key(char *key, size_t len, struct transport *t, const char *memdev)
+{
+	u64 serial;
+	int ret;
+
+	if (t && (t->caps & TRANSPORT_CFG_ABS))
+		ret = pci_dsn(t, &serial);
+	else
+		ret = cxl_memdev_serial(memdev, &serial);
+	if (ret)
+		return ret;
+
+	snprintf(key, len, "%s%016llx", t && t->sim ? "sim-" : "",
+		 (unsigned long long)serial);
+	return 0;
+}
+
+/**
+ * cache_path() - Path of a cache file, its directory created if needed
+ * @path: filled in
+ * @len: room in @path
+ * @key: from cache_key()
+ * @kind: what is cached, the file extension
+ *
+ * Return: 0 or -errno
+ */
+int cache_path(char *path, size_t len, const char *key, const char *kind)
+{
+	const char *dir = getenv("CXL_APP_CACHE_DIR");
+	char *p;
+
+	if (!dir || !*dir)
+		dir = CACHE_DIR_DEFAULT;
+
+	snprintf(path, len, "%s/", dir);
+	for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (mkdir(path, 0755) && errno != EEXIST)
+			return -errno;
+		*p = '/';
+	}
+
+	snprintf(path, len, "%s/%s.%s", dir, key, kind);
+	return 0;
+}
@@ -0,0 +1,493 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cdat.h>
+#include <doe.h>
+#include <bitfield.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+/**
+ * DOC: cdat
+ *
+ * The CDAT is read entry by entry through CXL table access and the
+ * entries are assembled back to back into one buffer, which then is
+ * exactly the table as the device holds it, and what a dump file
+ * holds. The parser never copies out of it: cdat_next() walks the
+ * entries in place, checking each one is whole and at least as long
+ * as its type requires, and the cdat_<type>() views cast to the typed
+ * structure only when the type matches.
+ *
+ * The table rarely changes, so cdat_read_cached() keeps a copy on
+ * disk and only reads the header, entry handle 0, to check it still is
+ * the table the device holds: same length, checksum and sequence.
+ *
+ * A full read also records the entry handle and type of each structure
+ * in a struct cdat_index. With a current index, the structures of one
+ * type are fetched by handle, an exchange each, skipping the rest.
+ */
+
+/* Minimum length of each type, SSLBIS being followed by its entries */
+static const u16 cdat_min_len[CDAT_TYPE_MAX] = {
+	[CDAT_TYPE_DSMAS]	= sizeof(struct cdat_dsmas),
+	[CDAT_TYPE_DSLBIS]	= sizeof(struct cdat_dslbis),
+	[CDAT_TYPE_DSMSCIS]	= sizeof(struct cdat_dsmscis),
+	[CDAT_TYPE_DSIS]	= sizeof(struct cdat_dsis),
+	[CDAT_TYPE_DSEMTS]	= sizeof(struct cdat_dsemts),
+	[CDAT_TYPE_SSLBIS]	= sizeof(struct cdat_sslbis),
+};
+
+static const char * const cdat_type_names[CDAT_TYPE_MAX] = {
+	[CDAT_TYPE_DSMAS]	= "DSMAS",
+	[CDAT_TYPE_DSLBIS]	= "DSLBIS",
+	[CDAT_TYPE_DSMSCIS]	= "DSMSCIS",
+	[CDAT_TYPE_DSIS]	= "DSIS",
+	[CDAT_TYPE_DSEMTS]	= "DSEMTS",
+	[CDAT_TYPE_SSLBIS]	= "SSLBIS",
+};
+
+static const char * const cdat_hmat_names[] = {
+	[CDAT_HMAT_ACCESS_LATENCY]	= "access latency",
+	[CDAT_HMAT_READ_LATENCY]	= "read latency",
+	[CDAT_HMAT_WRITE_LATENCY]	= "write latency",
+	[CDAT_HMAT_ACCESS_BANDWIDTH]	= "access bandwidth",
+	[CDAT_HMAT_READ_BANDWIDTH]	= "read bandwidth",
+	[CDAT_HMAT_WRITE_BANDWIDTH]	= "write bandwidth",
+};
+
+static const char *cdat_hmat_unit(u8 data_type)
+{
+	return data_type < CDAT_HMAT_ACCESS_BANDWIDTH ? "ps" : "MB/s";
+}
+
+const char *cdat_type_name(u8 type)
+{
+	return type < CDAT_TYPE_MAX ? cdat_type_names[type] : "unknown";
+}
+
+/* A type by name, DSMAS, dslbis..., or by number */
+int cdat_type_parse(const char *name)
+{
+	char *end;
+	long type;
+	int i;
+
+	for (i = 0; i < CDAT_TYPE_MAX; i++)
+		if (!strcasecmp(name, cdat_type_names[i]))
+			return i;
+
+	type = strtol(name, &end, 0);
+	if (*end || end == name || type < 0 || type > 0xff)
+		return -EINVAL;
+
+	return type;
+}
+
+const char *cdat_hmat_name(u8 data_type)
+{
+	return data_type < ARRAY_SIZE(cdat_hmat_names) ?
+	       cdat_hmat_names[data_type] : "unknown";
+}
+
+/**
+ * cdat_init() - Validate a CDAT
+ * @cdat: set to view @buf
+ * @buf: the table, starting with its header
+ * @len: bytes in @buf, at least the table length
+ *
+ * Return: 0, -EINVAL when the length does not fit or -EBADMSG when
+ * the checksum does not add up
+ */
+int cdat_init(struct cdat *cdat, const void *buf, size_t len)
+{
+	const struct cdat_header *hdr = buf;
+	const u8 *p = buf;
+	u8 sum = 0;
+	u32 i;
+
+	if (len < sizeof(*hdr) || hdr->length < sizeof(*hdr) ||
+	    hdr->length > len)
+		return -EINVAL;
+
+	for (i = 0; i < hdr->length; i++)
+		sum += p[i];
+	if (sum)
+		return -EBADMSG;
+
+	cdat->hdr = hdr;
+	cdat->end = p + hdr->length;
+	return 0;
+}
+
+/**
+ * cdat_next() - The entry after @e
+ * @cdat: from cdat_init()
+ * @e: an entry cdat_next() returned, NULL for the first one
+ *
+ * Return: the entry, or NULL at the end of the table or at the first
+ * entry that does not fit in it or is too short for its type
+ */
+const struct cdat_entry_header *cdat_next(const struct cdat *cdat,
+					  const struct cdat_entry_header *e)
+{
+	const u8 *p = e ? (const u8 *)e + e->length :
+			  (const u8 *)cdat->hdr + sizeof(*cdat->hdr);
+
+	if (p >= cdat->end)
+		return NULL;
+
+	return cdat_entry(p, cdat->end - p);
+}
+
+/**
+ * cdat_entry() - Validate a single CDAT structure
+ * @buf: the structure
+ * @len: bytes in @buf
+ *
+ * Return: the structure, or NULL when it does not fit in @len or is
+ * too short for its type
+ */
+const struct cdat_entry_header *cdat_entry(const void *buf, size_t len)
+{
+	const struct cdat_entry_header *e = buf;
+	u16 min_len = sizeof(*e);
+
+	if (len < sizeof(*e))
+		return NULL;
+
+	if (e->type < CDAT_TYPE_MAX)
+		min_len = cdat_min_len[e->type];
+
+	if (e->length < min_len || e->length > len)
+		return NULL;
+
+	if (e->type == CDAT_TYPE_SSLBIS &&
+	    (e->length - min_len) % sizeof(struct cdat_sslbe))
+		return NULL;
+
+	return e;
+}
+
+void cdat_print_entry(FILE *f, const struct cdat_entry_header *e)
+{
+	const struct cdat_dsmas *dsmas;
+	const struct cdat_dslbis *dslbis;
+	const struct cdat_dsmscis *dsmscis;
+	const struct cdat_dsis *dsis;
+	const struct cdat_dsemts *dsemts;
+	const struct cdat_sslbis *sslbis;
+	int i;
+
+	fprintf(f, "%-7s length %u:", cdat_type_name(e->type), e->length);
+
+	if ((dsmas = cdat_dsmas(e)))
+		fprintf(f, " handle %u flags 0x%02x DPA 0x%llx-0x%llx\n",
+			dsmas->dsmad_handle, dsmas->flags,
+			(unsigned long long)dsmas->dpa_base,
+			(unsigned long long)(dsmas->dpa_base +
+					     dsmas->dpa_length - 1));
+	else if ((dslbis = cdat_dslbis(e)))
+		fprintf(f, " handle %u %s %llu %s\n", dslbis->handle,
+			cdat_hmat_name(dslbis->data_type),
+			(unsigned long long)
+			cdat_value(dslbis->entry_base_unit,
+				   dslbis->entry[0]),
+			cdat_hmat_unit(dslbis->data_type));
+	else if ((dsmscis = cdat_dsmscis(e)))
+		fprintf(f, " handle %u side cache %llu attributes 0x%08x\n",
+			dsmscis->dsmas_handle,
+			(unsigned long long)dsmscis->side_cache_size,
+			dsmscis->cache_attributes);
+	else if ((dsis = cdat_dsis(e)))
+		fprintf(f, " handle %u flags 0x%02x\n", dsis->handle,
+			dsis->flags);
+	else if ((dsemts = cdat_dsemts(e)))
+		fprintf(f, " handle %u EFI type %u DPA offset 0x%llx length 0x%llx\n",
+			dsemts->dsmas_handle, dsemts->memory_type,
+			(unsigned long long)dsemts->dpa_offset,
+			(unsigned long long)dsemts->range_length);
+	else if ((sslbis = cdat_sslbis(e))) {
+		fprintf(f, " %s\n", cdat_hmat_name(sslbis->data_type));
+		for (i = 0; i < cdat_sslbis_n(sslbis); i++)
+			fprintf(f, "        port 0x%04x <-> port 0x%04x %llu %s\n",
+				sslbis->entries[i].portx_id,
+				sslbis->entries[i].porty_id,
+				(unsigned long long)
+				cdat_value(sslbis->entry_base_unit,
+					   sslbis->entries[i].value),
+				cdat_hmat_unit(sslbis->data_type));
+	} else
+		fprintf(f, "\n");
+}
+
+void cdat_print(FILE *f, const struct cdat *cdat)
+{
+	const struct cdat_entry_header *e;
+
+	fprintf(f, "CDAT length %u revision %u checksum 0x%02x sequence %u\n",
+		cdat->hdr->length, cdat->hdr->revision, cdat->hdr->checksum,
+		cdat->hdr->sequence);
+
+	cdat_for_each_entry(cdat, e)
+		cdat_print_entry(f, e);
+}
+
+/**
+ * cdat_read() - Read the CDAT of a device through table access
+ * @mb: the DOE mailbox serving CXL table access
+ * @buf: the table is assembled here, 4-byte aligned
+ * @cap: bytes in @buf
+ * @idx: filled in with the handle of each structure, or NULL
+ *
+ * Each entry is received straight into its place in @buf. The table
+ * access header the device puts in front of it lands on the last
+ * dword of the entry before, which is saved and put back.
+ *
+ * Return: length of the table in bytes, or -errno
+ */
+int cdat_read(struct doe_mb *mb, void *buf, size_t cap, struct cdat_index *idx)
+{
+	u32 *dst, saved, first[1 + sizeof(struct cdat_header) / 4];
+	u32 req, handle = 0, next, len;
+	size_t off = 0;
+	int ret;
+
+	if (idx)
+		idx->n = 0;
+
+	do {
+		req = FIELD_PREP(CXL_DOE_TABLE_ACCESS_REQ_CODE,
+				 CXL_DOE_TABLE_ACCESS_REQ_CODE_READ) |
+		      FIELD_PREP(CXL_DOE_TABLE_ACCESS_TABLE_TYPE,
+				 CXL_DOE_TABLE_ACCESS_TABLE_TYPE_CDATA) |
+		      FIELD_PREP(CXL_DOE_TABLE_ACCESS_ENTRY_HANDLE, handle);
+
+		if (!off) {
+			dst = first;
+			ret = doe_exchange(mb, PCI_DVSEC_VENDOR_ID_CXL,
+					   CXL_DOE_PROTOCOL_TABLE_ACCESS, &req, 1,
+					   dst, ARRAY_SIZE(first));
+		} else {
+			dst = (u32 *)((u8 *)buf + off) - 1;
+			saved = *dst;
+			ret = doe_exchange(mb, PCI_DVSEC_VENDOR_ID_CXL,
+					   CXL_DOE_PROTOCOL_TABLE_ACCESS, &req, 1,
+					   dst, (cap - off) / 4 + 1);
+		}
+		if (ret < 0)
+			return ret;
+		if (ret < 2)
+			return -EIO;
+
+		len = (ret - 1) * 4;
+		next = FIELD_GET(CXL_DOE_TABLE_ACCESS_ENTRY_HANDLE, dst[0]);
+
+		if (!off) {
+			/* Handle 0 is the header, never more than @first holds */
+			if ((size_t)ret > ARRAY_SIZE(first))
+				return -EIO;
+			if (len > cap)
+				return -ENOSPC;
+			memcpy(buf, &first[1], len);
+			if (idx)
+				memcpy(&idx->hdr, buf, sizeof(idx->hdr));
+		} else {
+			*dst = saved;
+			if (off + len > cap)
+				return -ENOSPC;
+			if (idx && idx->n < CDAT_MAX_ENTRIES) {
+				idx->ent[idx->n].handle = handle;
+				idx->ent[idx->n].type = ((u8 *)buf)[off];
+				idx->ent[idx->n].length = len;
+				idx->n++;
+			}
+		}
+		off += len;
+		handle = next;
+	} while (handle != CXL_DOE_TABLE_ACCESS_LAST_ENTRY);
+
+	return off;
+}
+
+/* The header alone, entry handle 0, in a single exchange */
+int cdat_read_header(struct doe_mb *mb, struct cdat_header *hdr)
+{
+	u32 req = 0, rsp[1 + sizeof(*hdr) / 4];
+	int ret;
+
+	ret = doe_exchange(mb, PCI_DVSEC_VENDOR_ID_CXL,
+			   CXL_DOE_PROTOCOL_TABLE_ACCESS, &req, 1,
+			   rsp, ARRAY_SIZE(rsp));
+	if (ret < 0)
+		return ret;
+	if (ret < (int)ARRAY_SIZE(rsp))
+		return -EIO;
+
+	memcpy(hdr, &rsp[1], sizeof(*hdr));
+	return 0;
+}
+
+/**
+ * cdat_read_entry() - Fetch a single structure by its entry handle
+ * @mb: the DOE mailbox serving CXL table access
+ * @handle: from struct cdat_index
+ * @buf: the structure, 4-byte aligned
+ * @cap: bytes in @buf
+ *
+ * Return: length of the structure in bytes, or -errno
+ */
+int cdat_read_entry(struct doe_mb *mb, u16 handle, void *buf, size_t cap)
+{
+	u32 req;
+	int ret, len;
+
+	req = FIELD_PREP(CXL_DOE_TABLE_ACCESS_REQ_CODE,
+			 CXL_DOE_TABLE_ACCESS_REQ_CODE_READ) |
+	      FIELD_PREP(CXL_DOE_TABLE_ACCESS_TABLE_TYPE,
+			 CXL_DOE_TABLE_ACCESS_TABLE_TYPE_CDATA) |
+	      FIELD_PREP(CXL_DOE_TABLE_ACCESS_ENTRY_HANDLE, handle);
+
+	ret = doe_exchange(mb, PCI_DVSEC_VENDOR_ID_CXL,
+			   CXL_DOE_PROTOCOL_TABLE_ACCESS, &req, 1,
+			   buf, cap / 4);
+	if (ret < 0)
+		return ret;
+	if (ret < 2)
+		return -EIO;
+	if ((size_t)ret > cap / 4)
+		return -ENOSPC;
+
+	/* Drop the table access response header */
+	len = (ret - 1) * 4;
+	memmove(buf, (u32 *)buf + 1, len);
+
+	return cdat_entry(buf, len) ? len : -EBADMSG;
+}
+
+/**
+ * cdat_read_cached() - cdat_read(), unless the copy at @path is current
+ * @mb: the DOE mailbox serving CXL table access
+ * @path: the cached copy, written when it is not current
+ * @buf: the table is assembled or loaded here, 4-byte aligned
+ * @cap: bytes in @buf
+ * @hit: set when the cached copy was current
+ * @idx: filled in by cdat_read() when the cached copy was stale, or NULL
+ *
+ * Return: length of the table in bytes, or -errno
+ */
+int cdat_read_cached(struct doe_mb *mb, const char *path, void *buf,
+		     size_t cap, bool *hit, struct cdat_index *idx)
+{
+	const struct cdat_header *cached = buf;
+	struct cdat_header hdr;
+	struct cdat cdat;
+	int len, ret;
+
+	*hit = false;
+
+	ret = cdat_read_header(mb, &hdr);
+	if (ret)
+		return ret;
+
+	len = cdat_load(path, buf, cap);
+	if (len > 0 && !cdat_init(&cdat, buf, len) &&
+	    cached->length == hdr.length && cached->checksum == hdr.checksum &&
+	    cached->sequence == hdr.sequence) {
+		*hit = true;
+		return cached->length;
+	}
+
+	len = cdat_read(mb, buf, cap, idx);
+	if (len > 0 && !cdat_init(&cdat, buf, len))
+		cdat_save(path, buf, cdat.hdr->length);
+
+	return len;
+}
+
+int cdat_load(const char *path, void *buf, size_t cap)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	len = read(fd, buf, cap);
+	if (len < 0)
+		len = -errno;
+	close(fd);
+
+	return len;
+}
+
+/* Written to a temporary file first, so readers never see half of it */
+int cdat_save(const char *path, const void *buf, size_t len)
+{
+	char tmp[4096];
+	ssize_t ret;
+	int fd;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -errno;
+
+	ret = write(fd, buf, len);
+	if (ret < 0)
+		ret = -errno;
+	else if (ret != (ssize_t)len)
+		ret = -EIO;
+	if (close(fd) && ret >= 0)
+		ret = -errno;
+	if (ret < 0) {
+		unlink(tmp);
+		return ret;
+	}
+
+	if (rename(tmp, path)) {
+		ret = -errno;
+		unlink(tmp);
+		return ret;
+	}
+
+	return 0;
+}
+
+/* The index is only good for the table it was built from */
+bool cdat_index_current(const struct cdat_index *idx,
+			const struct cdat_header *hdr)
+{
+	return idx->n && idx->hdr.length == hdr->length &&
+	       idx->hdr.checksum == hdr->checksum &&
+	       idx->hdr.sequence == hdr->sequence;
+}
+
+int cdat_index_load(const char *path, struct cdat_index *idx)
+{
+	int len;
+
+	len = cdat_load(path, idx, sizeof(*idx));
+	if (len < 0)
+		return len;
+	if ((size_t)len < offsetof(struct cdat_index, ent) ||
+	    idx->n > CDAT_MAX_ENTRIES ||
+	    (size_t)len != offsetof(struct cdat_index, ent) +
+			   idx->n * sizeof(idx->ent[0])) {
+		idx->n = 0;
+		return -EBADMSG;
+	}
+
+	return 0;
+}
+
+int cdat_index_save(const char *path, const struct cdat_index *idx)
+{
+	return cdat_save(path, idx, offsetof(struct cdat_index, ent) +
+				    idx->n * sizeof(idx->ent[0]));
+}
@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+
+#include "include/linux/fuse.h"
+
+#include <cuse.h>
+#include <cxlmem.h>
+#include <doe_sim.h>
+#include <regs.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+/**
+ * DOC: cuse
+ *
+ * /dev/cxl/memN served from userspace through CUSE, so the tool, as is,
+ * runs against a simulated device on any box with /dev/cuse, no CXL
+ * hardware and no patched driver. The protocol is spoken directly on
+ * the /dev/cuse fd, one request read and one reply written at a time:
+ * CUSE_INIT names the device, OPEN and RELEASE are acknowledged, and
+ * the ioctls are unrestricted, their arguments pulled in with
+ * FUSE_IOCTL_RETRY rounds, one for the argument and, for those pointing
+ * further, one more for what it points to.
+ *
+ * CXL_MEM_CONFIG_WR and CXL_MEM_CONFIG_BATCH go to the DOE state machine
+ * of the simulated device, at offsets relative to its DOE instance as
+ * the driver's are, the instance serving discovery, CDAT and
+ * compliance. CXL_MEM_SEND_COMMAND goes to the mailbox registers of the
+ * device, answered by its thread, CXL_MEM_QUERY_COMMANDS lists
+ * cxl_mem_commands[]. CXL_MEM_DOE_IRQ_EVENTFD fails, an eventfd does not
+ * cross into the server, and the tool polls. Each ioctl takes at least
+ * the latency set for its op, on top of the device's own.
+ */
+
+#define CUSE_MAX_RW		0x10000
+#define CUSE_MAX_BATCH		1024
+#define CUSE_MAX_OUT		0x10000
+
+static u64 cuse_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/**
+ * cuse_dev_init() - Put a simulated device behind a CUSE device
+ * @cd: filled in
+ * @sim: the device, after doe_sim_init(); its mailbox thread is started
+ * @name: the device, relative to /dev
+ *
+ * Return: 0, or -errno
+ */
+int cuse_dev_init(struct cuse_dev *cd, struct doe_sim_dev *sim,
+		  const char *name)
+{
+	int ret;
+
+	memset(cd, 0, sizeof(*cd));
+	cd->name = name;
+	cd->sim = sim;
+
+	ret = cxl_regs_probe(&cd->regs, sim->regs, sizeof(sim->regs));
+	if (ret)
+		return ret;
+
+	/*
+	 * The driver's instance is the only one CXL_MEM_CONFIG_WR reaches,
+	 * so it serves every protocol of doe_sim_protocols[].
+	 */
+	cd->doe_cap = sim->doe[0].cap;
+	sim->doe[0].protocols = BIT(0) | BIT(1) | BIT(2);
+
+	return doe_sim_mbox_start(sim, sim->regs);
+}
+
+void cuse_dev_exit(struct cuse_dev *cd)
+{
+	doe_sim_mbox_stop(cd->sim);
+}
+
+int cuse_open(void)
+{
+	int fd = open("/dev/cuse", O_RDWR | O_CLOEXEC);
+
+	return fd < 0 ? -errno : fd;
+}
+
+static int cuse_reply(int fd, u64 unique, int error, const struct iovec *data,
+		      int n)
+{
+	struct fuse_out_header oh = { .error = error, .unique = unique };
+	struct iovec iov[8] = { { &oh, sizeof(oh) } };
+	int i;
+
+	oh.len = sizeof(oh);
+	for (i = 0; i < n && i + 1 < (int)ARRAY_SIZE(iov); i++) {
+		iov[i + 1] = data[i];
+		oh.len += data[i].iov_len;
+	}
+
+	/* ENOENT: the request was interrupted, no one waits for the reply */
+	if (writev(fd, iov, i + 1) < 0 && errno != ENOENT)
+		return -errno;
+	return 0;
+}
+
+static int cuse_reply_err(int fd, u64 unique, int error)
+{
+	return cuse_reply(fd, unique, error, NULL, 0);
+}
+
+/* What the ioctl needs of the caller's memory, to be asked for again */
+struct cuse_retry {
+	struct fuse_ioctl_out out;
+	struct fuse_ioctl_iovec iov[4];
+};
+
+/* The in iovecs first, then the out ones */
+static void cuse_retry_add(struct cuse_retry *r, bool is_in, u64 base, u64 len)
+{
+	unsigned int n = r->out.in_iovs + r->out.out_iovs;
+
+	if (!len)
+		return;
+	r->iov[n] = (struct fuse_ioctl_iovec) { .base = base, .len = len };
+	if (is_in)
+		r->out.in_iovs++;
+	else
+		r->out.out_iovs++;
+}
+
+static int cuse_retry_send(struct cuse_dev *cd, int fd, u64 unique,
+			   struct cuse_retry *r)
+{
+	struct iovec iov[2] = {
+		{ &r->out, sizeof(r->out) },
+		{ r->iov, (r->out.in_iovs + r->out.out_iovs) * sizeof(r->iov[0]) },
+	};
+
+	cd->n_retry++;
+	r->out.flags = FUSE_IOCTL_RETRY;
+	return cuse_reply(fd, unique, 0, iov, 2);
+}
+
+/*
+ * The ioctl done, its output @data copied to the out iovecs in order,
+ * once the latency of the op is over.
+ */
+static int cuse_ioctl_done(struct cuse_dev *cd, int fd, u64 unique,
+			   const struct iovec *data, int n)
+{
+	struct fuse_ioctl_out out = { 0 };
+	struct iovec iov[4] = { { &out, sizeof(out) } };
+	struct timespec ts = {
+		.tv_sec = cd->deadline_us / 1000000,
+		.tv_nsec = cd->deadline_us % 1000000 * 1000,
+	};
+	int i;
+
+	/* Asleep, not spinning, so the server takes no CPU off the client */
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+
+	for (i = 0; i < n && i + 1 < (int)ARRAY_SIZE(iov); i++)
+		iov[i + 1] = data[i];
+	return cuse_reply(fd, unique, 0, iov, i + 1);
+}
+
+static int cuse_query(struct cuse_dev *cd, int fd, u64 unique,
+		      const struct fuse_ioctl_in *in, const u8 *data)
+{
+	static u8 buf[sizeof(struct cxl_mem_query_commands) +
+		      CXL_MEM_COMMAND_ID_MAX * sizeof(struct cxl_command_info)];
+	struct cxl_mem_query_commands *q = (void *)buf;
+	struct cuse_retry r = { 0 };
+	struct iovec iov;
+	size_t need;
+	u32 asked;
+
+	if (in->in_size < sizeof(*q)) {
+		cuse_retry_add(&r, true, in->arg, sizeof(*q));
+		return cuse_retry_send(cd, fd, unique, &r);
+	}
+
+	memcpy(&asked, data, sizeof(asked));
+	q->n_commands = 0;
+	cxl_mem_query(q);
+	if (asked && asked < q->n_commands)
+		q->n_commands = asked;
+	need = sizeof(*q) + (asked ? q->n_commands : 0) *
+			    sizeof(struct cxl_command_info);
+
+	if (in->out_size < need) {
+		cuse_retry_add(&r, true, in->arg, sizeof(*q));
+		cuse_retry_add(&r, false, in->arg, need);
+		return cuse_retry_send(cd, fd, unique, &r);
+	}
+
+	q->n_commands = asked;
+	cxl_mem_query(q);
+	iov = (struct iovec) { buf, need };
+	return cuse_ioctl_done(cd, fd, unique, &iov, 1);
+}
+
+static int cuse_send(struct cuse_dev *cd, int fd, u64 unique,
+		     const struct fuse_ioctl_in *in, const u8 *data)
+{
+	static u8 out[CUSE_MAX_OUT];
+	struct cxl_send_command s;
+	struct cuse_retry r = { 0 };
+	struct cxl_mbox_cmd cmd;
+	struct iovec iov[2];
+	int ret;
+
+	if (in->in_size < sizeof(s)) {
+		cuse_retry_add(&r, true, in->arg, sizeof(s));
+		return cuse_retry_send(cd, fd, unique, &r);
+	}
+
+	memcpy(&s, data, sizeof(s));
+	if (s.in.size > cd->regs.payload_size || s.out.size > CUSE_MAX_OUT)
+		return cuse_reply_err(fd, unique, -EINVAL);
+
+	if (in->in_size < sizeof(s) + s.in.size ||
+	    in->out_size < sizeof(s) + s.out.size) {
+		cuse_retry_add(&r, true, in->arg, sizeof(s));
+		cuse_retry_add(&r, true, s.in.payload, s.in.size);
+		cuse_retry_add(&r, false, in->arg, sizeof(s));
+		cuse_retry_add(&r, false, s.out.payload, s.out.size);
+		return cuse_retry_send(cd, fd, unique, &r);
+	}
+
+	ret = cxl_mem_validate(&s, cd->regs.payload_size, &cmd);
+	if (ret)
+		return cuse_reply_err(fd, unique, ret);
+	cmd.payload_in = (void *)(data + sizeof(s));
+	cmd.payload_out = out;
+
+	ret = cxl_regs_mbox_send(&cd->regs, &cmd);
+	if (ret)
+		return cuse_reply_err(fd, unique, ret);
+
+	s.retval = cmd.return_code;
+	s.out.size = cmd.size_out;
+	iov[0] = (struct iovec) { &s, sizeof(s) };
+	iov[1] = (struct iovec) { out, cmd.size_out };
+	return cuse_ioctl_done(cd, fd, unique, iov, 2);
+}
+
+/* One access, at an offset relative to the DOE instance */
+static void cuse_config_one(struct cuse_dev *cd, struct cxl_pdev_config *op)
+{
+	u32 offset = op->offset;
+
+	op->offset += cd->doe_cap;
+	doe_sim_config(cd->sim, op);
+	op->offset = offset;
+}
+
+static int cuse_config(struct cuse_dev *cd, int fd, u64 unique,
+		       const struct fuse_ioctl_in *in, const u8 *data)
+{
+	struct cxl_pdev_config op;
+	struct cuse_retry r = { 0 };
+	struct iovec iov;
+
+	if (in->in_size < sizeof(op) || in->out_size < sizeof(op)) {
+		cuse_retry_add(&r, true, in->arg, sizeof(op));
+		cuse_retry_add(&r, false, in->arg, sizeof(op));
+		return cuse_retry_send(cd, fd, unique, &r);
+	}
+
+	memcpy(&op, data, sizeof(op));
+	cuse_config_one(cd, &op);
+	iov = (struct iovec) { &op, sizeof(op) };
+	return cuse_ioctl_done(cd, fd, unique, &iov, 1);
+}
+
+static int cuse_config_batch(struct cuse_dev *cd, int fd, u64 unique,
+			     const struct fuse_ioctl_in *in, const u8 *data)
+{
+	static struct cxl_pdev_config ops[CUSE_MAX_BATCH];
+	struct cxl_pdev_config_batch b;
+	struct cuse_retry r = { 0 };
+	struct iovec iov[2];
+	size_t len;
+	u32 i;
+
+	if (in->in_size < sizeof(b)) {
+		cuse_retry_add(&r, true, in->arg, sizeof(b));
+		return cuse_retry_send(cd, fd, unique, &r);
+	}
+
+	memcpy(&b, data, sizeof(b));
+	if (b.n_ops > CUSE_MAX_BATCH)
+		return cuse_reply_err(fd, unique, -E2BIG);
+	len = b.n_ops * sizeof(ops[0]);
+
+	if (in->in_size < sizeof(b) + len || in->out_size < sizeof(b) + len) {
+		cuse_retry_add(&r, true, in->arg, sizeof(b));
+		cuse_retry_add(&r, true, b.ops, len);
+		cuse_retry_add(&r, false, in->arg, sizeof(b));
+		cuse_retry_add(&r, false, b.ops, len);
+		return cuse_retry_send(cd, fd, unique, &r);
+	}
+
+	memcpy(ops, data + sizeof(b), len);
+	for (i = 0; i < b.n_ops; i++)
+		cuse_config_one(cd, &ops[i]);
+
+	iov[0] = (struct iovec) { &b, sizeof(b) };
+	iov[1] = (struct iovec) { ops, len };
+	return cuse_ioctl_done(cd, fd, unique, iov, 2);
+}
+
+static int cuse_ioctl(struct cuse_dev *cd, int fd,
+		      const struct fuse_in_header *ih, const u8 *body)
+{
+	const struct fuse_ioctl_in *in = (const void *)body;
+	const u8 *data = body + sizeof(*in);
+	u64 retry = cd->n_retry;
+	enum cuse_op op;
+	int ret;
+
+	if (ih->len < sizeof(*ih) + sizeof(*in) + in->in_size)
+		return cuse_reply_err(fd, ih->unique, -EINVAL);
+
+	switch (in->cmd) {
+	case CXL_MEM_QUERY_COMMANDS:
+		op = CUSE_OP_QUERY;
+		break;
+	case CXL_MEM_SEND_COMMAND:
+		op = CUSE_OP_SEND;
+		break;
+	case CXL_MEM_CONFIG_WR:
+	case CXL_MEM_CONFIG_BATCH:
+		op = CUSE_OP_CONFIG;
+		break;
+	default:
+		cd->n_err++;
+		return cuse_reply_err(fd, ih->unique, -ENOTTY);
+	}
+
+	/* Counted from the last round, the one with the arguments */
+	cd->deadline_us = cuse_now_us() + cd->latency_us[op];
+
+	switch (in->cmd) {
+	case CXL_MEM_QUERY_COMMANDS:
+		ret = cuse_query(cd, fd, ih->unique, in, data);
+		break;
+	case CXL_MEM_SEND_COMMAND:
+		ret = cuse_send(cd, fd, ih->unique, in, data);
+		break;
+	case CXL_MEM_CONFIG_WR:
+		ret = cuse_config(cd, fd, ih->unique, in, data);
+		break;
+	default:
+		ret = cuse_config_batch(cd, fd, ih->unique, in, data);
+	}
+
+	if (cd->n_retry == retry)
+		cd->n_op[op]++;
+	return ret;
+}
+
+static int cuse_init(struct cuse_dev *cd, int fd,
+		     const struct fuse_in_header *ih, const u8 *body)
+{
+	const struct cuse_init_in *in = (const void *)body;
+	struct cuse_init_out out = {
+		.major = FUSE_KERNEL_VERSION,
+		.minor = FUSE_KERNEL_MINOR_VERSION,
+		.flags = CUSE_UNRESTRICTED_IOCTL,
+		.max_read = CUSE_MAX_RW,
+		.max_write = CUSE_MAX_RW,
+	};
+	char info[64];
+	struct iovec iov[2] = {
+		{ &out, sizeof(out) },
+		{ info, 0 },
+	};
+
+	if (in->major != FUSE_KERNEL_VERSION)
+		return cuse_reply_err(fd, ih->unique, -EPROTO);
+
+	iov[1].iov_len = snprintf(info, sizeof(info), "DEVNAME=%s", cd->name) + 1;
+	return cuse_reply(fd, ih->unique, 0, iov, 2);
+}
+
+/**
+ * cuse_serve() - Answer the requests on a /dev/cuse fd
+ * @cd: the device
+ * @fd: from cuse_open(), or anything passing the requests one per read()
+ * @stop: set to return, by a signal handler say
+ *
+ * Return: 0 once @stop is set or the device gone, or -errno
+ */
+int cuse_serve(struct cuse_dev *cd, int fd, volatile bool *stop)
+{
+	static u8 buf[FUSE_MIN_READ_BUFFER + CUSE_MAX_RW];
+	const struct fuse_in_header *ih = (const void *)buf;
+	struct fuse_open_out open_out = { 0 };
+	struct iovec iov = { &open_out, sizeof(open_out) };
+	ssize_t n;
+	int ret;
+
+	while (!*stop) {
+		n = read(fd, buf, sizeof(buf));
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n < 0)
+			return errno == ENODEV ? 0 : -errno;
+		if (n == 0)
+			return 0;
+		if ((size_t)n < sizeof(*ih))
+			continue;
+
+		switch (ih->opcode) {
+		case CUSE_INIT:
+			ret = cuse_init(cd, fd, ih, buf + sizeof(*ih));
+			break;
+		case FUSE_OPEN:
+			ret = cuse_reply(fd, ih->unique, 0, &iov, 1);
+			break;
+		case FUSE_RELEASE:
+		case FUSE_FLUSH:
+			ret = cuse_reply_err(fd, ih->unique, 0);
+			break;
+		case FUSE_IOCTL:
+			ret = cuse_ioctl(cd, fd, ih, buf + sizeof(*ih));
+			break;
+		case FUSE_INTERRUPT:
+			/* Every request is answered before the next is read */
+			ret = 0;
+			break;
+		default:
+			ret = cuse_reply_err(fd, ih->unique, -ENOSYS);
+		}
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+void cuse_print_stats(FILE *f, const struct cuse_dev *cd)
+{
+	static const char *const names[] = {
+		[CUSE_OP_QUERY] = "query",
+		[CUSE_OP_SEND] = "send",
+		[CUSE_OP_CONFIG] = "config",
+	};
+	int i;
+
+	for (i = 0; i < CUSE_OP_MAX; i++)
+		fprintf(f, "%-8s %10llu ioctls, %u us added\n", names[i],
+			(unsigned long long)cd->n_op[i], cd->latency_us[i]);
+	fprintf(f, "%llu retries, %llu failed, %llu mailbox commands\n",
+		(unsigned long long)cd->n_retry, (unsigned long long)cd->n_err,
+		(unsigned long long)cd->sim->n_mbox);
+}
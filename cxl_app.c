@@ -1,15 +1,33 @@
 #include <stdio.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
 #include <string.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "include/linux/cxl_mem.h"  /* ioctl symbols, structs */
 #include "include/linux/pci_regs.h" /* bitfield mask, etc.*/
 
 #include <mbox.h>
+#include <cxlmem.h>
 #include <doe.h>
+#include <doe_sim.h>
+#include <pci.h>
+#include <transport.h>
+#include <cache.h>
+#include <cdat.h>
+#include <perf.h>
+#include <trace.h>
+#include <regs.h>
+#include <cuse.h>
+#include <dev.h>
+#include <xfer.h>
 #include <bitfield.h>
 
 #define DEBUG
@@ -17,6 +35,13 @@
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 #define max(a, b) ((a) > (b) ? (a) : (b))
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+/*
+ * What a command returns when it ran but failed, having said why: unlike
+ * a negative return, a usage error, no help text after it.
+ */
+#define CXL_APP_FAIL	1
 
 /*
  * To understand the IOCTL code/define from cxl_mem.h, eg.
@@ -63,45 +88,139 @@
 
 const char* help= "\
 -h                           help message\n\
--query                       CXL_MEM_QUERY_COMMANDS\n\
--cfg_rd [0xoffset]           CXL_MEM_CONFIG_WR Read Hex\n\
--cfg_wr [0xoffset] [0xaddr]  CXL_MEM_CONFIG_WR Write Hex\n\
--doe_discovery [0xindex=0-3] CXL_DISCOVERY\n\
+-query                       CXL_MEM_QUERY_COMMANDS, through the registers\n\
+                             with -sim or a -transport mapping them; published to\n\
+                             /dev/shm/cxl_app.<serial> for -query_snapshot\n\
+-query_snapshot [memN|key]   The commands of mem0, or memN, or the cache key, as\n\
+                             the last -query or mailbox command published them,\n\
+                             needs no device\n\
+-mbox_bench [n]              IDENTIFY n times (1000) through the mailbox registers\n\
+                             and through CXL_MEM_SEND_COMMAND, the latency of each\n\
+-cel [file]                  The Command Effects Log, printed or to the file, in\n\
+                             chunks of the largest payload the mailbox takes\n\
+-lsa_dump [file]             The Label Storage Area to the file, the same way\n\
+-lsa_load [file]             The file to the Label Storage Area, the same way\n\
+-poison_list [dpa] [len]     The poison list of len bytes from dpa, of the whole\n\
+                             capacity by default, however many responses it takes\n\
+-cfg_rd [0xoffset]           Config space Read Hex, through the DOE transport\n\
+-cfg_wr [0xoffset] [0xaddr]  Config space Write Hex, through the DOE transport\n\
+-regs                        The memory device registers per the Register Locator,\n\
+                             mapped through -transport vfio: or vfio-file:, or -sim\n\
+-sim_vfio_file [file]        Writes the simulated device as a file for\n\
+                             -transport vfio-file:, needs no device\n\
+-sim_mbox_serve [dir]        Writes the simulated device as dir/config and\n\
+                             dir/resource2, then answers the mailbox there until\n\
+                             interrupted, for -transport sysfs:dir elsewhere\n\
+-cuse_serve [memN]           Serves /dev/cxl/memN through CUSE from the simulated\n\
+                             device until interrupted, for this tool unmodified\n\
+-cuse_latency [op=us,...]    Along with -cuse_serve, the time each ioctl takes at\n\
+                             least: query, send, config, and doe the time the\n\
+                             DOE takes to answer (50), as in -sim_model\n\
+-doe_discovery               Discovery on every DOE instance, refreshes the cache\n\
+-doe_probe                   The DOE instances and their protocols, cached if possible\n\
 -doe_cxl_cdat_get_length     CDAT length\n\
 -doe_cxl_cdat_read_table     Prints all the CDAT tables\n\
+-doe_cxl_cdat_read_entry [type]  Prints the CDAT structures of a type, DSMAS,\n\
+                             DSLBIS..., fetched one by one once indexed\n\
+-doe_cxl_cdat_dump [file]    Prints all the CDAT tables and saves the CDAT to file\n\
+-doe_cxl_cdat_perf           Latency and bandwidth of each DPA range per the CDAT,\n\
+                             its NUMA node, and the memory policy to use\n\
+-doe_cxl_route               End-to-end latency and bandwidth from the host bridge,\n\
+                             the CDAT of the memdev and of every switch on the way\n\
+-cdat_parse [file...]        Prints the CDAT dump files, needs no device\n\
+-doe_cxl_cdat_bench          CDAT read with and without batching the accesses\n\
+-transport_bench             CDAT and config space reads through the ioctl and\n\
+                             through the config file, with and without io_uring\n\
+-doe_stats                   Along with a DOE command, prints its latency histogram\n\
+-doe_poll                    Along with a DOE command, polls even if DOE interrupts work\n\
+-sim                         Along with a DOE command, runs it on a simulated DOE mailbox\n\
+-sim_model [key=val,...]     Along with -sim, how long the simulated device takes,\n\
+                             in us: doe (GO to response), mbox (a mailbox command)\n\
+                             and bg (a background command), each 50, fixed:50,\n\
+                             uniform:20:80, exp:10:40 (10 plus an exponential of\n\
+                             mean 40) or spike:50:5000:10 (5000 10 times in 1000);\n\
+                             seed (1) to draw them, and virtual to only count the\n\
+                             time rather than wait for it\n\
+-sim_bench [n]               CDAT read, IDENTIFY and SCAN_MEDIA n times (1000) on\n\
+                             the simulated device on a virtual clock: the time the\n\
+                             tool takes alone, no system call, against what the\n\
+                             device would per -sim_model\n\
 ./cxl_app -doe_cxl_compliance Request/Response Code is from 0 thr 0xf\n\
+-doe_compliance_sweep        Every compliance request code on every CXL memdev, in\n\
+                             parallel, with the latency of each exchange; with\n\
+                             -transport name:arg, only the device it names\n\
 Note: you always read/write from/to offset from the DOE instance and not the config space\n\
+-doe_all                     Along with a DOE command, uses every DOE instance through\n\
+                             the PCI config file, not only the driver's one\n\
+-transport [name]            Along with a DOE command, what the accesses go through:\n\
+                             ioctl (/dev/cxl/mem0, the driver's DOE instance only),\n\
+                             sysfs (the PCI config file), uring (the same through\n\
+                             io_uring), sysfs:<dir> or uring:<dir> (the config file\n\
+                             in another directory), vfio:<PCI address> (a\n\
+                             function bound to vfio-pci), vfio-file:<file>\n\
+                             (a file laid out as one, see -sim_vfio_file) or\n\
+                             replay:<file> (a capture of -record, no device)\n\
+-record [file]               Along with a command, captures every access and mailbox\n\
+                             command and what the device answered, with their\n\
+                             timing, for -transport replay:file; ignores the cache.\n\
+                             -doe_compliance_sweep captures each device to file.memN\n\
+-replay_scale [x]            Along with -transport replay:, the times of the capture\n\
+                             scaled by x (1), 0 to not wait at all\n\
+-debug [level]               Along with a DOE command, prints as it goes: 1 the\n\
+                             DOE steps and the transports, 2 also every config\n\
+                             space access\n\
+-trace_dump                  Along with a DOE command, records every config space\n\
+                             access and prints them all once done\n\
+-nocache                     Along with a DOE command, ignores what is cached in\n\
+                             $CXL_APP_CACHE_DIR (/var/cache/cxl_app): the DOE\n\
+                             protocols and the CDAT\n\
 example:\n\
 ./cxl_app -cfg_rd 0x00\n\
 ./cxl_app -cfg_wr 0x10 0x00ff0004\n\
-./cxl_app -doe_discovery 0\n\
+./cxl_app -doe_discovery\n\
 ./cxl_app -doe_cxl_cdat_get_length\n\
 ./cxl_app -doe_cxl_cdat_read_table\n\
+./cxl_app -doe_cxl_cdat_read_entry dslbis\n\
+./cxl_app -doe_cxl_cdat_perf\n\
+./cxl_app -cdat_parse dumps/*.cdat\n\
 ./cxl_app -doe_cxl_complience 0xf\n\
+./cxl_app -transport vfio:0000:35:00.0 -doe_probe\n\
   ";
 
 #define READ  0
 #define WRITE 1
 
-int FD;
+/*
+ * mem0: the mailbox commands and the driver's DOE instance through
+ * /dev/cxl/mem0, the whole config space or whatever -transport asked
+ * for through dev.pci
+ */
+static struct cxl_dev dev;
+static bool use_pci;
 typedef struct cxl_pdev_config cxl_pdev_config;
 
-int cxl_query(void)
+/* What the DOE exchanges and -cfg_rd/-cfg_wr go through */
+static struct transport *cxl_transport(void)
 {
-	typedef struct cxl_mem_query_commands cxl_mem_query_commands;
-	typedef struct cxl_command_info cxl_command_info;
-	int n_cmds= 0;
-
-	/* QUERY with n_commands == 0 to get command size */
-	ioctl(FD, CXL_MEM_QUERY_COMMANDS, &n_cmds);
-	printf("Querying\n");
+	return cxl_dev_transport(&dev);
+}
 
-	cxl_mem_query_commands* cmds= malloc(sizeof(cxl_mem_query_commands)
-			 + n_cmds * sizeof(cxl_command_info));
-	cmds->n_commands = n_cmds;
+static struct transport *cxl_mbox_transport(void);
 
-	/* QUERY with command size & pre-alloc memory */
-	ioctl(FD, CXL_MEM_QUERY_COMMANDS, cmds);
+int cxl_query(void)
+{
+	const struct cxl_mem_query_commands *cmds;
+	struct cxl_mbox_identify id;
+	int ret;
+
+	/* Queried once, with the device */
+	ret = cxl_dev_mbox_open(&dev);
+	if (ret) {
+		printf("Query failed: %s\n", strerror(-ret));
+		return ret;
+	}
+	cmds = cxl_dev_commands(&dev);
+	printf("Querying\n");
 
 	for (int i = 0; i < (int)cmds->n_commands; i++) {
 		printf("cmd[%d]=%s", i, cxl_mem_id_to_name(cmds->commands[i].id));
@@ -111,321 +230,1654 @@ int cxl_query(void)
 	}
 
 	/* Test run one of the commands */
-	{
-		/*
-		 * @id: ID number for the command 1
-		 * @flags: Flags that specify command behavior 0
-		 * @size_in: Expected input size, or ~0 if variable length 0
-		 * @size_out: Expected output size, or ~0 if variable length 67
-		 */
-		char payload_out[67] = {0};
-		struct cxl_send_command *csc = malloc(sizeof(struct cxl_send_command));
-		csc->id = 1;
-		csc->flags = 0;
-		csc->in.size = 0;
-		csc->in.payload = 0;
-		csc->out.size = 67;
-		csc->out.payload = (unsigned long)&payload_out;
-
-		printf("mb: let us test-run:\n"
-		       "\tcmd[1]=%s -> @flags 0 @size_in 0 @size_out 67\n",
-		       cxl_mem_id_to_name(csc->id));
-
-		ioctl(FD, CXL_MEM_SEND_COMMAND, csc);
-
-		printf("\tresult=%s\n", (char *)csc->out.payload);
-	}
+	printf("mb: let us test-run:\n"
+	       "\tcmd[%d]=%s -> @flags 0 @size_in 0 @size_out %zu\n",
+	       CXL_MEM_COMMAND_ID_IDENTIFY,
+	       cxl_mem_id_to_name(CXL_MEM_COMMAND_ID_IDENTIFY), sizeof(id));
+	ret = cxl_identify(cxl_mbox_transport(), &id);
+	if (ret)
+		printf("\tfailed: %s\n", strerror(-ret));
+	else
+		printf("\tresult=%.*s\n", (int)sizeof(id.fw_revision),
+		       id.fw_revision);
 
 	return 0;
 };
 
-int cxl_config(char* offset_s, char* data_s)
+/* What another run published of the device, without opening it */
+int cxl_query_snapshot(const char *name)
 {
-	int offset, val, is_write;
-	cxl_pdev_config *config_payload = malloc(sizeof(cxl_pdev_config));
+	char key[CACHE_KEY_LEN];
+	const struct cxl_snap *s;
+	struct cxl_snap snap;
+	int ret;
+
+	if (!name || name[0] == '-')
+		name = "mem0";
+
+	/* A key as given, sim-<serial> say, or that of the memdev */
+	s = cxl_snap_open(name);
+	if (!s && !cache_key(key, sizeof(key), NULL, name))
+		s = cxl_snap_open(key);
+	if (!s) {
+		printf("%s: no snapshot, -query publishes one\n", name);
+		return -1;
+	}
 
-	if (data_s == NULL)
-		is_write = 0;
-	else {
-		is_write = 1;
-		val = strtol(data_s, NULL, 16);
+	ret = cxl_snap_read(s, &snap);
+	cxl_snap_close(s);
+	if (ret) {
+		printf("%s: %s\n", name, strerror(-ret));
+		return ret;
 	}
 
-	offset = strtol(offset_s, NULL, 16);
+	printf("%s: %u commands, %llu byte payload, as of %s", name,
+	       snap.n_commands, (unsigned long long)snap.payload_size,
+	       ctime(&(time_t){ snap.time }));
+	for (int i = 0; i < (int)snap.n_commands; i++) {
+		printf("cmd[%d]=%s", i, cxl_mem_id_to_name(snap.commands[i].id));
+		printf("\t-> @flags %d", snap.commands[i].flags);
+		printf(" @size_in %d", snap.commands[i].size_in);
+		printf(" @size_out %d\n", snap.commands[i].size_out);
+	}
 
-	config_payload->offset = offset;
-	config_payload->val = val;
-	config_payload->is_write = is_write;
+	return 0;
+}
+
+int cxl_config(char* offset_s, char* data_s)
+{
+	cxl_pdev_config config_payload = {
+		.offset = strtol(offset_s, NULL, 16),
+		.is_write = data_s != NULL,
+		.val = data_s ? strtol(data_s, NULL, 16) : 0,
+	};
 
-	ioctl(FD, CXL_MEM_CONFIG_WR, config_payload);
+	transport_config(cxl_transport(), &config_payload, 1);
 
-	printf("CONFIG_WR %s [%0x] ", (is_write)? "write" : "read",
-		    config_payload->offset);
+	printf("CONFIG_WR %s [%0x] ", (config_payload.is_write)? "write" : "read",
+		    config_payload.offset);
 
 	for (int i = 0; i < 32; i += 8)
-		printf(" %02x", (config_payload->val >> i) & 0xff);
+		printf(" %02x", (config_payload.val >> i) & 0xff);
 
 	printf("\n");
 	return 0;
 };
 
-void doe_config(cxl_pdev_config* config_payload, uint32_t offset,
-		uint32_t val, uint32_t is_write)
+/* The memory device registers, mapped by the transport */
+int cxl_regs(void)
+{
+	struct transport *t = cxl_transport();
+	struct cxl_regs r;
+	int ret;
+
+	if (!(t->caps & TRANSPORT_MMIO)) {
+		printf("The %s transport does not map the BARs\n",
+		       transport_name(t));
+		return 0;
+	}
+
+	ret = cxl_regs_map(&r, t);
+	if (ret) {
+		printf("No memory device registers: %s\n", strerror(-ret));
+		return 0;
+	}
+
+	cxl_regs_print(stdout, &r);
+	return 0;
+}
+
+/* The simulated device, config space and registers, as a vfio-file: */
+int cxl_sim_vfio_file(const char *path)
 {
+	static struct doe_sim_dev sim;
+	int ret;
+
+	if (!path)
+		return -1;
+	if (doe_sim_init(&sim, 50) < 0)
+		return -1;
+
+	ret = transport_vfio_file_create(path, sim.cfg, sizeof(sim.cfg),
+					 DOE_SIM_REGS_BAR, sim.regs,
+					 sizeof(sim.regs));
+	doe_sim_exit(&sim);
+	if (ret) {
+		printf("%s: %s\n", path, strerror(-ret));
+		return -1;
+	}
+
+	printf("%s: the simulated device, try -transport vfio-file:%s\n",
+	       path, path);
+	return 0;
+}
+
+/* @len bytes of @buf as @dir/@name */
+static int cxl_write_file(const char *dir, const char *name, const void *buf,
+			  size_t len)
+{
+	char path[PATH_MAX];
+	int fd, ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -errno;
+	if (write(fd, buf, len) != (ssize_t)len)
+		ret = -EIO;
+	close(fd);
+	return ret;
+}
+
+/*
+ * The simulated device as a sysfs directory, config and resource2, its
+ * mailbox answered in the file until SIGINT or SIGTERM.
+ */
+int cxl_sim_mbox_serve(const char *dir)
+{
+	static struct doe_sim_dev sim;
+	char path[PATH_MAX];
+	sigset_t set;
+	void *regs;
+	int fd, sig, ret;
+
+	if (!dir)
+		return -1;
+	if (doe_sim_init(&sim, 50) < 0)
+		return -1;
+
+	ret = cxl_write_file(dir, "config", sim.cfg, sizeof(sim.cfg));
+	if (!ret)
+		ret = cxl_write_file(dir, "resource2", sim.regs, sizeof(sim.regs));
+	if (ret) {
+		printf("%s: %s\n", dir, strerror(-ret));
+		doe_sim_exit(&sim);
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/resource2", dir);
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	regs = fd < 0 ? MAP_FAILED : mmap(NULL, sizeof(sim.regs),
+					  PROT_READ | PROT_WRITE, MAP_SHARED,
+					  fd, 0);
+	if (fd >= 0)
+		close(fd);
+	if (regs == MAP_FAILED) {
+		printf("%s: %s\n", path, strerror(errno));
+		doe_sim_exit(&sim);
+		return -1;
+	}
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	doe_sim_mbox_start(&sim, regs);
+	printf("%s: answering the mailbox, try -transport sysfs:%s\n", dir, dir);
+	fflush(stdout);
+	sigwait(&set, &sig);
+
+	doe_sim_mbox_stop(&sim);
+	printf("%llu mailbox commands answered\n",
+	       (unsigned long long)sim.n_mbox);
+	munmap(regs, sizeof(sim.regs));
+	doe_sim_exit(&sim);
+	return 0;
+}
+
+static volatile bool cuse_stop;
+
+static void cxl_cuse_signal(int sig)
+{
+	cuse_stop = true;
+}
+
+/* op=us,... as -cuse_latency takes it */
+static int cxl_cuse_latency(struct cuse_dev *cd, char *spec)
+{
+	static const char *const ops[] = {
+		[CUSE_OP_QUERY] = "query",
+		[CUSE_OP_SEND] = "send",
+		[CUSE_OP_CONFIG] = "config",
+	};
+	char *tok, *val;
 	int i;
-	config_payload->offset = offset;
-	config_payload->val = val;
-	config_payload->is_write = is_write;
 
-	ioctl(FD, CXL_MEM_CONFIG_WR, config_payload);
+	for (tok = strtok(spec, ","); tok; tok = strtok(NULL, ",")) {
+		val = strchr(tok, '=');
+		if (!val)
+			return -1;
+		*val++ = '\0';
+		if (strcmp(tok, "doe") == 0) {
+			if (doe_sim_dist_parse(&cd->sim->lat[DOE_SIM_LAT_DOE],
+					       val))
+				return -1;
+			continue;
+		}
+		for (i = 0; i < CUSE_OP_MAX; i++)
+			if (strcmp(tok, ops[i]) == 0)
+				break;
+		if (i == CUSE_OP_MAX)
+			return -1;
+		cd->latency_us[i] = atoi(val);
+	}
 
-	printf("CONFIG_%s [%0x] ", is_write ? "WR": "RD", config_payload->offset);
-	printf(" %08x ", config_payload->val);
+	return 0;
+}
 
-	for (i = 0; i < 32; i += 8)
-		print_by_byte(" %02x", (config_payload->val >> i) & 0xff);
+/* /dev/cxl/@memdev, the simulated device answering, until SIGINT or SIGTERM */
+int cxl_cuse_serve(const char *memdev, char *latency)
+{
+	static struct doe_sim_dev sim;
+	struct sigaction sa = { .sa_handler = cxl_cuse_signal };
+	struct cuse_dev cd;
+	char name[64];
+	int fd, ret;
 
-	printf("\n");
-};
+	if (!memdev || memdev[0] == '-')
+		memdev = "mem0";
+	snprintf(name, sizeof(name), "cxl/%s", memdev);
+
+	if (doe_sim_init(&sim, 50) < 0)
+		return -1;
+	ret = cuse_dev_init(&cd, &sim, name);
+	if (!ret && latency && cxl_cuse_latency(&cd, latency)) {
+		printf("-cuse_latency: op=us,..., op one of doe query send config\n");
+		cuse_dev_exit(&cd);
+		doe_sim_exit(&sim);
+		return -1;
+	}
+	fd = ret ? ret : cuse_open();
+	if (fd < 0) {
+		printf("/dev/cuse: %s\n", strerror(-fd));
+		cuse_dev_exit(&cd);
+		doe_sim_exit(&sim);
+		return -1;
+	}
 
-int cxl_doe_discovery(char* dword_s)
-{
-	/*
-	 *  #### DW0 - Header1 ####
-	 *  [31:24]	Resv			don't care
-	 *  [23:16]	Data Object Type	0x0
-	 *  [15:0]	Vendor ID		0x0001
-	 *
-	 *  #### DW1 - Header2 ####
-	 *  [31:18]	Resv			-//-
-	 *  [17:0]	Length			0x3
-	 *
-	 *  #### DW2 Request (Data Object DWORD 0) ####
-	 *  [31:0]	Index			0, 1, then 2, etc.
-	 *					until DW Response[31:24]
-	 *					returns 0 indicating it's final entry.
-	 *
-	 *  ...or...
-	 *
-	 *  #### DW2 Response (-//-). Note, response is also followed by two headers ####
-	 *  [31:24]	Next Indext		?
-	 *  [23:16]	Data Object Type	?
-	 *  [15:0]	Vendor ID		?
-	 */
-
-	cxl_pdev_config* config_payload = malloc(sizeof(cxl_pdev_config));
-	uint32_t data_obj[3];
-
-	data_obj[0] = 0x00000001;
-	data_obj[1] = 0x3;
-	data_obj[2] = strtol(dword_s, NULL, 16);
-
-	pr_debug("Issue Abort\n");
-	doe_config(config_payload, PCI_DOE_CTRL, PCI_DOE_CTRL_ABORT, WRITE);
-
-	pr_debug("Write DOE header1 (vid and type)\n");
-	doe_config(config_payload, PCI_DOE_WRITE, data_obj[0], WRITE);
-
-	pr_debug("Write DOE header2 (length)\n");
-	doe_config(config_payload, PCI_DOE_WRITE, data_obj[1], WRITE);
-
-	pr_debug("Write DWORD %x()\n", data_obj[2]);
-	doe_config(config_payload, PCI_DOE_WRITE, data_obj[2], WRITE);
-
-	pr_debug("Set GO\n");
-	doe_config(config_payload, PCI_DOE_CTRL, PCI_DOE_CTRL_GO, WRITE);
-
-	pr_debug("Check Data Object Ready is set?\n");
-	doe_config(config_payload, PCI_DOE_STATUS, 0, READ);
-
-	/*
-	 * Read the first dword to get the protocol. We expect VID, and
-	 * the Protocol to be 0x1 and 0x0 respectively.
-	 */
-	doe_config(config_payload, PCI_DOE_READ, 0, READ);
-	/* Write Discovery response success */
-	doe_config(config_payload, PCI_DOE_READ, 0x0, WRITE);
-
-	/*
-	 * Read the second dword to get the length. As we will read only
-	 * the next dword afterwards we assume it is three dword long.
-	 *
-	 * Note, DW Response[31:24] may have Next Index value set, indicating
-	 * there may be a pair of VID-Protocol for CMA/SPDM, and then for
-	 * SCMA/SPDM supported from the DOE instance.
-	 */
-	doe_config(config_payload, PCI_DOE_READ, 0, READ);
-	/* Write Discovery response success */
-	doe_config(config_payload, PCI_DOE_READ, 0x0, WRITE);
-
-	doe_config(config_payload, PCI_DOE_READ, 0, READ);
-	/* Write Discovery response success */
-	doe_config(config_payload, PCI_DOE_READ, 0x0, WRITE);
+	/* No SA_RESTART, the read of the next request returns */
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	printf("/dev/%s: serving, try -doe_probe or -query on %s\n", name, memdev);
+	fflush(stdout);
+	ret = cuse_serve(&cd, fd, &cuse_stop);
+	if (ret)
+		printf("/dev/cuse: %s\n", strerror(-ret));
+
+	cuse_print_stats(stdout, &cd);
+	close(fd);
+	cuse_dev_exit(&cd);
+	doe_sim_exit(&sim);
+	return ret ? -1 : 0;
+}
+
+/* A response buffer reused by every exchange */
+static u32 doe_rsp[1024];
+static struct doe_sim_dev doe_sim;
+static bool use_sim, use_poll, use_cache = true;
+static const char *use_transport, *use_record;
+
+/* The mailbox of -transport, of the registers, or the driver's */
+static struct transport *cxl_mbox_transport(void)
+{
+	return cxl_dev_mbox(&dev);
+}
+
+/* Path of a cache file of the device, see cache.c */
+static int cxl_cache_path(char *path, size_t len, const char *kind)
+{
+	char key[CACHE_KEY_LEN];
+	int ret;
+
+	ret = cache_key(key, sizeof(key), cxl_transport(), dev.name);
+	if (ret)
+		return ret;
+
+	return cache_path(path, len, key, kind);
+}
+
+/**
+ * cxl_doe_dev() - The DOE instances and the protocols they serve
+ * @refresh: run discovery even if the protocol table is cached
+ *
+ * Set up on first use. The protocol table comes from the cache when
+ * there is one, from discovery otherwise, and is then cached.
+ */
+static struct doe_dev *cxl_doe_dev(bool refresh)
+{
+	char path[PATH_MAX];
+	bool cached;
+
+	if (dev.doe_ready && !refresh)
+		return &dev.doe;
+
+	if (!dev.doe_ready) {
+		dev.doe_ready = true;
+		if (doe_dev_init(&dev.doe, cxl_transport(), !use_poll))
+			return &dev.doe;
+	}
+
+	cached = !cxl_cache_path(path, sizeof(path),
+				 cxl_transport()->caps & TRANSPORT_CFG_ABS ?
+				 "doe" : "doe_drv");
+
+	if (cached && use_cache && !refresh && doe_dev_load(&dev.doe, path) > 0)
+		return &dev.doe;
+
+	if (doe_dev_discover(&dev.doe) > 0 && cached)
+		doe_dev_save(&dev.doe, path);
+
+	return &dev.doe;
+}
+
+/* The mailbox serving the protocol, or NULL */
+static struct doe_mb *cxl_doe_mb(u16 vid, u8 type)
+{
+	struct doe_dev *dd = cxl_doe_dev(false);
+	struct doe_mb *mb = doe_dev_find(dd, vid, type);
+
+	/* Without a protocol table, the driver's instance is tried anyway */
+	if (!mb && !dd->n_prot && dd->n_mb)
+		mb = &dd->mb[0];
+
+	if (!mb)
+		printf("No DOE instance serves VID=0x%04x Protocol=0x%02x\n",
+		       vid, type);
+
+	return mb;
+}
+
+static int cxl_doe_print_protocols(struct doe_dev *dd)
+{
+	int i, j;
+
+	if (!dd->n_prot) {
+		printf("No DOE protocol found\n");
+		return -1;
+	}
+
+	for (i = 0; i < dd->n_mb; i++) {
+		printf("DOE @0x%03x:", dd->mb[i].cap);
+		for (j = 0; j < dd->n_prot; j++)
+			if (dd->prot[j].mb == &dd->mb[i])
+				printf(" VID=0x%04x Protocol=0x%02x",
+				       dd->prot[j].vid, dd->prot[j].type);
+		printf("\n");
+	}
 
 	return 0;
+}
+
+/* Every DOE instance in the config space and its protocols, maybe cached */
+int cxl_doe_probe(void)
+{
+	return cxl_doe_print_protocols(cxl_doe_dev(false));
+}
+
+/* Discovery on every DOE instance, refreshing the cached protocol table */
+int cxl_doe_discovery(void)
+{
+	return cxl_doe_print_protocols(cxl_doe_dev(true));
 };
 
-int cxl_doe_cxl_cdat(char *dword_s, char *length_or_table)
+/* The assembled CDAT, reused by every read, and where its entries are */
+static u32 cdat_buf[CDAT_MAX_SIZE / 4];
+static struct cdat_index cdat_idx;
+
+/* The index goes along with the cached CDAT, so both come from one read */
+static void cxl_cdat_index_save(void)
 {
-	cxl_pdev_config* config_payload = malloc(sizeof(cxl_pdev_config));
-	uint32_t data_obj[3], dword;
-	int length, payload_length, i;
-	int entry_handle = 0;
+	char path[PATH_MAX];
+
+	if (cdat_idx.n && !cxl_cache_path(path, sizeof(path), "cdat_idx"))
+		cdat_index_save(path, &cdat_idx);
+}
+
+/* The whole CDAT into cdat_buf, unless the cached copy is current */
+static int cxl_cdat_get(struct doe_mb *mb, struct cdat *cdat)
+{
+	char path[PATH_MAX];
+	bool hit = false;
+	int length, ret;
+
+	if (use_cache && !cxl_cache_path(path, sizeof(path), "cdat")) {
+		length = cdat_read_cached(mb, path, cdat_buf, sizeof(cdat_buf),
+					  &hit, &cdat_idx);
+		/* A read failing partway leaves an index short of entries */
+		if (!hit && length >= 0)
+			cxl_cdat_index_save();
+	} else {
+		length = cdat_read(mb, cdat_buf, sizeof(cdat_buf), &cdat_idx);
+	}
+	if (length < 0) {
+		printf("CDAT read failed %d\n", length);
+		return length;
+	}
+
+	if (hit)
+		printf("CDAT cached in %s is current\n", path);
+
+	ret = cdat_init(cdat, cdat_buf, length);
+	if (ret)
+		printf("CDAT invalid (%s), %d bytes read\n",
+		       ret == -EBADMSG ? "checksum" : "length", length);
+
+	return ret;
+}
+
+/*
+ * "length" reads only the CDAT header, entry handle 0. "table" reads
+ * every entry, unless the cached copy is current, prints them and saves
+ * the table to @dump if given.
+ */
+int cxl_doe_cxl_cdat(char *length_or_table, char *dump)
+{
+	struct doe_mb *mb = cxl_doe_mb(PCI_DVSEC_VENDOR_ID_CXL,
+				       CXL_DOE_PROTOCOL_TABLE_ACCESS);
+	struct cdat_header hdr;
+	struct cdat cdat;
+	int ret;
+
+	if (!mb)
+		return -1;
 
-	dword = strtol(dword_s, NULL, 16);
 	printf("DOE TYPE=2 VID=0x1e98\n");
-	printf("DWORD REQUEST (EntryHandle)=%x\n", dword);
-
-	data_obj[0] = 0x00021e98;
-	data_obj[1] = 0x3;
-	data_obj[2] = dword;
-
-	do {
-		u32 cdat_length;
-
-		pr_debug("Issue Abort\n");
-		doe_config(config_payload, PCI_DOE_CTRL, PCI_DOE_CTRL_ABORT, WRITE);
-
-		pr_debug("Write DOE header1 (vid and type)\n");
-		doe_config(config_payload, PCI_DOE_WRITE, data_obj[0], WRITE);
-
-		pr_debug("Write DOE header2 (length)\n");
-		doe_config(config_payload, PCI_DOE_WRITE, data_obj[1], WRITE);
-
-		pr_debug("Write DWORD (%04x)\n", dword);
-		doe_config(config_payload, PCI_DOE_WRITE, data_obj[2], WRITE);
-
-		pr_debug("Set GO\n");
-		doe_config(config_payload, PCI_DOE_CTRL, PCI_DOE_CTRL_GO, WRITE);
-
-		pr_debug("Check Data Object Ready is set?\n");
-		doe_config(config_payload, PCI_DOE_STATUS, 0, READ);
-		if (!FIELD_GET(PCI_DOE_STATUS_DATA_OBJECT_READY, config_payload->val))
-			printf("Data Object Ready Clear - Error\n");
-
-		/* Read the first dword to get the header1 */
-		doe_config(config_payload, PCI_DOE_READ, 0, READ);
-		/* Write anything to indicate success */
-		doe_config(config_payload, PCI_DOE_READ, 0x0, WRITE);
-
-		/* Read the second word to get the length */
-		doe_config(config_payload, PCI_DOE_READ, 0, READ);
-		length = config_payload->val & 0x0000ffff;
-		payload_length = length - 2;
-		payload_length = max(payload_length, 0);
-		/* Write to indicate success */
-		doe_config(config_payload, PCI_DOE_READ, 0x0, WRITE);
-
-		printf("DOE response length=%0d response payload length %0d\n",
-		       length, payload_length);
-
-		for (i = 0; i < payload_length; i++) {
-			/* Read cdat response */
-			doe_config(config_payload, PCI_DOE_READ, 0, READ);
-
-			/*
-			 * Get the CXL table access header entry handle.
-			 * entry handle 0xffff_xxxx indicates no more entries
-			 */
-			if (i == 0) {
-				entry_handle = FIELD_GET(CXL_DOE_TABLE_ACCESS_ENTRY_HANDLE,
-							 config_payload->val);
-				pr_debug("entry_handle %08x\n", entry_handle);
-			}
 
-			if (i == 1) {
-				cdat_length = config_payload->val;
-			}
+	if (0 == strncmp("length", length_or_table, sizeof("length"))) {
+		ret = cdat_read_header(mb, &hdr);
+		if (ret) {
+			printf("CDAT header read failed %d\n", ret);
+			return ret;
+		}
+
+		printf("CDAT length %08x\n", hdr.length);
+		return 0;
+	}
 
+	ret = cxl_cdat_get(mb, &cdat);
+	if (ret)
+		return ret;
 
-			/* Prior to the last ack, ensure Data Object Ready */
-			if (i == payload_length - 1) {
-				doe_config(config_payload, PCI_DOE_STATUS, 0, READ);
-				if (!FIELD_GET(PCI_DOE_STATUS_DATA_OBJECT_READY, config_payload->val))
-					printf("Data Object Ready Clear - Error\n");
+	printf("\n");
+	cdat_print(stdout, &cdat);
+
+	if (dump && (ret = cdat_save(dump, cdat_buf, cdat.hdr->length)))
+		printf("Can not save the CDAT to %s: %s\n", dump, strerror(-ret));
+
+	return ret;
+};
+
+/*
+ * Only the CDAT structures of one type. With a current index that is the
+ * header plus one exchange per matching structure, instead of the whole
+ * table; otherwise the table is read, cached and indexed first.
+ */
+int cxl_doe_cxl_cdat_entry(char *type_name)
+{
+	struct doe_mb *mb = cxl_doe_mb(PCI_DVSEC_VENDOR_ID_CXL,
+				       CXL_DOE_PROTOCOL_TABLE_ACCESS);
+	const struct cdat_entry_header *e;
+	struct cdat_header hdr;
+	struct cdat cdat;
+	char path[PATH_MAX];
+	int type, len, ret;
+	u32 i, n = 0;
+
+	if (!mb || !type_name)
+		return -1;
+
+	type = cdat_type_parse(type_name);
+	if (type < 0) {
+		printf("Unknown CDAT structure type %s\n", type_name);
+		return -1;
+	}
+
+	printf("DOE TYPE=2 VID=0x1e98\n");
+
+	ret = cdat_read_header(mb, &hdr);
+	if (ret) {
+		printf("CDAT header read failed %d\n", ret);
+		return ret;
+	}
+
+	if (use_cache && !cxl_cache_path(path, sizeof(path), "cdat_idx") &&
+	    !cdat_index_load(path, &cdat_idx) &&
+	    cdat_index_current(&cdat_idx, &hdr)) {
+		printf("CDAT index cached in %s is current\n\n", path);
+		for (i = 0; i < cdat_idx.n; i++) {
+			if (cdat_idx.ent[i].type != type)
+				continue;
+			len = cdat_read_entry(mb, cdat_idx.ent[i].handle,
+					      cdat_buf, sizeof(cdat_buf));
+			if (len < 0) {
+				printf("CDAT entry %u read failed %d\n",
+				       cdat_idx.ent[i].handle, len);
+				return len;
 			}
+			cdat_print_entry(stdout, (void *)cdat_buf);
+			n++;
+		}
+		goto out;
+	}
+
+	if (use_cache && !cxl_cache_path(path, sizeof(path), "cdat")) {
+		bool hit;
+
+		len = cdat_read_cached(mb, path, cdat_buf, sizeof(cdat_buf),
+				       &hit, &cdat_idx);
+		/* A current CDAT but a lost index: read it again to rebuild */
+		if (len >= 0 && hit)
+			len = cdat_read(mb, cdat_buf, sizeof(cdat_buf),
+					&cdat_idx);
+		/* A read failing partway leaves an index short of entries */
+		if (len >= 0)
+			cxl_cdat_index_save();
+	} else {
+		len = cdat_read(mb, cdat_buf, sizeof(cdat_buf), &cdat_idx);
+	}
+	if (len < 0) {
+		printf("CDAT read failed %d\n", len);
+		return len;
+	}
+
+	ret = cdat_init(&cdat, cdat_buf, len);
+	if (ret) {
+		printf("CDAT invalid (%s), %d bytes read\n",
+		       ret == -EBADMSG ? "checksum" : "length", len);
+		return ret;
+	}
+
+	printf("\n");
+	cdat_for_each_entry(&cdat, e) {
+		if (e->type != type)
+			continue;
+		cdat_print_entry(stdout, e);
+		n++;
+	}
+
+out:
+	if (!n)
+		printf("No %s structure in the CDAT\n", cdat_type_name(type));
+	return 0;
+}
+
+/*
+ * The latency and bandwidth of every DPA range of the memdev, per its
+ * CDAT, the NUMA node each range is online as, and a memory policy per
+ * kind of workload.
+ */
+int cxl_doe_cxl_cdat_perf(void)
+{
+	struct doe_mb *mb = cxl_doe_mb(PCI_DVSEC_VENDOR_ID_CXL,
+				       CXL_DOE_PROTOCOL_TABLE_ACCESS);
+	static struct perf_model model;
+	struct cdat cdat;
+	int ret;
+
+	if (!mb)
+		return -1;
+
+	ret = cxl_cdat_get(mb, &cdat);
+	if (ret)
+		return ret;
+
+	ret = perf_model_init(&model, dev.name, &cdat);
+	if (ret) {
+		printf("No DSMAS in the CDAT, no DPA range to model\n");
+		return ret;
+	}
+
+	ret = perf_model_map(&model);
+	if (ret < 0)
+		printf("%s has no CXL endpoint in sysfs: %s\n", dev.name,
+		       strerror(-ret));
+
+	printf("\n");
+	perf_model_print(stdout, &model);
+	printf("\n");
+	perf_advise(stdout, &model);
+
+	return 0;
+}
+
+/* Port type, PCI_EXP_TYPE_*, and port number of a PCI Express port */
+static int cxl_pcie_port(struct transport *port, u8 *type, u8 *number)
+{
+	u8 pos = pci_find_cap(port, PCI_CAP_ID_EXP);
+
+	if (!pos)
+		return -ENODEV;
+
+	*type = FIELD_GET(PCI_EXP_FLAGS_TYPE,
+			  pci_cfg_read(port, pos) >> 16);
+	*number = FIELD_GET(PCI_EXP_LNKCAP_PN,
+			    pci_cfg_read(port, pos + PCI_EXP_LNKCAP));
+	return 0;
+}
+
+/*
+ * Every DOE instance of another device than the one opened, and the
+ * protocols they serve, cached under the device's own serial number.
+ */
+static int cxl_doe_dev_open(struct doe_dev *dd, struct transport *dev)
+{
+	char key[CACHE_KEY_LEN], path[PATH_MAX];
+	bool cached;
+	int ret;
+
+	ret = doe_dev_init(dd, dev, !use_poll);
+	if (ret)
+		return ret;
 
-			/* Write to advance on */
-			doe_config(config_payload, PCI_DOE_READ, 0x0, WRITE);
+	cached = use_cache && !cache_key(key, sizeof(key), dev, NULL) &&
+		 !cache_path(path, sizeof(path), key, "doe");
+	if (cached && doe_dev_load(dd, path) > 0)
+		return 0;
+
+	if (doe_dev_discover(dd) > 0 && cached)
+		doe_dev_save(dd, path);
+
+	return 0;
+}
+
+/*
+ * The SSLBIS of a switch, from the CDAT of its upstream port @usp. Its
+ * protocol table and CDAT are cached under its own serial number.
+ */
+static int cxl_switch_hop(struct transport *usp, struct perf_hop *hop)
+{
+	static struct doe_dev dd;
+	static u32 buf[CDAT_MAX_SIZE / 4];
+	char key[CACHE_KEY_LEN], path[PATH_MAX];
+	struct doe_mb *mb;
+	struct cdat cdat;
+	bool cached, hit;
+	int ret;
+
+	ret = cxl_doe_dev_open(&dd, usp);
+	if (ret)
+		return ret;
+
+	cached = use_cache && !cache_key(key, sizeof(key), usp, NULL);
+	mb = doe_dev_find(&dd, PCI_DVSEC_VENDOR_ID_CXL,
+			  CXL_DOE_PROTOCOL_TABLE_ACCESS);
+	if (!mb) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	if (cached && !cache_path(path, sizeof(path), key, "cdat"))
+		ret = cdat_read_cached(mb, path, buf, sizeof(buf), &hit, NULL);
+	else
+		ret = cdat_read(mb, buf, sizeof(buf), NULL);
+	if (ret < 0)
+		goto out;
+
+	ret = cdat_init(&cdat, buf, ret);
+	if (!ret && !perf_hop_sslbis(hop, &cdat))
+		ret = -ENOENT;
+out:
+	doe_dev_exit(&dd);
+	return ret;
+}
+
+/*
+ * The end-to-end latency and bandwidth from the host bridge down to the
+ * memdev, through every switch: the memdev's DSLBIS plus the SSLBIS of
+ * each switch upstream port on the way.
+ */
+int cxl_doe_cxl_route(void)
+{
+	struct doe_mb *mb = cxl_doe_mb(PCI_DVSEC_VENDOR_ID_CXL,
+				       CXL_DOE_PROTOCOL_TABLE_ACCESS);
+	static char dirs[2 * PERF_MAX_HOPS + 2][PATH_MAX];
+	static struct perf_model model;
+	static struct perf_route rt;
+	static struct doe_sim_dev usp_sim;
+	char dir[PATH_MAX];
+	struct transport port, ep;
+	struct perf_hop *hop;
+	struct cdat cdat;
+	u8 type, number;
+	int i, n, ret;
+
+	if (!mb)
+		return -1;
+
+	ret = cxl_cdat_get(mb, &cdat);
+	if (ret)
+		return ret;
+
+	ret = perf_model_init(&model, dev.name, &cdat);
+	if (ret) {
+		printf("No DSMAS in the CDAT, no DPA range to model\n");
+		return ret;
+	}
+
+	if (use_sim) {
+		/* One switch in front of the device, on its port 1 */
+		memset(&rt, 0, sizeof(rt));
+		snprintf(rt.host_bridge, sizeof(rt.host_bridge), "pci0000:00");
+		snprintf(rt.root_port, sizeof(rt.root_port), "sim");
+		if (doe_sim_init_switch(&usp_sim, 50) < 0)
+			return -1;
+		transport_open_sim(&port, &usp_sim);
+		hop = &rt.hop[rt.n++];
+		snprintf(hop->name, sizeof(hop->name), "sim-usp");
+		hop->port = 1;
+		ret = cxl_switch_hop(&port, hop);
+		if (ret)
+			printf("No SSLBIS from %s: %s\n", hop->name, strerror(-ret));
+		doe_sim_exit(&usp_sim);
+		goto print;
+	}
+
+	if (use_pci && dev.pci.path[0]) {
+		snprintf(dir, sizeof(dir), "%s", dev.pci.path);
+	} else {
+		ret = pci_memdev_dir(dev.name, dir, sizeof(dir));
+		if (ret) {
+			printf("Can not find the PCI function of %s: %s\n",
+			       dev.name, strerror(-ret));
+			return ret;
 		}
+	}
 
-		data_obj[2] += 0x10000;
+	n = perf_pci_chain(dir, &rt, dirs, ARRAY_SIZE(dirs));
+	if (n < 0) {
+		printf("%s is not in the PCI hierarchy\n", dev.name);
+		return n;
+	}
 
-		if (0 == strncmp("length", length_or_table, sizeof("length"))) {
-			printf("CDAT length %08x\n",  cdat_length);
-			break;
-		} else if (0 == strncmp("table", length_or_table, sizeof("table")))
-			printf("\n");
+	/* A switch is an upstream port followed by one of its downstream ports */
+	for (i = 0; i + 1 < n && rt.n < PERF_MAX_HOPS; i++) {
+		if (transport_open_sysfs_dev(&port, dirs[i]))
+			continue;
+		ret = cxl_pcie_port(&port, &type, &number);
+		if (ret || type != PCI_EXP_TYPE_UPSTREAM) {
+			transport_close(&port);
+			continue;
+		}
 
-	/* Iterate until handle_entry 0xffffxxxx for no more entires. */
-	} while (entry_handle != CXL_DOE_TABLE_ACCESS_LAST_ENTRY);
+		hop = &rt.hop[rt.n++];
+		snprintf(hop->name, sizeof(hop->name), "%s",
+			 strrchr(dirs[i], '/') + 1);
+		if (!transport_open_sysfs_dev(&ep, dirs[i + 1])) {
+			if (!cxl_pcie_port(&ep, &type, &number))
+				hop->port = number;
+			transport_close(&ep);
+		}
 
+		ret = cxl_switch_hop(&port, hop);
+		if (ret)
+			printf("No SSLBIS from %s: %s\n", hop->name, strerror(-ret));
+		transport_close(&port);
+	}
+
+print:
+	printf("\n");
+	perf_route_print(stdout, &model, &rt);
 	return 0;
+}
+
+struct cdat_parse_ctx {
+	char **files;
+	int n;
+	int next;
+	char **out;
 };
 
+/* Workers take the files in turn, each formatting into its own buffer */
+static void *cxl_cdat_parse_worker(void *arg)
+{
+	struct cdat_parse_ctx *ctx = arg;
+	u32 *buf = malloc(CDAT_MAX_SIZE);
+	struct cdat cdat;
+	size_t size;
+	FILE *f;
+	int i, len, ret;
+
+	if (!buf)
+		return NULL;
+
+	while ((i = __atomic_fetch_add(&ctx->next, 1, __ATOMIC_RELAXED)) < ctx->n) {
+		f = open_memstream(&ctx->out[i], &size);
+		if (!f)
+			continue;
+
+		fprintf(f, "== %s\n", ctx->files[i]);
+		len = cdat_load(ctx->files[i], buf, CDAT_MAX_SIZE);
+		if (len < 0)
+			fprintf(f, "%s\n", strerror(-len));
+		else if ((ret = cdat_init(&cdat, buf, len)))
+			fprintf(f, "CDAT invalid (%s)\n",
+				ret == -EBADMSG ? "checksum" : "length");
+		else
+			cdat_print(f, &cdat);
+		fclose(f);
+	}
+
+	free(buf);
+	return NULL;
+}
+
+/*
+ * Parse CDAT dump files, as many at once as there are CPUs, and print
+ * them in the order given.
+ */
+int cxl_cdat_parse(int n, char **files)
+{
+	struct cdat_parse_ctx ctx = { .files = files, .n = n };
+	long n_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t *threads;
+	int i, n_threads;
+
+	if (n < 1)
+		return -1;
+
+	n_threads = min(n, n_cpu > 0 ? n_cpu : 1);
+	ctx.out = calloc(n, sizeof(*ctx.out));
+	threads = calloc(n_threads, sizeof(*threads));
+	if (!ctx.out || !threads)
+		return -1;
+
+	for (i = 1; i < n_threads; i++)
+		if (pthread_create(&threads[i], NULL, cxl_cdat_parse_worker, &ctx))
+			threads[i] = pthread_self();
+	cxl_cdat_parse_worker(&ctx);
+	for (i = 1; i < n_threads; i++)
+		if (!pthread_equal(threads[i], pthread_self()))
+			pthread_join(threads[i], NULL);
+
+	for (i = 0; i < n; i++) {
+		if (ctx.out[i])
+			fputs(ctx.out[i], stdout);
+		free(ctx.out[i]);
+	}
+
+	free(threads);
+	free(ctx.out);
+	return 0;
+}
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * Read the whole CDAT once with a call into the transport per register
+ * access and once batched, and compare the call count and the
+ * wall-clock time.
+ */
+int cxl_doe_cxl_cdat_bench(void)
+{
+	static const char *mode[] = { "per access", "batched" };
+	struct doe_mb *mb = cxl_doe_mb(PCI_DVSEC_VENDOR_ID_CXL,
+				       CXL_DOE_PROTOCOL_TABLE_ACCESS);
+	u64 n_call[2];
+	double elapsed[2], t0;
+	int batch, ret;
+
+	if (!mb)
+		return -1;
+
+	/* Every run reads the whole table */
+	use_cache = false;
+
+	for (batch = 0; batch < 2; batch++) {
+		if (batch)
+			mb->flags |= DOE_MB_BATCH;
+		else
+			mb->flags &= ~DOE_MB_BATCH;
+		memset(&mb->stats, 0, sizeof(mb->stats));
+
+		t0 = now_us();
+		ret = cxl_doe_cxl_cdat("table", NULL);
+		elapsed[batch] = now_us() - t0;
+		n_call[batch] = mb->stats.n_call;
+		if (ret)
+			return ret;
+
+		if (batch && !(mb->t->caps & TRANSPORT_BATCH))
+			printf("The %s transport does not batch\n",
+			       transport_name(mb->t));
+	}
+
+	printf("\n%-12s %10s %12s\n", "CDAT read", "calls", "time [us]");
+	for (batch = 0; batch < 2; batch++)
+		printf("%-12s %10llu %12.0f\n", mode[batch],
+		       (unsigned long long)n_call[batch], elapsed[batch]);
+
+	return 0;
+}
+
+/* One CDAT read and, with absolute offsets, config space reads on @t */
+static void cxl_transport_bench_one(struct transport *t)
+{
+	static u32 buf[CDAT_MAX_SIZE / 4];
+	static u32 cfg[PCI_CFG_SPACE_EXP_SIZE / 4];
+	struct doe_dev dd;
+	struct doe_mb *mb;
+	u64 n_sys;
+	double t0;
+	int ret, i;
+
+	ret = cxl_doe_dev_open(&dd, t);
+	if (ret) {
+		printf("%-8s no DOE instance\n", transport_name(t));
+		return;
+	}
+
+	mb = doe_dev_find(&dd, PCI_DVSEC_VENDOR_ID_CXL,
+			  CXL_DOE_PROTOCOL_TABLE_ACCESS);
+	if (!mb && !dd.n_prot)
+		mb = &dd.mb[0];
+	if (mb) {
+		n_sys = transport_syscalls(t);
+		t0 = now_us();
+		ret = cdat_read(mb, buf, sizeof(buf), NULL);
+		printf("%-8s %-22s %10llu %12.0f%s\n", transport_name(t),
+		       "CDAT read",
+		       (unsigned long long)(transport_syscalls(t) - n_sys),
+		       now_us() - t0, ret < 0 ? "  failed" : "");
+	}
+	doe_dev_exit(&dd);
+
+	if (!(t->caps & TRANSPORT_CFG_ABS))
+		return;
+
+	n_sys = transport_syscalls(t);
+	t0 = now_us();
+	for (i = 0; i < (int)ARRAY_SIZE(cfg); i++)
+		cfg[i] = pci_cfg_read(t, i * 4);
+	printf("%-8s %-22s %10llu %12.0f\n", transport_name(t),
+	       "config space per dword",
+	       (unsigned long long)(transport_syscalls(t) - n_sys),
+	       now_us() - t0);
+
+	n_sys = transport_syscalls(t);
+	t0 = now_us();
+	ret = pci_cfg_read_block(t, 0, cfg, ARRAY_SIZE(cfg));
+	printf("%-8s %-22s %10llu %12.0f%s\n", transport_name(t),
+	       "config space in one",
+	       (unsigned long long)(transport_syscalls(t) - n_sys),
+	       now_us() - t0, ret ? "  failed" : "");
+}
+
+/*
+ * The same reads through the CXL_MEM_CONFIG_WR ioctl and through the
+ * sysfs config file, with and without io_uring, comparing the system
+ * calls and the wall-clock time.
+ */
+int cxl_transport_bench(void)
+{
+	static const char *const names[] = { "ioctl", "uring", "sysfs" };
+	struct transport t;
+	unsigned int i;
+
+	/* Every run reads from the device */
+	use_cache = false;
+
+	printf("%-8s %-22s %10s %12s\n", "", "", "syscalls", "time [us]");
+	if (use_sim) {
+		cxl_transport_bench_one(&dev.pci);
+		return 0;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		if (transport_open(&t, names[i], dev.name, 0)) {
+			printf("%-8s not available\n", names[i]);
+			continue;
+		}
+		cxl_transport_bench_one(&t);
+		transport_close(&t);
+	}
+
+	return 0;
+}
+
+static int cxl_cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* @n IDENTIFY on @t, the latency percentiles */
+static void cxl_mbox_bench_one(struct transport *t, const char *what, int n)
+{
+	static double lat[100000];
+	struct cxl_mbox_identify id;
+	double t0, sum = 0;
+	u64 n_sys = transport_syscalls(t);
+	int i, ret = 0;
+
+	for (i = 0; i < n; i++) {
+		t0 = now_us();
+		ret = cxl_identify(t, &id);
+		lat[i] = now_us() - t0;
+		if (ret)
+			break;
+		sum += lat[i];
+	}
+	if (i < n) {
+		printf("%-10s IDENTIFY failed: %s\n", what, strerror(-ret));
+		return;
+	}
+
+	qsort(lat, n, sizeof(lat[0]), cxl_cmp_double);
+	printf("%-10s %8d %10.2f %10.2f %10.2f %10.2f %10.2f %10llu\n", what, n,
+	       lat[0], sum / n, lat[n / 2], lat[n * 99 / 100], lat[n - 1],
+	       (unsigned long long)(transport_syscalls(t) - n_sys));
+}
+
+/*
+ * Raw mailbox latency: the registers driven from here, against
+ * CXL_MEM_SEND_COMMAND and the driver doing the same.
+ */
+int cxl_mbox_bench(const char *n_s)
+{
+	int n = n_s ? atoi(n_s) : 1000;
+
+	if (n <= 0 || n > 100000)
+		n = 1000;
+
+	printf("%-10s %8s %10s %10s %10s %10s %10s %10s\n", "IDENTIFY", "n",
+	       "min [us]", "avg", "p50", "p99", "max", "syscalls");
+	if (use_pci && !cxl_regs_attach(&dev.pci))
+		cxl_mbox_bench_one(cxl_mbox_transport(), "registers", n);
+	else if (use_pci)
+		printf("%-10s not mapped by the %s transport\n", "registers",
+		       transport_name(&dev.pci));
+	if (dev.mem.ops)
+		cxl_mbox_bench_one(&dev.mem, "ioctl", n);
+
+	return 0;
+}
+
+static int cxl_cel_print(void *priv, u64 off, void *buf, size_t len)
+{
+	const struct cxl_cel_entry *e = buf;
+	const struct cxl_mem_command *c;
+	size_t i;
+
+	for (i = 0; i < len / sizeof(*e); i++) {
+		c = cxl_mem_find_command(e[i].opcode);
+		printf("0x%04x effect 0x%04x %s\n", e[i].opcode, e[i].effect,
+		       c ? cxl_mem_id_to_name(c->info.id) : "");
+	}
+	return 0;
+}
+
+/* The Command Effects Log, printed or to @path, however long it is */
+int cxl_cel(const char *path)
+{
+	static const u8 cel_uuid[16] = CXL_CEL_UUID;
+	struct cxl_mbox_get_supported_logs *gsl;
+	size_t n = 0;
+	u32 size = 0;
+	ssize_t ret;
+	int fd = -1;
+
+	gsl = cxl_dev_buf_get(&dev);
+	if (gsl) {
+		n = dev.payload_size;
+		ret = cxl_get_supported_logs(cxl_mbox_transport(), gsl, &n);
+		for (u32 i = 0; !ret && i < gsl->entries &&
+		     sizeof(*gsl) + (i + 1) * sizeof(gsl->entry[0]) <= n; i++)
+			if (!memcmp(gsl->entry[i].uuid, cel_uuid, 16))
+				size = gsl->entry[i].size;
+		cxl_dev_buf_put(&dev, gsl);
+	}
+	if (!size) {
+		printf("No Command Effects Log\n");
+		return CXL_APP_FAIL;
+	}
+
+	if (path && path[0] != '-') {
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			printf("%s: %s\n", path, strerror(errno));
+			return CXL_APP_FAIL;
+		}
+	}
+
+	ret = cxl_xfer_get_log(&dev, cel_uuid, 0, size,
+			       fd >= 0 ? cxl_xfer_to_fd : cxl_cel_print, &fd);
+	if (fd >= 0)
+		close(fd);
+	if (ret < 0) {
+		printf("CEL: %s\n", strerror(-ret));
+		return CXL_APP_FAIL;
+	}
+
+	printf("CEL: %zd of %u bytes, %zu-byte payloads\n", ret, size,
+	       dev.payload_size);
+	return 0;
+}
+
+/* The whole Label Storage Area to @path, or as much of it as @path holds from it */
+int cxl_lsa(const char *path, bool load)
+{
+	struct cxl_mbox_identify id;
+	struct stat st;
+	u32 size;
+	ssize_t ret;
+	double t0;
+	int fd;
+
+	if (!path || path[0] == '-')
+		return -1;
+
+	ret = cxl_identify(cxl_mbox_transport(), &id);
+	if (ret) {
+		printf("IDENTIFY: %s\n", strerror(-ret));
+		return CXL_APP_FAIL;
+	}
+	size = id.lsa_size;
+
+	fd = load ? open(path, O_RDONLY | O_CLOEXEC) :
+		    open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		printf("%s: %s\n", path, strerror(errno));
+		return CXL_APP_FAIL;
+	}
+	if (load && !fstat(fd, &st) && (u64)st.st_size < size)
+		size = st.st_size;
+
+	t0 = now_us();
+	ret = load ? cxl_xfer_set_lsa(&dev, 0, size, cxl_xfer_from_fd, &fd) :
+		     cxl_xfer_get_lsa(&dev, 0, size, cxl_xfer_to_fd, &fd);
+	close(fd);
+	if (ret < 0) {
+		printf("LSA: %s\n", strerror(-ret));
+		return CXL_APP_FAIL;
+	}
+
+	printf("LSA: %zd bytes %s %s in %.0f us, %zu-byte payloads\n", ret,
+	       load ? "from" : "to", path, now_us() - t0, dev.payload_size);
+	return 0;
+}
+
+static int cxl_poison_print(void *priv, u64 off, void *buf, size_t len)
+{
+	const struct cxl_poison_record *r = buf;
+	size_t i;
+
+	for (i = 0; i < len / sizeof(*r); i++)
+		printf("0x%016llx %6u lines, source %llu\n",
+		       (unsigned long long)(r[i].address & ~CXL_POISON_SOURCE_MASK),
+		       r[i].length,
+		       (unsigned long long)(r[i].address & CXL_POISON_SOURCE_MASK));
+	return 0;
+}
+
+/* The poison list of @len bytes from @dpa, the whole capacity by default */
+int cxl_poison_list(const char *dpa_s, const char *len_s)
+{
+	struct cxl_mbox_identify id;
+	u64 dpa = 0, len, capacity;
+	ssize_t ret;
+
+	ret = cxl_identify(cxl_mbox_transport(), &id);
+	if (ret) {
+		printf("IDENTIFY: %s\n", strerror(-ret));
+		return CXL_APP_FAIL;
+	}
+	capacity = id.total_capacity << 28;
+
+	if (dpa_s && dpa_s[0] != '-')
+		dpa = strtoull(dpa_s, NULL, 0);
+	if (dpa >= capacity) {
+		printf("DPA 0x%llx beyond the capacity, 0x%llx\n",
+		       (unsigned long long)dpa, (unsigned long long)capacity);
+		return CXL_APP_FAIL;
+	}
+
+	len = capacity - dpa;
+	if (len_s && len_s[0] != '-') {
+		len = strtoull(len_s, NULL, 0);
+		if (len > capacity - dpa) {
+			printf("0x%llx bytes from 0x%llx beyond the capacity, 0x%llx\n",
+			       (unsigned long long)len, (unsigned long long)dpa,
+			       (unsigned long long)capacity);
+			return CXL_APP_FAIL;
+		}
+	}
+
+	ret = cxl_xfer_get_poison(&dev, dpa, len / 64, cxl_poison_print, NULL);
+	if (ret < 0) {
+		printf("Poison list: %s\n", strerror(-ret));
+		return CXL_APP_FAIL;
+	}
+
+	printf("%zd poisoned range%s\n", ret / sizeof(struct cxl_poison_record),
+	       ret == sizeof(struct cxl_poison_record) ? "" : "s");
+	return 0;
+}
+
+/*
+ * -sim_model: doe=, mbox= and bg= the latencies of the simulated device,
+ * seed= and virtual
+ */
+static int cxl_sim_model(struct doe_sim_dev *sim, char *spec)
+{
+	static const char *const lats[] = {
+		[DOE_SIM_LAT_DOE] = "doe",
+		[DOE_SIM_LAT_MBOX] = "mbox",
+		[DOE_SIM_LAT_BG] = "bg",
+	};
+	char *tok, *val;
+	int i;
+
+	for (tok = strtok(spec, ","); tok; tok = strtok(NULL, ",")) {
+		if (strcmp(tok, "virtual") == 0) {
+			doe_sim_virtual(sim);
+			continue;
+		}
+		val = strchr(tok, '=');
+		if (!val)
+			return -1;
+		*val++ = '\0';
+		if (strcmp(tok, "seed") == 0) {
+			doe_sim_seed(sim, strtoull(val, NULL, 0));
+			continue;
+		}
+		for (i = 0; i < DOE_SIM_LAT_MAX; i++)
+			if (strcmp(tok, lats[i]) == 0)
+				break;
+		if (i == DOE_SIM_LAT_MAX || doe_sim_dist_parse(&sim->lat[i], val))
+			return -1;
+	}
+
+	return 0;
+}
+
+static u64 cxl_sim_model_us(void)
+{
+	int i;
+	u64 us = 0;
+
+	for (i = 0; i < DOE_SIM_LAT_MAX; i++)
+		us += doe_sim.model_us[i];
+	return us;
+}
+
+/* What cxl_sim_bench() runs, 0 when the device answered */
+static int cxl_sim_bench_cdat(void)
+{
+	static u32 buf[CDAT_MAX_SIZE / 4];
+	struct doe_mb *mb = cxl_doe_mb(PCI_DVSEC_VENDOR_ID_CXL,
+				       CXL_DOE_PROTOCOL_TABLE_ACCESS);
+
+	return mb && cdat_read(mb, buf, sizeof(buf), NULL) > 0 ? 0 : -1;
+}
+
+static int cxl_sim_bench_identify(void)
+{
+	struct cxl_mbox_identify id;
+
+	return cxl_identify(cxl_mbox_transport(), &id);
+}
+
+/* The whole media, the 4 x 256 MiB of the simulated device in 64-byte units */
+static int cxl_sim_bench_scan_media(void)
+{
+	return cxl_scan_media(cxl_mbox_transport(), 0, (4ULL << 28) / 64, 0);
+}
+
+/*
+ * The tool's own time: the simulated device on a virtual clock takes
+ * none, makes no system call, and what it would have taken per its
+ * model, drawn the same for the same seed, is printed beside.
+ */
+int cxl_sim_bench(const char *n_s)
+{
+	static const struct {
+		const char *name;
+		int (*run)(void);
+	} ops[] = {
+		{ "CDAT read", cxl_sim_bench_cdat },
+		{ "IDENTIFY", cxl_sim_bench_identify },
+		{ "SCAN_MEDIA", cxl_sim_bench_scan_media },
+	};
+	static double tool[100000], dev_us[100000];
+	int n = n_s ? atoi(n_s) : 1000;
+	double t0, tool_sum, dev_sum;
+	u64 n_sys, model;
+	unsigned int op;
+	int i;
+
+	if (n <= 0 || n > 100000)
+		n = 1000;
+	if (!use_sim || !doe_sim.virt)
+		return -1;
+
+	/* The set-up, before any time is taken */
+	if (!cxl_doe_mb(PCI_DVSEC_VENDOR_ID_CXL, CXL_DOE_PROTOCOL_TABLE_ACCESS) ||
+	    cxl_regs_attach(&dev.pci))
+		return -1;
+
+	printf("%-10s %8s %10s %10s %10s %12s %10s %10s\n", "", "n",
+	       "tool [us]", "p50", "p99", "device [us]", "p99", "syscalls");
+	for (op = 0; op < ARRAY_SIZE(ops); op++) {
+		tool_sum = dev_sum = 0;
+		n_sys = transport_syscalls(&dev.pci);
+		for (i = 0; i < n; i++) {
+			model = cxl_sim_model_us();
+			t0 = now_us();
+			if (ops[op].run())
+				break;
+			tool[i] = now_us() - t0;
+			dev_us[i] = cxl_sim_model_us() - model;
+			tool_sum += tool[i];
+			dev_sum += dev_us[i];
+		}
+		if (i < n) {
+			printf("%-10s failed\n", ops[op].name);
+			continue;
+		}
+
+		qsort(tool, n, sizeof(tool[0]), cxl_cmp_double);
+		qsort(dev_us, n, sizeof(dev_us[0]), cxl_cmp_double);
+		printf("%-10s %8d %10.2f %10.2f %10.2f %12.1f %10.0f %10llu\n",
+		       ops[op].name, n, tool_sum / n, tool[n / 2],
+		       tool[n * 99 / 100], dev_sum / n, dev_us[n * 99 / 100],
+		       (unsigned long long)(transport_syscalls(&dev.pci) - n_sys));
+	}
+
+	return 0;
+}
+
 int cxl_doe_cxl_compliance(char *dword_s)
 {
-	cxl_pdev_config* config_payload = malloc(sizeof(cxl_pdev_config));
-	uint32_t data_obj[3], dword;
-	int length, payload_length, i;
+	struct doe_mb *mb = cxl_doe_mb(PCI_DVSEC_VENDOR_ID_CXL,
+				       CXL_DOE_PROTOCOL_COMPLIANCE);
+	u32 dword;
+	int length, i;
+
+	if (!mb)
+		return -1;
 
 	dword = strtol(dword_s, NULL, 16);
 	printf("DOE TYPE=0 VID=0x1e98\n");
 	printf("DWORD REQUEST (Version of Capability Requested)=0x%02x\n", dword);
 
-	data_obj[0] = 0x00001e98;
-	data_obj[1] = 0x3;
-	data_obj[2] = dword;
+	length = doe_exchange(mb, PCI_DVSEC_VENDOR_ID_CXL,
+			      CXL_DOE_PROTOCOL_COMPLIANCE, &dword, 1,
+			      doe_rsp, ARRAY_SIZE(doe_rsp));
+	if (length < 0)
+		return length;
+
+	printf("DOE response length=%0d response payload length %0d\n",
+	       length + DOE_HDR_DW, length);
 
-	pr_debug("Issue Abort\n");
-	doe_config(config_payload, PCI_DOE_CTRL, PCI_DOE_CTRL_ABORT, WRITE);
+	for (i = 0; i < min(length, (int)ARRAY_SIZE(doe_rsp)); i++)
+		printf("DW%d %08x\n", i, doe_rsp[i]);
 
-	pr_debug("Write DOE header1 (vid and type)\n");
-	doe_config(config_payload, PCI_DOE_WRITE, data_obj[0], WRITE);
+	return 0;
+}
 
-	pr_debug("Write DOE header2 (length)\n");
-	doe_config(config_payload, PCI_DOE_WRITE, data_obj[1], WRITE);
+#define CXL_COMPLIANCE_CODES	16
+#define CXL_SWEEP_MAX_DEV	32
+#define CXL_SWEEP_SIM_DEV	4
+
+static const char *const cxl_compliance_names[CXL_COMPLIANCE_CODES] = {
+	"Query Capabilities",
+	"Query Status",
+	"Multiple Write Streaming",
+	"Producer-Consumer",
+	"Bogus Writes",
+	"Inject Poison",
+	"Inject CRC",
+	"Inject Flow Control",
+	"Toggle Cache Flush",
+	"Inject MAC Delay",
+	"Insert Unexpected MAC",
+	"Inject Viral",
+	"Inject ALMP in Any State",
+	"Ignore Received ALMP",
+	"Inject Bit Error in Flit",
+	"Inject Memory Device Poison",
+};
 
-	pr_debug("Write DWORD %x()\n", data_obj[2]);
-	doe_config(config_payload, PCI_DOE_WRITE, data_obj[2], WRITE);
+/**
+ * struct cxl_sweep - The compliance sweep of one device
+ * @dev: the device, memN or simN, its config space in @dev.pci and its
+ *	 DOE instances in @dev.doe; @dev.sim NULL for a real one
+ * @us: latency of the exchange of each request code, 0 when not sent
+ * @total_us: time the whole sweep of the device took
+ * @out: what it has to say, printed once every device is done
+ */
+struct cxl_sweep {
+	struct cxl_dev dev;
+	double us[CXL_COMPLIANCE_CODES];
+	double total_us;
+	char *out;
+};
 
-	pr_debug("Set GO\n");
-	doe_config(config_payload, PCI_DOE_CTRL, PCI_DOE_CTRL_GO, WRITE);
+/*
+ * Response header: response code, version, length in bytes, then a
+ * status. Query Capabilities adds the bitmaps of the available and of
+ * the enabled request codes.
+ */
+static void cxl_compliance_decode(FILE *f, u32 code, const u32 *rsp, int n,
+				  double us)
+{
+	fprintf(f, "  0x%x %-28s %8.0f us  ", code, cxl_compliance_names[code],
+		us);
+	if (n < 2) {
+		fprintf(f, "short response, %d dwords\n", n);
+		return;
+	}
+	if ((rsp[0] & 0xff) != code) {
+		fprintf(f, "response code 0x%x\n", rsp[0] & 0xff);
+		return;
+	}
 
-	pr_debug("Check Data Object Ready is set?\n");
-	doe_config(config_payload, PCI_DOE_STATUS, 0, READ);
+	fprintf(f, "v%u %s", rsp[0] >> 8 & 0xff,
+		rsp[1] & 0xff ? "status" : "success");
+	if (rsp[1] & 0xff)
+		fprintf(f, " 0x%02x", rsp[1] & 0xff);
+	if (!code && n >= 6)
+		fprintf(f, ", available 0x%016llx enabled 0x%016llx",
+			(unsigned long long)rsp[3] << 32 | rsp[2],
+			(unsigned long long)rsp[5] << 32 | rsp[4]);
+	fprintf(f, "\n");
+}
 
-	/* Read the first dword to get the header1 */
-	doe_config(config_payload, PCI_DOE_READ, 0, READ);
-	/* Write anything to indicate success */
-	doe_config(config_payload, PCI_DOE_READ, 0x0, WRITE);
+/*
+ * Every request code on one device. Query Capabilities goes first and
+ * only the codes it reports as available follow, the others being
+ * error injections the device may not expect.
+ */
+static void *cxl_sweep_dev(void *arg)
+{
+	struct cxl_sweep *sw = arg;
+	struct doe_mb *mb;
+	u32 rsp[64], code;
+	u64 avail = 0;
+	double t0, t;
+	size_t size;
+	FILE *f;
+	int n;
+
+	f = open_memstream(&sw->out, &size);
+	if (!f)
+		return NULL;
+
+	fprintf(f, "== %s\n", sw->dev.name);
+	if (cxl_doe_dev_open(&sw->dev.doe, &sw->dev.pci)) {
+		fprintf(f, "  no DOE instance\n");
+		goto out;
+	}
 
-	/* Read the second word to get the length */
-	doe_config(config_payload, PCI_DOE_READ, 0, READ);
-	length = config_payload->val & 0x0000ffff;
-	payload_length = length - 2;
-	payload_length = max(payload_length, 0);
+	mb = doe_dev_find(&sw->dev.doe, PCI_DVSEC_VENDOR_ID_CXL,
+			  CXL_DOE_PROTOCOL_COMPLIANCE);
+	if (!mb) {
+		fprintf(f, "  no DOE instance serves compliance\n");
+		goto exit;
+	}
 
-	/* Write to indicate success */
-	doe_config(config_payload, PCI_DOE_READ, 0x0, WRITE);
+	t0 = now_us();
+	for (code = 0; code < CXL_COMPLIANCE_CODES; code++) {
+		if (code && !(avail & BIT(code))) {
+			fprintf(f, "  0x%x %-28s not available\n", code,
+				cxl_compliance_names[code]);
+			continue;
+		}
 
-	printf("DOE response length=%0d response payload length %0d\n",
-	       length, payload_length);
+		t = now_us();
+		n = doe_exchange(mb, PCI_DVSEC_VENDOR_ID_CXL,
+				 CXL_DOE_PROTOCOL_COMPLIANCE, &code, 1,
+				 rsp, ARRAY_SIZE(rsp));
+		sw->us[code] = now_us() - t;
+		if (n < 0) {
+			fprintf(f, "  0x%x %-28s %8.0f us  failed %d\n", code,
+				cxl_compliance_names[code], sw->us[code], n);
+			continue;
+		}
 
-	for (i = 0; i < payload_length; i++) {
-		doe_config(config_payload, PCI_DOE_READ, 0, READ);
+		cxl_compliance_decode(f, code, rsp, min(n, (int)ARRAY_SIZE(rsp)),
+				      sw->us[code]);
+		if (!code && n >= 4 && !(rsp[1] & 0xff))
+			avail = (u64)rsp[3] << 32 | rsp[2];
+	}
+	sw->total_us = now_us() - t0;
+	fprintf(f, "  %.0f us in total\n", sw->total_us);
+
+exit:
+	doe_dev_exit(&sw->dev.doe);
+out:
+	fclose(f);
+	return NULL;
+}
 
-		/* Prior to the last ack, ensure Data Object Ready */
-		if (i == payload_length - 1) {
-			doe_config(config_payload, PCI_DOE_STATUS, 0, READ);
-			if (!FIELD_GET(PCI_DOE_STATUS_DATA_OBJECT_READY, config_payload->val))
-				printf("Data Object Ready Clear - Error\n");
+/*
+ * Every CXL memdev whose config space opens, through -transport if given,
+ * or simulated ones; the one device of a -transport name:arg, which names
+ * a directory, a function or a file rather than a way to reach any memdev
+ */
+static int cxl_sweep_devices(struct cxl_sweep *sw, int max)
+{
+	struct dirent *d;
+	DIR *dir;
+	int n = 0, id;
+
+	if (use_transport && strchr(use_transport, ':')) {
+		cxl_dev_init(&sw[0].dev, dev.name);
+		if (transport_open(&sw[0].dev.pci, use_transport, dev.name, 0)) {
+			cxl_dev_exit(&sw[0].dev);
+			return -ENODEV;
 		}
+		return 1;
+	}
 
-		/* Write to advance on */
-		doe_config(config_payload, PCI_DOE_READ, 0x0, WRITE);
+	if (use_sim) {
+		for (; n < CXL_SWEEP_SIM_DEV && n < max; n++) {
+			struct doe_sim_dev *sim = malloc(sizeof(*sim));
+			char name[16];
+
+			if (!sim || doe_sim_init(sim, 50) < 0) {
+				free(sim);
+				break;
+			}
+			snprintf(name, sizeof(name), "sim%d", n);
+			cxl_dev_init(&sw[n].dev, name);
+			transport_open_sim(&sw[n].dev.pci, sim);
+			sw[n].dev.sim = sim;
+		}
+		return n;
 	}
 
+	dir = opendir("/sys/bus/cxl/devices");
+	if (!dir)
+		return -errno;
+
+	while ((d = readdir(dir)) && n < max) {
+		if (sscanf(d->d_name, "mem%d", &id) != 1)
+			continue;
+		cxl_dev_init(&sw[n].dev, d->d_name);
+		if (transport_open(&sw[n].dev.pci, use_transport, d->d_name,
+				   use_transport ? 0 : TRANSPORT_CFG_ABS)) {
+			printf("Can not open the config space of %s\n", d->d_name);
+			cxl_dev_exit(&sw[n].dev);
+			continue;
+		}
+		n++;
+	}
+	closedir(dir);
+
+	return n;
+}
+
+/*
+ * Every compliance request code on every DOE-capable device, a thread
+ * per device, then the decoded responses and the latency of each
+ * exchange, device by device.
+ */
+int cxl_doe_compliance_sweep(void)
+{
+	struct cxl_sweep *sw;
+	pthread_t threads[CXL_SWEEP_MAX_DEV];
+	double t0, wall, sum = 0;
+	int i, n;
+
+	sw = calloc(CXL_SWEEP_MAX_DEV, sizeof(*sw));
+	if (!sw)
+		return CXL_APP_FAIL;
+
+	n = cxl_sweep_devices(sw, CXL_SWEEP_MAX_DEV);
+	if (n <= 0) {
+		printf("No CXL memdev\n");
+		free(sw);
+		return CXL_APP_FAIL;
+	}
+
+	/* A capture per device, <file>.<name> */
+	for (i = 0; use_record && i < n; i++) {
+		char path[PATH_MAX];
+
+		snprintf(path, sizeof(path), "%s.%s", use_record, sw[i].dev.name);
+		if (transport_record(&sw[i].dev.pci, path))
+			printf("Can not record %s to %s\n", sw[i].dev.name, path);
+	}
+
+	t0 = now_us();
+	for (i = 1; i < n; i++)
+		if (pthread_create(&threads[i], NULL, cxl_sweep_dev, &sw[i]))
+			threads[i] = pthread_self();
+	cxl_sweep_dev(&sw[0]);
+	for (i = 1; i < n; i++) {
+		if (pthread_equal(threads[i], pthread_self()))
+			cxl_sweep_dev(&sw[i]);
+		else
+			pthread_join(threads[i], NULL);
+	}
+	wall = now_us() - t0;
+
+	for (i = 0; i < n; i++) {
+		if (sw[i].out)
+			fputs(sw[i].out, stdout);
+		free(sw[i].out);
+		sum += sw[i].total_us;
+		cxl_dev_exit(&sw[i].dev);
+		if (sw[i].dev.sim) {
+			doe_sim_exit(sw[i].dev.sim);
+			free(sw[i].dev.sim);
+		}
+	}
+
+	printf("\n%d device%s swept in %.0f us, %.0f us one after the other\n",
+	       n, n == 1 ? "" : "s", wall, sum);
+
+	free(sw);
 	return 0;
 }
 
@@ -445,12 +1897,44 @@ int parse_input(int argc, char **argv)
 			return cxl_config(argv[idx + 1], NULL);
 		if (strcmp(argv[idx], "-cfg_wr") == 0)
 			return cxl_config(argv[idx + 1], argv[idx + 2]);
+		if (strcmp(argv[idx], "-regs") == 0)
+			return cxl_regs();
+		if (strcmp(argv[idx], "-mbox_bench") == 0)
+			return cxl_mbox_bench(argv[idx + 1]);
+		if (strcmp(argv[idx], "-cel") == 0)
+			return cxl_cel(argv[idx + 1]);
+		if (strcmp(argv[idx], "-lsa_dump") == 0)
+			return cxl_lsa(argv[idx + 1], false);
+		if (strcmp(argv[idx], "-lsa_load") == 0)
+			return cxl_lsa(argv[idx + 1], true);
+		if (strcmp(argv[idx], "-poison_list") == 0)
+			return cxl_poison_list(argv[idx + 1],
+					       argv[idx + 1] ? argv[idx + 2] : NULL);
+		if (strcmp(argv[idx], "-sim_bench") == 0)
+			return cxl_sim_bench(argv[idx + 1]);
+		if (strcmp(argv[idx], "-doe_probe") == 0)
+			return cxl_doe_probe();
 		if (strcmp(argv[idx], "-doe_discovery") == 0)
-			return cxl_doe_discovery(argv[idx + 1]);
+			return cxl_doe_discovery();
 		if (strcmp(argv[idx], "-doe_cxl_cdat_get_length") == 0)
-			return cxl_doe_cxl_cdat("0", "length");
+			return cxl_doe_cxl_cdat("length", NULL);
 		if (strcmp(argv[idx], "-doe_cxl_cdat_read_table") == 0)
-			return cxl_doe_cxl_cdat("0", "table");
+			return cxl_doe_cxl_cdat("table", NULL);
+		if (strcmp(argv[idx], "-doe_cxl_cdat_read_entry") == 0)
+			return cxl_doe_cxl_cdat_entry(argv[idx + 1]);
+		if (strcmp(argv[idx], "-doe_cxl_cdat_perf") == 0)
+			return cxl_doe_cxl_cdat_perf();
+		if (strcmp(argv[idx], "-doe_cxl_route") == 0)
+			return cxl_doe_cxl_route();
+		if (strcmp(argv[idx], "-doe_cxl_cdat_dump") == 0)
+			return argv[idx + 1] ?
+			       cxl_doe_cxl_cdat("table", argv[idx + 1]) : -1;
+		if (strcmp(argv[idx], "-doe_cxl_cdat_bench") == 0)
+			return cxl_doe_cxl_cdat_bench();
+		if (strcmp(argv[idx], "-transport_bench") == 0)
+			return cxl_transport_bench();
+		if (strcmp(argv[idx], "-doe_compliance_sweep") == 0)
+			return cxl_doe_compliance_sweep();
 		if (strcmp(argv[idx], "-doe_cxl_complience") == 0)
 			return cxl_doe_cxl_compliance(argv[idx + 1]);
 	}
@@ -459,13 +1943,117 @@ int parse_input(int argc, char **argv)
 
 int main(int argc, char** argv)
 {
+     bool sweep = false;
      int ret;
-     char* dev_path= "/dev/cxl/mem0";
 
-     if ((FD= open(dev_path, O_RDWR)) < 0) {
-         printf("Open error loc: %s\n", dev_path);
-         printf("Try sudo %s\n", argv[0]);
-         exit(0);
+     cxl_dev_init(&dev, "mem0");
+
+     /* Offline, no device needed */
+     for (int i= 0; i < argc; i++)
+         if (strcmp(argv[i], "-cdat_parse") == 0)
+             exit(cxl_cdat_parse(argc - i - 1, argv + i + 1) ? 1 : 0);
+     for (int i= 0; i < argc; i++)
+         if (strcmp(argv[i], "-query_snapshot") == 0)
+             exit(cxl_query_snapshot(argv[i + 1]) ? 1 : 0);
+     for (int i= 0; i < argc; i++)
+         if (strcmp(argv[i], "-sim_vfio_file") == 0)
+             exit(cxl_sim_vfio_file(argv[i + 1]) ? 1 : 0);
+     for (int i= 0; i < argc; i++)
+         if (strcmp(argv[i], "-sim_mbox_serve") == 0)
+             exit(cxl_sim_mbox_serve(argv[i + 1]) ? 1 : 0);
+     for (int i= 0; i < argc; i++) {
+         char *latency = NULL;
+
+         if (strcmp(argv[i], "-cuse_serve") != 0)
+             continue;
+         for (int j= 0; j + 1 < argc; j++)
+             if (strcmp(argv[j], "-cuse_latency") == 0)
+                 latency = argv[j + 1];
+         exit(cxl_cuse_serve(argv[i + 1], latency) ? 1 : 0);
+     }
+
+     for (int i= 0; i < argc; i++) {
+         if (strcmp(argv[i], "-sim") == 0 ||
+             strcmp(argv[i], "-sim_bench") == 0)
+             use_sim = true;
+         if (strcmp(argv[i], "-doe_poll") == 0)
+             use_poll = true;
+         if (strcmp(argv[i], "-doe_all") == 0 ||
+             strcmp(argv[i], "-doe_probe") == 0)
+             use_pci = true;
+         if (strcmp(argv[i], "-transport") == 0 && i + 1 < argc)
+             use_transport = argv[i + 1];
+         if (strcmp(argv[i], "-record") == 0 && i + 1 < argc) {
+             use_record = argv[i + 1];
+             use_cache = false;
+         }
+         if (strcmp(argv[i], "-nocache") == 0)
+             use_cache = false;
+         if (strcmp(argv[i], "-debug") == 0)
+             debug_level = i + 1 < argc ? atoi(argv[i + 1]) : DEBUG_LEVEL_DEBUG;
+         if (strcmp(argv[i], "-trace_dump") == 0)
+             trace_start();
+     }
+
+     if (use_sim) {
+         if (doe_sim_init(&doe_sim, 50) < 0)
+             exit(0);
+         for (int i= 0; i + 1 < argc; i++)
+             if (strcmp(argv[i], "-sim_model") == 0 &&
+                 cxl_sim_model(&doe_sim, argv[i + 1])) {
+                 printf("-sim_model: key=val,..., key one of doe mbox bg seed, or virtual\n");
+                 doe_sim_exit(&doe_sim);
+                 exit(1);
+             }
+         for (int i= 0; i < argc; i++)
+             if (strcmp(argv[i], "-sim_bench") == 0)
+                 doe_sim_virtual(&doe_sim);
+         transport_open_sim(&dev.pci, &doe_sim);
+         dev.sim = &doe_sim;
+         use_pci = true;
+     } else {
+         /* Not needed when the accesses go elsewhere, to vfio-pci say */
+         if ((ret= transport_open_ioctl(&dev.mem, dev.name)) < 0 && !use_transport) {
+             printf("Open error loc: /dev/cxl/mem0: %s\n", strerror(-ret));
+             printf("Try sudo %s\n", argv[0]);
+             exit(0);
+         }
+         if (use_pci || use_transport) {
+             ret= transport_open(&dev.pci, use_transport, dev.name,
+                                 use_transport ? 0 : TRANSPORT_CFG_ABS);
+             use_pci = !ret;
+             if (ret < 0)
+                 printf("Can not open the %s transport to mem0: %s\n",
+                        use_transport ?: "config space", strerror(-ret));
+             if (ret < 0 && !dev.mem.ops)
+                 exit(0);
+         }
+     }
+
+     for (int i= 0; i + 1 < argc; i++)
+         if (strcmp(argv[i], "-replay_scale") == 0 &&
+             transport_replay_scale(&dev.pci, atof(argv[i + 1])))
+             printf("-replay_scale: along with -transport replay:<file>\n");
+
+     /* The sweep records each device it opens itself */
+     for (int i= 0; i < argc; i++)
+         if (strcmp(argv[i], "-doe_compliance_sweep") == 0)
+             sweep = true;
+     if (use_record && !sweep) {
+         /* The simulated device answering the registers before they go */
+         if (use_sim)
+             cxl_mbox_transport();
+         if ((ret= transport_record(cxl_transport(), use_record)) < 0) {
+             printf("Can not record to %s: %s\n", use_record, strerror(-ret));
+             exit(1);
+         }
+     }
+
+     if (debug_level >= DEBUG_LEVEL_DEBUG) {
+         if (dev.mem.ops)
+             transport_print_caps(&dev.mem);
+         if (use_pci)
+             transport_print_caps(&dev.pci);
      }
 
      if ((ret= parse_input(argc, argv)) < 0) {
@@ -474,6 +2062,19 @@ int main(int argc, char** argv)
            printf("\n%s\n", help);
      }
 
-     close(FD);
-     exit(0);
+     for (int i= 0; i < argc; i++) {
+         if (strcmp(argv[i], "-doe_stats") != 0)
+             continue;
+         for (int j= 0; j < dev.doe.n_mb; j++) {
+             printf("DOE @0x%03x ", dev.doe.mb[j].cap);
+             doe_print_stats(&dev.doe.mb[j]);
+         }
+     }
+
+     if (trace_on())
+         trace_dump(stdout);
+     cxl_dev_exit(&dev);
+     if (use_sim)
+         doe_sim_exit(&doe_sim);
+     exit(ret == CXL_APP_FAIL ? EXIT_FAILURE : 0);
 }
@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <dev.h>
+#include <cache.h>
+#include <doe_sim.h>
+#include <regs.h>
+
+/**
+ * DOC: cxl dev
+ *
+ * A handle on a memory device: the transports that reach it, its DOE
+ * instances, and what its mailbox takes, the commands it supports and
+ * the largest payload it moves. Those are learnt on the first mailbox
+ * command, along with a pool of payload buffers that size, so that a
+ * command runs on memory already there rather than a malloc() of its
+ * own. Nothing in the handle is global: one per device, and as many
+ * devices as wanted, driven from one process, each from its thread.
+ *
+ * What was learnt is published too, in a struct cxl_snap in shared
+ * memory named after the device's cache key, see cache.c. Another
+ * process asking whether the device has a command maps it read-only
+ * and loads a word, rather than opening the device and querying it.
+ * The snapshot outlives the process, until the next one rewrites it or
+ * the system restarts; a seqlock keeps readers off a half-written one.
+ */
+
+void cxl_dev_init(struct cxl_dev *d, const char *name)
+{
+	memset(d, 0, sizeof(*d));
+	snprintf(d->name, sizeof(d->name), "%s", name);
+	d->mem.fd = -1;
+	d->pci.fd = -1;
+	pthread_mutex_init(&d->lock, NULL);
+}
+
+void cxl_dev_exit(struct cxl_dev *d)
+{
+	doe_dev_exit(&d->doe);
+	d->doe_ready = false;
+	transport_close(&d->pci);
+	transport_close(&d->mem);
+	free(d->buf);
+	d->buf = NULL;
+	d->buf_used = 0;
+	d->mbox_ready = false;
+	pthread_mutex_destroy(&d->lock);
+}
+
+/* What the DOE exchanges and config accesses go through */
+struct transport *cxl_dev_transport(struct cxl_dev *d)
+{
+	return d->pci.ops ? &d->pci : &d->mem;
+}
+
+/*
+ * The mailbox: that of @pci when it has one, in the registers when it
+ * maps them, @sim then answering it, otherwise the driver's.
+ */
+struct transport *cxl_dev_mbox(struct cxl_dev *d)
+{
+	if (!d->pci.ops ||
+	    (!(d->pci.caps & TRANSPORT_MBOX) && cxl_regs_attach(&d->pci)))
+		return &d->mem;
+	if (d->sim && d->pci.regs)
+		doe_sim_mbox_attach(d->sim, d->pci.regs);
+	return &d->pci;
+}
+
+/*
+ * The payload registers when mapped, what the driver says its mailbox
+ * takes otherwise; the smallest there is when nothing tells.
+ */
+static size_t cxl_dev_payload_size(struct cxl_dev *d, struct transport *t)
+{
+	char path[PATH_MAX];
+	unsigned long size = 0;
+	FILE *f;
+
+	if (t->regs)
+		return t->regs->payload_size;
+	if (t != &d->mem)
+		return CXL_DEV_PAYLOAD_MIN;
+
+	snprintf(path, sizeof(path), "/sys/bus/cxl/devices/%s/payload_max",
+		 d->name);
+	f = fopen(path, "r");
+	if (!f)
+		return CXL_DEV_PAYLOAD_MIN;
+	if (fscanf(f, "%lu", &size) != 1 || size < CXL_DEV_PAYLOAD_MIN)
+		size = CXL_DEV_PAYLOAD_MIN;
+	fclose(f);
+	return size;
+}
+
+/* Each buffer of the pool starts on its own CXL_DEV_BUF_ALIGN boundary */
+static size_t cxl_dev_buf_stride(const struct cxl_dev *d)
+{
+	return (d->payload_size + CXL_DEV_BUF_ALIGN - 1) &
+	       ~(size_t)(CXL_DEV_BUF_ALIGN - 1);
+}
+
+static void cxl_snap_write(struct cxl_snap *s, const struct cxl_dev *d)
+{
+	u32 seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED) | 1;
+
+	__atomic_store_n(&s->seq, seq, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	s->magic = CXL_SNAP_MAGIC;
+	s->n_commands = d->query.n_commands;
+	__atomic_store_n(&s->cmd_mask, d->cmd_mask, __ATOMIC_RELEASE);
+	s->payload_size = d->payload_size;
+	s->time = time(NULL);
+	memcpy(s->commands, d->query.commands,
+	       d->query.n_commands * sizeof(s->commands[0]));
+
+	__atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Best effort: without a key or /dev/shm, the others query themselves */
+static void cxl_dev_publish(struct cxl_dev *d)
+{
+	char key[CACHE_KEY_LEN], name[sizeof(CXL_SNAP_PREFIX) + CACHE_KEY_LEN];
+	struct cxl_snap *s;
+	int fd;
+
+	/* A capture says what the device took then, not what it takes now */
+	if (!strcmp(transport_name(cxl_dev_mbox(d)), "replay") ||
+	    cache_key(key, sizeof(key), cxl_dev_transport(d), d->name))
+		return;
+
+	snprintf(name, sizeof(name), CXL_SNAP_PREFIX "%s", key);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return;
+	if (ftruncate(fd, sizeof(*s)) == 0) {
+		s = mmap(NULL, sizeof(*s), PROT_READ | PROT_WRITE, MAP_SHARED,
+			 fd, 0);
+		if (s != MAP_FAILED) {
+			cxl_snap_write(s, d);
+			munmap(s, sizeof(*s));
+		}
+	}
+	close(fd);
+}
+
+static int cxl_dev_mbox_setup(struct cxl_dev *d)
+{
+	struct transport *t = cxl_dev_mbox(d);
+	u32 i;
+	int ret;
+
+	/* The driver fills in no more than it has, without saying how many */
+	d->query.n_commands = 0;
+	ret = transport_query(t, &d->query);
+	if (!ret && d->query.n_commands > CXL_MEM_COMMAND_ID_MAX)
+		d->query.n_commands = CXL_MEM_COMMAND_ID_MAX;
+	if (!ret)
+		ret = transport_query(t, &d->query);
+	if (ret)
+		return ret;
+
+	d->cmd_mask = 0;
+	for (i = 0; i < d->query.n_commands; i++)
+		if (d->query.commands[i].id < CXL_MEM_COMMAND_ID_MAX)
+			d->cmd_mask |= 1ULL << d->query.commands[i].id;
+
+	d->payload_size = cxl_dev_payload_size(d, t);
+	d->buf = aligned_alloc(CXL_DEV_BUF_ALIGN,
+			       CXL_DEV_NR_BUF * cxl_dev_buf_stride(d));
+	if (!d->buf)
+		return -ENOMEM;
+
+	d->mbox_ready = true;
+	cxl_dev_publish(d);
+	return 0;
+}
+
+/**
+ * cxl_dev_mbox_open() - Learn what the mailbox takes
+ * @d: the device
+ *
+ * The commands, the payload size and the pool, once; later calls return
+ * at once. The other cxl_dev_* of the mailbox call it themselves.
+ *
+ * Return: 0 or -errno
+ */
+int cxl_dev_mbox_open(struct cxl_dev *d)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&d->lock);
+	if (!d->mbox_ready)
+		ret = cxl_dev_mbox_setup(d);
+	pthread_mutex_unlock(&d->lock);
+	return ret;
+}
+
+/* The commands of the mailbox, NULL when it could not be queried */
+const struct cxl_mem_query_commands *cxl_dev_commands(struct cxl_dev *d)
+{
+	return cxl_dev_mbox_open(d) ? NULL : &d->query;
+}
+
+/* Command CXL_MEM_COMMAND_ID_@id when the mailbox supports it, or NULL */
+const struct cxl_command_info *cxl_dev_command(struct cxl_dev *d,
+					       unsigned int id)
+{
+	u32 i;
+
+	if (!cxl_dev_has_command(d, id))
+		return NULL;
+
+	for (i = 0; i < d->query.n_commands; i++)
+		if (d->query.commands[i].id == id)
+			return &d->query.commands[i];
+	return NULL;
+}
+
+/* Command CXL_MEM_COMMAND_ID_@id is there, without a search */
+bool cxl_dev_has_command(struct cxl_dev *d, unsigned int id)
+{
+	return id < CXL_MEM_COMMAND_ID_MAX && !cxl_dev_mbox_open(d) &&
+	       (d->cmd_mask & 1ULL << id);
+}
+
+/**
+ * cxl_dev_buf_get() - A payload buffer of the pool
+ * @d: the device
+ *
+ * @d->payload_size bytes, CXL_DEV_BUF_ALIGN aligned, the caller's until
+ * cxl_dev_buf_put().
+ *
+ * Return: the buffer, NULL when all are out or the mailbox is not there
+ */
+void *cxl_dev_buf_get(struct cxl_dev *d)
+{
+	void *buf = NULL;
+	int i;
+
+	if (cxl_dev_mbox_open(d))
+		return NULL;
+
+	pthread_mutex_lock(&d->lock);
+	for (i = 0; i < CXL_DEV_NR_BUF; i++)
+		if (!(d->buf_used & 1U << i)) {
+			d->buf_used |= 1U << i;
+			buf = d->buf + i * cxl_dev_buf_stride(d);
+			break;
+		}
+	pthread_mutex_unlock(&d->lock);
+	return buf;
+}
+
+void cxl_dev_buf_put(struct cxl_dev *d, void *buf)
+{
+	size_t i;
+
+	if (!buf)
+		return;
+
+	i = ((u8 *)buf - d->buf) / cxl_dev_buf_stride(d);
+	pthread_mutex_lock(&d->lock);
+	d->buf_used &= ~(1U << i);
+	pthread_mutex_unlock(&d->lock);
+}
+
+/**
+ * cxl_snap_open() - The snapshot another process published of a device
+ * @key: its cache key, from cache_key()
+ *
+ * Return: the snapshot, mapped read-only until cxl_snap_close(), or NULL
+ * when none was published
+ */
+const struct cxl_snap *cxl_snap_open(const char *key)
+{
+	char name[sizeof(CXL_SNAP_PREFIX) + CACHE_KEY_LEN];
+	struct cxl_snap *s;
+	struct stat st;
+	int fd;
+
+	snprintf(name, sizeof(name), CXL_SNAP_PREFIX "%s", key);
+	fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(*s)) {
+		close(fd);
+		return NULL;
+	}
+
+	s = mmap(NULL, sizeof(*s), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (s == MAP_FAILED)
+		return NULL;
+	if (s->magic != CXL_SNAP_MAGIC) {
+		munmap(s, sizeof(*s));
+		return NULL;
+	}
+
+	return s;
+}
+
+void cxl_snap_close(const struct cxl_snap *s)
+{
+	if (s)
+		munmap((void *)s, sizeof(*s));
+}
+
+/**
+ * cxl_snap_read() - A consistent copy of a snapshot
+ * @s: from cxl_snap_open()
+ * @copy: filled in
+ *
+ * Return: 0, -EAGAIN when the writer kept it busy throughout, -EBADMSG
+ * when what it holds is not a command list
+ */
+int cxl_snap_read(const struct cxl_snap *s, struct cxl_snap *copy)
+{
+	u32 seq, j;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		memcpy(copy, s, sizeof(*copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+
+		/* World-readable, and maybe of another build: trust none of it */
+		if (copy->n_commands > CXL_MEM_COMMAND_ID_MAX)
+			return -EBADMSG;
+		for (j = 0; j < copy->n_commands; j++)
+			if (copy->commands[j].id >= CXL_MEM_COMMAND_ID_MAX)
+				return -EBADMSG;
+		return 0;
+	}
+
+	return -EAGAIN;
+}
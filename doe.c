@@ -0,0 +1,839 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "include/linux/pci_regs.h"
+
+#include <doe.h>
+#include <pci.h>
+#include <transport.h>
+#include <trace.h>
+#include <bitfield.h>
+
+#define DEBUG
+#include <debug_or_not.h>
+
+#define READ  0
+#define WRITE 1
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+/* Response dwords per batch: a read, its ack and the last Status check */
+#define DOE_DRAIN_CHUNK ((size_t)(DOE_MB_MAX_OPS - 1) / 2)
+
+/**
+ * DOC: doe
+ *
+ * Data Object Exchange engine. Every DOE protocol (discovery, CDAT
+ * table access, compliance) goes through doe_exchange(), so the
+ * register sequence lives in one place:
+ *
+ *  - Status read, and Abort only when it shows the mailbox busy, in
+ *    error or with a stale Data Object Ready
+ *  - Header1 (vid/type), Header2 (length) and the request payload
+ *    written to the Write Data Mailbox
+ *  - GO
+ *  - Data Object Ready polled in the Status
+ *  - every response dword read from the Read Data Mailbox and acked
+ *    by a write to it
+ *
+ * The accesses are queued in the mailbox and go to the transport in one
+ * call per phase: the whole request, the two response headers, then the
+ * response payload. A transport without TRANSPORT_BATCH gets one call
+ * per access.
+ *
+ * Abort is only issued when the mailbox is found Busy, in Error or
+ * with a stale response. The Status is polled by spinning a few reads,
+ * then yielding, then sleeping with a growing interval. Once the
+ * mailbox has a history the spinning is skipped and the first sleep
+ * lasts most of its average response time, so a slow device is not
+ * hammered with config reads and a fast one is not slept past.
+ *
+ * When the capability advertises PCI_DOE_CAP_INT_SUP and the transport
+ * has an fd signalling it, the interrupt is enabled and the wait for
+ * the response blocks in poll() instead.
+ *
+ * A device may have several DOE instances, each serving its own set
+ * of protocols. doe_dev_init() finds all of them in the extended
+ * capability list and doe_dev_discover() runs discovery on each to map
+ * the protocols to the mailboxes. The map rarely changes, so it can be
+ * saved and loaded instead. doe_run() runs the work queued for
+ * different mailboxes concurrently, a thread per mailbox.
+ */
+
+/* Status reads before yielding, and yields before sleeping */
+#define DOE_POLL_SPIN		4
+#define DOE_POLL_YIELD		4
+/* Bounds of the sleep between two Status reads */
+#define DOE_POLL_MIN_US		1
+#define DOE_POLL_MAX_US		10000
+
+static u64 doe_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void doe_sleep_us(u32 us)
+{
+	struct timespec ts = {
+		.tv_sec = us / 1000000,
+		.tv_nsec = (us % 1000000) * 1000L,
+	};
+
+	nanosleep(&ts, NULL);
+}
+
+void doe_mb_init(struct doe_mb *mb, struct transport *t, u16 cap)
+{
+	mb->t = t;
+	mb->cap = cap;
+	mb->irq_fd = -1;
+	mb->ctrl = 0;
+	mb->flags = DOE_MB_BATCH;
+	mb->busy_us = 0;
+	memset(&mb->stats, 0, sizeof(mb->stats));
+	mb->n_ops = 0;
+}
+
+static void doe_print_op(struct cxl_pdev_config *config_payload)
+{
+	int i;
+
+	printf("CONFIG_%s [%0x] ", config_payload->is_write ? "WR": "RD",
+	       config_payload->offset);
+	printf(" %08x ", config_payload->val);
+
+	for (i = 0; i < 32; i += 8)
+		print_by_byte(" %02x", (config_payload->val >> i) & 0xff);
+
+	printf("\n");
+}
+
+/**
+ * doe_queue() - Queue a register access
+ * @mb: the DOE mailbox
+ * @reg: register, relative to the DOE capability
+ * @val: value to write, ignored for reads
+ * @is_write: WRITE or READ
+ *
+ * A full queue is submitted first, so callers reading back the
+ * returned entry must doe_submit() before DOE_MB_MAX_OPS are queued.
+ *
+ * Return: the queued entry, holding the value read after doe_submit()
+ */
+struct cxl_pdev_config *doe_queue(struct doe_mb *mb, u32 reg, u32 val,
+				  bool is_write)
+{
+	struct cxl_pdev_config *op;
+
+	if (mb->n_ops == DOE_MB_MAX_OPS)
+		doe_submit(mb);
+
+	op = &mb->ops[mb->n_ops++];
+	op->offset = mb->cap + reg;
+	op->val = val;
+	op->is_write = is_write;
+
+	return op;
+}
+
+/*
+ * Trace @n accesses from @first, issued at @t0 and done now, sharing the
+ * time evenly. Return now.
+ */
+static u64 doe_trace_ops(struct doe_mb *mb, unsigned int first,
+			 unsigned int n, u64 t0)
+{
+	u64 t = trace_now_ns();
+	unsigned int i;
+
+	for (i = first; i < first + n; i++)
+		trace_access(mb->cap, &mb->ops[i], t0, (t - t0) / n);
+
+	return t;
+}
+
+void doe_submit(struct doe_mb *mb)
+{
+	bool trace = trace_on();
+	unsigned int i;
+	u64 t0 = 0;
+
+	if (!mb->n_ops)
+		return;
+
+	if (trace)
+		t0 = trace_now_ns();
+
+	if ((mb->flags & DOE_MB_BATCH) && (mb->t->caps & TRANSPORT_BATCH)) {
+		mb->stats.n_call++;
+		transport_config(mb->t, mb->ops, mb->n_ops);
+		if (trace)
+			doe_trace_ops(mb, 0, mb->n_ops, t0);
+	} else {
+		for (i = 0; i < mb->n_ops; i++) {
+			mb->stats.n_call++;
+			transport_config(mb->t, &mb->ops[i], 1);
+			if (trace)
+				t0 = doe_trace_ops(mb, i, 1, t0);
+		}
+	}
+
+	if (debug_level >= DEBUG_LEVEL_ACCESS)
+		for (i = 0; i < mb->n_ops; i++)
+			doe_print_op(&mb->ops[i]);
+
+	mb->n_ops = 0;
+}
+
+u32 doe_read(struct doe_mb *mb, u32 reg)
+{
+	struct cxl_pdev_config *op = doe_queue(mb, reg, 0, READ);
+
+	doe_submit(mb);
+	return op->val;
+}
+
+void doe_write(struct doe_mb *mb, u32 reg, u32 val)
+{
+	doe_queue(mb, reg, val, WRITE);
+	doe_submit(mb);
+}
+
+/**
+ * doe_mb_irq_enable() - Complete the exchanges on the DOE interrupt
+ * @mb: the DOE mailbox
+ *
+ * Return: 0, or -errno when the mailbox keeps polling
+ */
+int doe_mb_irq_enable(struct doe_mb *mb)
+{
+	int fd;
+
+	if (!FIELD_GET(PCI_DOE_CAP_INT_SUP, doe_read(mb, PCI_DOE_CAP)))
+		return -EOPNOTSUPP;
+
+	mb->stats.n_call++;
+	fd = transport_irq_fd(mb->t, mb->cap);
+	if (fd < 0)
+		return fd;
+
+	mb->irq_fd = fd;
+	mb->ctrl = PCI_DOE_CTRL_INT_EN;
+	doe_write(mb, PCI_DOE_CTRL, mb->ctrl);
+	return 0;
+}
+
+void doe_mb_exit(struct doe_mb *mb)
+{
+	if (mb->irq_fd < 0)
+		return;
+
+	doe_write(mb, PCI_DOE_CTRL, 0);
+	transport_irq_release(mb->t, mb->cap, mb->irq_fd);
+	mb->irq_fd = -1;
+	mb->ctrl = 0;
+}
+
+/* Queue a read of one dword out of the Read Data Mailbox and its ack */
+static struct cxl_pdev_config *doe_queue_pop(struct doe_mb *mb)
+{
+	struct cxl_pdev_config *op = doe_queue(mb, PCI_DOE_READ, 0, READ);
+
+	/* Write anything to indicate success */
+	doe_queue(mb, PCI_DOE_READ, 0x0, WRITE);
+	return op;
+}
+
+static bool doe_idle(u32 status)
+{
+	return !(status & (PCI_DOE_STATUS_BUSY | PCI_DOE_STATUS_ERROR));
+}
+
+static bool doe_done(u32 status)
+{
+	return status & (PCI_DOE_STATUS_DATA_OBJECT_READY | PCI_DOE_STATUS_ERROR);
+}
+
+/* Block until the DOE interrupt signals the response, or time out */
+static int doe_wait_irq(struct doe_mb *mb, u32 *status)
+{
+	struct pollfd pfd = { .fd = mb->irq_fd, .events = POLLIN };
+	u64 t0 = doe_now_us(), elapsed, count;
+	int ret;
+
+	for (;;) {
+		*status = doe_read(mb, PCI_DOE_STATUS);
+		if (FIELD_GET(PCI_DOE_STATUS_INT_STATUS, *status))
+			doe_write(mb, PCI_DOE_STATUS, PCI_DOE_STATUS_INT_STATUS);
+		if (doe_done(*status))
+			return 0;
+
+		elapsed = doe_now_us() - t0;
+		if (elapsed > PCI_DOE_TIMEOUT_US)
+			return -ETIMEDOUT;
+
+		ret = poll(&pfd, 1, (PCI_DOE_TIMEOUT_US - elapsed) / 1000 + 1);
+		if (ret < 0 && errno != EINTR)
+			return -errno;
+		if (ret > 0) {
+			mb->stats.n_irq++;
+			if (read(mb->irq_fd, &count, sizeof(count)) < 0 &&
+			    errno != EAGAIN)
+				return -errno;
+		}
+	}
+}
+
+/**
+ * doe_poll() - Poll the Status until a condition is met
+ * @mb: the DOE mailbox
+ * @cond: doe_idle() or doe_done()
+ * @status: the last Status read
+ *
+ * Return: 0 or -ETIMEDOUT after PCI_DOE_TIMEOUT_US
+ */
+static int doe_poll(struct doe_mb *mb, bool (*cond)(u32), u32 *status)
+{
+	u64 t0 = doe_now_us();
+	u32 interval = max(mb->busy_us / 8, DOE_POLL_MIN_US);
+	unsigned int polls = 0;
+
+	if (mb->irq_fd >= 0 && cond == doe_done)
+		return doe_wait_irq(mb, status);
+
+	/* A device known to be slow gets most of its time up front */
+	if (mb->busy_us > DOE_POLL_MAX_US / 100 && cond == doe_done) {
+		doe_sleep_us(min(mb->busy_us - mb->busy_us / 4, DOE_POLL_MAX_US));
+		polls = DOE_POLL_SPIN + DOE_POLL_YIELD;
+	}
+
+	for (;; polls++) {
+		*status = doe_read(mb, PCI_DOE_STATUS);
+		if (cond(*status))
+			return 0;
+
+		if (doe_now_us() - t0 > PCI_DOE_TIMEOUT_US)
+			return -ETIMEDOUT;
+
+		if (polls < DOE_POLL_SPIN)
+			continue;
+
+		if (polls < DOE_POLL_SPIN + DOE_POLL_YIELD) {
+			sched_yield();
+			continue;
+		}
+
+		doe_sleep_us(interval);
+		interval = min(interval * 2, DOE_POLL_MAX_US);
+	}
+}
+
+static int doe_abort(struct doe_mb *mb)
+{
+	u32 status;
+	int ret;
+
+	pr_debug("Issue Abort\n");
+	mb->stats.n_abort++;
+	doe_write(mb, PCI_DOE_CTRL, mb->ctrl | PCI_DOE_CTRL_ABORT);
+
+	ret = doe_poll(mb, doe_idle, &status);
+	if (ret)
+		printf("DOE abort timed out, status %08x\n", status);
+
+	return ret;
+}
+
+static void doe_account(struct doe_mb *mb, u64 us)
+{
+	struct doe_stats *st = &mb->stats;
+	int bucket = 0;
+
+	while (bucket < DOE_HIST_BUCKETS - 1 && us >> bucket)
+		bucket++;
+
+	st->hist[bucket]++;
+	if (!st->n_exchange || us < st->min_us)
+		st->min_us = us;
+	st->max_us = max(st->max_us, us);
+	st->sum_us += us;
+	st->n_exchange++;
+}
+
+void doe_print_stats(struct doe_mb *mb)
+{
+	struct doe_stats *st = &mb->stats;
+	u32 peak = 0;
+	int i;
+
+	printf("DOE exchanges %llu aborts %llu irqs %llu errors %llu timeouts %llu calls %llu\n",
+	       (unsigned long long)st->n_exchange,
+	       (unsigned long long)st->n_abort,
+	       (unsigned long long)st->n_irq,
+	       (unsigned long long)st->n_error,
+	       (unsigned long long)st->n_timeout,
+	       (unsigned long long)st->n_call);
+	if (!st->n_exchange)
+		return;
+
+	printf("latency [us] min %llu avg %llu max %llu\n",
+	       (unsigned long long)st->min_us,
+	       (unsigned long long)(st->sum_us / st->n_exchange),
+	       (unsigned long long)st->max_us);
+
+	for (i = 0; i < DOE_HIST_BUCKETS; i++)
+		peak = max(peak, st->hist[i]);
+
+	for (i = 0; i < DOE_HIST_BUCKETS; i++) {
+		if (!st->hist[i])
+			continue;
+		printf("  [%7lu, %7lu) %8u %.*s\n",
+		       i ? 1UL << (i - 1) : 0UL, 1UL << i, st->hist[i],
+		       (int)(40 * st->hist[i] / peak),
+		       "########################################");
+	}
+}
+
+/**
+ * doe_exchange() - Send one data object and collect its response
+ * @mb: the DOE mailbox
+ * @vid: Header1 Vendor ID
+ * @type: Header1 Data Object Type
+ * @req: request payload, without the two headers
+ * @n: number of dwords in @req
+ * @rsp: response payload, without the two headers
+ * @cap: number of dwords @rsp has room for
+ *
+ * The response is always drained in full, so the mailbox is left
+ * idle. Dwords not fitting in @rsp are dropped.
+ *
+ * Return: length of the response payload in dwords, which is more
+ * than @cap when it was truncated, or -errno.
+ */
+int doe_exchange(struct doe_mb *mb, u16 vid, u8 type, const u32 *req,
+		 size_t n, u32 *rsp, size_t cap)
+{
+	struct cxl_pdev_config *status, *hdr1, *hdr2, *val[DOE_DRAIN_CHUNK];
+	u32 length, st;
+	u64 t0, t_go;
+	size_t i, j, todo;
+	int ret;
+
+	t0 = doe_now_us();
+
+	/* Only a mailbox left busy, failed or with a stale response is aborted */
+	st = doe_read(mb, PCI_DOE_STATUS);
+	if (!doe_idle(st) || FIELD_GET(PCI_DOE_STATUS_DATA_OBJECT_READY, st)) {
+		ret = doe_abort(mb);
+		if (ret)
+			goto timeout;
+	}
+
+	pr_debug("Write header1 (vid %04x type %02x), header2 (length %zu), "
+		 "%zu dwords and set GO\n", vid, type, n + DOE_HDR_DW, n);
+	doe_queue(mb, PCI_DOE_WRITE, (u32)type << 16 | vid, WRITE);
+	doe_queue(mb, PCI_DOE_WRITE, n + DOE_HDR_DW, WRITE);
+	for (i = 0; i < n; i++)
+		doe_queue(mb, PCI_DOE_WRITE, req[i], WRITE);
+	doe_queue(mb, PCI_DOE_CTRL, mb->ctrl | PCI_DOE_CTRL_GO, WRITE);
+	doe_submit(mb);
+	t_go = doe_now_us();
+
+	pr_debug("Wait for Data Object Ready\n");
+	ret = doe_poll(mb, doe_done, &st);
+	if (ret) {
+		doe_abort(mb);
+		goto timeout;
+	}
+	if (FIELD_GET(PCI_DOE_STATUS_ERROR, st)) {
+		printf("DOE Error, status %08x\n", st);
+		mb->stats.n_error++;
+		doe_abort(mb);
+		return -EIO;
+	}
+
+	/* Weigh the last response time in 1/4 into the polling pace */
+	mb->busy_us = (3ULL * mb->busy_us + (doe_now_us() - t_go)) / 4;
+
+	hdr1 = doe_queue_pop(mb);
+	hdr2 = doe_queue_pop(mb);
+	doe_submit(mb);
+
+	/* Header1 to check the response matches the request */
+	if (FIELD_GET(PCI_DOE_DATA_OBJECT_HEADER_1_VID, hdr1->val) != vid ||
+	    FIELD_GET(PCI_DOE_DATA_OBJECT_HEADER_1_TYPE, hdr1->val) != type) {
+		printf("DOE response header1 %08x, expected vid %04x type %02x\n",
+		       hdr1->val, vid, type);
+		doe_abort(mb);
+		return -EIO;
+	}
+
+	/* Header2 to get the length */
+	length = FIELD_GET(PCI_DOE_DATA_OBJECT_HEADER_2_LENGTH, hdr2->val);
+	if (length < DOE_HDR_DW) {
+		printf("DOE response length %u too short\n", length);
+		doe_abort(mb);
+		return -EIO;
+	}
+	length -= DOE_HDR_DW;
+
+	status = NULL;
+	for (i = 0; i < length; i += todo) {
+		todo = min(DOE_DRAIN_CHUNK, length - i);
+
+		for (j = 0; j < todo; j++) {
+			/* Prior to the last ack, ensure Data Object Ready */
+			if (i + j == length - 1) {
+				val[j] = doe_queue(mb, PCI_DOE_READ, 0, READ);
+				status = doe_queue(mb, PCI_DOE_STATUS, 0, READ);
+				doe_queue(mb, PCI_DOE_READ, 0x0, WRITE);
+			} else
+				val[j] = doe_queue_pop(mb);
+		}
+		doe_submit(mb);
+
+		for (j = 0; j < todo; j++)
+			if (i + j < cap)
+				rsp[i + j] = val[j]->val;
+	}
+
+	if (status && !FIELD_GET(PCI_DOE_STATUS_DATA_OBJECT_READY, status->val))
+		printf("Data Object Ready Clear - Error\n");
+
+	doe_account(mb, doe_now_us() - t0);
+	return length;
+
+timeout:
+	printf("DOE timed out, status %08x\n", st);
+	mb->stats.n_timeout++;
+	return ret;
+}
+
+/**
+ * doe_discover() - Run discovery, index after index, on a mailbox
+ * @mb: the DOE mailbox
+ * @prot: the protocols found
+ * @max: room in @prot
+ *
+ * Return: number of protocols found, at most @max, or -errno: -EIO when
+ * the Next Index of a response does not go up
+ */
+int doe_discover(struct doe_mb *mb, struct doe_protocol *prot, int max)
+{
+	/*
+	 *  #### DW0 - Header1 ####
+	 *  [31:24]	Resv			don't care
+	 *  [23:16]	Data Object Type	0x0
+	 *  [15:0]	Vendor ID		0x0001
+	 *
+	 *  #### DW1 - Header2 ####
+	 *  [31:18]	Resv			-//-
+	 *  [17:0]	Length			0x3
+	 *
+	 *  #### DW2 Request (Data Object DWORD 0) ####
+	 *  [31:0]	Index			0, 1, then 2, etc.
+	 *					until DW Response[31:24]
+	 *					returns 0 indicating it's final entry.
+	 *
+	 *  ...or...
+	 *
+	 *  #### DW2 Response (-//-). Note, response is also followed by two headers ####
+	 *  [31:24]	Next Indext		?
+	 *  [23:16]	Data Object Type	?
+	 *  [15:0]	Vendor ID		?
+	 */
+	u32 index = 0, next, rsp;
+	int n = 0, ret;
+
+	do {
+		ret = doe_exchange(mb, PCI_VENDOR_ID_PCI_SIG,
+				   PCI_DOE_PROTOCOL_DISCOVERY, &index, 1, &rsp, 1);
+		if (ret < 0)
+			return ret;
+		if (ret < 1)
+			return -EIO;
+
+		if (n < max) {
+			prot[n].vid = FIELD_GET(PCI_DOE_DATA_OBJECT_DISC_RSP_3_VID, rsp);
+			prot[n].type = FIELD_GET(PCI_DOE_DATA_OBJECT_DISC_RSP_3_PROTOCOL, rsp);
+			prot[n].mb = mb;
+			n++;
+		} else if (n == max) {
+			printf("DOE discovery: more than %d protocols, the rest dropped\n",
+			       max);
+			n++;
+		}
+
+		next = FIELD_GET(PCI_DOE_DATA_OBJECT_DISC_RSP_3_NEXT_INDEX, rsp);
+		/* Index is 8 bits: one that does not go up would never end */
+		if (next && next <= index) {
+			printf("DOE discovery: index %u followed by %u\n",
+			       index, next);
+			return -EIO;
+		}
+		index = next;
+	} while (index);
+
+	return min(n, max);
+}
+
+struct doe_worker {
+	pthread_t thread;
+	struct doe_job *jobs;
+	int n;
+	struct doe_mb *mb;
+};
+
+/* Every job of a mailbox, in the order queued */
+static void *doe_worker_fn(void *arg)
+{
+	struct doe_worker *w = arg;
+	int i;
+
+	for (i = 0; i < w->n; i++)
+		if (w->jobs[i].mb == w->mb)
+			w->jobs[i].ret = w->jobs[i].fn(w->mb, w->jobs[i].arg);
+
+	return NULL;
+}
+
+/**
+ * doe_run() - Run jobs, the ones on different mailboxes concurrently
+ * @jobs: the jobs, their ret filled in when done
+ * @n: number of @jobs
+ *
+ * Return: 0, or the first job's error
+ */
+int doe_run(struct doe_job *jobs, int n)
+{
+	struct doe_worker w[n];
+	int i, j, n_w = 0;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n_w; j++)
+			if (w[j].mb == jobs[i].mb)
+				break;
+		if (j < n_w)
+			continue;
+
+		w[n_w].jobs = jobs;
+		w[n_w].n = n;
+		w[n_w].mb = jobs[i].mb;
+		n_w++;
+	}
+
+	/* The first mailbox runs on this thread, or all if out of threads */
+	for (j = 1; j < n_w; j++)
+		if (pthread_create(&w[j].thread, NULL, doe_worker_fn, &w[j]))
+			w[j].thread = pthread_self();
+	if (n_w)
+		doe_worker_fn(&w[0]);
+	for (j = 1; j < n_w; j++) {
+		if (pthread_equal(w[j].thread, pthread_self()))
+			doe_worker_fn(&w[j]);
+		else
+			pthread_join(w[j].thread, NULL);
+	}
+
+	for (i = 0; i < n; i++)
+		if (jobs[i].ret < 0)
+			return jobs[i].ret;
+
+	return 0;
+}
+
+/**
+ * doe_dev_init() - Find every DOE instance of a device
+ * @dd: filled in
+ * @t: transport to the device. Without TRANSPORT_CFG_ABS only the
+ *     driver's DOE instance is there, at offset 0.
+ * @irq: complete the exchanges on the DOE interrupt where possible
+ *
+ * The protocols they serve are left to doe_dev_discover() or
+ * doe_dev_load().
+ *
+ * Return: 0, or -ENODEV when there is no DOE instance
+ */
+int doe_dev_init(struct doe_dev *dd, struct transport *t, bool irq)
+{
+	u16 cap = 0;
+	int i;
+
+	dd->t = t;
+	dd->n_mb = 0;
+	dd->n_prot = 0;
+
+	if (!(t->caps & TRANSPORT_CFG_ABS)) {
+		doe_mb_init(&dd->mb[dd->n_mb++], t, 0);
+	} else {
+		while (dd->n_mb < DOE_MAX_MB &&
+		       (cap = pci_find_next_ext_cap(t, cap, PCI_EXT_CAP_ID_DOE)))
+			doe_mb_init(&dd->mb[dd->n_mb++], t, cap);
+	}
+
+	if (!dd->n_mb)
+		return -ENODEV;
+
+	if (irq)
+		for (i = 0; i < dd->n_mb; i++)
+			doe_mb_irq_enable(&dd->mb[i]);
+
+	return 0;
+}
+
+static int doe_discover_job(struct doe_mb *mb, void *arg)
+{
+	return doe_discover(mb, arg, DOE_MAX_PROTOCOLS);
+}
+
+/**
+ * doe_dev_discover() - Map the protocols to the mailboxes serving them
+ * @dd: the device, after doe_dev_init()
+ *
+ * Discovery runs on all the mailboxes at once.
+ *
+ * Return: number of protocols found, or -errno when none is
+ */
+int doe_dev_discover(struct doe_dev *dd)
+{
+	struct doe_protocol found[DOE_MAX_MB][DOE_MAX_PROTOCOLS];
+	struct doe_job jobs[DOE_MAX_MB];
+	int i, j, ret = -ENODEV;
+
+	for (i = 0; i < dd->n_mb; i++) {
+		jobs[i].mb = &dd->mb[i];
+		jobs[i].fn = doe_discover_job;
+		jobs[i].arg = found[i];
+	}
+
+	doe_run(jobs, dd->n_mb);
+
+	dd->n_prot = 0;
+	for (i = 0; i < dd->n_mb; i++) {
+		if (jobs[i].ret < 0) {
+			printf("DOE @%03x discovery failed %d\n", dd->mb[i].cap,
+			       jobs[i].ret);
+			ret = jobs[i].ret;
+			continue;
+		}
+		for (j = 0; j < jobs[i].ret && dd->n_prot < DOE_MAX_PROTOCOLS; j++)
+			dd->prot[dd->n_prot++] = found[i][j];
+	}
+
+	return dd->n_prot ? dd->n_prot : ret;
+}
+
+/*
+ * The protocol table is saved as a line per protocol:
+ *	<DOE capability offset> <vid> <type>
+ * to a file of its own first, then renamed over @path, so that devices
+ * saving theirs at the same time never mix them up.
+ */
+int doe_dev_save(struct doe_dev *dd, const char *path)
+{
+	char tmp[PATH_MAX + 32];
+	FILE *f;
+	int i, ret;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d.%lx", path, getpid(),
+		 (unsigned long)pthread_self());
+	f = fopen(tmp, "w");
+	if (!f)
+		return -errno;
+
+	fprintf(f, "# cap vid type\n");
+	for (i = 0; i < dd->n_prot; i++)
+		fprintf(f, "%03x %04x %02x\n", dd->prot[i].mb->cap,
+			dd->prot[i].vid, dd->prot[i].type);
+
+	ret = fclose(f) ? -errno : 0;
+	if (!ret && rename(tmp, path))
+		ret = -errno;
+	if (ret)
+		unlink(tmp);
+
+	return ret;
+}
+
+/**
+ * doe_dev_load() - Read back a protocol table doe_dev_save() wrote
+ * @dd: the device, after doe_dev_init()
+ * @path: the file
+ *
+ * The table is only taken when every mailbox it names is still there.
+ *
+ * Return: number of protocols loaded, or -errno
+ */
+int doe_dev_load(struct doe_dev *dd, const char *path)
+{
+	FILE *f = fopen(path, "r");
+	unsigned int cap, vid, type;
+	char line[64];
+	int i, n = 0;
+
+	if (!f)
+		return -errno;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%x %x %x", &cap, &vid, &type) != 3 ||
+		    n == DOE_MAX_PROTOCOLS)
+			goto stale;
+
+		for (i = 0; i < dd->n_mb; i++)
+			if (dd->mb[i].cap == cap)
+				break;
+		if (i == dd->n_mb)
+			goto stale;
+
+		dd->prot[n].vid = vid;
+		dd->prot[n].type = type;
+		dd->prot[n].mb = &dd->mb[i];
+		n++;
+	}
+
+	fclose(f);
+	if (!n)
+		return -ENOENT;
+
+	dd->n_prot = n;
+	return n;
+
+stale:
+	fclose(f);
+	return -ESTALE;
+}
+
+void doe_dev_exit(struct doe_dev *dd)
+{
+	int i;
+
+	for (i = 0; i < dd->n_mb; i++)
+		doe_mb_exit(&dd->mb[i]);
+	dd->n_mb = 0;
+	dd->n_prot = 0;
+}
+
+/* The first mailbox found serving the protocol, NULL when none does */
+struct doe_mb *doe_dev_find(struct doe_dev *dd, u16 vid, u8 type)
+{
+	int i;
+
+	for (i = 0; i < dd->n_prot; i++)
+		if (dd->prot[i].vid == vid && dd->prot[i].type == type)
+			return dd->prot[i].mb;
+
+	return NULL;
+}
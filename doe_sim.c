@@ -0,0 +1,1080 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/timerfd.h>
+
+#include "include/linux/pci_regs.h"
+
+#include <doe.h>
+#include <doe_sim.h>
+#include <cdat.h>
+#include <cxlmem.h>
+#include <regs.h>
+#include <bitfield.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+/**
+ * DOC: doe sim
+ *
+ * A CXL device simulated in-process, so the DOE engine runs without
+ * the device or the patched kernel. Its extended config space holds a
+ * Device Serial Number, two DOE instances, the first serving CDAT
+ * table access and the second compliance, both serving discovery, and a
+ * Register Locator naming the memory device registers in BAR2. They
+ * answer the way a CXL 2.0 Type-3 device would, completing every
+ * request a DOE_SIM_LAT_DOE latency after GO. The completion raises the
+ * Interrupt Status and expires a timerfd, which plays the DOE interrupt
+ * for the interrupt-driven completion mode.
+ *
+ * The mailbox in the registers answers too once doe_sim_mbox_start()
+ * runs a thread for it, the device side of cxl_regs_mbox_send(): it
+ * spins on the doorbell, as a device would on its register, and answers
+ * every command of cxl_mem_commands[], SCAN_MEDIA in the background,
+ * each a DOE_SIM_LAT_MBOX latency after the doorbell. Anything else is
+ * unsupported. The registers it watches may be a file another process
+ * maps, so one process plays the device for another.
+ *
+ * Each latency is drawn from a struct doe_sim_dist, fixed by default,
+ * by a generator of its own per DOE instance and for the mailbox, all
+ * seeded by doe_sim_seed(): the same seed draws the same latencies in
+ * the same order, whatever the threads. After doe_sim_virtual() the
+ * latencies are not waited for but added to a virtual clock, each DOE
+ * instance and the mailbox keeping one: a response is ready as soon as
+ * its Status is read, the clock then moved to when it would have been,
+ * and the mailbox answers in the thread ringing the doorbell. The
+ * device then costs no system call and no wait, what the tool spends is
+ * its own, and a slow device is reproduced exactly by its model.
+ *
+ * doe_sim_init_switch() simulates instead the upstream port of a switch
+ * in front of it, whose CDAT has SSLBIS, for the end-to-end path.
+ */
+
+#define DOE_SIM_PCIE		0x40
+#define DOE_SIM_DSN		0x100
+#define DOE_SIM_DOE0		0x150
+#define DOE_SIM_DOE1		0x180
+#define DOE_SIM_REGLOC		0x1c0
+
+/* Where the capabilities are in the memory device register block */
+#define DOE_SIM_REGS_STATUS	0x100
+#define DOE_SIM_REGS_MEMDEV	0x180
+#define DOE_SIM_REGS_MBOX	0x1000
+
+/* What the discovery protocol may report, in index order */
+static const struct {
+	u16 vid;
+	u8 type;
+} doe_sim_protocols[] = {
+	{ PCI_VENDOR_ID_PCI_SIG, PCI_DOE_PROTOCOL_DISCOVERY },
+	{ PCI_DVSEC_VENDOR_ID_CXL, CXL_DOE_PROTOCOL_TABLE_ACCESS },
+	{ PCI_DVSEC_VENDOR_ID_CXL, CXL_DOE_PROTOCOL_COMPLIANCE },
+};
+
+static u64 doe_sim_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* splitmix64, one state per latency stream */
+static u64 doe_sim_rand(u64 *state)
+{
+	u64 z = (*state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/* ln(@x) for 0 < @x <= 1 without libm: @x = m 2^e, and atanh of m */
+static double doe_sim_ln(double x)
+{
+	double z, z2, term, sum = 0;
+	int e = 0, k;
+
+	while (x < 1) {
+		x *= 2;
+		e--;
+	}
+
+	z = (x - 1) / (x + 1);
+	z2 = z * z;
+	for (k = 1, term = z; k < 24; k += 2, term *= z2)
+		sum += term / k;
+	return 2 * sum + e * 0.69314718055994531;
+}
+
+/* A latency of @dev for @lat, drawn by @state */
+static u64 doe_sim_latency(struct doe_sim_dev *dev, enum doe_sim_lat lat,
+			   u64 *state)
+{
+	const struct doe_sim_dist *d = &dev->lat[lat];
+	u64 r = doe_sim_rand(state), us = d->a;
+
+	switch (d->type) {
+	case DOE_SIM_DIST_FIXED:
+		break;
+	case DOE_SIM_DIST_UNIFORM:
+		if (d->b > d->a)
+			us += r % (d->b - d->a + 1ULL);
+		break;
+	case DOE_SIM_DIST_EXP:
+		/* By inversion, u in (0, 1] */
+		us += -doe_sim_ln(((r >> 11) + 1) * 0x1p-53) * d->b + 0.5;
+		break;
+	case DOE_SIM_DIST_SPIKE:
+		if (r % 1000 < d->permille)
+			us = d->b;
+		break;
+	}
+
+	__atomic_add_fetch(&dev->model_us[lat], us, __ATOMIC_RELAXED);
+	return us;
+}
+
+/* The time of a DOE instance or of the mailbox, whose @clock it is */
+static u64 doe_sim_now(struct doe_sim_dev *dev, u64 *clock)
+{
+	return dev->virt ? *clock : doe_sim_now_us();
+}
+
+static void put_le(u8 *p, u64 val, int bytes)
+{
+	while (bytes--) {
+		*p++ = val & 0xff;
+		val >>= 8;
+	}
+}
+
+/* Start a new CDAT structure of @len bytes and return it */
+static u8 *doe_sim_cdat_add(struct doe_sim_dev *sim, u8 type, u16 len)
+{
+	u8 *p = &sim->cdat[sim->cdat_len];
+
+	sim->cdat_off[sim->n_cdat++] = sim->cdat_len;
+	sim->cdat_len += len;
+	p[0] = type;
+	put_le(&p[2], len, 2);
+	return p;
+}
+
+static void doe_sim_dslbis(struct doe_sim_dev *sim, u8 data_type, u16 entry)
+{
+	u8 *p = doe_sim_cdat_add(sim, 1, 24);
+
+	p[4] = 0;				/* DSMAS handle */
+	p[6] = data_type;
+	put_le(&p[8], 1000, 8);			/* entry base unit */
+	put_le(&p[16], entry, 2);
+}
+
+static void doe_sim_cdat_begin(struct doe_sim_dev *sim)
+{
+	/* Header, the length and checksum filled in when done */
+	sim->cdat_off[sim->n_cdat++] = 0;
+	sim->cdat_len = 16;
+	sim->cdat[4] = 1;			/* revision */
+	put_le(&sim->cdat[12], 1, 4);		/* sequence */
+}
+
+static void doe_sim_cdat_end(struct doe_sim_dev *sim)
+{
+	u8 sum = 0;
+	unsigned int i;
+
+	put_le(&sim->cdat[0], sim->cdat_len, 4);
+	for (i = 0; i < sim->cdat_len; i++)
+		sum += sim->cdat[i];
+	sim->cdat[5] = -sum;
+}
+
+/*
+ * 256 MiB of volatile memory, read/write latency 150/180 ns and
+ * read/write bandwidth 16/14 GB/s
+ */
+static void doe_sim_build_cdat(struct doe_sim_dev *sim)
+{
+	const u64 size = 256ULL << 20;
+	u8 *p;
+
+	doe_sim_cdat_begin(sim);
+
+	p = doe_sim_cdat_add(sim, 0, 24);	/* DSMAS */
+	p[4] = 0;				/* DSMAD handle */
+	put_le(&p[8], 0, 8);			/* DPA base */
+	put_le(&p[16], size, 8);		/* DPA length */
+
+	doe_sim_dslbis(sim, 1, 150);		/* read latency, ns */
+	doe_sim_dslbis(sim, 2, 180);		/* write latency, ns */
+	doe_sim_dslbis(sim, 4, 16);		/* read bandwidth, GB/s */
+	doe_sim_dslbis(sim, 5, 14);		/* write bandwidth, GB/s */
+
+	p = doe_sim_cdat_add(sim, 4, 24);	/* DSEMTS */
+	p[4] = 0;				/* DSMAS handle */
+	p[5] = 0;				/* EfiConventionalMemory */
+	put_le(&p[16], size, 8);
+
+	doe_sim_cdat_end(sim);
+}
+
+/* From the upstream port to downstream port @port, and back */
+static void doe_sim_sslbis(struct doe_sim_dev *sim, u8 data_type, u16 port,
+			   u16 entry)
+{
+	u8 *p = doe_sim_cdat_add(sim, 5, 16 + 8);
+
+	p[4] = data_type;
+	put_le(&p[8], 1000, 8);			/* entry base unit */
+	put_le(&p[16], CDAT_SSLBIS_USP_PORT, 2);
+	put_le(&p[18], port, 2);
+	put_le(&p[20], entry, 2);
+}
+
+/*
+ * A switch with downstream ports 1 and 2, latency 50 ns through either
+ * and a bandwidth of 12 GB/s to port 1, less than the device behind it
+ * has, and 32 GB/s to port 2
+ */
+static void doe_sim_build_switch_cdat(struct doe_sim_dev *sim)
+{
+	doe_sim_cdat_begin(sim);
+
+	doe_sim_sslbis(sim, 0, CDAT_SSLBIS_ANY_PORT, 50);	/* ns */
+	doe_sim_sslbis(sim, 3, 1, 12);				/* GB/s */
+	doe_sim_sslbis(sim, 3, 2, 32);				/* GB/s */
+
+	doe_sim_cdat_end(sim);
+}
+
+static void doe_sim_ext_cap(struct doe_sim_dev *dev, u16 off, u16 id,
+			    u16 next)
+{
+	dev->cfg[off / 4] = id | 1 << 16 | (u32)next << 20;
+}
+
+static void doe_sim_cap_hdr(struct doe_sim_dev *dev, int i, u16 id, u32 off,
+			    u32 len)
+{
+	u8 *hdr = dev->regs + i * CXLDEV_CAP_HDR_SIZE;
+
+	put_le(hdr, id | 1 << 16, 4);
+	put_le(hdr + CXLDEV_CAP_HDR_OFFSET, off, 4);
+	put_le(hdr + CXLDEV_CAP_HDR_LENGTH, len, 4);
+}
+
+/*
+ * A Register Locator with one block, the memory device registers at the
+ * start of BAR2, a 64-bit memory BAR. The block has a Device Status, a
+ * Primary Mailbox and a Memory Device Status capability, the device
+ * ready and its mailbox idle.
+ */
+static void doe_sim_build_regs(struct doe_sim_dev *dev)
+{
+	u16 pos = DOE_SIM_REGLOC;
+
+	dev->cfg[PCI_BASE_ADDRESS_0 / 4 + DOE_SIM_REGS_BAR] =
+		0xfe800000 | PCI_BASE_ADDRESS_MEM_TYPE_64;
+	doe_sim_ext_cap(dev, pos, PCI_EXT_CAP_ID_DVSEC, 0);
+	dev->cfg[(pos + PCI_DVSEC_HEADER1) / 4] = PCI_DVSEC_VENDOR_ID_CXL |
+		(CXL_DVSEC_REG_LOCATOR_BLOCK1_OFFSET + 8) << 20;
+	dev->cfg[(pos + PCI_DVSEC_HEADER2) / 4] = CXL_DVSEC_REG_LOCATOR;
+	dev->cfg[(pos + CXL_DVSEC_REG_LOCATOR_BLOCK1_OFFSET) / 4] =
+		DOE_SIM_REGS_BAR | CXL_REGLOC_RBI_MEMDEV << 8;
+
+	put_le(dev->regs, CXLDEV_CAP_ARRAY_CAP_ID | 1 << 16 | 3ULL << 32, 8);
+	doe_sim_cap_hdr(dev, 1, CXLDEV_CAP_CAP_ID_DEVICE_STATUS,
+			DOE_SIM_REGS_STATUS, 0x10);
+	doe_sim_cap_hdr(dev, 2, CXLDEV_CAP_CAP_ID_PRIMARY_MAILBOX,
+			DOE_SIM_REGS_MBOX, CXLDEV_MBOX_PAYLOAD_OFFSET +
+			(1 << DOE_SIM_PAYLOAD_ORDER));
+	doe_sim_cap_hdr(dev, 3, CXLDEV_CAP_CAP_ID_MEMDEV,
+			DOE_SIM_REGS_MEMDEV, 0x8);
+
+	put_le(dev->regs + DOE_SIM_REGS_MBOX + CXLDEV_MBOX_CAPS_OFFSET,
+	       DOE_SIM_PAYLOAD_ORDER, 4);
+	put_le(dev->regs + DOE_SIM_REGS_MEMDEV + CXLMDEV_STATUS_OFFSET,
+	       CXLMDEV_MS_READY << 2 | CXLMDEV_MBOX_IF_READY, 4);
+}
+
+static int doe_sim_add_mb(struct doe_sim_dev *dev, u16 cap, u32 protocols)
+{
+	struct doe_sim *sim = &dev->doe[dev->n_doe++];
+
+	sim->dev = dev;
+	sim->cap = cap;
+	sim->protocols = protocols;
+	sim->irq_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (sim->irq_fd < 0) {
+		perror("timerfd_create");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Every latency fixed, a background command taking four of them */
+static void doe_sim_lat_init(struct doe_sim_dev *dev, u32 latency_us)
+{
+	dev->lat[DOE_SIM_LAT_DOE].a = latency_us;
+	dev->lat[DOE_SIM_LAT_MBOX].a = latency_us;
+	dev->lat[DOE_SIM_LAT_BG].a = 4 * latency_us;
+}
+
+int doe_sim_init(struct doe_sim_dev *dev, u32 latency_us)
+{
+	memset(dev, 0, sizeof(*dev));
+	doe_sim_lat_init(dev, latency_us);
+
+	/* Class code of a CXL Memory Device */
+	dev->cfg[PCI_CLASS_REVISION / 4] = 0x05021000;
+	doe_sim_ext_cap(dev, DOE_SIM_DSN, PCI_EXT_CAP_ID_DSN, DOE_SIM_DOE0);
+	dev->cfg[DOE_SIM_DSN / 4 + 1] = 0x89abcdef;
+	dev->cfg[DOE_SIM_DSN / 4 + 2] = 0x01234567;
+	doe_sim_ext_cap(dev, DOE_SIM_DOE0, PCI_EXT_CAP_ID_DOE, DOE_SIM_DOE1);
+	doe_sim_ext_cap(dev, DOE_SIM_DOE1, PCI_EXT_CAP_ID_DOE, DOE_SIM_REGLOC);
+	doe_sim_build_regs(dev);
+
+	if (doe_sim_add_mb(dev, DOE_SIM_DOE0, BIT(0) | BIT(1)) ||
+	    doe_sim_add_mb(dev, DOE_SIM_DOE1, BIT(0) | BIT(2))) {
+		doe_sim_exit(dev);
+		return -1;
+	}
+
+	doe_sim_build_cdat(dev);
+	doe_sim_seed(dev, 1);
+	return 0;
+}
+
+/*
+ * The upstream port of a switch the device sits behind: a PCI Express
+ * capability to tell its port type, a DSN of its own and one DOE
+ * instance serving discovery and CDAT table access.
+ */
+int doe_sim_init_switch(struct doe_sim_dev *dev, u32 latency_us)
+{
+	memset(dev, 0, sizeof(*dev));
+	doe_sim_lat_init(dev, latency_us);
+
+	/* Class code of a PCI-to-PCI bridge, type 1 header */
+	dev->cfg[PCI_CLASS_REVISION / 4] = 0x06040000;
+	dev->cfg[PCI_HEADER_TYPE / 4] = PCI_HEADER_TYPE_BRIDGE << 16;
+	dev->cfg[PCI_COMMAND / 4] = PCI_STATUS_CAP_LIST << 16;
+	dev->cfg[PCI_CAPABILITY_LIST / 4] = DOE_SIM_PCIE;
+	dev->cfg[DOE_SIM_PCIE / 4] = PCI_CAP_ID_EXP |
+		(PCI_EXP_TYPE_UPSTREAM << 4 | 2) << 16;
+	doe_sim_ext_cap(dev, DOE_SIM_DSN, PCI_EXT_CAP_ID_DSN, DOE_SIM_DOE0);
+	dev->cfg[DOE_SIM_DSN / 4 + 1] = 0x89abcdef;
+	dev->cfg[DOE_SIM_DSN / 4 + 2] = 0x0123456a;
+	doe_sim_ext_cap(dev, DOE_SIM_DOE0, PCI_EXT_CAP_ID_DOE, 0);
+
+	if (doe_sim_add_mb(dev, DOE_SIM_DOE0, BIT(0) | BIT(1))) {
+		doe_sim_exit(dev);
+		return -1;
+	}
+
+	doe_sim_build_switch_cdat(dev);
+	doe_sim_seed(dev, 1);
+	return 0;
+}
+
+void doe_sim_exit(struct doe_sim_dev *dev)
+{
+	int i;
+
+	doe_sim_mbox_stop(dev);
+	for (i = 0; i < dev->n_doe; i++)
+		close(dev->doe[i].irq_fd);
+	dev->n_doe = 0;
+}
+
+static struct doe_sim *doe_sim_find(struct doe_sim_dev *dev, u32 off)
+{
+	int i;
+
+	for (i = 0; i < dev->n_doe; i++)
+		if (off >= dev->doe[i].cap &&
+		    off < dev->doe[i].cap + PCI_DOE_CAP_SIZEOF)
+			return &dev->doe[i];
+
+	return NULL;
+}
+
+/* None on a virtual clock, the timerfd would expire in real time */
+int doe_sim_irq_fd(struct doe_sim_dev *dev, u16 cap)
+{
+	struct doe_sim *sim = doe_sim_find(dev, cap);
+
+	return sim && !dev->virt ? sim->irq_fd : -1;
+}
+
+static void doe_sim_rsp(struct doe_sim *sim, u32 dw)
+{
+	if (sim->n_rsp < DOE_SIM_MAX_DW)
+		sim->rsp[sim->n_rsp++] = dw;
+}
+
+static bool doe_sim_serves(struct doe_sim *sim, u16 vid, u8 type)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(doe_sim_protocols); i++)
+		if (doe_sim_protocols[i].vid == vid &&
+		    doe_sim_protocols[i].type == type)
+			return sim->protocols & BIT(i);
+
+	return false;
+}
+
+static int doe_sim_discovery(struct doe_sim *sim)
+{
+	u32 index = FIELD_GET(PCI_DOE_DATA_OBJECT_DISC_REQ_3_INDEX, sim->req[2]);
+	unsigned int i, n = 0, next = 0, found = ARRAY_SIZE(doe_sim_protocols);
+
+	/* Index counts the protocols this mailbox serves */
+	for (i = 0; i < ARRAY_SIZE(doe_sim_protocols); i++) {
+		if (!(sim->protocols & BIT(i)))
+			continue;
+		if (n == index)
+			found = i;
+		else if (n == index + 1)
+			next = n;
+		n++;
+	}
+
+	if (found == ARRAY_SIZE(doe_sim_protocols))
+		return -1;
+
+	doe_sim_rsp(sim, doe_sim_protocols[found].vid |
+			 doe_sim_protocols[found].type << 16 | next << 24);
+	return 0;
+}
+
+static int doe_sim_table_access(struct doe_sim *mb)
+{
+	struct doe_sim_dev *sim = mb->dev;
+	u32 handle = FIELD_GET(CXL_DOE_TABLE_ACCESS_ENTRY_HANDLE, mb->req[2]);
+	u32 next = handle + 1, off, len, i;
+
+	if (FIELD_GET(CXL_DOE_TABLE_ACCESS_REQ_CODE, mb->req[2]) !=
+	    CXL_DOE_TABLE_ACCESS_REQ_CODE_READ || handle >= sim->n_cdat)
+		return -1;
+	if (next == sim->n_cdat)
+		next = CXL_DOE_TABLE_ACCESS_LAST_ENTRY;
+
+	off = sim->cdat_off[handle];
+	len = handle + 1 < sim->n_cdat ? sim->cdat_off[handle + 1] - off :
+					 sim->cdat_len - off;
+
+	doe_sim_rsp(mb, next << 16);
+	for (i = 0; i < len; i += 4)
+		doe_sim_rsp(mb, sim->cdat[off + i] |
+				 sim->cdat[off + i + 1] << 8 |
+				 sim->cdat[off + i + 2] << 16 |
+				 (u32)sim->cdat[off + i + 3] << 24);
+	return 0;
+}
+
+/*
+ * Response header: request code, version 1, length in bytes, then a
+ * status of 0. Query Capabilities (0) also gets the bitmap of the
+ * available and of the enabled requests, all 16 of them.
+ */
+static int doe_sim_compliance(struct doe_sim *sim)
+{
+	u32 code = sim->req[2] & 0xff;
+	u32 len = code ? 8 : 24;
+
+	if (code > 0xf)
+		return -1;
+
+	doe_sim_rsp(sim, code | 1 << 8 | len << 16);
+	doe_sim_rsp(sim, 0);
+	if (!code) {
+		doe_sim_rsp(sim, 0xffff);
+		doe_sim_rsp(sim, 0);
+		doe_sim_rsp(sim, 0xffff);
+		doe_sim_rsp(sim, 0);
+	}
+	return 0;
+}
+
+static void doe_sim_go(struct doe_sim *sim)
+{
+	struct itimerspec its = { 0 };
+	u64 latency_us;
+	u16 vid = FIELD_GET(PCI_DOE_DATA_OBJECT_HEADER_1_VID, sim->req[0]);
+	u8 type = FIELD_GET(PCI_DOE_DATA_OBJECT_HEADER_1_TYPE, sim->req[0]);
+	u32 length = FIELD_GET(PCI_DOE_DATA_OBJECT_HEADER_2_LENGTH, sim->req[1]);
+	int ret = -1;
+
+	sim->n_rsp = 0;
+	sim->rsp_pos = 0;
+	doe_sim_rsp(sim, sim->req[0]);
+	doe_sim_rsp(sim, 0);
+
+	if (sim->n_req < 3 || length != sim->n_req || !doe_sim_serves(sim, vid, type))
+		ret = -1;
+	else if (vid == PCI_VENDOR_ID_PCI_SIG && type == PCI_DOE_PROTOCOL_DISCOVERY)
+		ret = doe_sim_discovery(sim);
+	else if (vid == PCI_DVSEC_VENDOR_ID_CXL &&
+		 type == CXL_DOE_PROTOCOL_TABLE_ACCESS)
+		ret = doe_sim_table_access(sim);
+	else if (vid == PCI_DVSEC_VENDOR_ID_CXL &&
+		 type == CXL_DOE_PROTOCOL_COMPLIANCE)
+		ret = doe_sim_compliance(sim);
+
+	sim->n_req = 0;
+	if (ret) {
+		sim->n_rsp = 0;
+		sim->status = PCI_DOE_STATUS_ERROR;
+		return;
+	}
+
+	sim->rsp[1] = sim->n_rsp;
+	sim->status = PCI_DOE_STATUS_BUSY;
+	latency_us = doe_sim_latency(sim->dev, DOE_SIM_LAT_DOE, &sim->rng);
+	sim->ready_at_us = doe_sim_now(sim->dev, &sim->clock_us) + latency_us;
+	if (sim->dev->virt)
+		return;
+
+	/* A zero it_value disarms, so the timer needs at least 1 ns */
+	its.it_value.tv_sec = latency_us / 1000000;
+	its.it_value.tv_nsec = (latency_us % 1000000) * 1000L + 1;
+	timerfd_settime(sim->irq_fd, 0, &its, NULL);
+}
+
+/* On a virtual clock, reading the Status waits for the response */
+static u32 doe_sim_status(struct doe_sim *sim)
+{
+	if (sim->dev->virt && sim->clock_us < sim->ready_at_us &&
+	    FIELD_GET(PCI_DOE_STATUS_BUSY, sim->status))
+		sim->clock_us = sim->ready_at_us;
+
+	if (FIELD_GET(PCI_DOE_STATUS_BUSY, sim->status) &&
+	    doe_sim_now(sim->dev, &sim->clock_us) >= sim->ready_at_us) {
+		sim->status = PCI_DOE_STATUS_DATA_OBJECT_READY;
+		if (FIELD_GET(PCI_DOE_CTRL_INT_EN, sim->ctrl))
+			sim->status |= PCI_DOE_STATUS_INT_STATUS;
+	}
+
+	return sim->status;
+}
+
+void doe_sim_config(struct doe_sim_dev *dev, struct cxl_pdev_config *op)
+{
+	struct doe_sim *sim = doe_sim_find(dev, op->offset);
+
+	op->retval = 0;
+	if (op->offset >= sizeof(dev->cfg) || op->offset % 4) {
+		op->retval = -1;
+		return;
+	}
+
+	if (!sim || op->offset == sim->cap) {
+		if (!op->is_write)
+			op->val = dev->cfg[op->offset / 4];
+		return;
+	}
+
+	switch (op->offset - sim->cap) {
+	case PCI_DOE_CAP:
+		if (!op->is_write)
+			op->val = PCI_DOE_CAP_INT_SUP;
+		break;
+	case PCI_DOE_CTRL:
+		if (!op->is_write) {
+			op->val = sim->ctrl & PCI_DOE_CTRL_INT_EN;
+			break;
+		}
+		sim->ctrl = op->val & PCI_DOE_CTRL_INT_EN;
+		if (FIELD_GET(PCI_DOE_CTRL_ABORT, op->val)) {
+			sim->n_req = 0;
+			sim->n_rsp = 0;
+			sim->status = 0;
+		} else if (FIELD_GET(PCI_DOE_CTRL_GO, op->val))
+			doe_sim_go(sim);
+		break;
+	case PCI_DOE_STATUS:
+		if (op->is_write)
+			sim->status &= ~(op->val & PCI_DOE_STATUS_INT_STATUS);
+		else
+			op->val = doe_sim_status(sim);
+		break;
+	case PCI_DOE_WRITE:
+		if (op->is_write && sim->n_req < DOE_SIM_MAX_DW)
+			sim->req[sim->n_req++] = op->val;
+		break;
+	case PCI_DOE_READ:
+		if (!FIELD_GET(PCI_DOE_STATUS_DATA_OBJECT_READY,
+			       doe_sim_status(sim))) {
+			if (!op->is_write)
+				op->val = 0;
+			break;
+		}
+		if (!op->is_write) {
+			op->val = sim->rsp[sim->rsp_pos];
+		} else if (++sim->rsp_pos == sim->n_rsp) {
+			sim->status &= ~PCI_DOE_STATUS_DATA_OBJECT_READY;
+			sim->n_rsp = 0;
+		}
+		break;
+	default:
+		if (!op->is_write)
+			op->val = 0;
+	}
+}
+
+/* CXL 2.0 8.2.9.5.1.1 Identify Memory Device output payload */
+static void doe_sim_identify(struct cxl_mbox_identify *id)
+{
+	*id = (struct cxl_mbox_identify) {
+		.total_capacity = 4,		/* 256MB units */
+		.volatile_capacity = 4,		/* volatile only */
+		.info_event_log_size = 16,
+		.warning_event_log_size = 16,
+		.failure_event_log_size = 16,
+		.fatal_event_log_size = 16,
+		.lsa_size = DOE_SIM_LSA_SIZE,
+		.poison_list_max_mer = { 0x00, 0x01 },	/* 256 */
+	};
+	snprintf(id->fw_revision, sizeof(id->fw_revision), "doe_sim 1.0");
+}
+
+/* CXL 2.0 8.2.9.5.3.1 Get Health Info output payload, a healthy device */
+static void doe_sim_health_info(struct cxl_mbox_health_info *hi)
+{
+	*hi = (struct cxl_mbox_health_info) {
+		.temperature = 35,		/* Celsius */
+	};
+}
+
+/* CXL 2.0 8.2.9.4.1.1 Command Effects Log UUID */
+static const u8 doe_sim_cel_uuid[16] = CXL_CEL_UUID;
+
+/* The CEL, one 4-byte entry per command the device answers; NULL @out sizes it */
+static size_t doe_sim_cel(u8 *out, u32 off, u32 len)
+{
+	const struct cxl_mem_command *c;
+	size_t n = 0;
+	u32 id, i = 0;
+
+	for (id = 0; id < CXL_MEM_COMMAND_ID_MAX && n < len; id++) {
+		c = cxl_mem_find_id(id);
+		if (!c || !c->opcode)
+			continue;
+		if (i >= off) {
+			if (out) {
+				put_le(&out[n], c->opcode, 2);
+				put_le(&out[n + 2], 0, 2);
+			}
+			n += 4;
+		}
+		i += 4;
+	}
+
+	return n;
+}
+
+static u16 doe_sim_inject_poison(struct doe_sim_dev *dev, u64 dpa)
+{
+	unsigned int i;
+
+	dpa &= ~0x3fULL;
+	for (i = 0; i < dev->n_poison; i++)
+		if (dev->poison[i] == dpa)
+			return CXL_MBOX_CMD_RC_SUCCESS;
+	if (dev->n_poison == DOE_SIM_POISON_MAX)
+		return CXL_MBOX_CMD_RC_INPUT;
+
+	dev->poison[dev->n_poison++] = dpa;
+	return CXL_MBOX_CMD_RC_SUCCESS;
+}
+
+static void doe_sim_clear_poison(struct doe_sim_dev *dev, u64 dpa)
+{
+	unsigned int i;
+
+	dpa &= ~0x3fULL;
+	for (i = 0; i < dev->n_poison; i++)
+		if (dev->poison[i] == dpa) {
+			dev->poison[i] = dev->poison[--dev->n_poison];
+			dev->poison_next = 0;
+			return;
+		}
+}
+
+/*
+ * The poisoned lines in the range, as many as a payload holds; More
+ * Records set when some are left, for the next GET_POISON to return
+ */
+static size_t doe_sim_get_poison(struct doe_sim_dev *dev, const u8 *in,
+				 u8 *out)
+{
+	const struct cxl_mbox_poison_in *pi = (const void *)in;
+	struct cxl_mbox_poison_out *po = (void *)out;
+	unsigned int max = ((1U << DOE_SIM_PAYLOAD_ORDER) - sizeof(*po)) /
+			   sizeof(po->record[0]);
+	u64 start = pi->offset & ~0x3fULL, end = start + pi->length * 64;
+	unsigned int i;
+
+	memset(po, 0, sizeof(*po));
+	for (i = dev->poison_next; i < dev->n_poison; i++) {
+		if (dev->poison[i] < start || dev->poison[i] >= end)
+			continue;
+		if (po->count == max) {
+			po->flags = CXL_POISON_FLAG_MORE;
+			break;
+		}
+		/* Source: injected */
+		po->record[po->count].address = dev->poison[i] | 3;
+		po->record[po->count].length = 1;
+		po->record[po->count].reserved = 0;
+		po->count++;
+	}
+	dev->poison_next = i < dev->n_poison ? i : 0;
+
+	return sizeof(*po) + po->count * sizeof(po->record[0]);
+}
+
+/*
+ * The command, from @in, answered in @out: what an unremarkable device
+ * would say, the LSA, the shutdown state and the poison list kept, the
+ * rest made up.
+ */
+static u16 doe_sim_mbox_exec(struct doe_sim_dev *dev, u16 opcode,
+			     const u8 *in, size_t n_in, u8 *out, size_t *n_out)
+{
+	const struct cxl_mem_command *c = cxl_mem_find_command(opcode);
+	const struct cxl_mbox_get_log *log;
+	struct cxl_mbox_get_supported_logs *gsl;
+	struct cxl_mbox_get_fw_info *fw;
+	u32 off, len;
+
+	*n_out = 0;
+	if (!opcode || !c)
+		return CXL_MBOX_CMD_RC_UNSUPPORTED;
+	if (c->info.size_in != ~0U && c->info.size_in != n_in)
+		return CXL_MBOX_CMD_RC_INPUT;
+	/* Fixed size outputs are zero but for what is filled in below */
+	if (c->info.size_out != ~0U) {
+		*n_out = c->info.size_out;
+		memset(out, 0, *n_out);
+	}
+
+	switch (opcode) {
+	case CXL_MBOX_OP_IDENTIFY:
+		doe_sim_identify((struct cxl_mbox_identify *)out);
+		break;
+	case CXL_MBOX_OP_GET_HEALTH_INFO:
+		doe_sim_health_info((struct cxl_mbox_health_info *)out);
+		break;
+	case CXL_MBOX_OP_GET_FW_INFO:
+		fw = (struct cxl_mbox_get_fw_info *)out;
+		fw->num_slots = 2;
+		fw->slot_info = 1;			/* active slot */
+		snprintf(fw->slot_1_revision, sizeof(fw->slot_1_revision),
+			 "doe_sim 1.0");
+		break;
+	case CXL_MBOX_OP_GET_PARTITION_INFO:
+		((struct cxl_mbox_get_partition_info *)out)->active_volatile_cap = 4;
+		break;
+	case CXL_MBOX_OP_GET_SUPPORTED_LOGS:
+		gsl = (struct cxl_mbox_get_supported_logs *)out;
+		memset(gsl, 0, sizeof(*gsl) + sizeof(gsl->entry[0]));
+		gsl->entries = 1;
+		memcpy(gsl->entry[0].uuid, doe_sim_cel_uuid, 16);
+		gsl->entry[0].size = doe_sim_cel(NULL, 0, ~0U);
+		*n_out = sizeof(*gsl) + sizeof(gsl->entry[0]);
+		break;
+	case CXL_MBOX_OP_GET_LOG:
+		log = (const struct cxl_mbox_get_log *)in;
+		if (memcmp(log->uuid, doe_sim_cel_uuid, 16))
+			return CXL_MBOX_CMD_RC_UNSUPPORTED;
+		if (log->length > 1U << DOE_SIM_PAYLOAD_ORDER)
+			return CXL_MBOX_CMD_RC_INPUT;
+		*n_out = doe_sim_cel(out, log->offset, log->length);
+		break;
+	case CXL_MBOX_OP_GET_LSA:
+		off = ((const struct cxl_mbox_get_lsa *)in)->offset;
+		len = ((const struct cxl_mbox_get_lsa *)in)->length;
+		if (off > DOE_SIM_LSA_SIZE || len > DOE_SIM_LSA_SIZE - off ||
+		    len > 1U << DOE_SIM_PAYLOAD_ORDER)
+			return CXL_MBOX_CMD_RC_INPUT;
+		memcpy(out, &dev->lsa[off], len);
+		*n_out = len;
+		break;
+	case CXL_MBOX_OP_SET_LSA:
+		if (n_in < sizeof(struct cxl_mbox_set_lsa))
+			return CXL_MBOX_CMD_RC_INPUT;
+		off = ((const struct cxl_mbox_set_lsa *)in)->offset;
+		len = n_in - sizeof(struct cxl_mbox_set_lsa);
+		if (off > DOE_SIM_LSA_SIZE || len > DOE_SIM_LSA_SIZE - off)
+			return CXL_MBOX_CMD_RC_INPUT;
+		memcpy(&dev->lsa[off], ((const struct cxl_mbox_set_lsa *)in)->data,
+		       len);
+		break;
+	case CXL_MBOX_OP_GET_SHUTDOWN_STATE:
+		((struct cxl_mbox_shutdown_state *)out)->state =
+			dev->shutdown_state;
+		break;
+	case CXL_MBOX_OP_SET_SHUTDOWN_STATE:
+		dev->shutdown_state =
+			((const struct cxl_mbox_shutdown_state *)in)->state;
+		break;
+	case CXL_MBOX_OP_GET_SCAN_MEDIA_CAPS:
+		((struct cxl_mbox_scan_media_caps *)out)->estimated_ms = 1;
+		break;
+	case CXL_MBOX_OP_GET_POISON:
+		*n_out = doe_sim_get_poison(dev, in, out);
+		break;
+	case CXL_MBOX_OP_INJECT_POISON:
+		return doe_sim_inject_poison(dev,
+			((const struct cxl_mbox_inject_poison *)in)->address);
+	case CXL_MBOX_OP_CLEAR_POISON:
+		doe_sim_clear_poison(dev,
+			((const struct cxl_mbox_clear_poison *)in)->address);
+		break;
+	case CXL_MBOX_OP_GET_SCAN_MEDIA:
+		memset(out, 0, sizeof(struct cxl_mbox_get_scan_media));
+		*n_out = sizeof(struct cxl_mbox_get_scan_media);
+		break;
+	case CXL_MBOX_OP_SCAN_MEDIA:
+		return CXL_MBOX_CMD_RC_BACKGROUND;
+	}
+
+	return CXL_MBOX_CMD_RC_SUCCESS;
+}
+
+/*
+ * Busy rather than asleep until then, usleep() is coarser than latency;
+ * on a virtual clock the mailbox's moves there instead
+ */
+static void doe_sim_mbox_until(struct doe_sim_dev *dev, u64 t_us)
+{
+	if (dev->virt) {
+		if (dev->mbox_clock_us < t_us)
+			dev->mbox_clock_us = t_us;
+		return;
+	}
+
+	while (doe_sim_now_us() < t_us)
+		;
+}
+
+/* Scan Media progressing in the Background Command Status register */
+static void doe_sim_mbox_bg(struct doe_sim_dev *dev, volatile u8 *mbox,
+			    u16 opcode)
+{
+	u64 t = doe_sim_now(dev, &dev->mbox_clock_us);
+	u64 us = doe_sim_latency(dev, DOE_SIM_LAT_BG, &dev->mbox_rng);
+	u64 pct;
+
+	for (pct = 0; pct <= 100; pct += 25) {
+		doe_sim_mbox_until(dev, t + us * pct / 100);
+		cxl_writeq(FIELD_PREP(CXLDEV_MBOX_BG_CMD_COMMAND_OPCODE_MASK,
+				      opcode) |
+			   FIELD_PREP(CXLDEV_MBOX_BG_CMD_PCT_MASK, pct),
+			   mbox + CXLDEV_MBOX_BG_CMD_STATUS_OFFSET);
+	}
+
+	__sync_synchronize();
+	cxl_writeq(FIELD_PREP(CXLDEV_MBOX_STATUS_RET_CODE_MASK,
+			      CXL_MBOX_CMD_RC_BACKGROUND),
+		   mbox + CXLDEV_MBOX_STATUS_OFFSET);
+}
+
+static void doe_sim_mbox_cmd(struct doe_sim_dev *dev, volatile u8 *mbox)
+{
+	u64 ready_at = doe_sim_now(dev, &dev->mbox_clock_us) +
+		       doe_sim_latency(dev, DOE_SIM_LAT_MBOX, &dev->mbox_rng);
+	u64 cmd = cxl_readq(mbox + CXLDEV_MBOX_CMD_OFFSET);
+	u16 opcode = FIELD_GET(CXLDEV_MBOX_CMD_COMMAND_OPCODE_MASK, cmd);
+	size_t n_in = FIELD_GET(CXLDEV_MBOX_CMD_PAYLOAD_LENGTH_MASK, cmd), n, i;
+	u8 in[1 << DOE_SIM_PAYLOAD_ORDER], out[1 << DOE_SIM_PAYLOAD_ORDER];
+	u64 status;
+	u16 rc;
+
+	if (n_in > sizeof(in))
+		n_in = sizeof(in);
+	for (i = 0; i < n_in; i++)
+		in[i] = mbox[CXLDEV_MBOX_PAYLOAD_OFFSET + i];
+	rc = doe_sim_mbox_exec(dev, opcode, in, n_in, out, &n);
+
+	for (i = 0; i < n; i++)
+		mbox[CXLDEV_MBOX_PAYLOAD_OFFSET + i] = out[i];
+	cmd &= ~CXLDEV_MBOX_CMD_PAYLOAD_LENGTH_MASK;
+	cmd |= FIELD_PREP(CXLDEV_MBOX_CMD_PAYLOAD_LENGTH_MASK, (u64)n);
+	cxl_writeq(cmd, mbox + CXLDEV_MBOX_CMD_OFFSET);
+	status = FIELD_PREP(CXLDEV_MBOX_STATUS_RET_CODE_MASK, (u64)rc);
+	if (rc == CXL_MBOX_CMD_RC_BACKGROUND)
+		status |= CXLDEV_MBOX_STATUS_BG_CMD;
+	cxl_writeq(status, mbox + CXLDEV_MBOX_STATUS_OFFSET);
+
+	doe_sim_mbox_until(dev, ready_at);
+	/* The answer before the doorbell clears */
+	__sync_synchronize();
+	cxl_writel(0, mbox + CXLDEV_MBOX_CTRL_OFFSET);
+	dev->n_mbox++;
+
+	if (rc == CXL_MBOX_CMD_RC_BACKGROUND)
+		doe_sim_mbox_bg(dev, mbox, opcode);
+}
+
+/* Spins while busy, yields the CPU once idle for a millisecond */
+static void *doe_sim_mbox_thread(void *arg)
+{
+	struct doe_sim_dev *dev = arg;
+	volatile u8 *mbox = dev->mbox_regs + DOE_SIM_REGS_MBOX;
+	u64 idle_since = doe_sim_now_us();
+
+	while (__atomic_load_n(&dev->mbox_run, __ATOMIC_ACQUIRE)) {
+		if (!(cxl_readl(mbox + CXLDEV_MBOX_CTRL_OFFSET) &
+		      CXLDEV_MBOX_CTRL_DOORBELL)) {
+			if (doe_sim_now_us() - idle_since > 1000)
+				usleep(50);
+			else
+				sched_yield();
+			continue;
+		}
+
+		/* The command and its payload once the doorbell is seen set */
+		__sync_synchronize();
+		doe_sim_mbox_cmd(dev, mbox);
+		idle_since = doe_sim_now_us();
+	}
+
+	return NULL;
+}
+
+/**
+ * doe_sim_mbox_start() - Answer the mailbox commands rung in a register block
+ * @dev: the simulated device
+ * @regs: the block, laid out as @dev->regs; @dev->regs itself, or a
+ *	  shared mapping of a file holding a copy
+ *
+ * Return: 0, or -errno
+ */
+int doe_sim_mbox_start(struct doe_sim_dev *dev, volatile u8 *regs)
+{
+	int ret;
+
+	if (dev->mbox_run)
+		return -EBUSY;
+
+	dev->mbox_regs = regs;
+	dev->mbox_run = true;
+	ret = pthread_create(&dev->mbox_thread, NULL, doe_sim_mbox_thread, dev);
+	if (ret) {
+		dev->mbox_run = false;
+		return -ret;
+	}
+
+	return 0;
+}
+
+void doe_sim_mbox_stop(struct doe_sim_dev *dev)
+{
+	if (!dev->mbox_run)
+		return;
+
+	__atomic_store_n(&dev->mbox_run, false, __ATOMIC_RELEASE);
+	pthread_join(dev->mbox_thread, NULL);
+}
+
+/* The doorbell answered in the thread ringing it, on a virtual clock */
+static void doe_sim_mbox_ring(void *priv)
+{
+	struct doe_sim_dev *dev = priv;
+
+	doe_sim_mbox_cmd(dev, dev->mbox_regs + DOE_SIM_REGS_MBOX);
+}
+
+/**
+ * doe_sim_mbox_attach() - Answer the mailbox of the registers of @dev
+ * @dev: the simulated device
+ * @r: its registers, as mapped by cxl_regs_map()
+ *
+ * On a virtual clock @r rings the doorbell into @dev, no thread
+ * involved; otherwise doe_sim_mbox_start() runs one, if not yet.
+ *
+ * Return: 0, or -errno
+ */
+int doe_sim_mbox_attach(struct doe_sim_dev *dev, struct cxl_regs *r)
+{
+	if (!dev->virt)
+		return dev->mbox_run ? 0 : doe_sim_mbox_start(dev, r->base);
+
+	dev->mbox_regs = r->base;
+	r->ring = doe_sim_mbox_ring;
+	r->ring_priv = dev;
+	return 0;
+}
+
+/**
+ * doe_sim_dist_parse() - A latency distribution from its description
+ * @d: set when @s is valid
+ * @s: in microseconds, "50" or "fixed:50", "uniform:20:80", "exp:10:40"
+ *     for 10 plus an exponential of mean 40, "spike:50:5000:10" for 5000
+ *     10 times in 1000 and 50 otherwise
+ *
+ * Return: 0, or -EINVAL
+ */
+int doe_sim_dist_parse(struct doe_sim_dist *d, const char *s)
+{
+	struct doe_sim_dist t = { 0 };
+	char c;
+
+	if (sscanf(s, "%u%c", &t.a, &c) == 1 ||
+	    sscanf(s, "fixed:%u%c", &t.a, &c) == 1)
+		t.type = DOE_SIM_DIST_FIXED;
+	else if (sscanf(s, "uniform:%u:%u%c", &t.a, &t.b, &c) == 2 &&
+		 t.a <= t.b)
+		t.type = DOE_SIM_DIST_UNIFORM;
+	else if (sscanf(s, "exp:%u:%u%c", &t.a, &t.b, &c) == 2)
+		t.type = DOE_SIM_DIST_EXP;
+	else if (sscanf(s, "spike:%u:%u:%u%c", &t.a, &t.b, &t.permille,
+			&c) == 3 && t.permille <= 1000)
+		t.type = DOE_SIM_DIST_SPIKE;
+	else
+		return -EINVAL;
+
+	*d = t;
+	return 0;
+}
+
+/**
+ * doe_sim_seed() - Restart the latencies of @dev
+ * @dev: the simulated device
+ * @seed: the same one draws the same latencies again, 1 after init
+ */
+void doe_sim_seed(struct doe_sim_dev *dev, u64 seed)
+{
+	int i;
+
+	/* A state per stream drawn from @seed, so that they do not overlap */
+	dev->mbox_rng = doe_sim_rand(&seed);
+	for (i = 0; i < dev->n_doe; i++)
+		dev->doe[i].rng = doe_sim_rand(&seed);
+}
+
+/**
+ * doe_sim_virtual() - Put @dev on a virtual clock, see DOC: doe sim
+ * @dev: the simulated device, its mailbox not yet attached
+ *
+ * Every clock starts at 0; what they move by is in @dev->model_us.
+ */
+void doe_sim_virtual(struct doe_sim_dev *dev)
+{
+	int i;
+
+	dev->virt = true;
+	dev->mbox_clock_us = 0;
+	for (i = 0; i < dev->n_doe; i++)
+		dev->doe[i].clock_us = 0;
+}
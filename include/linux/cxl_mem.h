@@ -24,6 +24,8 @@
 #define CXL_MEM_QUERY_COMMANDS _IOR(0xCE, 1, struct cxl_mem_query_commands)
 #define CXL_MEM_SEND_COMMAND _IOWR(0xCE, 2, struct cxl_send_command)
 #define CXL_MEM_CONFIG_WR _IOWR(0xCE, 3, struct cxl_pdev_config)
+#define CXL_MEM_CONFIG_BATCH _IOWR(0xCE, 4, struct cxl_pdev_config_batch)
+#define CXL_MEM_DOE_IRQ_EVENTFD _IOW(0xCE, 5, __s32)
 
 #define CXL_CMDS                                                          \
 	___C(INVALID, "Invalid Command"),                                 \
@@ -200,4 +202,25 @@ struct cxl_pdev_config {
 	bool is_write;
 };
 
+/*
+ * @n_ops: Number of entries in @ops (input), number processed (output).
+ * @rsvd: Must be zero.
+ * @ops: Pointer to an array of struct cxl_pdev_config, processed in order.
+ *	 Reads update the @val of their own entry.
+ *
+ * Same as CXL_MEM_CONFIG_WR but for a whole vector of accesses at once.
+ * Kernels without it fail the ioctl with -ENOTTY.
+ */
+struct cxl_pdev_config_batch {
+	__u32 n_ops;
+	__u32 rsvd;
+	__u64 ops;
+};
+
+/*
+ * CXL_MEM_DOE_IRQ_EVENTFD takes an eventfd the driver signals on every
+ * DOE interrupt of its DOE instance, or -1 to stop signalling. Userspace
+ * still owns PCI_DOE_CTRL_INT_EN and clearing PCI_DOE_STATUS_INT_STATUS.
+ */
+
 #endif
@@ -0,0 +1,14 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stddef.h>
+
+struct transport;
+
+#define CACHE_DIR_DEFAULT	"/var/cache/cxl_app"
+#define CACHE_KEY_LEN		64
+
+int cache_key(char *key, size_t len, struct transport *t, const char *memdev);
+int cache_path(char *path, size_t len, const char *key, const char *kind);
+
+#endif /*__CACHE_H__*/
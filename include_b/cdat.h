@@ -0,0 +1,205 @@
+#ifndef __CDAT_H__
+#define __CDAT_H__
+
+#include <stddef.h>
+#include <stdio.h>
+#include <kernel_types.h>
+#include <bitfield.h>
+
+struct doe_mb;
+
+/*
+ * Coherent Device Attribute Table, as read through CXL table access.
+ * The structures are views straight into the table, which is little
+ * endian like the hosts this runs on.
+ */
+#define CDAT_MAX_SIZE		(64 * 1024)
+
+enum cdat_type {
+	CDAT_TYPE_DSMAS		= 0,
+	CDAT_TYPE_DSLBIS	= 1,
+	CDAT_TYPE_DSMSCIS	= 2,
+	CDAT_TYPE_DSIS		= 3,
+	CDAT_TYPE_DSEMTS	= 4,
+	CDAT_TYPE_SSLBIS	= 5,
+	CDAT_TYPE_MAX
+};
+
+/* HMAT data types of DSLBIS and SSLBIS */
+enum cdat_hmat_type {
+	CDAT_HMAT_ACCESS_LATENCY	= 0,
+	CDAT_HMAT_READ_LATENCY		= 1,
+	CDAT_HMAT_WRITE_LATENCY		= 2,
+	CDAT_HMAT_ACCESS_BANDWIDTH	= 3,
+	CDAT_HMAT_READ_BANDWIDTH	= 4,
+	CDAT_HMAT_WRITE_BANDWIDTH	= 5,
+};
+
+struct cdat_header {
+	u32 length;
+	u8 revision;
+	u8 checksum;
+	u8 reserved[6];
+	u32 sequence;
+} __attribute__((packed));
+
+struct cdat_entry_header {
+	u8 type;
+	u8 reserved;
+	u16 length;
+} __attribute__((packed));
+
+/* Device Scoped Memory Affinity Structure */
+struct cdat_dsmas {
+	struct cdat_entry_header hdr;
+	u8 dsmad_handle;
+	u8 flags;
+#define CDAT_DSMAS_FLAG_NV		BIT(2)
+#define CDAT_DSMAS_FLAG_SHAREABLE	BIT(3)
+	u16 reserved;
+	u64 dpa_base;
+	u64 dpa_length;
+} __attribute__((packed));
+
+/* Device Scoped Latency and Bandwidth Information Structure */
+struct cdat_dslbis {
+	struct cdat_entry_header hdr;
+	u8 handle;
+	u8 flags;
+	u8 data_type;
+	u8 reserved;
+	u64 entry_base_unit;
+	u16 entry[3];
+	u16 reserved2;
+} __attribute__((packed));
+
+/* Device Scoped Memory Side Cache Information Structure */
+struct cdat_dsmscis {
+	struct cdat_entry_header hdr;
+	u8 dsmas_handle;
+	u8 reserved[3];
+	u64 side_cache_size;
+	u32 cache_attributes;
+} __attribute__((packed));
+
+/* Device Scoped Initiator Structure */
+struct cdat_dsis {
+	struct cdat_entry_header hdr;
+	u8 flags;
+	u8 handle;
+	u16 reserved;
+} __attribute__((packed));
+
+/* Device Scoped EFI Memory Type Structure */
+struct cdat_dsemts {
+	struct cdat_entry_header hdr;
+	u8 dsmas_handle;
+	u8 memory_type;
+	u16 reserved;
+	u64 dpa_offset;
+	u64 range_length;
+} __attribute__((packed));
+
+/* Switch Scoped Latency and Bandwidth Entry */
+struct cdat_sslbe {
+	u16 portx_id;
+	u16 porty_id;
+	u16 value;
+	u16 reserved;
+} __attribute__((packed));
+
+#define CDAT_SSLBIS_ANY_PORT	0xffff
+#define CDAT_SSLBIS_USP_PORT	0x100
+
+/* Switch Scoped Latency and Bandwidth Information Structure */
+struct cdat_sslbis {
+	struct cdat_entry_header hdr;
+	u8 data_type;
+	u8 reserved[3];
+	u64 entry_base_unit;
+	struct cdat_sslbe entries[];
+} __attribute__((packed));
+
+#define CDAT_MAX_ENTRIES	256
+
+/**
+ * struct cdat_index - Where each CDAT structure is, by entry handle
+ * @hdr: header of the table indexed, to tell whether it is current
+ * @n: number of entries in @ent
+ * @ent: the structures in table order, with their table access handle
+ */
+struct cdat_index {
+	struct cdat_header hdr;
+	u32 n;
+	struct cdat_index_entry {
+		u16 handle;
+		u8 type;
+		u8 reserved;
+		u16 length;
+		u16 reserved2;
+	} ent[CDAT_MAX_ENTRIES];
+};
+
+/**
+ * struct cdat - A validated CDAT
+ * @hdr: the header, at the start of the table
+ * @end: one past the last byte, per the header length
+ */
+struct cdat {
+	const struct cdat_header *hdr;
+	const u8 *end;
+};
+
+int cdat_init(struct cdat *cdat, const void *buf, size_t len);
+const struct cdat_entry_header *cdat_next(const struct cdat *cdat,
+					  const struct cdat_entry_header *e);
+
+#define cdat_for_each_entry(cdat, e)					\
+	for ((e) = cdat_next(cdat, NULL); (e); (e) = cdat_next(cdat, e))
+
+#define CDAT_VIEW(name, TYPE)						\
+static inline const struct cdat_##name *				\
+cdat_##name(const struct cdat_entry_header *e)				\
+{									\
+	return e->type == CDAT_TYPE_##TYPE ?				\
+	       (const struct cdat_##name *)e : NULL;			\
+}
+
+/* Typed views, NULL when the entry is of another type */
+CDAT_VIEW(dsmas, DSMAS)
+CDAT_VIEW(dslbis, DSLBIS)
+CDAT_VIEW(dsmscis, DSMSCIS)
+CDAT_VIEW(dsis, DSIS)
+CDAT_VIEW(dsemts, DSEMTS)
+CDAT_VIEW(sslbis, SSLBIS)
+
+static inline int cdat_sslbis_n(const struct cdat_sslbis *s)
+{
+	return (s->hdr.length - sizeof(*s)) / sizeof(struct cdat_sslbe);
+}
+
+/* Entry value times its base unit: picoseconds, or MB/s */
+static inline u64 cdat_value(u64 base_unit, u16 entry)
+{
+	return base_unit * entry;
+}
+
+const struct cdat_entry_header *cdat_entry(const void *buf, size_t len);
+const char *cdat_type_name(u8 type);
+int cdat_type_parse(const char *name);
+const char *cdat_hmat_name(u8 data_type);
+void cdat_print_entry(FILE *f, const struct cdat_entry_header *e);
+void cdat_print(FILE *f, const struct cdat *cdat);
+int cdat_read(struct doe_mb *mb, void *buf, size_t cap, struct cdat_index *idx);
+int cdat_read_header(struct doe_mb *mb, struct cdat_header *hdr);
+int cdat_read_entry(struct doe_mb *mb, u16 handle, void *buf, size_t cap);
+int cdat_read_cached(struct doe_mb *mb, const char *path, void *buf,
+		     size_t cap, bool *hit, struct cdat_index *idx);
+bool cdat_index_current(const struct cdat_index *idx,
+			const struct cdat_header *hdr);
+int cdat_index_load(const char *path, struct cdat_index *idx);
+int cdat_index_save(const char *path, const struct cdat_index *idx);
+int cdat_load(const char *path, void *buf, size_t cap);
+int cdat_save(const char *path, const void *buf, size_t len);
+
+#endif /*__CDAT_H__*/
@@ -0,0 +1,49 @@
+#ifndef __CUSE_H__
+#define __CUSE_H__
+
+#include <stdio.h>
+#include <kernel_types.h>
+#include <regs.h>
+
+struct doe_sim_dev;
+
+/* The ioctls served, what the latency and the counts are kept per */
+enum cuse_op {
+	CUSE_OP_QUERY,
+	CUSE_OP_SEND,
+	CUSE_OP_CONFIG,
+	CUSE_OP_MAX
+};
+
+/**
+ * struct cuse_dev - A /dev/cxl/memN answered from userspace
+ * @name: the device, relative to /dev, cxl/mem0
+ * @sim: the simulated device behind it
+ * @regs: its mailbox registers, answered by @sim
+ * @doe_cap: the DOE instance CXL_MEM_CONFIG_WR offsets are relative to
+ * @latency_us: added to each ioctl of an op, on top of what @sim takes
+ * @n_op: ioctls served, per op
+ * @n_retry: FUSE_IOCTL_RETRY rounds they took
+ * @n_err: ioctls failed, unknown ones among them
+ * @deadline_us: when the ioctl in hand may complete
+ */
+struct cuse_dev {
+	const char *name;
+	struct doe_sim_dev *sim;
+	struct cxl_regs regs;
+	u16 doe_cap;
+	u32 latency_us[CUSE_OP_MAX];
+	u64 n_op[CUSE_OP_MAX];
+	u64 n_retry;
+	u64 n_err;
+	u64 deadline_us;
+};
+
+int cuse_dev_init(struct cuse_dev *cd, struct doe_sim_dev *sim,
+		  const char *name);
+void cuse_dev_exit(struct cuse_dev *cd);
+int cuse_open(void);
+int cuse_serve(struct cuse_dev *cd, int fd, volatile bool *stop);
+void cuse_print_stats(FILE *f, const struct cuse_dev *cd);
+
+#endif /*__CUSE_H__*/
@@ -2,6 +2,8 @@
 /* Copyright(c) 2020-2021 Intel Corporation. */
 #ifndef __CXL_MEM_H__
 #define __CXL_MEM_H__
+#include <stddef.h>
+#include <kernel_types.h>
 #include "../include/linux/cxl_mem.h"
 
 #define BIT(x) (1UL << (x))
@@ -63,4 +65,313 @@ struct cxl_mem_command {
 #define CXL_CMD_FLAG_FORCE_ENABLE BIT(0)
 };
 
+/* CXL 2.0 8.2.8.4.5.1 Command Return Codes */
+enum cxl_mbox_ret {
+	CXL_MBOX_CMD_RC_SUCCESS		= 0x0000,
+	CXL_MBOX_CMD_RC_BACKGROUND	= 0x0001,
+	CXL_MBOX_CMD_RC_INPUT		= 0x0002,
+	CXL_MBOX_CMD_RC_UNSUPPORTED	= 0x0003,
+	CXL_MBOX_CMD_RC_INTERNAL	= 0x0004,
+	CXL_MBOX_CMD_RC_RETRY		= 0x0005,
+	CXL_MBOX_CMD_RC_BUSY		= 0x0006,
+	CXL_MBOX_CMD_RC_MEDIADISABLED	= 0x0007,
+};
+
+/**
+ * struct cxl_mbox_cmd - A command to be submitted to hardware.
+ * @opcode: (input) The command set and command submitted to hardware.
+ * @payload_in: (input) Pointer to the input payload.
+ * @payload_out: (output) Pointer to the output payload. Must be allocated by
+ *		 the caller.
+ * @size_in: (input) Number of bytes to load from @payload_in.
+ * @size_out: (input) Max number of bytes loaded into @payload_out.
+ *            (output) Number of bytes generated by the device. For fixed size
+ *            outputs commands this is always expected to be deterministic. For
+ *            variable sized output commands, it tells the exact number of bytes
+ *            written.
+ * @return_code: (output) Error code returned from hardware.
+ *
+ * This is the primary mechanism used to send commands to the hardware.
+ * All the fields except @payload_* correspond exactly to the fields described in
+ * Command Register section of the CXL 2.0 8.2.8.4.5. @payload_in and
+ * @payload_out are written to, and read from the Command Payload Registers
+ * defined in CXL 2.0 8.2.8.4.8.
+ */
+struct cxl_mbox_cmd {
+	u16 opcode;
+	void *payload_in;
+	void *payload_out;
+	size_t size_in;
+	size_t size_out;
+	u16 return_code;
+};
+
+/*
+ * The payloads of the commands, CXL 2.0 8.2.9, little-endian as the
+ * host. Each is checked against the size the specification gives it,
+ * which cxl_mem_commands[] takes from here; those of variable size are
+ * the fixed part ahead of what varies.
+ */
+#define CXL_PAYLOAD_SIZE(type, size)                                          \
+	_Static_assert(sizeof(struct type) == (size), #type " is not " #size)
+
+/* 8.2.9.2.1 Get FW Info */
+struct cxl_mbox_get_fw_info {
+	u8 num_slots;
+	u8 slot_info;
+	u8 activation_cap;
+	u8 reserved[13];
+	char slot_1_revision[0x10];
+	char slot_2_revision[0x10];
+	char slot_3_revision[0x10];
+	char slot_4_revision[0x10];
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_get_fw_info, 0x50);
+
+/* 8.2.9.2.3 Activate FW */
+struct cxl_mbox_activate_fw {
+	u8 action;
+	u8 slot;
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_activate_fw, 0x2);
+
+/* 8.2.9.4.1 Get Supported Logs, an entry per log */
+struct cxl_gsl_entry {
+	u8 uuid[16];
+	u32 size;
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_gsl_entry, 0x14);
+
+struct cxl_mbox_get_supported_logs {
+	u16 entries;
+	u8 reserved[6];
+	struct cxl_gsl_entry entry[];
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_get_supported_logs, 0x8);
+
+/* 8.2.9.4.1.1 Command Effects Log, its UUID and an entry per command */
+#define CXL_CEL_UUID                                                           \
+	{ 0x0d, 0xa9, 0xc0, 0xb5, 0xbf, 0x41, 0x4b, 0x78,                      \
+	  0x8f, 0x79, 0x96, 0xb1, 0x62, 0x3b, 0x3f, 0x17 }
+
+struct cxl_cel_entry {
+	u16 opcode;
+	u16 effect;
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_cel_entry, 0x4);
+
+/* 8.2.9.4.2 Get Log */
+struct cxl_mbox_get_log {
+	u8 uuid[16];
+	u32 offset;
+	u32 length;
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_get_log, 0x18);
+
+/* 8.2.9.5.1.1 Identify Memory Device */
+struct cxl_mbox_identify {
+	char fw_revision[0x10];
+	u64 total_capacity;
+	u64 volatile_capacity;
+	u64 persistent_capacity;
+	u64 partition_align;
+	u16 info_event_log_size;
+	u16 warning_event_log_size;
+	u16 failure_event_log_size;
+	u16 fatal_event_log_size;
+	u32 lsa_size;
+	u8 poison_list_max_mer[3];
+	u16 inject_poison_limit;
+	u8 poison_caps;
+	u8 qos_telemetry_caps;
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_identify, 0x43);
+
+/* 8.2.9.5.2.1 Get Partition Info, capacities in 256 MiB units */
+struct cxl_mbox_get_partition_info {
+	u64 active_volatile_cap;
+	u64 active_persistent_cap;
+	u64 next_volatile_cap;
+	u64 next_persistent_cap;
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_get_partition_info, 0x20);
+
+/* 8.2.9.5.2.2 Set Partition Info */
+struct cxl_mbox_set_partition_info {
+	u64 volatile_capacity;
+	u8 flags;
+#define CXL_SET_PARTITION_IMMEDIATE_FLAG	BIT(0)
+	u8 reserved;
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_set_partition_info, 0xa);
+
+/* 8.2.9.5.2.3 Get LSA */
+struct cxl_mbox_get_lsa {
+	u32 offset;
+	u32 length;
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_get_lsa, 0x8);
+
+/* 8.2.9.5.2.4 Set LSA, the data following */
+struct cxl_mbox_set_lsa {
+	u32 offset;
+	u32 reserved;
+	u8 data[];
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_set_lsa, 0x8);
+
+/* 8.2.9.5.3.1 Get Health Info */
+struct cxl_mbox_health_info {
+	u8 health_status;
+	u8 media_status;
+	u8 ext_status;
+	u8 life_used;
+	u16 temperature;
+	u32 dirty_shutdowns;
+	u32 volatile_errors;
+	u32 pmem_errors;
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_health_info, 0x12);
+
+/* 8.2.9.5.3.2 Get Alert Configuration */
+struct cxl_mbox_get_alert_config {
+	u8 valid_alerts;
+	u8 programmable_alerts;
+	u8 life_used_crit_alert_threshold;
+	u8 life_used_prog_warn_threshold;
+	u16 dev_over_temp_crit_alert_threshold;
+	u16 dev_under_temp_crit_alert_threshold;
+	u16 dev_over_temp_prog_warn_threshold;
+	u16 dev_under_temp_prog_warn_threshold;
+	u16 corrected_volatile_mem_err_prog_warn_threshold;
+	u16 corrected_pmem_err_prog_warn_threshold;
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_get_alert_config, 0x10);
+
+/* 8.2.9.5.3.3 Set Alert Configuration */
+struct cxl_mbox_set_alert_config {
+	u8 valid_alert_actions;
+	u8 enable_alert_actions;
+	u8 life_used_prog_warn_threshold;
+	u8 reserved;
+	u16 dev_over_temp_prog_warn_threshold;
+	u16 dev_under_temp_prog_warn_threshold;
+	u16 corrected_volatile_mem_err_prog_warn_threshold;
+	u16 corrected_pmem_err_prog_warn_threshold;
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_set_alert_config, 0xc);
+
+/* 8.2.9.5.3.4/5 Get and Set Shutdown State */
+struct cxl_mbox_shutdown_state {
+	u8 state;
+#define CXL_SHUTDOWN_STATE_DIRTY	BIT(0)
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_shutdown_state, 0x1);
+
+/* 8.2.9.5.4.1 Get Poison List, also the media error records of Scan Media */
+struct cxl_mbox_poison_in {
+	u64 offset;
+	u64 length;
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_poison_in, 0x10);
+
+struct cxl_poison_record {
+	u64 address;
+#define CXL_POISON_SOURCE_MASK		0x7ULL
+	u32 length;				/* in 64-byte units */
+	u32 reserved;
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_poison_record, 0x10);
+
+struct cxl_mbox_poison_out {
+	u8 flags;
+#define CXL_POISON_FLAG_MORE		BIT(0)
+#define CXL_POISON_FLAG_OVERFLOW	BIT(1)
+#define CXL_POISON_FLAG_SCANNING	BIT(2)
+	u8 reserved1;
+	u64 overflow_ts;
+	u16 count;
+	u8 reserved2[0x14];
+	struct cxl_poison_record record[];
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_poison_out, 0x20);
+
+/* 8.2.9.5.4.2 Inject Poison */
+struct cxl_mbox_inject_poison {
+	u64 address;
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_inject_poison, 0x8);
+
+/* 8.2.9.5.4.3 Clear Poison */
+struct cxl_mbox_clear_poison {
+	u64 address;
+	u8 write_data[64];
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_clear_poison, 0x48);
+
+/* 8.2.9.5.4.4 Get Scan Media Capabilities, the range as Get Poison List's */
+struct cxl_mbox_scan_media_caps {
+	u32 estimated_ms;
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_scan_media_caps, 0x4);
+
+/* 8.2.9.5.4.5 Scan Media */
+struct cxl_mbox_scan_media {
+	u64 offset;
+	u64 length;
+	u8 flags;
+#define CXL_SCAN_MEDIA_NO_EVENT_LOG	BIT(0)
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_scan_media, 0x11);
+
+/* 8.2.9.5.4.6 Get Scan Media Results */
+struct cxl_mbox_get_scan_media {
+	u64 restart_address;
+	u64 restart_length;
+	u8 flags;
+#define CXL_SCAN_MEDIA_FLAG_MORE	BIT(0)
+#define CXL_SCAN_MEDIA_FLAG_OVERFLOW	BIT(1)
+	u8 reserved1;
+	u16 count;
+	u8 reserved2[0xc];
+	struct cxl_poison_record record[];
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_get_scan_media, 0x20);
+
+/* 8.2.9.5.6.1 Get Security State */
+struct cxl_mbox_get_security_state {
+	u32 state;
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_get_security_state, 0x4);
+
+/* 8.2.9.5.6.2 Set Passphrase */
+struct cxl_mbox_set_passphrase {
+	u8 type;
+	u8 reserved[31];
+	u8 old_pass[32];
+	u8 new_pass[32];
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_set_passphrase, 0x60);
+
+/* 8.2.9.5.6.3/6 Disable Passphrase and Passphrase Secure Erase */
+struct cxl_mbox_disable_passphrase {
+	u8 type;
+	u8 reserved[31];
+	u8 pass[32];
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_disable_passphrase, 0x40);
+
+/* 8.2.9.5.6.4 Unlock */
+struct cxl_mbox_unlock {
+	u8 pass[32];
+} __attribute__((packed));
+CXL_PAYLOAD_SIZE(cxl_mbox_unlock, 0x20);
+
+const struct cxl_mem_command *cxl_mem_find_command(u16 opcode);
+const struct cxl_mem_command *cxl_mem_find_id(unsigned int id);
+int cxl_mem_query_ids(struct cxl_mem_query_commands *q, u64 ids);
+int cxl_mem_query(struct cxl_mem_query_commands *q);
+int cxl_mem_validate(const struct cxl_send_command *send, size_t payload_size,
+		     struct cxl_mbox_cmd *mbox_cmd);
+
 #endif
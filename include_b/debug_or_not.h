@@ -2,7 +2,13 @@
 #define __DEBUG_OR_NOT__
 
 #ifdef DEBUG
-#define pr_debug(fmt, ...) printf("debug: " fmt, ##__VA_ARGS__)
+extern int debug_level;
+
+/* Formatted only at the debug level asking for it, see trace.h */
+#define pr_debug(fmt, ...) do {					\
+	if (debug_level > 0)						\
+		printf("debug: " fmt, ##__VA_ARGS__);			\
+} while (0)
 #else
 #define pr_debug(fmt, ...) do {} while(0)
 #endif
@@ -0,0 +1,114 @@
+#ifndef __DEV_H__
+#define __DEV_H__
+
+#include <stddef.h>
+#include <pthread.h>
+#include <kernel_types.h>
+#include <transport.h>
+#include <doe.h>
+
+struct doe_sim_dev;
+
+/* Payload buffers of the pool, and their alignment, a page */
+#define CXL_DEV_NR_BUF		4
+#define CXL_DEV_BUF_ALIGN	4096
+
+/* The smallest mailbox payload, CXL 2.0 8.2.8.4.3, 2^8 bytes */
+#define CXL_DEV_PAYLOAD_MIN	256
+
+/* A bit per command ID in a u64, the command sets of cxl_dev and cxl_snap */
+_Static_assert(CXL_MEM_COMMAND_ID_MAX <= 64, "command IDs beyond a u64 mask");
+
+/* The snapshot, /dev/shm/cxl_app.<cache key> */
+#define CXL_SNAP_PREFIX		"/cxl_app."
+#define CXL_SNAP_MAGIC		0x31504e534c5843ULL	/* "CXLSNP1" */
+
+/**
+ * struct cxl_snap - What a device's mailbox takes, for other processes
+ * @magic: CXL_SNAP_MAGIC, once written
+ * @seq: odd while being written
+ * @n_commands: entries of @commands
+ * @cmd_mask: BIT(CXL_MEM_COMMAND_ID_*) of the commands supported
+ * @payload_size: the largest payload of the mailbox
+ * @time: when written, seconds since the Epoch
+ * @commands: as CXL_MEM_QUERY_COMMANDS returned them
+ *
+ * Written by the first mailbox command of a process on the device, read
+ * only by the others: whether a command is there is a load of @cmd_mask,
+ * the rest a copy taken by cxl_snap_read().
+ */
+struct cxl_snap {
+	u64 magic;
+	u32 seq;
+	u32 n_commands;
+	u64 cmd_mask;
+	u64 payload_size;
+	u64 time;
+	struct cxl_command_info commands[CXL_MEM_COMMAND_ID_MAX];
+};
+
+/**
+ * struct cxl_dev - A memory device and what driving it takes
+ * @name: the memdev, mem0
+ * @mem: /dev/cxl/<name>, the driver's mailbox and DOE instance
+ * @pci: the config space, or the transport asked for; not open if unused
+ * @sim: the simulated device @pci reaches, answering its mailbox
+ * @doe: the DOE instances, set up by the caller on first use
+ * @doe_ready: @doe was set up
+ * @lock: serializes the mailbox set-up and the pool
+ * @mbox_ready: @query, @payload_size and @buf are there
+ * @query: the commands of the mailbox, with room for every one there is
+ * @cmd_mask: BIT(CXL_MEM_COMMAND_ID_*) of those in @query
+ * @payload_size: the largest payload the mailbox moves
+ * @buf: CXL_DEV_NR_BUF buffers of @payload_size, each CXL_DEV_BUF_ALIGN
+ *	  aligned
+ * @buf_used: those handed out, a bit each
+ *
+ * Handles are independent of each other, as many as there are devices
+ * in one process. After the first mailbox command none allocates.
+ */
+struct cxl_dev {
+	char name[32];
+	struct transport mem;
+	struct transport pci;
+	struct doe_sim_dev *sim;
+	struct doe_dev doe;
+	bool doe_ready;
+	pthread_mutex_t lock;
+	bool mbox_ready;
+	union {
+		struct cxl_mem_query_commands query;
+		u8 query_buf[sizeof(struct cxl_mem_query_commands) +
+			     CXL_MEM_COMMAND_ID_MAX *
+			     sizeof(struct cxl_command_info)];
+	};
+	u64 cmd_mask;
+	size_t payload_size;
+	u8 *buf;
+	u32 buf_used;
+};
+
+void cxl_dev_init(struct cxl_dev *d, const char *name);
+void cxl_dev_exit(struct cxl_dev *d);
+struct transport *cxl_dev_transport(struct cxl_dev *d);
+struct transport *cxl_dev_mbox(struct cxl_dev *d);
+int cxl_dev_mbox_open(struct cxl_dev *d);
+const struct cxl_mem_query_commands *cxl_dev_commands(struct cxl_dev *d);
+const struct cxl_command_info *cxl_dev_command(struct cxl_dev *d,
+					       unsigned int id);
+bool cxl_dev_has_command(struct cxl_dev *d, unsigned int id);
+void *cxl_dev_buf_get(struct cxl_dev *d);
+void cxl_dev_buf_put(struct cxl_dev *d, void *buf);
+
+const struct cxl_snap *cxl_snap_open(const char *key);
+void cxl_snap_close(const struct cxl_snap *s);
+int cxl_snap_read(const struct cxl_snap *s, struct cxl_snap *copy);
+
+/* Command CXL_MEM_COMMAND_ID_@id is there, the one read it takes */
+static inline bool cxl_snap_has(const struct cxl_snap *s, unsigned int id)
+{
+	return id < CXL_MEM_COMMAND_ID_MAX &&
+	       (__atomic_load_n(&s->cmd_mask, __ATOMIC_ACQUIRE) & 1ULL << id);
+}
+
+#endif /*__DEV_H__*/
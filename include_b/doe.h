@@ -1,6 +1,10 @@
 #ifndef __DOE_H__
 #define __DOE_H__
 
+#include <stddef.h>
+#include <kernel_types.h>
+#include "../include/linux/cxl_mem.h"
+
 #define CXL_DOE_TABLE_ACCESS_REQ_CODE           0x000000ff
 #define   CXL_DOE_TABLE_ACCESS_REQ_CODE_READ    0
 #define CXL_DOE_TABLE_ACCESS_TABLE_TYPE         0x0000ff00
@@ -9,4 +13,133 @@
 #define CXL_DOE_TABLE_ACCESS_LAST_ENTRY         0xffff
 #define CXL_DOE_PROTOCOL_TABLE_ACCESS 2
 
+#define PCI_DVSEC_VENDOR_ID_CXL			0x1e98
+#define PCI_VENDOR_ID_PCI_SIG			0x0001
+#define PCI_DOE_PROTOCOL_DISCOVERY		0x00
+#define CXL_DOE_PROTOCOL_COMPLIANCE		0x00
+
+/* Header1 + Header2, prepended to every data object */
+#define DOE_HDR_DW				2
+
+struct transport;
+
+/* Register accesses queued before they go to the transport in one batch */
+#define DOE_MB_MAX_OPS				256
+
+/* 1 second, as in the DOE ECN, for a response or an abort to complete */
+#define PCI_DOE_TIMEOUT_US			1000000
+
+/* Latency histogram buckets, log2 of microseconds: [0,1), [1,2), [2,4)... */
+#define DOE_HIST_BUCKETS			24
+
+/**
+ * struct doe_stats - What the exchanges on a mailbox cost
+ * @n_call: calls into the transport issued so far
+ * @n_exchange: exchanges completed
+ * @n_abort: aborts issued on a busy or failed mailbox
+ * @n_irq: DOE interrupts waited for
+ * @n_error: exchanges that ended in DOE Error
+ * @n_timeout: exchanges that timed out
+ * @sum_us, @min_us, @max_us: exchange latency
+ * @hist: exchange latency histogram, see DOE_HIST_BUCKETS
+ */
+struct doe_stats {
+	u64 n_call;
+	u64 n_exchange;
+	u64 n_abort;
+	u64 n_irq;
+	u64 n_error;
+	u64 n_timeout;
+	u64 sum_us;
+	u64 min_us;
+	u64 max_us;
+	u32 hist[DOE_HIST_BUCKETS];
+};
+
+/**
+ * struct doe_mb - State of one DOE mailbox
+ * @t: the transport the accesses go to
+ * @cap: offset of the DOE capability. The driver already relocates
+ *	 the offsets to its DOE instance, so it is 0 for a transport
+ *	 without TRANSPORT_CFG_ABS.
+ * @irq_fd: fd becoming readable on the DOE interrupt, -1 to poll
+ * @ctrl: Control bits kept set on every write of it, PCI_DOE_CTRL_INT_EN
+ * @flags: DOE_MB_* below
+ * @busy_us: running average of how long the device takes from GO to
+ *	     Data Object Ready, sets the pace of the Status polling
+ * @stats: see struct doe_stats
+ * @n_ops: number of accesses queued in @ops
+ * @ops: the queued accesses, reused for every exchange
+ */
+struct doe_mb {
+	struct transport *t;
+	u16 cap;
+	int irq_fd;
+	u32 ctrl;
+	unsigned int flags;
+#define DOE_MB_BATCH	(1U << 0)	/* queued accesses go in one call */
+	u32 busy_us;
+	struct doe_stats stats;
+	unsigned int n_ops;
+	struct cxl_pdev_config ops[DOE_MB_MAX_OPS];
+};
+
+void doe_mb_init(struct doe_mb *mb, struct transport *t, u16 cap);
+int doe_mb_irq_enable(struct doe_mb *mb);
+void doe_mb_exit(struct doe_mb *mb);
+struct cxl_pdev_config *doe_queue(struct doe_mb *mb, u32 reg, u32 val,
+				  bool is_write);
+void doe_submit(struct doe_mb *mb);
+void doe_print_stats(struct doe_mb *mb);
+u32 doe_read(struct doe_mb *mb, u32 reg);
+void doe_write(struct doe_mb *mb, u32 reg, u32 val);
+int doe_exchange(struct doe_mb *mb, u16 vid, u8 type, const u32 *req,
+		 size_t n, u32 *rsp, size_t cap);
+
+#define DOE_MAX_MB				8
+#define DOE_MAX_PROTOCOLS			32
+
+/* A protocol found by discovery, and the mailbox serving it */
+struct doe_protocol {
+	u16 vid;
+	u8 type;
+	struct doe_mb *mb;
+};
+
+/**
+ * struct doe_dev - Every DOE instance of a device
+ * @t: the transport to the device
+ * @mb, @n_mb: a mailbox per DOE extended capability
+ * @prot, @n_prot: protocol to mailbox map, built by discovery
+ */
+struct doe_dev {
+	struct transport *t;
+	struct doe_mb mb[DOE_MAX_MB];
+	int n_mb;
+	struct doe_protocol prot[DOE_MAX_PROTOCOLS];
+	int n_prot;
+};
+
+/**
+ * struct doe_job - Work for doe_run()
+ * @mb: the mailbox @fn exchanges on
+ * @fn: the work, its return value goes to @ret
+ * @arg: passed to @fn
+ */
+struct doe_job {
+	struct doe_mb *mb;
+	int (*fn)(struct doe_mb *mb, void *arg);
+	void *arg;
+	int ret;
+};
+
+int doe_discover(struct doe_mb *mb, struct doe_protocol *prot, int max);
+int doe_run(struct doe_job *jobs, int n);
+int doe_dev_init(struct doe_dev *dd, struct transport *t, bool irq);
+int doe_dev_discover(struct doe_dev *dd);
+int doe_dev_save(struct doe_dev *dd, const char *path);
+int doe_dev_load(struct doe_dev *dd, const char *path);
+void doe_dev_exit(struct doe_dev *dd);
+struct doe_mb *doe_dev_find(struct doe_dev *dd, u16 vid, u8 type);
+
 #endif
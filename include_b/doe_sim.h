@@ -0,0 +1,141 @@
+#ifndef __DOE_SIM_H__
+#define __DOE_SIM_H__
+
+#include <pthread.h>
+#include <kernel_types.h>
+#include "../include/linux/cxl_mem.h"
+
+#define DOE_SIM_MAX_DW		1024
+#define DOE_SIM_CDAT_SIZE	512
+#define DOE_SIM_MAX_MB		2
+/* The memory device registers, in BAR2 */
+#define DOE_SIM_REGS_BAR	2
+#define DOE_SIM_REGS_SIZE	0x2000
+#define DOE_SIM_PAYLOAD_ORDER	9
+#define DOE_SIM_LSA_SIZE	1024
+/* What IDENTIFY says the poison list holds at most */
+#define DOE_SIM_POISON_MAX	256
+
+struct doe_sim_dev;
+struct cxl_regs;
+
+/* What the simulated device takes time for */
+enum doe_sim_lat {
+	DOE_SIM_LAT_DOE,	/* GO to Data Object Ready */
+	DOE_SIM_LAT_MBOX,	/* doorbell set to doorbell clear */
+	DOE_SIM_LAT_BG,		/* a background command, start to end */
+	DOE_SIM_LAT_MAX
+};
+
+enum doe_sim_dist_type {
+	DOE_SIM_DIST_FIXED,	/* @a */
+	DOE_SIM_DIST_UNIFORM,	/* between @a and @b */
+	DOE_SIM_DIST_EXP,	/* @a plus an exponential of mean @b */
+	DOE_SIM_DIST_SPIKE,	/* @a, and @b @permille times in 1000 */
+};
+
+/**
+ * struct doe_sim_dist - How a latency is drawn, in microseconds
+ * @type: DOE_SIM_DIST_*
+ * @a, @b, @permille: its parameters
+ */
+struct doe_sim_dist {
+	enum doe_sim_dist_type type;
+	u32 a;
+	u32 b;
+	u32 permille;
+};
+
+/**
+ * struct doe_sim - One simulated DOE mailbox
+ * @dev: the device it is part of
+ * @cap: offset of its DOE extended capability
+ * @protocols: bitmap of the doe_sim_protocols[] it serves
+ * @ctrl, @status: the DOE Control and Status registers
+ * @irq_fd: timerfd expiring when the response is ready, the stand-in
+ *	    for the DOE interrupt
+ * @ready_at_us: time the pending response gets ready
+ * @rng: state of the latencies drawn for this mailbox
+ * @clock_us: its virtual clock, see doe_sim_virtual()
+ * @req, @n_req: request being written to the Write Data Mailbox
+ * @rsp, @n_rsp, @rsp_pos: response served from the Read Data Mailbox
+ */
+struct doe_sim {
+	struct doe_sim_dev *dev;
+	u16 cap;
+	u32 protocols;
+	u32 ctrl;
+	u32 status;
+	int irq_fd;
+	u64 ready_at_us;
+	u64 rng;
+	u64 clock_us;
+	u32 req[DOE_SIM_MAX_DW];
+	unsigned int n_req;
+	u32 rsp[DOE_SIM_MAX_DW];
+	unsigned int n_rsp;
+	unsigned int rsp_pos;
+};
+
+/**
+ * struct doe_sim_dev - Simulated CXL device or switch port, its config
+ *			space and CDAT
+ * @cfg: the extended config space, the DOE registers excepted
+ * @doe, @n_doe: its DOE mailboxes
+ * @lat: the latency of each DOE_SIM_LAT_*
+ * @virt: time is virtual, see doe_sim_virtual()
+ * @model_us: latency drawn so far, per DOE_SIM_LAT_*
+ * @cdat, @cdat_len: the CDAT served by table access
+ * @cdat_off: offset of each CDAT structure, [0] being the header
+ * @n_cdat: number of entries in @cdat_off
+ * @regs: the memory device register block, the Register Locator in
+ *	  @cfg pointing at it
+ * @mbox_regs: the register block whose mailbox doe_sim_mbox_start()
+ *	       answers, @regs or a file mapping a copy of it
+ * @mbox_thread, @mbox_run: the thread answering it
+ * @n_mbox: mailbox commands answered
+ * @mbox_rng, @mbox_clock_us: @rng and @clock_us of the mailbox
+ * @lsa: Label Storage Area, what SET_LSA wrote
+ * @shutdown_state: what SET_SHUTDOWN_STATE wrote
+ * @poison: the DPAs INJECT_POISON poisoned, CLEAR_POISON not cleared
+ * @n_poison: entries of @poison
+ * @poison_next: where the GET_POISON that said more resumes
+ */
+struct doe_sim_dev {
+	u32 cfg[1024];
+	struct doe_sim doe[DOE_SIM_MAX_MB];
+	int n_doe;
+	struct doe_sim_dist lat[DOE_SIM_LAT_MAX];
+	bool virt;
+	u64 model_us[DOE_SIM_LAT_MAX];
+	u8 cdat[DOE_SIM_CDAT_SIZE];
+	unsigned int cdat_len;
+	unsigned int cdat_off[16];
+	unsigned int n_cdat;
+	u8 regs[DOE_SIM_REGS_SIZE] __attribute__((aligned(8)));
+	volatile u8 *mbox_regs;
+	pthread_t mbox_thread;
+	bool mbox_run;
+	u64 n_mbox;
+	u64 mbox_rng;
+	u64 mbox_clock_us;
+	u8 lsa[DOE_SIM_LSA_SIZE];
+	u8 shutdown_state;
+	u64 poison[DOE_SIM_POISON_MAX];
+	unsigned int n_poison;
+	unsigned int poison_next;
+};
+
+int doe_sim_init(struct doe_sim_dev *dev, u32 latency_us);
+int doe_sim_init_switch(struct doe_sim_dev *dev, u32 latency_us);
+void doe_sim_exit(struct doe_sim_dev *dev);
+void doe_sim_config(struct doe_sim_dev *dev, struct cxl_pdev_config *op);
+int doe_sim_irq_fd(struct doe_sim_dev *dev, u16 cap);
+int doe_sim_mbox_start(struct doe_sim_dev *dev, volatile u8 *regs);
+void doe_sim_mbox_stop(struct doe_sim_dev *dev);
+int doe_sim_mbox_attach(struct doe_sim_dev *dev, struct cxl_regs *r);
+int doe_sim_dist_parse(struct doe_sim_dist *d, const char *s);
+void doe_sim_seed(struct doe_sim_dev *dev, u64 seed);
+void doe_sim_virtual(struct doe_sim_dev *dev);
+
+#endif /*__DOE_SIM_H__*/
@@ -8,10 +8,15 @@ typedef uint8_t  u8;
 typedef uint16_t  u16;
 typedef uint32_t  u32;
 typedef uint64_t  u64;
+typedef int32_t  s32;
 
+/* The kernel uapi headers included before, vfio.h say, bring their own */
+#ifndef _LINUX_TYPES_H
 typedef uint8_t  __u8;
 typedef uint16_t  __u16;
 typedef uint32_t  __u32;
 typedef uint64_t  __u64;
+typedef int32_t  __s32;
+#endif
 
 #endif
@@ -1,6 +1,54 @@
 #ifndef __MBOX_H__
 #define __MBOX_H__
 
+#include <stddef.h>
+#include <cxlmem.h>
+
+struct transport;
+
 const char *cxl_mem_id_to_name(unsigned int);
 
+/*
+ * The commands of cxl_mem_commands[], typed, on the caller's payloads
+ * and nothing allocated: 0 or -errno, the device's return code turned
+ * into one by cxl_mbox_rc_errno().
+ */
+int cxl_mbox_rc_errno(u16 rc);
+int cxl_mbox_send(struct transport *t, unsigned int id, const void *in,
+		  size_t size_in, void *out, size_t *size_out);
+
+int cxl_identify(struct transport *t, struct cxl_mbox_identify *id);
+int cxl_get_fw_info(struct transport *t, struct cxl_mbox_get_fw_info *fw);
+int cxl_get_partition_info(struct transport *t,
+			   struct cxl_mbox_get_partition_info *pi);
+int cxl_set_partition_info(struct transport *t,
+			   const struct cxl_mbox_set_partition_info *pi);
+int cxl_get_health_info(struct transport *t, struct cxl_mbox_health_info *hi);
+int cxl_get_alert_config(struct transport *t,
+			 struct cxl_mbox_get_alert_config *ac);
+int cxl_set_alert_config(struct transport *t,
+			 const struct cxl_mbox_set_alert_config *ac);
+int cxl_get_shutdown_state(struct transport *t, u8 *state);
+int cxl_set_shutdown_state(struct transport *t, u8 state);
+int cxl_inject_poison(struct transport *t, u64 dpa);
+int cxl_clear_poison(struct transport *t,
+		     const struct cxl_mbox_clear_poison *cp);
+int cxl_get_scan_media_caps(struct transport *t, u64 dpa, u64 len,
+			    u32 *estimated_ms);
+int cxl_scan_media(struct transport *t, u64 dpa, u64 len, u8 flags);
+
+/* Variable size outputs: *@size bytes at most, those returned after */
+int cxl_get_supported_logs(struct transport *t,
+			   struct cxl_mbox_get_supported_logs *gsl,
+			   size_t *size);
+int cxl_get_log(struct transport *t, const u8 uuid[16], u32 offset,
+		void *out, size_t *size);
+int cxl_get_lsa(struct transport *t, u32 offset, void *out, size_t *size);
+int cxl_set_lsa(struct transport *t, struct cxl_mbox_set_lsa *lsa,
+		size_t len);
+int cxl_get_poison(struct transport *t, u64 dpa, u64 len,
+		   struct cxl_mbox_poison_out *po, size_t *size);
+int cxl_get_scan_media(struct transport *t,
+		       struct cxl_mbox_get_scan_media *sm, size_t *size);
+
 #endif /*__MBOX_H__*/
@@ -0,0 +1,25 @@
+#ifndef __PCI_H__
+#define __PCI_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <kernel_types.h>
+#include "../include/linux/cxl_mem.h"
+
+struct transport;
+
+/* Dwords in one vectored access, the whole extended config space */
+#define PCI_CFG_MAX_IOV		1024
+
+int pci_cfg_rw(struct transport *t, off_t base, struct cxl_pdev_config *ops,
+	       unsigned int n);
+int pci_memdev_dir(const char *memdev, char *dir, size_t len);
+u32 pci_cfg_read(struct transport *t, u32 offset);
+int pci_cfg_read_block(struct transport *t, u32 offset, u32 *buf,
+		       unsigned int n);
+u8 pci_find_cap(struct transport *t, u8 id);
+u16 pci_find_next_ext_cap(struct transport *t, u16 start, u16 id);
+u16 pci_find_dvsec(struct transport *t, u16 vendor, u16 id);
+int pci_dsn(struct transport *t, u64 *dsn);
+
+#endif /*__PCI_H__*/
@@ -0,0 +1,109 @@
+#ifndef __PERF_H__
+#define __PERF_H__
+
+#include <stdio.h>
+#include <limits.h>
+#include <kernel_types.h>
+#include <cdat.h>
+
+#define PERF_MAX_RANGES	16
+#define PERF_MAX_NODES	64
+#define PERF_MAX_HOPS	8
+
+/**
+ * struct perf_range - Performance of one DPA range, a DSMAS
+ * @handle: DSMAS handle, what the DSLBIS refer to
+ * @flags: CDAT_DSMAS_FLAG_*
+ * @dpa_base: start of the range in the device physical address space
+ * @dpa_length: its size
+ * @rd_lat: read latency in ps, 0 when the CDAT does not say
+ * @wr_lat: write latency in ps, 0 when the CDAT does not say
+ * @rd_bw: read bandwidth in MB/s, 0 when the CDAT does not say
+ * @wr_bw: write bandwidth in MB/s, 0 when the CDAT does not say
+ * @hpa_base: host physical address of the region mapping the range, or 0
+ * @node: the NUMA node backing the range, -1 when none does
+ */
+struct perf_range {
+	u8 handle;
+	u8 flags;
+	u64 dpa_base;
+	u64 dpa_length;
+	u64 rd_lat;
+	u64 wr_lat;
+	u64 rd_bw;
+	u64 wr_bw;
+	u64 hpa_base;
+	int node;
+};
+
+/**
+ * struct perf_model - What a memdev's CDAT says about its memory
+ * @memdev: memN
+ * @n: number of ranges in @r
+ * @r: one per DSMAS, in CDAT order
+ */
+struct perf_model {
+	char memdev[32];
+	int n;
+	struct perf_range r[PERF_MAX_RANGES];
+};
+
+/**
+ * struct perf_node - A NUMA node with memory, as the kernel reports it
+ * @id: node number
+ * @cpus: the node has CPUs, so its memory is CPU-attached
+ * @rd_lat: read latency in ps from its nearest initiators, 0 when unknown
+ * @rd_bw: read bandwidth in MB/s from its nearest initiators, 0 when unknown
+ */
+struct perf_node {
+	int id;
+	bool cpus;
+	u64 rd_lat;
+	u64 rd_bw;
+};
+
+/**
+ * struct perf_hop - A switch on the way from the host bridge to a memdev
+ * @name: PCI address of its upstream port, whose CDAT has the SSLBIS
+ * @port: port number of the downstream port the route leaves by
+ * @rd_lat: read latency in ps between the two ports, 0 when unknown
+ * @wr_lat: write latency in ps between the two ports, 0 when unknown
+ * @rd_bw: read bandwidth in MB/s between the two ports, 0 when unknown
+ * @wr_bw: write bandwidth in MB/s between the two ports, 0 when unknown
+ */
+struct perf_hop {
+	char name[32];
+	u16 port;
+	u64 rd_lat;
+	u64 wr_lat;
+	u64 rd_bw;
+	u64 wr_bw;
+};
+
+/**
+ * struct perf_route - From a host bridge down to a memdev
+ * @host_bridge: pciDDDD:BB, the host bridge
+ * @root_port: PCI address of the root port
+ * @n: number of switches in @hop
+ * @hop: the switches, from the root port down
+ */
+struct perf_route {
+	char host_bridge[32];
+	char root_port[32];
+	int n;
+	struct perf_hop hop[PERF_MAX_HOPS];
+};
+
+int perf_model_init(struct perf_model *m, const char *memdev,
+		    const struct cdat *cdat);
+int perf_model_map(struct perf_model *m);
+void perf_model_print(FILE *f, const struct perf_model *m);
+int perf_nodes(struct perf_node *nodes, int max);
+void perf_advise(FILE *f, const struct perf_model *m);
+int perf_pci_chain(const char *path, struct perf_route *rt, char (*dirs)[PATH_MAX],
+		   int max);
+int perf_hop_sslbis(struct perf_hop *hop, const struct cdat *cdat);
+void perf_route_print(FILE *f, const struct perf_model *m,
+		      const struct perf_route *rt);
+
+#endif /*__PERF_H__*/
@@ -0,0 +1,138 @@
+#ifndef __REGS_H__
+#define __REGS_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <kernel_types.h>
+
+struct transport;
+struct cxl_mbox_cmd;
+struct cxl_send_command;
+struct cxl_mem_query_commands;
+
+/* CXL 2.0 8.1.9 Register Locator DVSEC */
+#define CXL_DVSEC_REG_LOCATOR				8
+#define   CXL_DVSEC_REG_LOCATOR_BLOCK1_OFFSET		0xc
+#define     CXL_DVSEC_REG_LOCATOR_BIR_MASK		0x00000007
+#define     CXL_DVSEC_REG_LOCATOR_BLOCK_ID_MASK		0x0000ff00
+#define     CXL_DVSEC_REG_LOCATOR_BLOCK_OFF_LOW_MASK	0xffff0000
+
+/* Register Block Identifier */
+enum cxl_regloc_type {
+	CXL_REGLOC_RBI_EMPTY = 0,
+	CXL_REGLOC_RBI_COMPONENT,
+	CXL_REGLOC_RBI_VIRT,
+	CXL_REGLOC_RBI_MEMDEV,
+	CXL_REGLOC_RBI_TYPES
+};
+
+/* CXL 2.0 8.2.8.1 Device Capabilities Array Register */
+#define CXLDEV_CAP_ARRAY_OFFSET				0x0
+#define   CXLDEV_CAP_ARRAY_CAP_ID			0
+#define   CXLDEV_CAP_ARRAY_ID_MASK			0x000000000000ffffULL
+#define   CXLDEV_CAP_ARRAY_COUNT_MASK			0x0000ffff00000000ULL
+/* CXL 2.0 8.2.8.2 CXL Device Capability Header Register, 16 bytes each */
+#define CXLDEV_CAP_HDR_SIZE				0x10
+#define   CXLDEV_CAP_HDR_CAP_ID_MASK			0x0000ffff
+#define   CXLDEV_CAP_HDR_VERSION_MASK			0x00ff0000
+#define CXLDEV_CAP_HDR_OFFSET				0x4
+#define CXLDEV_CAP_HDR_LENGTH				0x8
+/* CXL 2.0 8.2.8.2.1 CXL Device Capabilities */
+#define CXLDEV_CAP_CAP_ID_DEVICE_STATUS			0x1
+#define CXLDEV_CAP_CAP_ID_PRIMARY_MAILBOX		0x2
+#define CXLDEV_CAP_CAP_ID_SECONDARY_MAILBOX		0x3
+#define CXLDEV_CAP_CAP_ID_MEMDEV			0x4000
+
+/* CXL 2.0 8.2.8.4 Mailbox Registers */
+#define CXLDEV_MBOX_CAPS_OFFSET				0x00
+#define   CXLDEV_MBOX_CAP_PAYLOAD_SIZE_MASK		0x0000001f
+#define   CXLDEV_MBOX_CAP_BG_CMD_IRQ			0x00000040
+#define CXLDEV_MBOX_CTRL_OFFSET				0x04
+#define   CXLDEV_MBOX_CTRL_DOORBELL			0x00000001
+#define CXLDEV_MBOX_CMD_OFFSET				0x08
+#define   CXLDEV_MBOX_CMD_COMMAND_OPCODE_MASK		0x000000000000ffffULL
+#define   CXLDEV_MBOX_CMD_PAYLOAD_LENGTH_MASK		0x0000001fffff0000ULL
+#define CXLDEV_MBOX_STATUS_OFFSET			0x10
+#define   CXLDEV_MBOX_STATUS_BG_CMD			0x0000000000000001ULL
+#define   CXLDEV_MBOX_STATUS_RET_CODE_MASK		0x0000ffff00000000ULL
+#define CXLDEV_MBOX_BG_CMD_STATUS_OFFSET		0x18
+#define   CXLDEV_MBOX_BG_CMD_COMMAND_OPCODE_MASK	0x000000000000ffffULL
+#define   CXLDEV_MBOX_BG_CMD_PCT_MASK			0x00000000007f0000ULL
+#define   CXLDEV_MBOX_BG_CMD_RET_CODE_MASK		0x0000ffff00000000ULL
+#define CXLDEV_MBOX_PAYLOAD_OFFSET			0x20
+
+/* How long a command may take, in the foreground and in the background */
+#define CXL_MAILBOX_TIMEOUT_US				2000000
+#define CXL_MAILBOX_BG_TIMEOUT_US			60000000
+/* Spun on before the doorbell wait yields the CPU */
+#define CXL_MAILBOX_SPIN_US				10
+
+/* CXL 2.0 8.2.8.5.1.1 Memory Device Status Register */
+#define CXLMDEV_STATUS_OFFSET				0x0
+#define   CXLMDEV_DEV_FATAL				0x00000001
+#define   CXLMDEV_FW_HALT				0x00000002
+#define   CXLMDEV_MEDIA_STATUS_MASK			0x0000000c
+#define     CXLMDEV_MS_READY				1
+#define   CXLMDEV_MBOX_IF_READY				0x00000010
+
+static inline u32 cxl_readl(const volatile void *addr)
+{
+	return *(const volatile u32 *)addr;
+}
+
+static inline u64 cxl_readq(const volatile void *addr)
+{
+	return *(const volatile u64 *)addr;
+}
+
+static inline void cxl_writel(u32 val, volatile void *addr)
+{
+	*(volatile u32 *)addr = val;
+}
+
+static inline void cxl_writeq(u64 val, volatile void *addr)
+{
+	*(volatile u64 *)addr = val;
+}
+
+/**
+ * struct cxl_regs - The CXL memory device register block, mapped
+ * @bar: the BAR it is in
+ * @offset: where in the BAR
+ * @base: mapped, at @offset
+ * @len: bytes mapped past @base
+ * @status: Device Status capability, NULL when absent
+ * @mbox: Primary Mailbox capability, NULL when absent
+ * @memdev: Memory Device Status capability, NULL when absent
+ * @payload_size: mailbox payload registers, in bytes
+ * @cel_ids: BIT(CXL_MEM_COMMAND_ID_*) of the commands in the Command
+ *	     Effects Log, once cxl_regs_query() read it; 0 before
+ * @ring: called with @ring_priv once the doorbell is rung, for a device
+ *	  answering in the caller's thread, the simulated one on a
+ *	  virtual clock; NULL for the others
+ */
+struct cxl_regs {
+	int bar;
+	u64 offset;
+	volatile u8 *base;
+	size_t len;
+	volatile u8 *status;
+	volatile u8 *mbox;
+	volatile u8 *memdev;
+	size_t payload_size;
+	u64 cel_ids;
+	void (*ring)(void *priv);
+	void *ring_priv;
+};
+
+int cxl_regloc_find(struct transport *t, enum cxl_regloc_type type, int *bar,
+		    u64 *offset);
+int cxl_regs_probe(struct cxl_regs *r, volatile u8 *base, size_t len);
+int cxl_regs_map(struct cxl_regs *r, struct transport *t);
+void cxl_regs_print(FILE *f, const struct cxl_regs *r);
+int cxl_regs_mbox_send(struct cxl_regs *r, struct cxl_mbox_cmd *cmd);
+int cxl_regs_attach(struct transport *t);
+int cxl_regs_send_command(struct transport *t, struct cxl_send_command *send);
+int cxl_regs_query(struct transport *t, struct cxl_mem_query_commands *q);
+
+#endif /*__REGS_H__*/
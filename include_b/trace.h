@@ -0,0 +1,95 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdio.h>
+#include <time.h>
+#include <kernel_types.h>
+#include "../include/linux/cxl_mem.h"
+
+/* Records kept, the oldest overwritten first */
+#define TRACE_RING_ORDER	16
+#define TRACE_RING_SIZE		(1U << TRACE_RING_ORDER)
+
+/**
+ * enum debug_level - What is printed as it happens
+ * @DEBUG_LEVEL_OFF: nothing, the default
+ * @DEBUG_LEVEL_DEBUG: the pr_debug() messages
+ * @DEBUG_LEVEL_ACCESS: those and every config space access
+ */
+enum debug_level {
+	DEBUG_LEVEL_OFF,
+	DEBUG_LEVEL_DEBUG,
+	DEBUG_LEVEL_ACCESS,
+};
+
+extern int debug_level;
+
+/**
+ * struct trace_rec - One config space access
+ * @ts_ns: CLOCK_MONOTONIC time it was issued
+ * @dur_ns: time the access took, its share of a batch for batched ones
+ * @offset: config space offset, as given to the transport
+ * @val: value written, or read
+ * @cap: DOE capability it belongs to, to name the register
+ * @is_write: WRITE or READ
+ * @err: the access failed
+ */
+struct trace_rec {
+	u64 ts_ns;
+	u32 dur_ns;
+	u32 offset;
+	u32 val;
+	u16 cap;
+	u8 is_write;
+	u8 err;
+};
+
+/**
+ * struct trace_ring - The accesses, recorded without formatting them
+ * @on: record, off unless asked for
+ * @head: records ever taken, the next one goes to head % TRACE_RING_SIZE
+ * @rec: the records
+ */
+struct trace_ring {
+	bool on;
+	u64 head;
+	struct trace_rec rec[TRACE_RING_SIZE];
+};
+
+extern struct trace_ring trace_ring;
+
+static inline bool trace_on(void)
+{
+	return trace_ring.on;
+}
+
+static inline u64 trace_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Safe from several threads at once, each taking a slot of its own */
+static inline void trace_access(u16 cap, const struct cxl_pdev_config *op,
+				u64 ts_ns, u32 dur_ns)
+{
+	struct trace_rec *r;
+	u64 slot;
+
+	slot = __atomic_fetch_add(&trace_ring.head, 1, __ATOMIC_RELAXED);
+	r = &trace_ring.rec[slot & (TRACE_RING_SIZE - 1)];
+	r->ts_ns = ts_ns;
+	r->dur_ns = dur_ns;
+	r->offset = op->offset;
+	r->val = op->val;
+	r->cap = cap;
+	r->is_write = op->is_write;
+	r->err = op->retval != 0;
+}
+
+void trace_start(void);
+void trace_dump(FILE *f);
+
+#endif /*__TRACE_H__*/
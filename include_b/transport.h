@@ -0,0 +1,115 @@
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+#include <errno.h>
+#include <limits.h>
+#include <kernel_types.h>
+#include "../include/linux/cxl_mem.h"
+
+struct doe_sim_dev;
+struct transport;
+struct cxl_regs;
+
+/* What a transport can do, for the layers above to pick the fastest one */
+#define TRANSPORT_CFG_ABS	(1U << 0)	/* absolute config offsets */
+#define TRANSPORT_BATCH		(1U << 1)	/* many accesses in one call */
+#define TRANSPORT_ASYNC		(1U << 2)	/* DOE completion on an fd */
+#define TRANSPORT_MBOX		(1U << 3)	/* CXL mailbox commands */
+#define TRANSPORT_MMIO		(1U << 4)	/* BARs mapped */
+
+/**
+ * struct transport_ops - A way to reach a device
+ * @name: as given to transport_open()
+ * @config: @n config space accesses, the contract of CXL_MEM_CONFIG_WR;
+ *	    only more than one with TRANSPORT_BATCH
+ * @irq_fd: an fd readable when the DOE instance at @cap interrupts,
+ *	    with TRANSPORT_ASYNC
+ * @irq_release: done with what @irq_fd returned
+ * @mbox_send: a CXL mailbox command, with TRANSPORT_MBOX
+ * @query: the CXL mailbox commands supported, with TRANSPORT_MBOX
+ * @bar_map: map a BAR, with TRANSPORT_MMIO; the mapping is the
+ *	     backend's, kept until @close
+ * @close: release the backend
+ *
+ * The operations return 0 or -errno.
+ */
+struct transport_ops {
+	const char *name;
+	int (*config)(struct transport *t, struct cxl_pdev_config *ops,
+		      unsigned int n);
+	int (*irq_fd)(struct transport *t, u16 cap);
+	void (*irq_release)(struct transport *t, u16 cap, int fd);
+	int (*mbox_send)(struct transport *t, struct cxl_send_command *cmd);
+	int (*query)(struct transport *t, struct cxl_mem_query_commands *q);
+	int (*bar_map)(struct transport *t, int bar, void **base, size_t *len);
+	void (*close)(struct transport *t);
+};
+
+/**
+ * struct transport - An open transport to a device
+ * @ops: its backend, NULL when not open
+ * @caps: TRANSPORT_*, settled at open: the DOE mailboxes drive one
+ *	  transport from a thread each, none of which writes them
+ * @fd: the file the backend works on, -1 for none
+ * @sim: the simulated device, for the sim backend
+ * @priv: whatever else the backend keeps
+ * @path: sysfs directory of the PCI function, when known
+ * @regs: the device registers, once cxl_regs_attach() mapped them
+ * @n_syscall: system calls the backend issued, what batching saves;
+ *	       counted and read with transport_count_syscall() and
+ *	       transport_syscalls(), from any thread
+ */
+struct transport {
+	const struct transport_ops *ops;
+	unsigned int caps;
+	int fd;
+	struct doe_sim_dev *sim;
+	void *priv;
+	char path[PATH_MAX];
+	struct cxl_regs *regs;
+	u64 n_syscall;
+};
+
+int transport_open_ioctl(struct transport *t, const char *memdev);
+int transport_open_sysfs(struct transport *t, const char *memdev);
+int transport_open_sysfs_dev(struct transport *t, const char *dir);
+int transport_open_uring(struct transport *t, const char *memdev);
+int transport_open_uring_dev(struct transport *t, const char *dir);
+int transport_open_vfio(struct transport *t, const char *bdf);
+int transport_open_vfio_file(struct transport *t, const char *path);
+int transport_vfio_file_create(const char *path, const void *cfg,
+			       size_t cfg_len, int bar, const void *regs,
+			       size_t regs_len);
+void transport_open_sim(struct transport *t, struct doe_sim_dev *sim);
+int transport_record(struct transport *t, const char *path);
+int transport_open_replay(struct transport *t, const char *path);
+int transport_replay_scale(struct transport *t, double scale);
+int transport_open(struct transport *t, const char *name, const char *memdev,
+		   unsigned int need);
+void transport_close(struct transport *t);
+const char *transport_name(const struct transport *t);
+void transport_print_caps(const struct transport *t);
+
+static inline int transport_config(struct transport *t,
+				   struct cxl_pdev_config *ops, unsigned int n)
+{
+	return t->ops ? t->ops->config(t, ops, n) : -ENODEV;
+}
+
+static inline void transport_count_syscall(struct transport *t)
+{
+	__atomic_fetch_add(&t->n_syscall, 1, __ATOMIC_RELAXED);
+}
+
+static inline u64 transport_syscalls(const struct transport *t)
+{
+	return __atomic_load_n(&t->n_syscall, __ATOMIC_RELAXED);
+}
+
+int transport_irq_fd(struct transport *t, u16 cap);
+void transport_irq_release(struct transport *t, u16 cap, int fd);
+int transport_mbox_send(struct transport *t, struct cxl_send_command *cmd);
+int transport_query(struct transport *t, struct cxl_mem_query_commands *q);
+int transport_bar_map(struct transport *t, int bar, void **base, size_t *len);
+
+#endif /*__TRANSPORT_H__*/
@@ -0,0 +1,31 @@
+#ifndef __XFER_H__
+#define __XFER_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <kernel_types.h>
+
+struct cxl_dev;
+
+/*
+ * A chunk of a transfer, @len bytes at @off of it: what a read delivers,
+ * or, for a write, what to fill in. 0 to go on, -errno to stop there.
+ */
+typedef int (*cxl_xfer_fn)(void *priv, u64 off, void *buf, size_t len);
+
+/* The cxl_xfer_fn of a file, @priv its int fd: written to, or read from */
+int cxl_xfer_to_fd(void *priv, u64 off, void *buf, size_t len);
+int cxl_xfer_from_fd(void *priv, u64 off, void *buf, size_t len);
+
+ssize_t cxl_xfer_get_log(struct cxl_dev *d, const u8 uuid[16], u32 off,
+			 u32 len, cxl_xfer_fn fn, void *priv);
+ssize_t cxl_xfer_get_lsa(struct cxl_dev *d, u32 off, u32 len,
+			 cxl_xfer_fn fn, void *priv);
+ssize_t cxl_xfer_set_lsa(struct cxl_dev *d, u32 off, u32 len,
+			 cxl_xfer_fn fn, void *priv);
+ssize_t cxl_xfer_get_poison(struct cxl_dev *d, u64 dpa, u64 len,
+			    cxl_xfer_fn fn, void *priv);
+ssize_t cxl_xfer_get_scan_media(struct cxl_dev *d, cxl_xfer_fn fn,
+				void *priv);
+
+#endif /*__XFER_H__*/
@@ -1,7 +1,12 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
 #include <cxlmem.h>
+#include <mbox.h>
+#include <transport.h>
 #include <kernel_types.h>
 #include "include/linux/cxl_mem.h"
 
@@ -32,6 +37,39 @@
 	.flags = _flags,                                                       \
 	}
 
+#define CXL_CMD_IN(_id, sin, sout, _flags)	CXL_CMD(_id, sin, sout, _flags),
+#define CXL_CMD_OPCODE(_id, sin, sout, _flags)                                 \
+	[CXL_MBOX_OP_##_id] = CXL_MEM_COMMAND_ID_##_id,
+
+/*
+ * The commands but RAW, their sizes those of the payload structs of
+ * cxlmem.h, which are checked against the specification there.
+ */
+#define CXL_MEM_COMMANDS(C)                                                    \
+	C(IDENTIFY, 0, sizeof(struct cxl_mbox_identify),                       \
+	  CXL_CMD_FLAG_FORCE_ENABLE)                                           \
+	C(GET_SUPPORTED_LOGS, 0, CXL_VARIABLE_PAYLOAD,                         \
+	  CXL_CMD_FLAG_FORCE_ENABLE)                                           \
+	C(GET_FW_INFO, 0, sizeof(struct cxl_mbox_get_fw_info), 0)              \
+	C(GET_PARTITION_INFO, 0, sizeof(struct cxl_mbox_get_partition_info), 0) \
+	C(GET_LSA, sizeof(struct cxl_mbox_get_lsa), CXL_VARIABLE_PAYLOAD, 0)   \
+	C(GET_HEALTH_INFO, 0, sizeof(struct cxl_mbox_health_info), 0)          \
+	C(GET_LOG, sizeof(struct cxl_mbox_get_log), CXL_VARIABLE_PAYLOAD,      \
+	  CXL_CMD_FLAG_FORCE_ENABLE)                                           \
+	C(SET_PARTITION_INFO, sizeof(struct cxl_mbox_set_partition_info), 0, 0) \
+	C(SET_LSA, CXL_VARIABLE_PAYLOAD, 0, 0)                                 \
+	C(GET_ALERT_CONFIG, 0, sizeof(struct cxl_mbox_get_alert_config), 0)    \
+	C(SET_ALERT_CONFIG, sizeof(struct cxl_mbox_set_alert_config), 0, 0)    \
+	C(GET_SHUTDOWN_STATE, 0, sizeof(struct cxl_mbox_shutdown_state), 0)    \
+	C(SET_SHUTDOWN_STATE, sizeof(struct cxl_mbox_shutdown_state), 0, 0)    \
+	C(GET_POISON, sizeof(struct cxl_mbox_poison_in), CXL_VARIABLE_PAYLOAD, 0) \
+	C(INJECT_POISON, sizeof(struct cxl_mbox_inject_poison), 0, 0)          \
+	C(CLEAR_POISON, sizeof(struct cxl_mbox_clear_poison), 0, 0)            \
+	C(GET_SCAN_MEDIA_CAPS, sizeof(struct cxl_mbox_poison_in),              \
+	  sizeof(struct cxl_mbox_scan_media_caps), 0)                          \
+	C(SCAN_MEDIA, sizeof(struct cxl_mbox_scan_media), 0, 0)                \
+	C(GET_SCAN_MEDIA, 0, CXL_VARIABLE_PAYLOAD, 0)
+
 /*
  * This table defines the supported mailbox commands for the driver. This table
  * is made up of a UAPI structure. Non-negative values as parameters in the
@@ -39,48 +77,364 @@
  * 0, and the user passed in 1, it is an error.
  */
 static struct cxl_mem_command cxl_mem_commands[CXL_MEM_COMMAND_ID_MAX] = {
-	CXL_CMD(IDENTIFY, 0, 0x43, CXL_CMD_FLAG_FORCE_ENABLE),
+	CXL_MEM_COMMANDS(CXL_CMD_IN)
 #ifdef CONFIG_CXL_MEM_RAW_COMMANDS
 	CXL_CMD(RAW, CXL_VARIABLE_PAYLOAD, CXL_VARIABLE_PAYLOAD, 0),
 #endif
-	CXL_CMD(GET_SUPPORTED_LOGS, 0, CXL_VARIABLE_PAYLOAD, CXL_CMD_FLAG_FORCE_ENABLE),
-	CXL_CMD(GET_FW_INFO, 0, 0x50, 0),
-	CXL_CMD(GET_PARTITION_INFO, 0, 0x20, 0),
-	CXL_CMD(GET_LSA, 0x8, CXL_VARIABLE_PAYLOAD, 0),
-	CXL_CMD(GET_HEALTH_INFO, 0, 0x12, 0),
-	CXL_CMD(GET_LOG, 0x18, CXL_VARIABLE_PAYLOAD, CXL_CMD_FLAG_FORCE_ENABLE),
-	CXL_CMD(SET_PARTITION_INFO, 0x0a, 0, 0),
-	CXL_CMD(SET_LSA, CXL_VARIABLE_PAYLOAD, 0, 0),
-	CXL_CMD(GET_ALERT_CONFIG, 0, 0x10, 0),
-	CXL_CMD(SET_ALERT_CONFIG, 0xc, 0, 0),
-	CXL_CMD(GET_SHUTDOWN_STATE, 0, 0x1, 0),
-	CXL_CMD(SET_SHUTDOWN_STATE, 0x1, 0, 0),
-	CXL_CMD(GET_POISON, 0x10, CXL_VARIABLE_PAYLOAD, 0),
-	CXL_CMD(INJECT_POISON, 0x8, 0, 0),
-	CXL_CMD(CLEAR_POISON, 0x48, 0, 0),
-	CXL_CMD(GET_SCAN_MEDIA_CAPS, 0x10, 0x4, 0),
-	CXL_CMD(SCAN_MEDIA, 0x11, 0, 0),
-	CXL_CMD(GET_SCAN_MEDIA, 0, CXL_VARIABLE_PAYLOAD, 0),
 };
 
-__attribute__((unused))
-static struct cxl_mem_command *cxl_mem_find_command(u16 opcode)
+_Static_assert(CXL_MEM_COMMAND_ID_MAX <= 0x100,
+	       "cxl_mem_opcode_ids[] holds command IDs in a byte");
+
+/*
+ * The command ID of each opcode, 0 for those not in the table: the
+ * mailbox responders look every command up by its opcode. 64 KiB of
+ * read-only data, of which the few pages with commands are touched.
+ */
+static const u8 cxl_mem_opcode_ids[CXL_MBOX_OP_MAX] = {
+	CXL_MEM_COMMANDS(CXL_CMD_OPCODE)
+};
+
+const struct cxl_mem_command *cxl_mem_find_command(u16 opcode)
 {
-	struct cxl_mem_command *c;
+	u8 id = cxl_mem_opcode_ids[opcode];
+
+	return id ? &cxl_mem_commands[id] : NULL;
+}
 
-	cxl_for_each_cmd(c)
-		if (c->opcode == opcode)
-			return c;
+/* The command of CXL_MEM_COMMAND_ID_@id, NULL when not built in */
+const struct cxl_mem_command *cxl_mem_find_id(unsigned int id)
+{
+	if (id >= CXL_MEM_COMMAND_ID_MAX || !cxl_mem_commands[id].info.id)
+		return NULL;
 
-	return NULL;
+	return &cxl_mem_commands[id];
 }
 
+/* Of CXL_MEM_COMMAND_ID_@id, "unknown" beyond the IDs there are */
 const char *cxl_mem_id_to_name(unsigned int id)
 {
-	struct cxl_mem_command *c = &cxl_mem_commands[id];
+	if (id >= CXL_MEM_COMMAND_ID_MAX)
+		return "unknown";
 
-	if (!c)
-		return NULL;
+	return cxl_command_names[cxl_mem_commands[id].info.id].name;
+}
+
+/**
+ * cxl_mem_query_ids() - Commands of cxl_mem_commands[], the way
+ *			 CXL_MEM_QUERY_COMMANDS reports them
+ * @q: as given to the ioctl
+ * @ids: BIT(CXL_MEM_COMMAND_ID_*) of those to report
+ *
+ * For the transports that drive the mailbox themselves.
+ *
+ * Return: 0
+ */
+int cxl_mem_query_ids(struct cxl_mem_query_commands *q, u64 ids)
+{
+	struct cxl_mem_command *c;
+	u32 n = 0;
+
+	cxl_for_each_cmd(c) {
+		/* Those not built in, RAW without CONFIG_CXL_MEM_RAW_COMMANDS */
+		if (!c->info.id || !(ids & 1ULL << c->info.id))
+			continue;
+		if (n < q->n_commands)
+			q->commands[n] = c->info;
+		n++;
+	}
+
+	if (!q->n_commands || n < q->n_commands)
+		q->n_commands = n;
+	return 0;
+}
+
+/* Every command the tool knows, whether the device has it or not */
+int cxl_mem_query(struct cxl_mem_query_commands *q)
+{
+	return cxl_mem_query_ids(q, ~0ULL);
+}
+
+/**
+ * cxl_mem_validate() - Turn a CXL_MEM_SEND_COMMAND into a mailbox command
+ * @send: as given to the ioctl
+ * @payload_size: size of the payload registers of the mailbox
+ * @mbox_cmd: filled in, its payloads those of @send
+ *
+ * The checks of the driver on the sizes, against cxl_mem_commands[].
+ *
+ * Return: 0, -ENOTTY for a command not in the table, -EINVAL for sizes
+ * it does not take
+ */
+int cxl_mem_validate(const struct cxl_send_command *send, size_t payload_size,
+		     struct cxl_mbox_cmd *mbox_cmd)
+{
+	const struct cxl_mem_command *c;
+
+	if (send->id == CXL_MEM_COMMAND_ID_INVALID ||
+	    send->id >= CXL_MEM_COMMAND_ID_MAX)
+		return -ENOTTY;
+
+	c = &cxl_mem_commands[send->id];
+	if (!c->info.id)
+		return -ENOTTY;
+
+	if (send->in.size > payload_size)
+		return -EINVAL;
+	if (c->info.size_in != CXL_VARIABLE_PAYLOAD &&
+	    c->info.size_in != send->in.size)
+		return -EINVAL;
+	if (c->info.size_out != CXL_VARIABLE_PAYLOAD &&
+	    c->info.size_out > send->out.size)
+		return -EINVAL;
+
+	*mbox_cmd = (struct cxl_mbox_cmd) {
+		.opcode = send->id == CXL_MEM_COMMAND_ID_RAW ?
+			  send->raw.opcode : c->opcode,
+		.payload_in = (void *)(uintptr_t)send->in.payload,
+		.payload_out = (void *)(uintptr_t)send->out.payload,
+		.size_in = send->in.size,
+		.size_out = send->out.size < payload_size ?
+			    send->out.size : payload_size,
+	};
+	return 0;
+}
+
+/**
+ * cxl_mbox_rc_errno() - What a device return code means to the caller
+ * @rc: CXL 2.0 8.2.8.4.5.1 Command Return Code
+ *
+ * Return: 0 for success, -errno otherwise
+ */
+int cxl_mbox_rc_errno(u16 rc)
+{
+	switch (rc) {
+	case CXL_MBOX_CMD_RC_SUCCESS:
+		return 0;
+	case CXL_MBOX_CMD_RC_INPUT:
+		return -EINVAL;
+	case CXL_MBOX_CMD_RC_UNSUPPORTED:
+		return -EOPNOTSUPP;
+	case CXL_MBOX_CMD_RC_RETRY:
+	case CXL_MBOX_CMD_RC_BUSY:
+		return -EBUSY;
+	case CXL_MBOX_CMD_RC_INTERNAL:
+		return -EIO;
+	default:
+		return -ENXIO;
+	}
+}
+
+/**
+ * cxl_mbox_send() - A command of cxl_mem_commands[] over @t
+ * @t: a transport with TRANSPORT_MBOX
+ * @id: CXL_MEM_COMMAND_ID_*
+ * @in: its input payload, @size_in bytes
+ * @size_in: of @in
+ * @out: for its output payload, NULL when it has none
+ * @size_out: what @out holds; the bytes the device returned on success
+ *
+ * What the typed commands below go through, on the caller's buffers.
+ *
+ * Return: 0, -errno of the transport or for the device return code
+ */
+int cxl_mbox_send(struct transport *t, unsigned int id, const void *in,
+		  size_t size_in, void *out, size_t *size_out)
+{
+	struct cxl_send_command cmd = {
+		.id = id,
+		.in.size = size_in,
+		.in.payload = (unsigned long)in,
+		.out.size = size_out ? *size_out : 0,
+		.out.payload = (unsigned long)out,
+	};
+	int ret = transport_mbox_send(t, &cmd);
+
+	if (ret)
+		return ret;
+	if (size_out)
+		*size_out = cmd.out.size;
+	return cxl_mbox_rc_errno(cmd.retval);
+}
+
+/* A command of fixed size output @size, @out holding all of it */
+static int cxl_mbox_get(struct transport *t, unsigned int id, const void *in,
+			size_t size_in, void *out, size_t size)
+{
+	size_t n = size;
+	int ret = cxl_mbox_send(t, id, in, size_in, out, &n);
+
+	if (ret)
+		return ret;
+	/* Short of what the table said: the rest is the device's to say */
+	if (n < size)
+		memset((u8 *)out + n, 0, size - n);
+	return 0;
+}
+
+int cxl_identify(struct transport *t, struct cxl_mbox_identify *id)
+{
+	return cxl_mbox_get(t, CXL_MEM_COMMAND_ID_IDENTIFY, NULL, 0,
+			    id, sizeof(*id));
+}
 
-	return cxl_command_names[c->info.id].name;
+int cxl_get_fw_info(struct transport *t, struct cxl_mbox_get_fw_info *fw)
+{
+	return cxl_mbox_get(t, CXL_MEM_COMMAND_ID_GET_FW_INFO, NULL, 0,
+			    fw, sizeof(*fw));
+}
+
+int cxl_get_partition_info(struct transport *t,
+			   struct cxl_mbox_get_partition_info *pi)
+{
+	return cxl_mbox_get(t, CXL_MEM_COMMAND_ID_GET_PARTITION_INFO, NULL, 0,
+			    pi, sizeof(*pi));
+}
+
+int cxl_set_partition_info(struct transport *t,
+			   const struct cxl_mbox_set_partition_info *pi)
+{
+	return cxl_mbox_send(t, CXL_MEM_COMMAND_ID_SET_PARTITION_INFO,
+			     pi, sizeof(*pi), NULL, NULL);
+}
+
+int cxl_get_health_info(struct transport *t, struct cxl_mbox_health_info *hi)
+{
+	return cxl_mbox_get(t, CXL_MEM_COMMAND_ID_GET_HEALTH_INFO, NULL, 0,
+			    hi, sizeof(*hi));
+}
+
+int cxl_get_alert_config(struct transport *t,
+			 struct cxl_mbox_get_alert_config *ac)
+{
+	return cxl_mbox_get(t, CXL_MEM_COMMAND_ID_GET_ALERT_CONFIG, NULL, 0,
+			    ac, sizeof(*ac));
+}
+
+int cxl_set_alert_config(struct transport *t,
+			 const struct cxl_mbox_set_alert_config *ac)
+{
+	return cxl_mbox_send(t, CXL_MEM_COMMAND_ID_SET_ALERT_CONFIG,
+			     ac, sizeof(*ac), NULL, NULL);
+}
+
+int cxl_get_shutdown_state(struct transport *t, u8 *state)
+{
+	struct cxl_mbox_shutdown_state ss;
+	int ret = cxl_mbox_get(t, CXL_MEM_COMMAND_ID_GET_SHUTDOWN_STATE,
+			       NULL, 0, &ss, sizeof(ss));
+
+	if (!ret)
+		*state = ss.state;
+	return ret;
+}
+
+int cxl_set_shutdown_state(struct transport *t, u8 state)
+{
+	struct cxl_mbox_shutdown_state ss = { .state = state };
+
+	return cxl_mbox_send(t, CXL_MEM_COMMAND_ID_SET_SHUTDOWN_STATE,
+			     &ss, sizeof(ss), NULL, NULL);
+}
+
+int cxl_inject_poison(struct transport *t, u64 dpa)
+{
+	struct cxl_mbox_inject_poison ip = { .address = dpa };
+
+	return cxl_mbox_send(t, CXL_MEM_COMMAND_ID_INJECT_POISON,
+			     &ip, sizeof(ip), NULL, NULL);
+}
+
+int cxl_clear_poison(struct transport *t,
+		     const struct cxl_mbox_clear_poison *cp)
+{
+	return cxl_mbox_send(t, CXL_MEM_COMMAND_ID_CLEAR_POISON,
+			     cp, sizeof(*cp), NULL, NULL);
+}
+
+int cxl_get_scan_media_caps(struct transport *t, u64 dpa, u64 len,
+			    u32 *estimated_ms)
+{
+	struct cxl_mbox_poison_in in = { .offset = dpa, .length = len };
+	struct cxl_mbox_scan_media_caps caps;
+	int ret = cxl_mbox_get(t, CXL_MEM_COMMAND_ID_GET_SCAN_MEDIA_CAPS,
+			       &in, sizeof(in), &caps, sizeof(caps));
+
+	if (!ret)
+		*estimated_ms = caps.estimated_ms;
+	return ret;
+}
+
+/* Returns once the device is done with it, in the background or not */
+int cxl_scan_media(struct transport *t, u64 dpa, u64 len, u8 flags)
+{
+	struct cxl_mbox_scan_media sm = {
+		.offset = dpa,
+		.length = len,
+		.flags = flags,
+	};
+
+	return cxl_mbox_send(t, CXL_MEM_COMMAND_ID_SCAN_MEDIA,
+			     &sm, sizeof(sm), NULL, NULL);
+}
+
+/*
+ * The variable size outputs: @size bytes at most of @out, the bytes
+ * the device returned in *@size on success.
+ */
+
+int cxl_get_supported_logs(struct transport *t,
+			   struct cxl_mbox_get_supported_logs *gsl,
+			   size_t *size)
+{
+	return cxl_mbox_send(t, CXL_MEM_COMMAND_ID_GET_SUPPORTED_LOGS,
+			     NULL, 0, gsl, size);
+}
+
+int cxl_get_log(struct transport *t, const u8 uuid[16], u32 offset,
+		void *out, size_t *size)
+{
+	struct cxl_mbox_get_log in = {
+		.offset = offset,
+		.length = *size,
+	};
+
+	memcpy(in.uuid, uuid, sizeof(in.uuid));
+	return cxl_mbox_send(t, CXL_MEM_COMMAND_ID_GET_LOG, &in, sizeof(in),
+			     out, size);
+}
+
+int cxl_get_lsa(struct transport *t, u32 offset, void *out, size_t *size)
+{
+	struct cxl_mbox_get_lsa in = {
+		.offset = offset,
+		.length = *size,
+	};
+
+	return cxl_mbox_send(t, CXL_MEM_COMMAND_ID_GET_LSA, &in, sizeof(in),
+			     out, size);
+}
+
+/* @lsa holds its offset and @len bytes of data after it, sent in place */
+int cxl_set_lsa(struct transport *t, struct cxl_mbox_set_lsa *lsa, size_t len)
+{
+	lsa->reserved = 0;
+	return cxl_mbox_send(t, CXL_MEM_COMMAND_ID_SET_LSA,
+			     lsa, sizeof(*lsa) + len, NULL, NULL);
+}
+
+int cxl_get_poison(struct transport *t, u64 dpa, u64 len,
+		   struct cxl_mbox_poison_out *po, size_t *size)
+{
+	struct cxl_mbox_poison_in in = { .offset = dpa, .length = len };
+
+	return cxl_mbox_send(t, CXL_MEM_COMMAND_ID_GET_POISON,
+			     &in, sizeof(in), po, size);
+}
+
+int cxl_get_scan_media(struct transport *t,
+		       struct cxl_mbox_get_scan_media *sm, size_t *size)
+{
+	return cxl_mbox_send(t, CXL_MEM_COMMAND_ID_GET_SCAN_MEDIA,
+			     NULL, 0, sm, size);
 }
@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "include/linux/pci_regs.h"
+
+#include <pci.h>
+#include <regs.h>
+#include <transport.h>
+
+/**
+ * DOC: pci
+ *
+ * The sysfs backend of the transports, the config file of the PCI
+ * function behind a memdev or of a port on the way to it. Unlike
+ * CXL_MEM_CONFIG_WR, whose offsets the driver relocates to its own DOE
+ * instance, the offsets here are absolute, so the extended capability
+ * list can be walked and every DOE instance reached. Stock kernels have
+ * it, root only for the extended config space.
+ *
+ * Each call is a system call, so the accesses a batch queues are merged
+ * into runs: reads, or writes, of consecutive dwords go in one preadv()
+ * or pwritev(). A read of the whole extended config space is a single
+ * one. The DOE response drain alternates a read of the Read Data
+ * Mailbox and the write acking it, the same register, which no vector
+ * merges; it stays a call per access.
+ *
+ * The BARs are the resourceN files next to config, mapped whole on
+ * first use. A directory holding a config and a resource2 file made up
+ * for the purpose passes for a device, see -sim_mbox_serve.
+ *
+ * And the config space helpers, over any transport with absolute
+ * offsets.
+ */
+
+/**
+ * pci_cfg_rw() - Config space accesses on a file, merged into vectors
+ * @t: its fd is the file
+ * @base: file offset of config space offset 0
+ * @ops: the accesses, each retval set
+ * @n: number of @ops
+ *
+ * Return: 0, or -errno of the first run failing
+ */
+int pci_cfg_rw(struct transport *t, off_t base, struct cxl_pdev_config *ops,
+	       unsigned int n)
+{
+	struct iovec iov[PCI_CFG_MAX_IOV];
+	unsigned int i, j, k;
+	ssize_t ret;
+	int err = 0;
+
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && j - i < PCI_CFG_MAX_IOV &&
+		     ops[j].is_write == ops[i].is_write &&
+		     ops[j].offset == ops[j - 1].offset + sizeof(ops[j].val); j++)
+			;
+
+		for (k = i; k < j; k++) {
+			iov[k - i].iov_base = &ops[k].val;
+			iov[k - i].iov_len = sizeof(ops[k].val);
+		}
+
+		transport_count_syscall(t);
+		if (ops[i].is_write)
+			ret = pwritev(t->fd, iov, j - i, base + ops[i].offset);
+		else
+			ret = preadv(t->fd, iov, j - i, base + ops[i].offset);
+
+		/* A short transfer fails the accesses past its end */
+		for (k = i; k < j; k++)
+			ops[k].retval = ret >= (ssize_t)((k - i + 1) *
+							 sizeof(ops[k].val)) ? 0 : -1;
+		if (ret != (ssize_t)((j - i) * sizeof(ops[i].val)) && !err)
+			err = ret < 0 ? -errno : -EIO;
+	}
+
+	return err;
+}
+
+static int transport_sysfs_config(struct transport *t,
+				  struct cxl_pdev_config *ops, unsigned int n)
+{
+	return pci_cfg_rw(t, 0, ops, n);
+}
+
+/* The BARs mapped, what the sysfs backend keeps */
+struct transport_sysfs {
+	struct {
+		void *base;
+		size_t len;
+	} bar[PCI_STD_NUM_BARS];
+};
+
+static int transport_sysfs_bar_map(struct transport *t, int bar, void **base,
+				   size_t *len)
+{
+	struct transport_sysfs *s = t->priv;
+	char path[PATH_MAX + 16];
+	struct stat st;
+	void *p;
+	int fd;
+
+	if (bar < 0 || bar >= PCI_STD_NUM_BARS)
+		return -EINVAL;
+	if (!s) {
+		s = calloc(1, sizeof(*s));
+		if (!s)
+			return -ENOMEM;
+		t->priv = s;
+	}
+	if (s->bar[bar].base)
+		goto out;
+
+	snprintf(path, sizeof(path), "%s/resource%d", t->path, bar);
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		close(fd);
+		return -ENODEV;
+	}
+
+	p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return -errno;
+	s->bar[bar].base = p;
+	s->bar[bar].len = st.st_size;
+out:
+	*base = s->bar[bar].base;
+	*len = s->bar[bar].len;
+	return 0;
+}
+
+static void transport_sysfs_close(struct transport *t)
+{
+	struct transport_sysfs *s = t->priv;
+	int i;
+
+	if (s) {
+		for (i = 0; i < PCI_STD_NUM_BARS; i++)
+			if (s->bar[i].base)
+				munmap(s->bar[i].base, s->bar[i].len);
+		free(s);
+	}
+	t->priv = NULL;
+	if (t->fd >= 0)
+		close(t->fd);
+}
+
+const struct transport_ops transport_sysfs_ops = {
+	.name = "sysfs",
+	.config = transport_sysfs_config,
+	.mbox_send = cxl_regs_send_command,
+	.query = cxl_regs_query,
+	.bar_map = transport_sysfs_bar_map,
+	.close = transport_sysfs_close,
+};
+
+/* @dir is the sysfs directory of the PCI function, its config file in it */
+int transport_open_sysfs_dev(struct transport *t, const char *dir)
+{
+	char cfg[PATH_MAX + 8];
+
+	memset(t, 0, sizeof(*t));
+	snprintf(t->path, sizeof(t->path), "%s", dir);
+	snprintf(cfg, sizeof(cfg), "%s/config", t->path);
+
+	t->fd = open(cfg, O_RDWR | O_CLOEXEC);
+	if (t->fd < 0)
+		return -errno;
+
+	t->ops = &transport_sysfs_ops;
+	t->caps = TRANSPORT_CFG_ABS | TRANSPORT_BATCH | TRANSPORT_MMIO;
+	return 0;
+}
+
+/*
+ * /sys/bus/cxl/devices/memN links to the memdev in sysfs, whose parent
+ * is the PCI function.
+ */
+int pci_memdev_dir(const char *memdev, char *dir, size_t len)
+{
+	char link[PATH_MAX], real[PATH_MAX];
+
+	snprintf(link, sizeof(link), "/sys/bus/cxl/devices/%s", memdev);
+	if (!realpath(link, real))
+		return -errno;
+
+	snprintf(dir, len, "%s", dirname(real));
+	return 0;
+}
+
+int transport_open_sysfs(struct transport *t, const char *memdev)
+{
+	char dir[PATH_MAX];
+	int ret;
+
+	t->ops = NULL;
+	t->fd = -1;
+	ret = pci_memdev_dir(memdev, dir, sizeof(dir));
+	if (ret)
+		return ret;
+
+	return transport_open_sysfs_dev(t, dir);
+}
+
+u32 pci_cfg_read(struct transport *t, u32 offset)
+{
+	struct cxl_pdev_config op = { .offset = offset };
+
+	if (transport_config(t, &op, 1))
+		return ~0U;
+
+	return op.val;
+}
+
+/**
+ * pci_cfg_read_block() - Read consecutive dwords of config space
+ * @t: transport to the config space
+ * @offset: of the first dword
+ * @buf: filled in, ~0 for the dwords that failed
+ * @n: number of dwords
+ *
+ * Up to PCI_CFG_MAX_IOV dwords go to the transport in one call, one
+ * system call for the sysfs and vfio transports.
+ *
+ * Return: 0, or -errno when a dword failed
+ */
+int pci_cfg_read_block(struct transport *t, u32 offset, u32 *buf,
+		       unsigned int n)
+{
+	struct cxl_pdev_config ops[PCI_CFG_MAX_IOV];
+	unsigned int i, todo;
+	int ret, err = 0;
+
+	for (; n; n -= todo, offset += todo * 4, buf += todo) {
+		todo = n < PCI_CFG_MAX_IOV ? n : PCI_CFG_MAX_IOV;
+		memset(ops, 0, todo * sizeof(*ops));
+		for (i = 0; i < todo; i++)
+			ops[i].offset = offset + i * 4;
+
+		ret = transport_config(t, ops, todo);
+		if (ret && !err)
+			err = ret;
+		for (i = 0; i < todo; i++)
+			buf[i] = ops[i].retval ? ~0U : ops[i].val;
+	}
+
+	return err;
+}
+
+/* Offset of the capability @id in the legacy list, PCI_CAP_ID_*, or 0 */
+u8 pci_find_cap(struct transport *t, u8 id)
+{
+	/* minimum 4 bytes per capability, past the header */
+	int ttl = (PCI_CFG_SPACE_SIZE - PCI_STD_HEADER_SIZEOF) / 4;
+	u32 header;
+	u8 pos;
+
+	if (!(pci_cfg_read(t, PCI_COMMAND) >> 16 & PCI_STATUS_CAP_LIST))
+		return 0;
+
+	pos = pci_cfg_read(t, PCI_CAPABILITY_LIST) & 0xfc;
+	while (pos >= PCI_STD_HEADER_SIZEOF && ttl-- > 0) {
+		header = pci_cfg_read(t, pos);
+		if (header == ~0U)
+			break;
+		if ((header & 0xff) == id)
+			return pos;
+		pos = header >> 8 & 0xfc;
+	}
+
+	return 0;
+}
+
+/**
+ * pci_find_next_ext_cap() - Walk the extended capability list
+ * @t: transport to the config space
+ * @start: a capability found before, 0 to start from the first one
+ * @id: PCI_EXT_CAP_ID_*
+ *
+ * Return: offset of the next capability @id after @start, or 0
+ */
+u16 pci_find_next_ext_cap(struct transport *t, u16 start, u16 id)
+{
+	/* minimum 8 bytes per capability */
+	int ttl = (PCI_CFG_SPACE_EXP_SIZE - PCI_CFG_SPACE_SIZE) / 8;
+	u16 pos = PCI_CFG_SPACE_SIZE;
+	u32 header;
+
+	if (start)
+		pos = start;
+
+	header = pci_cfg_read(t, pos);
+	if (header == 0 || header == ~0U)
+		return 0;
+
+	while (ttl-- > 0) {
+		if (PCI_EXT_CAP_ID(header) == id && pos != start)
+			return pos;
+
+		pos = PCI_EXT_CAP_NEXT(header);
+		if (pos < PCI_CFG_SPACE_SIZE)
+			break;
+
+		header = pci_cfg_read(t, pos);
+		if (header == ~0U)
+			break;
+	}
+
+	return 0;
+}
+
+/* Offset of the DVSEC @id of @vendor, 0 when there is none */
+u16 pci_find_dvsec(struct transport *t, u16 vendor, u16 id)
+{
+	u16 pos = 0;
+
+	while ((pos = pci_find_next_ext_cap(t, pos, PCI_EXT_CAP_ID_DVSEC)))
+		if (PCI_DVSEC_HEADER1_VID(pci_cfg_read(t, pos + PCI_DVSEC_HEADER1)) == vendor &&
+		    PCI_DVSEC_HEADER2_ID(pci_cfg_read(t, pos + PCI_DVSEC_HEADER2)) == id)
+			return pos;
+
+	return 0;
+}
+
+/* Device Serial Number, the unique id of a device */
+int pci_dsn(struct transport *t, u64 *dsn)
+{
+	u16 pos = pci_find_next_ext_cap(t, 0, PCI_EXT_CAP_ID_DSN);
+
+	if (!pos)
+		return -ENODEV;
+
+	*dsn = (u64)pci_cfg_read(t, pos + 8) << 32 | pci_cfg_read(t, pos + 4);
+	return 0;
+}
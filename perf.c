@@ -0,0 +1,754 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "include/linux/mempolicy.h"
+
+#include <perf.h>
+#include <cdat.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+/**
+ * DOC: perf
+ *
+ * The DSMAS of a CDAT split the device physical address (DPA) space in
+ * ranges, the DSLBIS give each range a latency and a bandwidth. Put
+ * together they are the performance model of a memdev, one entry per DPA
+ * range.
+ *
+ * The model is then mapped onto the NUMA nodes: the endpoint decoders of
+ * the memdev say which region a DPA range is in, the region says where it
+ * is in host physical memory (HPA), and the memory block at that HPA, or
+ * the DAX device of the region, says which node it is. Set
+ * $CXL_APP_SYSFS to read another tree than /sys.
+ *
+ * The CDAT numbers are the device alone, the host bridge and any switch
+ * come on top, so they are a lower bound of what a CPU sees. A switch
+ * has a CDAT too, on its upstream port, whose SSLBIS give the latency
+ * and bandwidth between two of its ports. Along the route from the host
+ * bridge down to the memdev the latencies add up, while the bandwidth is
+ * that of the narrowest link.
+ */
+
+static const char *perf_sysfs(void)
+{
+	const char *root = getenv("CXL_APP_SYSFS");
+
+	return root && *root ? root : "/sys";
+}
+
+static int perf_read_str(const char *path, char *buf, size_t len)
+{
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+
+	if (!fgets(buf, len, f))
+		ret = -ENODATA;
+	else
+		buf[strcspn(buf, "\n")] = '\0';
+	fclose(f);
+
+	return ret;
+}
+
+/* sysfs numbers are decimal, or hex with 0x */
+static int perf_read_u64(const char *path, int base, u64 *val)
+{
+	char buf[64], *end;
+	int ret;
+
+	ret = perf_read_str(path, buf, sizeof(buf));
+	if (ret)
+		return ret;
+
+	errno = 0;
+	*val = strtoull(buf, &end, base);
+	if (errno || end == buf)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int perf_read_attr(const char *dir, const char *attr, u64 *val)
+{
+	char path[PATH_MAX + 64];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	return perf_read_u64(path, 0, val);
+}
+
+/**
+ * perf_model_init() - The model of a memdev from its CDAT
+ * @m: filled in, no range mapped to a node yet
+ * @memdev: memN
+ * @cdat: a validated CDAT
+ *
+ * Return: 0, or -ENOENT when the CDAT has no DSMAS
+ */
+int perf_model_init(struct perf_model *m, const char *memdev,
+		    const struct cdat *cdat)
+{
+	const struct cdat_entry_header *e;
+	const struct cdat_dsmas *dsmas;
+	const struct cdat_dslbis *dslbis;
+	struct perf_range *r;
+	u64 val;
+	int i;
+
+	memset(m, 0, sizeof(*m));
+	snprintf(m->memdev, sizeof(m->memdev), "%s", memdev);
+
+	cdat_for_each_entry(cdat, e) {
+		dsmas = cdat_dsmas(e);
+		if (!dsmas || m->n == PERF_MAX_RANGES)
+			continue;
+
+		r = &m->r[m->n++];
+		r->handle = dsmas->dsmad_handle;
+		r->flags = dsmas->flags;
+		r->dpa_base = dsmas->dpa_base;
+		r->dpa_length = dsmas->dpa_length;
+		r->node = -1;
+	}
+
+	/* A DSLBIS may come before the DSMAS it is about */
+	cdat_for_each_entry(cdat, e) {
+		dslbis = cdat_dslbis(e);
+		if (!dslbis)
+			continue;
+
+		val = cdat_value(dslbis->entry_base_unit, dslbis->entry[0]);
+		for (i = 0; i < m->n; i++) {
+			r = &m->r[i];
+			if (r->handle != dslbis->handle)
+				continue;
+
+			switch (dslbis->data_type) {
+			case CDAT_HMAT_ACCESS_LATENCY:
+				r->rd_lat = r->wr_lat = val;
+				break;
+			case CDAT_HMAT_READ_LATENCY:
+				r->rd_lat = val;
+				break;
+			case CDAT_HMAT_WRITE_LATENCY:
+				r->wr_lat = val;
+				break;
+			case CDAT_HMAT_ACCESS_BANDWIDTH:
+				r->rd_bw = r->wr_bw = val;
+				break;
+			case CDAT_HMAT_READ_BANDWIDTH:
+				r->rd_bw = val;
+				break;
+			case CDAT_HMAT_WRITE_BANDWIDTH:
+				r->wr_bw = val;
+				break;
+			}
+		}
+	}
+
+	return m->n ? 0 : -ENOENT;
+}
+
+/* endpointN whose uport is @memdev */
+static int perf_endpoint(const char *memdev, char *ep, size_t len)
+{
+	char path[PATH_MAX], link[PATH_MAX], *base;
+	struct dirent *d;
+	ssize_t n;
+	DIR *dir;
+	int ret = -ENOENT;
+
+	snprintf(path, sizeof(path), "%s/bus/cxl/devices", perf_sysfs());
+	dir = opendir(path);
+	if (!dir)
+		return -errno;
+
+	while ((d = readdir(dir))) {
+		if (strncmp(d->d_name, "endpoint", strlen("endpoint")))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/bus/cxl/devices/%s/uport",
+			 perf_sysfs(), d->d_name);
+		n = readlink(path, link, sizeof(link) - 1);
+		if (n < 0)
+			continue;
+		link[n] = '\0';
+
+		base = strrchr(link, '/');
+		if (strcmp(base ? base + 1 : link, memdev))
+			continue;
+
+		snprintf(ep, len, "%s", d->d_name);
+		ret = 0;
+		break;
+	}
+	closedir(dir);
+
+	return ret;
+}
+
+/* The node of the memory block at @hpa, when it is online as System RAM */
+static int perf_hpa_node(u64 hpa)
+{
+	char path[PATH_MAX];
+	struct dirent *d;
+	u64 block;
+	DIR *dir;
+	int node = -1;
+
+	snprintf(path, sizeof(path), "%s/devices/system/memory/block_size_bytes",
+		 perf_sysfs());
+	if (perf_read_u64(path, 16, &block) || !block)
+		return -1;
+
+	snprintf(path, sizeof(path), "%s/devices/system/memory/memory%llu",
+		 perf_sysfs(), (unsigned long long)(hpa / block));
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	while ((d = readdir(dir)))
+		if (sscanf(d->d_name, "node%d", &node) == 1)
+			break;
+	closedir(dir);
+
+	return node;
+}
+
+/* The target node of the DAX device of @region, when it is device DAX */
+static int perf_dax_node(const char *region)
+{
+	char path[PATH_MAX];
+	struct dirent *d;
+	u64 node;
+	DIR *dir;
+	int ret = -1;
+
+	snprintf(path, sizeof(path), "%s/bus/cxl/devices/%s/dax_%s",
+		 perf_sysfs(), region, region);
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	while ((d = readdir(dir))) {
+		if (strncmp(d->d_name, "dax", strlen("dax")) ||
+		    !strchr(d->d_name, '.'))
+			continue;
+
+		snprintf(path, sizeof(path),
+			 "%s/bus/cxl/devices/%s/dax_%s/%s/target_node",
+			 perf_sysfs(), region, region, d->d_name);
+		if (!perf_read_u64(path, 10, &node)) {
+			ret = node;
+			break;
+		}
+	}
+	closedir(dir);
+
+	return ret;
+}
+
+/**
+ * perf_model_map() - Find the region and NUMA node of every range
+ * @m: the model of a memdev
+ *
+ * Ranges no region maps, or whose region is not online, keep node -1.
+ *
+ * Return: number of ranges mapped to a node, or -errno when the memdev
+ * has no endpoint in sysfs
+ */
+int perf_model_map(struct perf_model *m)
+{
+	char ep[64], dec[PATH_MAX], path[PATH_MAX + 16], region[64];
+	u64 dpa, size, hpa;
+	struct dirent *d;
+	DIR *dir;
+	int i, n = 0, ret;
+
+	ret = perf_endpoint(m->memdev, ep, sizeof(ep));
+	if (ret)
+		return ret;
+
+	snprintf(path, sizeof(path), "%s/bus/cxl/devices/%s", perf_sysfs(), ep);
+	dir = opendir(path);
+	if (!dir)
+		return -errno;
+
+	while ((d = readdir(dir))) {
+		if (strncmp(d->d_name, "decoder", strlen("decoder")))
+			continue;
+
+		snprintf(dec, sizeof(dec), "%s/bus/cxl/devices/%s/%s",
+			 perf_sysfs(), ep, d->d_name);
+		if (perf_read_attr(dec, "dpa_resource", &dpa) ||
+		    perf_read_attr(dec, "dpa_size", &size) || !size)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/region", dec);
+		if (perf_read_str(path, region, sizeof(region)) || !*region)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/bus/cxl/devices/%s/resource",
+			 perf_sysfs(), region);
+		if (perf_read_u64(path, 0, &hpa))
+			continue;
+
+		for (i = 0; i < m->n; i++) {
+			struct perf_range *r = &m->r[i];
+
+			if (r->dpa_base < dpa || r->dpa_base >= dpa + size)
+				continue;
+
+			r->hpa_base = hpa;
+			r->node = perf_hpa_node(hpa);
+			if (r->node < 0)
+				r->node = perf_dax_node(region);
+			if (r->node >= 0)
+				n++;
+		}
+	}
+	closedir(dir);
+
+	return n;
+}
+
+void perf_model_print(FILE *f, const struct perf_model *m)
+{
+	const struct perf_range *r;
+	int i;
+
+	fprintf(f, "%s: %d DPA range%s\n", m->memdev, m->n, m->n == 1 ? "" : "s");
+	for (i = 0; i < m->n; i++) {
+		r = &m->r[i];
+		fprintf(f, "  DSMAS %u DPA 0x%llx-0x%llx%s%s\n", r->handle,
+			(unsigned long long)r->dpa_base,
+			(unsigned long long)(r->dpa_base + r->dpa_length - 1),
+			r->flags & CDAT_DSMAS_FLAG_NV ? " non-volatile" : "",
+			r->flags & CDAT_DSMAS_FLAG_SHAREABLE ? " shareable" : "");
+		fprintf(f, "    latency   read %llu ps write %llu ps\n",
+			(unsigned long long)r->rd_lat,
+			(unsigned long long)r->wr_lat);
+		fprintf(f, "    bandwidth read %llu MB/s write %llu MB/s\n",
+			(unsigned long long)r->rd_bw,
+			(unsigned long long)r->wr_bw);
+		if (r->node >= 0)
+			fprintf(f, "    region at HPA 0x%llx, node %d\n",
+				(unsigned long long)r->hpa_base, r->node);
+		else
+			fprintf(f, "    no NUMA node, the range is not online\n");
+	}
+}
+
+/* A node list such as 0-1,3 */
+static int perf_node_list(const char *s, int *ids, int max)
+{
+	int first, last, n = 0;
+	char *end;
+
+	while (*s) {
+		first = strtol(s, &end, 10);
+		if (end == s)
+			break;
+		last = first;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+		for (; first <= last && n < max; first++)
+			ids[n++] = first;
+		s = *end == ',' ? end + 1 : end;
+	}
+
+	return n;
+}
+
+/**
+ * perf_nodes() - The NUMA nodes with memory
+ * @nodes: filled in, latency and bandwidth as the kernel has them from
+ *	   the HMAT or the CDAT, access class 0
+ * @max: room in @nodes
+ *
+ * Return: number of nodes, or -errno
+ */
+int perf_nodes(struct perf_node *nodes, int max)
+{
+	char path[PATH_MAX], buf[4096];
+	int ids[PERF_MAX_NODES], i, n, ret;
+	u64 val;
+
+	snprintf(path, sizeof(path), "%s/devices/system/node/has_memory",
+		 perf_sysfs());
+	ret = perf_read_str(path, buf, sizeof(buf));
+	if (ret)
+		return ret;
+
+	n = perf_node_list(buf, ids, max < PERF_MAX_NODES ? max : PERF_MAX_NODES);
+	for (i = 0; i < n; i++) {
+		memset(&nodes[i], 0, sizeof(nodes[i]));
+		nodes[i].id = ids[i];
+
+		snprintf(path, sizeof(path), "%s/devices/system/node/node%d/cpulist",
+			 perf_sysfs(), ids[i]);
+		nodes[i].cpus = !perf_read_str(path, buf, sizeof(buf)) && *buf;
+
+		snprintf(path, sizeof(path),
+			 "%s/devices/system/node/node%d/access0/initiators/read_latency",
+			 perf_sysfs(), ids[i]);
+		if (!perf_read_u64(path, 10, &val))
+			nodes[i].rd_lat = val * 1000;
+
+		snprintf(path, sizeof(path),
+			 "%s/devices/system/node/node%d/access0/initiators/read_bandwidth",
+			 perf_sysfs(), ids[i]);
+		if (!perf_read_u64(path, 10, &val))
+			nodes[i].rd_bw = val;
+	}
+
+	return n;
+}
+
+static const char *perf_mpol_name(int mode)
+{
+	switch (mode) {
+	case MPOL_PREFERRED:
+		return "MPOL_PREFERRED";
+	case MPOL_BIND:
+		return "MPOL_BIND";
+	case MPOL_INTERLEAVE:
+		return "MPOL_INTERLEAVE";
+	case MPOL_LOCAL:
+		return "MPOL_LOCAL";
+	default:
+		return "MPOL_DEFAULT";
+	}
+}
+
+static const char *perf_numactl_opt(int mode)
+{
+	switch (mode) {
+	case MPOL_PREFERRED:
+		return "--preferred";
+	case MPOL_BIND:
+		return "--membind";
+	case MPOL_INTERLEAVE:
+		return "--interleave";
+	default:
+		return "--localalloc";
+	}
+}
+
+static void perf_advice(FILE *f, const char *workload, int mode,
+			const int *ids, int n, const char *why)
+{
+	int i;
+
+	fprintf(f, "  %-20s %s", workload, perf_mpol_name(mode));
+	if (n) {
+		fprintf(f, " node%s ", n > 1 ? "s" : "");
+		for (i = 0; i < n; i++)
+			fprintf(f, "%s%d", i ? "," : "", ids[i]);
+	}
+	fprintf(f, ", numactl %s", perf_numactl_opt(mode));
+	for (i = 0; i < n; i++)
+		fprintf(f, "%s%d", i ? "," : "=", ids[i]);
+	fprintf(f, "\n  %-20s (%s)\n", "", why);
+}
+
+/* The CDAT numbers for a node the memdev backs, the kernel ones otherwise */
+static void perf_node_merge(struct perf_node *node, const struct perf_model *m,
+			    bool *cxl)
+{
+	int i;
+
+	*cxl = false;
+	for (i = 0; i < m->n; i++) {
+		if (m->r[i].node != node->id)
+			continue;
+		*cxl = true;
+		if (m->r[i].rd_lat && (!node->rd_lat ||
+				       m->r[i].rd_lat > node->rd_lat))
+			node->rd_lat = m->r[i].rd_lat;
+		if (m->r[i].rd_bw && (!node->rd_bw ||
+				      m->r[i].rd_bw < node->rd_bw))
+			node->rd_bw = m->r[i].rd_bw;
+	}
+}
+
+/**
+ * perf_advise() - Recommend a memory policy per kind of workload
+ * @f: where to
+ * @m: the model of a memdev, mapped to its nodes
+ *
+ * Latency-sensitive memory goes to the node with the lowest read latency,
+ * the CPU-attached ones when nothing says otherwise. Bandwidth-sensitive
+ * memory is interleaved across every node with a known bandwidth, the
+ * memdev's included, as their bandwidths add up. Memory that has to be on
+ * the memdev, say for its capacity or because it is non-volatile, is
+ * bound to its node.
+ */
+void perf_advise(FILE *f, const struct perf_model *m)
+{
+	struct perf_node nodes[PERF_MAX_NODES];
+	int ids[PERF_MAX_NODES], cxl_ids[PERF_MAX_NODES];
+	int i, n, n_ids = 0, n_cxl = 0, best = -1;
+	u64 bw = 0;
+	char why[256];
+	bool cxl;
+
+	n = perf_nodes(nodes, PERF_MAX_NODES);
+	if (n < 0)
+		n = 0;
+
+	for (i = 0; i < n; i++) {
+		perf_node_merge(&nodes[i], m, &cxl);
+		if (cxl)
+			cxl_ids[n_cxl++] = nodes[i].id;
+		if (nodes[i].rd_bw) {
+			ids[n_ids++] = nodes[i].id;
+			bw += nodes[i].rd_bw;
+		}
+		if (nodes[i].rd_lat &&
+		    (best < 0 || nodes[i].rd_lat < nodes[best].rd_lat))
+			best = i;
+	}
+
+	fprintf(f, "Memory policy for %s:\n", m->memdev);
+	if (!n_cxl) {
+		fprintf(f, "  none, no DPA range of %s is online as a NUMA node\n",
+			m->memdev);
+		return;
+	}
+
+	if (best >= 0) {
+		snprintf(why, sizeof(why), "lowest read latency, %llu ps",
+			 (unsigned long long)nodes[best].rd_lat);
+		perf_advice(f, "latency-sensitive", MPOL_PREFERRED,
+			    &nodes[best].id, 1, why);
+	} else {
+		perf_advice(f, "latency-sensitive", MPOL_LOCAL, NULL, 0,
+			    "no latency known, CPU-attached memory first");
+	}
+
+	if (n_ids > 1) {
+		snprintf(why, sizeof(why),
+			 "read bandwidth adds up to %llu MB/s", (unsigned long long)bw);
+		perf_advice(f, "bandwidth-sensitive", MPOL_INTERLEAVE, ids, n_ids,
+			    why);
+	} else if (n > 1) {
+		for (i = 0; i < n; i++)
+			ids[i] = nodes[i].id;
+		perf_advice(f, "bandwidth-sensitive", MPOL_INTERLEAVE, ids, n,
+			    "bandwidth of the other nodes unknown, every node");
+	} else {
+		perf_advice(f, "bandwidth-sensitive", MPOL_BIND, cxl_ids, n_cxl,
+			    "the only node with memory");
+	}
+
+	snprintf(why, sizeof(why), "only %s memory", m->memdev);
+	perf_advice(f, "capacity", MPOL_BIND, cxl_ids, n_cxl, why);
+}
+
+/**
+ * perf_pci_chain() - The PCI functions from the root port down to a memdev
+ * @path: sysfs directory of the memdev's PCI function
+ * @rt: its host bridge and root port are filled in
+ * @dirs: sysfs directory of each PCI function, the root port first
+ * @max: room in @dirs
+ *
+ * sysfs nests a PCI function under the bridge it is behind, so the path
+ * of the memdev, /sys/devices/pci0000:00/0000:00:01.0/.../0000:03:00.0,
+ * lists every port in between.
+ *
+ * Return: number of entries in @dirs, or -EINVAL when @path is not in the
+ * PCI hierarchy
+ */
+int perf_pci_chain(const char *path, struct perf_route *rt,
+		   char (*dirs)[PATH_MAX], int max)
+{
+	unsigned int dom, bus, dev, fn;
+	const char *p, *end;
+	int n = 0, len;
+
+	memset(rt, 0, sizeof(*rt));
+
+	for (p = path; *p; p = end) {
+		while (*p == '/')
+			p++;
+		end = strchr(p, '/');
+		if (!end)
+			end = p + strlen(p);
+
+		len = 0;
+		if (sscanf(p, "%x:%x:%x.%x%n", &dom, &bus, &dev, &fn, &len) == 4 &&
+		    p + len == end) {
+			if (n < max)
+				snprintf(dirs[n++], PATH_MAX, "%.*s",
+					 (int)(end - path), path);
+		} else if (!n && !strncmp(p, "pci", 3)) {
+			snprintf(rt->host_bridge, sizeof(rt->host_bridge), "%.*s",
+				 (int)(end - p), p);
+		}
+	}
+
+	if (!n || !*rt->host_bridge)
+		return -EINVAL;
+
+	p = strrchr(dirs[0], '/');
+	snprintf(rt->root_port, sizeof(rt->root_port), "%s", p ? p + 1 : dirs[0]);
+
+	return n;
+}
+
+/**
+ * perf_hop_sslbis() - What the CDAT of a switch says about a hop
+ * @hop: @port set, the latency and bandwidth filled in
+ * @cdat: CDAT of its upstream port
+ *
+ * Either direction between the upstream port and @hop->port counts, and
+ * so does an entry for any port, though only for what no entry of
+ * @hop->port itself gives, wherever in the CDAT it comes.
+ *
+ * Return: number of SSLBIS entries used
+ */
+int perf_hop_sslbis(struct perf_hop *hop, const struct cdat *cdat)
+{
+	u64 *field[] = { &hop->rd_lat, &hop->wr_lat, &hop->rd_bw, &hop->wr_bw };
+	const struct cdat_entry_header *e;
+	const struct cdat_sslbis *sslbis;
+	const struct cdat_sslbe *be;
+	unsigned int mask, exact_seen = 0, j;
+	int i, used = 0;
+	bool exact;
+	u64 val;
+
+	cdat_for_each_entry(cdat, e) {
+		sslbis = cdat_sslbis(e);
+		if (!sslbis)
+			continue;
+
+		/* Of @field, which the data type gives */
+		switch (sslbis->data_type) {
+		case CDAT_HMAT_ACCESS_LATENCY:
+			mask = 0x3;
+			break;
+		case CDAT_HMAT_READ_LATENCY:
+			mask = 0x1;
+			break;
+		case CDAT_HMAT_WRITE_LATENCY:
+			mask = 0x2;
+			break;
+		case CDAT_HMAT_ACCESS_BANDWIDTH:
+			mask = 0xc;
+			break;
+		case CDAT_HMAT_READ_BANDWIDTH:
+			mask = 0x4;
+			break;
+		case CDAT_HMAT_WRITE_BANDWIDTH:
+			mask = 0x8;
+			break;
+		default:
+			continue;
+		}
+
+		for (i = 0; i < cdat_sslbis_n(sslbis); i++) {
+			be = &sslbis->entries[i];
+			if (be->portx_id == CDAT_SSLBIS_USP_PORT)
+				exact = be->porty_id == hop->port;
+			else if (be->porty_id == CDAT_SSLBIS_USP_PORT)
+				exact = be->portx_id == hop->port;
+			else
+				continue;
+			if (!exact &&
+			    be->portx_id != CDAT_SSLBIS_ANY_PORT &&
+			    be->porty_id != CDAT_SSLBIS_ANY_PORT)
+				continue;
+			/* A wildcard only where no exact entry was */
+			if (!exact && !(mask & ~exact_seen))
+				continue;
+
+			val = cdat_value(sslbis->entry_base_unit, be->value);
+			for (j = 0; j < ARRAY_SIZE(field); j++) {
+				if (!(mask & 1U << j))
+					continue;
+				if (exact)
+					exact_seen |= 1U << j;
+				else if (exact_seen & 1U << j)
+					continue;
+				*field[j] = val;
+			}
+			used++;
+		}
+	}
+
+	return used;
+}
+
+/* Bandwidth of the narrowest link, an unknown one, 0, left out */
+static u64 perf_min_bw(u64 a, u64 b)
+{
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+	return a < b ? a : b;
+}
+
+/**
+ * perf_route_print() - End-to-end latency and bandwidth per DPA range
+ * @f: where to
+ * @m: the model of the memdev, what its own CDAT says
+ * @rt: the switches between the host bridge and the memdev
+ *
+ * The host bridge and the root port are not in any CDAT, so the numbers
+ * are from the root port down.
+ */
+void perf_route_print(FILE *f, const struct perf_model *m,
+		      const struct perf_route *rt)
+{
+	const struct perf_hop *hop;
+	u64 rd_lat, wr_lat, rd_bw, wr_bw;
+	int i, j;
+
+	fprintf(f, "%s -> %s", rt->host_bridge, rt->root_port);
+	for (j = 0; j < rt->n; j++)
+		fprintf(f, " -> %s port %u", rt->hop[j].name, rt->hop[j].port);
+	fprintf(f, " -> %s\n", m->memdev);
+
+	for (j = 0; j < rt->n; j++) {
+		hop = &rt->hop[j];
+		fprintf(f, "  switch %s port %u: latency read %llu ps write %llu ps,",
+			hop->name, hop->port,
+			(unsigned long long)hop->rd_lat,
+			(unsigned long long)hop->wr_lat);
+		fprintf(f, " bandwidth read %llu MB/s write %llu MB/s\n",
+			(unsigned long long)hop->rd_bw,
+			(unsigned long long)hop->wr_bw);
+	}
+
+	for (i = 0; i < m->n; i++) {
+		rd_lat = m->r[i].rd_lat;
+		wr_lat = m->r[i].wr_lat;
+		rd_bw = m->r[i].rd_bw;
+		wr_bw = m->r[i].wr_bw;
+		for (j = 0; j < rt->n; j++) {
+			hop = &rt->hop[j];
+			rd_lat += hop->rd_lat;
+			wr_lat += hop->wr_lat;
+			rd_bw = perf_min_bw(rd_bw, hop->rd_bw);
+			wr_bw = perf_min_bw(wr_bw, hop->wr_bw);
+		}
+
+		fprintf(f, "  DSMAS %u end to end: latency read %llu ps write %llu ps,",
+			m->r[i].handle,
+			(unsigned long long)rd_lat, (unsigned long long)wr_lat);
+		fprintf(f, " bandwidth read %llu MB/s write %llu MB/s\n",
+			(unsigned long long)rd_bw, (unsigned long long)wr_bw);
+	}
+}
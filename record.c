@@ -0,0 +1,947 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+
+#include "include/linux/pci_regs.h"
+
+#include <transport.h>
+#include <pci.h>
+#include <doe.h>
+#include <regs.h>
+#include <cxlmem.h>
+#include <bitfield.h>
+
+#define DEBUG
+#include <debug_or_not.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+/**
+ * DOC: record
+ *
+ * A capture of what the tool did to a device, and what the device
+ * answered, to run it again without the device.
+ *
+ * transport_record() wraps an open transport so that every operation
+ * on it, a batch of config space accesses, a mailbox command or a
+ * query, goes to a file along with its results, when it started and
+ * how long it took. The file starts with the config space as it was
+ * and where the DOE instances are. The mapped registers cannot be
+ * watched, so the wrapper has no TRANSPORT_MMIO; the mailbox commands
+ * through them are recorded from above, as those of the ioctl.
+ *
+ * The replay backend, replay:<file>, serves a capture. It does not
+ * play the accesses back one by one, which would only fit the exact
+ * code that made them, but rebuilds what the device did:
+ *
+ *  - the config space, as captured
+ *  - each DOE exchange, its request, its response and its latency, up
+ *    to the first Status read ready, at most a poll late; a DOE
+ *    instance of the replay answers a request with the response
+ *    captured for the same one, ready that latency after GO
+ *  - each mailbox command, its input, its output, return code and time
+ *  - what a query returned
+ *
+ * and each call into the transport takes what one took in the capture.
+ * A capture with TRANSPORT_ASYNC is replayed with it, the DOE interrupt
+ * a timerfd expiring when the response gets ready. All the times are
+ * scaled by transport_replay_scale(), 1 by default, 0 for no waiting at
+ * all. A change to the DOE engine, polling less or
+ * batching more, then meets the same device as the capture did and is
+ * timed against it. What the capture has no answer for fails: a DOE
+ * request with the Error bit, a mailbox command as unsupported.
+ */
+
+#define RECORD_MAGIC		"CXLREC1"
+/* Dwords of a DOE request or response kept */
+#define RECORD_MAX_DW		1024
+
+/**
+ * struct record_hdr - What a capture starts with
+ * @magic: RECORD_MAGIC
+ * @name: the backend captured
+ * @caps: its TRANSPORT_* caps
+ * @n_doe, @doe_cap: its DOE instances
+ * @n_cfg: dwords of config space following, 0 for a transport with
+ *	   DOE-relative offsets
+ */
+struct record_hdr {
+	char magic[8];
+	char name[16];
+	u32 caps;
+	u32 n_doe;
+	u16 doe_cap[DOE_MAX_MB];
+	u32 n_cfg;
+};
+
+enum record_type {
+	RECORD_CONFIG = 1,
+	RECORD_MBOX,
+	RECORD_QUERY,
+};
+
+/**
+ * struct record_op - One operation on the transport, what follows it
+ * @type: RECORD_*
+ * @ret: what the operation returned
+ * @ts_ns: when it started, since the capture did
+ * @dur_ns: how long it took
+ * @n: RECORD_CONFIG, the accesses following, as struct cxl_pdev_config;
+ *     RECORD_MBOX, the bytes of input following the struct
+ *     cxl_send_command; RECORD_QUERY, the struct cxl_command_info
+ *     following the struct cxl_mem_query_commands
+ * @n_out: RECORD_MBOX, the bytes of output following the input
+ */
+struct record_op {
+	u8 type;
+	u8 rsvd[3];
+	s32 ret;
+	u64 ts_ns;
+	u64 dur_ns;
+	u32 n;
+	u32 n_out;
+};
+
+/**
+ * struct transport_record - What the recording wrapper keeps
+ * @inner: the transport recorded
+ * @f: the capture
+ * @lock: one operation at a time into @f, several DOE instances run
+ *	  concurrently
+ * @t0_ns: when the capture started
+ */
+struct transport_record {
+	struct transport inner;
+	FILE *f;
+	pthread_mutex_t lock;
+	u64 t0_ns;
+};
+
+static u64 record_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* @op then the @n chunks of payload, one record */
+static void record_write(struct transport_record *rec, struct record_op *op,
+			 u64 t_ns, const void **p, const size_t *len, int n)
+{
+	int i;
+
+	op->ts_ns = t_ns - rec->t0_ns;
+	op->dur_ns = record_now_ns() - t_ns;
+
+	pthread_mutex_lock(&rec->lock);
+	fwrite(op, sizeof(*op), 1, rec->f);
+	for (i = 0; i < n; i++)
+		if (len[i])
+			fwrite(p[i], len[i], 1, rec->f);
+	pthread_mutex_unlock(&rec->lock);
+}
+
+static int transport_record_config(struct transport *t,
+				   struct cxl_pdev_config *ops, unsigned int n)
+{
+	struct transport_record *rec = t->priv;
+	struct record_op op = { .type = RECORD_CONFIG, .n = n };
+	const void *p[] = { ops };
+	size_t len[] = { n * sizeof(*ops) };
+	u64 t_ns = record_now_ns();
+
+	op.ret = transport_config(&rec->inner, ops, n);
+	record_write(rec, &op, t_ns, p, len, 1);
+	__atomic_store_n(&t->n_syscall, transport_syscalls(&rec->inner),
+			 __ATOMIC_RELAXED);
+	return op.ret;
+}
+
+static int transport_record_irq_fd(struct transport *t, u16 cap)
+{
+	struct transport_record *rec = t->priv;
+
+	return transport_irq_fd(&rec->inner, cap);
+}
+
+static void transport_record_irq_release(struct transport *t, u16 cap, int fd)
+{
+	struct transport_record *rec = t->priv;
+
+	transport_irq_release(&rec->inner, cap, fd);
+}
+
+static int transport_record_mbox_send(struct transport *t,
+				      struct cxl_send_command *cmd)
+{
+	struct transport_record *rec = t->priv;
+	struct record_op op = { .type = RECORD_MBOX, .n = cmd->in.size };
+	const void *p[] = { cmd, (void *)(unsigned long)cmd->in.payload,
+			    (void *)(unsigned long)cmd->out.payload };
+	size_t len[] = { sizeof(*cmd), cmd->in.size, 0 };
+	u64 t_ns = record_now_ns();
+
+	op.ret = transport_mbox_send(&rec->inner, cmd);
+	if (!op.ret)
+		len[2] = op.n_out = cmd->out.size;
+	record_write(rec, &op, t_ns, p, len, 3);
+	__atomic_store_n(&t->n_syscall, transport_syscalls(&rec->inner),
+			 __ATOMIC_RELAXED);
+	return op.ret;
+}
+
+static int transport_record_query(struct transport *t,
+				  struct cxl_mem_query_commands *q)
+{
+	struct transport_record *rec = t->priv;
+	struct record_op op = { .type = RECORD_QUERY };
+	const void *p[] = { q, q->commands };
+	size_t len[] = { sizeof(*q), 0 };
+	u64 t_ns = record_now_ns();
+	u32 n = q->n_commands;
+
+	op.ret = transport_query(&rec->inner, q);
+	/* Only the entries filled in, none when asked for the count */
+	if (!op.ret && n)
+		op.n = min(n, q->n_commands);
+	len[1] = op.n * sizeof(q->commands[0]);
+	record_write(rec, &op, t_ns, p, len, 2);
+	__atomic_store_n(&t->n_syscall, transport_syscalls(&rec->inner),
+			 __ATOMIC_RELAXED);
+	return op.ret;
+}
+
+static void transport_record_close(struct transport *t)
+{
+	struct transport_record *rec = t->priv;
+
+	fclose(rec->f);
+	pthread_mutex_destroy(&rec->lock);
+	transport_close(&rec->inner);
+	free(rec);
+}
+
+static const struct transport_ops transport_record_ops = {
+	.name = "record",
+	.config = transport_record_config,
+	.irq_fd = transport_record_irq_fd,
+	.irq_release = transport_record_irq_release,
+	.mbox_send = transport_record_mbox_send,
+	.query = transport_record_query,
+	.close = transport_record_close,
+};
+
+/* The config space as it is and its DOE instances, when @t reaches them */
+static int record_hdr_write(struct transport *t, FILE *f)
+{
+	static u32 cfg[PCI_CFG_SPACE_EXP_SIZE / 4];
+	struct record_hdr hdr = { .magic = RECORD_MAGIC, .caps = t->caps };
+	u16 cap = 0;
+
+	snprintf(hdr.name, sizeof(hdr.name), "%s", transport_name(t));
+	if (t->caps & TRANSPORT_CFG_ABS) {
+		if (pci_cfg_read_block(t, 0, cfg, ARRAY_SIZE(cfg)))
+			return -EIO;
+		hdr.n_cfg = ARRAY_SIZE(cfg);
+		while (hdr.n_doe < DOE_MAX_MB &&
+		       (cap = pci_find_next_ext_cap(t, cap, PCI_EXT_CAP_ID_DOE)))
+			hdr.doe_cap[hdr.n_doe++] = cap;
+	} else {
+		/* The driver's instance, at 0 */
+		hdr.n_doe = 1;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(cfg, sizeof(cfg[0]), hdr.n_cfg, f) != hdr.n_cfg)
+		return -EIO;
+	return 0;
+}
+
+/**
+ * transport_record() - Record every operation on a transport
+ * @t: an open transport, the wrapper once done
+ * @path: the capture, for replay:@path
+ *
+ * The mailbox commands of a transport mapping the registers go through
+ * them, mapped here. @t is closed along with the capture.
+ *
+ * Return: 0, or -errno, @t left as it was
+ */
+int transport_record(struct transport *t, const char *path)
+{
+	struct transport_record *rec;
+	int ret;
+
+	if (!t->ops)
+		return -ENODEV;
+
+	rec = calloc(1, sizeof(*rec));
+	if (!rec)
+		return -ENOMEM;
+	rec->f = fopen(path, "w");
+	if (!rec->f) {
+		ret = -errno;
+		free(rec);
+		return ret;
+	}
+
+	/* Before the inner transport loses its registers to the wrapper */
+	if (t->caps & TRANSPORT_MMIO)
+		cxl_regs_attach(t);
+	ret = record_hdr_write(t, rec->f);
+	if (ret) {
+		fclose(rec->f);
+		free(rec);
+		return ret;
+	}
+
+	pthread_mutex_init(&rec->lock, NULL);
+	rec->inner = *t;
+	rec->t0_ns = record_now_ns();
+
+	t->ops = &transport_record_ops;
+	t->caps = rec->inner.caps & ~TRANSPORT_MMIO;
+	t->fd = -1;
+	t->priv = rec;
+	t->regs = NULL;
+	return 0;
+}
+
+/**
+ * struct replay_xchg - A DOE exchange of the capture
+ * @cap: the DOE instance
+ * @err: it ended with the Error bit
+ * @req, @n_req: the request
+ * @rsp, @n_rsp: the response
+ * @lat_ns: from GO to the response ready
+ * @n_served: times the replay answered with it
+ */
+struct replay_xchg {
+	u16 cap;
+	bool err;
+	u32 *req;
+	u32 n_req;
+	u32 *rsp;
+	u32 n_rsp;
+	u64 lat_ns;
+	u32 n_served;
+};
+
+/**
+ * struct replay_doe - A DOE instance, being parsed out of the capture or
+ *		       replayed
+ * @cap: where it is
+ * @ctrl, @status: its Control and Status registers
+ * @req, @n_req: the request being written
+ * @x: the exchange in flight, an index into the exchanges, -1 for none
+ * @irq_fd: replaying, a timerfd expiring when @x gets ready, -1 for none
+ * @pos: response dwords acked
+ * @t_ns: parsing, when GO was written; replaying, when @x gets ready
+ * @cur: parsing, the dword read from the Read Data Mailbox last
+ */
+struct replay_doe {
+	u16 cap;
+	u32 ctrl;
+	u32 status;
+	u32 req[RECORD_MAX_DW];
+	u32 n_req;
+	int x;
+	int irq_fd;
+	u32 pos;
+	u64 t_ns;
+	u32 cur;
+};
+
+/**
+ * struct transport_replay - What the replay backend keeps
+ * @buf, @len: the capture, loaded
+ * @hdr: its header
+ * @cfg: the config space
+ * @doe, @n_doe: the DOE instances
+ * @x, @n_x: the DOE exchanges captured
+ * @mbox, @n_mbox: the mailbox commands captured
+ * @query, @n_query_info: the commands the query returned the most of
+ * @n_query: the number of commands it reported, 0 for no query
+ * @call_ns, @access_ns: what a config call took in the capture, and
+ *			 each access of a batch on top
+ * @scale: of every time captured
+ * @n_miss: requests and commands the capture had no answer for
+ */
+struct transport_replay {
+	u8 *buf;
+	size_t len;
+	const struct record_hdr *hdr;
+	u32 cfg[PCI_CFG_SPACE_EXP_SIZE / 4];
+	struct replay_doe doe[DOE_MAX_MB];
+	int n_doe;
+	struct replay_xchg *x;
+	unsigned int n_x;
+	struct {
+		const struct record_op *op;
+		const struct cxl_send_command *cmd;
+		const u8 *in;
+		const u8 *out;
+		u32 n_served;
+	} *mbox;
+	unsigned int n_mbox;
+	const struct cxl_command_info *query;
+	u32 n_query_info;
+	u32 n_query;
+	u64 call_ns;
+	u64 access_ns;
+	double scale;
+	u64 n_miss;
+};
+
+static struct replay_doe *replay_doe_find(struct transport_replay *r, u32 off)
+{
+	int i;
+
+	for (i = 0; i < r->n_doe; i++)
+		if (off > r->doe[i].cap &&
+		    off < r->doe[i].cap + PCI_DOE_CAP_SIZEOF)
+			return &r->doe[i];
+
+	return NULL;
+}
+
+static void replay_xchg_end(struct replay_doe *d)
+{
+	d->x = -1;
+	d->status = 0;
+}
+
+/* An exchange started by GO at @t_ns */
+static int replay_xchg_add(struct transport_replay *r, struct replay_doe *d,
+			   u64 t_ns)
+{
+	struct replay_xchg *x;
+
+	x = realloc(r->x, (r->n_x + 1) * sizeof(*x));
+	if (!x)
+		return -ENOMEM;
+	r->x = x;
+	x = &r->x[r->n_x];
+	memset(x, 0, sizeof(*x));
+	x->cap = d->cap;
+	x->n_req = d->n_req;
+	x->req = malloc(d->n_req * sizeof(u32) + RECORD_MAX_DW * sizeof(u32));
+	if (!x->req)
+		return -ENOMEM;
+	memcpy(x->req, d->req, d->n_req * sizeof(u32));
+	x->rsp = x->req + d->n_req;
+
+	d->x = r->n_x++;
+	d->n_req = 0;
+	d->pos = 0;
+	d->t_ns = t_ns;
+	d->status = PCI_DOE_STATUS_BUSY;
+	return 0;
+}
+
+/* One access of the capture, into the exchange it is part of */
+static int replay_parse_access(struct transport_replay *r,
+			       const struct cxl_pdev_config *op,
+			       const struct record_op *rop)
+{
+	struct replay_doe *d = replay_doe_find(r, op->offset);
+	struct replay_xchg *x;
+	u64 start = rop->ts_ns, end = rop->ts_ns + rop->dur_ns;
+	u32 len;
+
+	if (op->retval)
+		return 0;
+	if (!d) {
+		/* Without a snapshot, the config space as it was read */
+		if (!r->hdr->n_cfg && !op->is_write &&
+		    op->offset < sizeof(r->cfg))
+			r->cfg[op->offset / 4] = op->val;
+		return 0;
+	}
+
+	x = d->x >= 0 ? &r->x[d->x] : NULL;
+	switch (op->offset - d->cap) {
+	case PCI_DOE_CTRL:
+		if (!op->is_write)
+			break;
+		if (FIELD_GET(PCI_DOE_CTRL_ABORT, op->val)) {
+			d->n_req = 0;
+			replay_xchg_end(d);
+		} else if (FIELD_GET(PCI_DOE_CTRL_GO, op->val)) {
+			return replay_xchg_add(r, d, end);
+		}
+		break;
+	case PCI_DOE_STATUS:
+		if (op->is_write || !x || d->status != PCI_DOE_STATUS_BUSY)
+			break;
+		if (!(op->val & (PCI_DOE_STATUS_DATA_OBJECT_READY |
+				 PCI_DOE_STATUS_ERROR)))
+			break;
+		x->lat_ns = max(start, d->t_ns) - d->t_ns;
+		x->err = FIELD_GET(PCI_DOE_STATUS_ERROR, op->val);
+		d->status = PCI_DOE_STATUS_DATA_OBJECT_READY;
+		if (x->err)
+			replay_xchg_end(d);
+		break;
+	case PCI_DOE_WRITE:
+		if (op->is_write && d->n_req < RECORD_MAX_DW)
+			d->req[d->n_req++] = op->val;
+		break;
+	case PCI_DOE_READ:
+		if (!x || d->status != PCI_DOE_STATUS_DATA_OBJECT_READY)
+			break;
+		if (!op->is_write) {
+			d->cur = op->val;
+			break;
+		}
+		if (x->n_rsp < RECORD_MAX_DW)
+			x->rsp[x->n_rsp++] = d->cur;
+		if (x->n_rsp < DOE_HDR_DW)
+			break;
+		/* Done once as long as the second header dword says */
+		len = FIELD_GET(PCI_DOE_DATA_OBJECT_HEADER_2_LENGTH, x->rsp[1]);
+		if (x->n_rsp >= min(len ? len : RECORD_MAX_DW, RECORD_MAX_DW))
+			replay_xchg_end(d);
+		break;
+	}
+
+	return 0;
+}
+
+/* What a config call costs, and each access of a batch on top */
+static void replay_config_cost(struct transport_replay *r, u64 n1, u64 ns1,
+			       u64 nb, u64 nb_ops, u64 nsb)
+{
+	if (n1)
+		r->call_ns = ns1 / n1;
+	else if (nb_ops)
+		r->call_ns = nsb / nb_ops;
+	if (nb_ops > nb && nsb > nb * r->call_ns)
+		r->access_ns = (nsb - nb * r->call_ns) / (nb_ops - nb);
+}
+
+static int replay_parse(struct transport_replay *r)
+{
+	const struct cxl_pdev_config *ops;
+	const struct record_op *op;
+	const struct cxl_mem_query_commands *q;
+	size_t pos = sizeof(*r->hdr) + r->hdr->n_cfg * sizeof(u32), len;
+	u64 n1 = 0, ns1 = 0, nb = 0, nb_ops = 0, nsb = 0;
+	unsigned int i;
+	void *p;
+	int ret;
+
+	for (; pos + sizeof(*op) <= r->len; pos += len) {
+		op = (const struct record_op *)(r->buf + pos);
+		pos += sizeof(*op);
+		switch (op->type) {
+		case RECORD_CONFIG:
+			len = (size_t)op->n * sizeof(*ops);
+			break;
+		case RECORD_MBOX:
+			len = sizeof(struct cxl_send_command) + op->n + op->n_out;
+			break;
+		case RECORD_QUERY:
+			len = sizeof(*q) + (size_t)op->n * sizeof(q->commands[0]);
+			break;
+		default:
+			return -EINVAL;
+		}
+		if (len > r->len - pos)
+			return -EINVAL;
+
+		if (op->type == RECORD_CONFIG) {
+			ops = (const void *)(r->buf + pos);
+			for (i = 0; i < op->n; i++) {
+				ret = replay_parse_access(r, &ops[i], op);
+				if (ret)
+					return ret;
+			}
+			if (op->n == 1) {
+				n1++;
+				ns1 += op->dur_ns;
+			} else {
+				nb++;
+				nb_ops += op->n;
+				nsb += op->dur_ns;
+			}
+		} else if (op->type == RECORD_MBOX) {
+			p = realloc(r->mbox, (r->n_mbox + 1) * sizeof(*r->mbox));
+			if (!p)
+				return -ENOMEM;
+			r->mbox = p;
+			r->mbox[r->n_mbox].op = op;
+			r->mbox[r->n_mbox].cmd = (const void *)(r->buf + pos);
+			r->mbox[r->n_mbox].in = r->buf + pos +
+						sizeof(struct cxl_send_command);
+			r->mbox[r->n_mbox].out = r->mbox[r->n_mbox].in + op->n;
+			r->mbox[r->n_mbox].n_served = 0;
+			r->n_mbox++;
+		} else if (!op->ret) {
+			q = (const void *)(r->buf + pos);
+			r->n_query = max(r->n_query, q->n_commands);
+			if (!r->query || op->n > r->n_query_info) {
+				r->query = q->commands;
+				r->n_query_info = op->n;
+			}
+		}
+	}
+
+	replay_config_cost(r, n1, ns1, nb, nb_ops, nsb);
+	for (i = 0; i < (unsigned int)r->n_doe; i++) {
+		r->doe[i].n_req = 0;
+		replay_xchg_end(&r->doe[i]);
+	}
+	return 0;
+}
+
+/* Busy rather than asleep, the times replayed are short ones */
+static void replay_wait(struct transport_replay *r, u64 t0_ns, u64 ns)
+{
+	u64 end = t0_ns + (u64)(ns * r->scale);
+
+	while (record_now_ns() < end)
+		;
+}
+
+/* The exchange captured for the same request, the least served first */
+static void replay_go(struct transport_replay *r, struct replay_doe *d)
+{
+	struct itimerspec its = { 0 };
+	struct replay_xchg *x, *best = NULL;
+	u64 ns;
+	unsigned int i;
+
+	for (i = 0; i < r->n_x; i++) {
+		x = &r->x[i];
+		if (x->cap != d->cap || x->n_req != d->n_req ||
+		    memcmp(x->req, d->req, d->n_req * sizeof(u32)) ||
+		    (!x->err && x->n_rsp < 2))
+			continue;
+		if (!best || x->n_served < best->n_served)
+			best = x;
+	}
+
+	d->n_req = 0;
+	d->pos = 0;
+	d->x = best ? best - r->x : -1;
+	if (!best) {
+		pr_debug("replay: no such DOE request in the capture\n");
+		r->n_miss++;
+		d->status = PCI_DOE_STATUS_ERROR;
+		return;
+	}
+
+	best->n_served++;
+	ns = best->lat_ns * r->scale;
+	d->status = PCI_DOE_STATUS_BUSY;
+	d->t_ns = record_now_ns() + ns;
+	if (d->irq_fd < 0)
+		return;
+
+	/* A zero it_value disarms, so the timer needs at least 1 ns */
+	its.it_value.tv_sec = ns / 1000000000;
+	its.it_value.tv_nsec = ns % 1000000000 + 1;
+	timerfd_settime(d->irq_fd, 0, &its, NULL);
+}
+
+static u32 replay_status(struct transport_replay *r, struct replay_doe *d)
+{
+	if (d->status == PCI_DOE_STATUS_BUSY && record_now_ns() >= d->t_ns) {
+		d->status = r->x[d->x].err ? PCI_DOE_STATUS_ERROR :
+					     PCI_DOE_STATUS_DATA_OBJECT_READY;
+		if (FIELD_GET(PCI_DOE_CTRL_INT_EN, d->ctrl))
+			d->status |= PCI_DOE_STATUS_INT_STATUS;
+	}
+
+	return d->status;
+}
+
+static void replay_access(struct transport_replay *r,
+			  struct cxl_pdev_config *op)
+{
+	struct replay_doe *d = replay_doe_find(r, op->offset);
+
+	op->retval = 0;
+	if (op->offset >= sizeof(r->cfg) || op->offset % 4) {
+		op->retval = -1;
+		return;
+	}
+
+	if (!d) {
+		if (!op->is_write)
+			op->val = r->cfg[op->offset / 4];
+		return;
+	}
+
+	switch (op->offset - d->cap) {
+	case PCI_DOE_CTRL:
+		if (!op->is_write) {
+			op->val = d->ctrl;
+			break;
+		}
+		d->ctrl = op->val & PCI_DOE_CTRL_INT_EN;
+		if (FIELD_GET(PCI_DOE_CTRL_ABORT, op->val)) {
+			d->n_req = 0;
+			replay_xchg_end(d);
+		} else if (FIELD_GET(PCI_DOE_CTRL_GO, op->val)) {
+			replay_go(r, d);
+		}
+		break;
+	case PCI_DOE_STATUS:
+		if (op->is_write)
+			d->status &= ~(op->val & PCI_DOE_STATUS_INT_STATUS);
+		else
+			op->val = replay_status(r, d);
+		break;
+	case PCI_DOE_WRITE:
+		if (op->is_write && d->n_req < RECORD_MAX_DW)
+			d->req[d->n_req++] = op->val;
+		break;
+	case PCI_DOE_READ:
+		if (!FIELD_GET(PCI_DOE_STATUS_DATA_OBJECT_READY,
+			       replay_status(r, d))) {
+			if (!op->is_write)
+				op->val = 0;
+			break;
+		}
+		if (!op->is_write)
+			op->val = r->x[d->x].rsp[d->pos];
+		else if (++d->pos == r->x[d->x].n_rsp)
+			replay_xchg_end(d);
+		break;
+	default:
+		/* The Capabilities register, as captured */
+		if (!op->is_write)
+			op->val = r->cfg[op->offset / 4];
+	}
+}
+
+static int transport_replay_irq_fd(struct transport *t, u16 cap)
+{
+	struct transport_replay *r = t->priv;
+	int i;
+
+	for (i = 0; i < r->n_doe; i++)
+		if (r->doe[i].cap == cap && r->doe[i].irq_fd >= 0)
+			return r->doe[i].irq_fd;
+
+	return -ENODEV;
+}
+
+/* The timerfd is the replay's */
+static void transport_replay_irq_release(struct transport *t, u16 cap, int fd)
+{
+}
+
+static int transport_replay_config(struct transport *t,
+				   struct cxl_pdev_config *ops, unsigned int n)
+{
+	struct transport_replay *r = t->priv;
+	u64 t0 = record_now_ns();
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < n; i++) {
+		replay_access(r, &ops[i]);
+		if (ops[i].retval && !ret)
+			ret = -EIO;
+	}
+
+	if (n)
+		replay_wait(r, t0, r->call_ns + (n - 1) * r->access_ns);
+	return ret;
+}
+
+/* The command captured with the same input, the least served first */
+static int transport_replay_mbox_send(struct transport *t,
+				      struct cxl_send_command *cmd)
+{
+	struct transport_replay *r = t->priv;
+	const void *in = (const void *)(unsigned long)cmd->in.payload;
+	u64 t0 = record_now_ns();
+	unsigned int i, best = r->n_mbox;
+	u32 n;
+
+	for (i = 0; i < r->n_mbox; i++) {
+		if (r->mbox[i].cmd->id != cmd->id ||
+		    r->mbox[i].op->n != cmd->in.size ||
+		    (cmd->in.size && memcmp(r->mbox[i].in, in, cmd->in.size)))
+			continue;
+		if (best == r->n_mbox || r->mbox[i].n_served < r->mbox[best].n_served)
+			best = i;
+	}
+
+	if (best == r->n_mbox) {
+		pr_debug("replay: no such mailbox command in the capture\n");
+		r->n_miss++;
+		cmd->retval = CXL_MBOX_CMD_RC_UNSUPPORTED;
+		cmd->out.size = 0;
+		return 0;
+	}
+
+	r->mbox[best].n_served++;
+	n = min(r->mbox[best].op->n_out, cmd->out.size);
+	if (n)
+		memcpy((void *)(unsigned long)cmd->out.payload,
+		       r->mbox[best].out, n);
+	cmd->out.size = n;
+	cmd->retval = r->mbox[best].cmd->retval;
+	replay_wait(r, t0, r->mbox[best].op->dur_ns);
+	return r->mbox[best].op->ret;
+}
+
+/* What the driver returns, out of what was captured */
+static int transport_replay_query(struct transport *t,
+				  struct cxl_mem_query_commands *q)
+{
+	struct transport_replay *r = t->priv;
+	u32 n;
+
+	if (!r->n_query)
+		return -EOPNOTSUPP;
+
+	n = min(q->n_commands, r->n_query_info);
+	memcpy(q->commands, r->query, n * sizeof(q->commands[0]));
+	if (!q->n_commands || r->n_query < q->n_commands)
+		q->n_commands = r->n_query;
+	return 0;
+}
+
+static void transport_replay_close(struct transport *t)
+{
+	struct transport_replay *r = t->priv;
+	unsigned int i;
+
+	if (r->n_miss)
+		printf("replay: %llu requests not in the capture\n",
+		       (unsigned long long)r->n_miss);
+	for (i = 0; i < (unsigned int)r->n_doe; i++)
+		if (r->doe[i].irq_fd >= 0)
+			close(r->doe[i].irq_fd);
+	for (i = 0; i < r->n_x; i++)
+		free(r->x[i].req);
+	free(r->x);
+	free(r->mbox);
+	free(r->buf);
+	free(r);
+}
+
+static const struct transport_ops transport_replay_ops = {
+	.name = "replay",
+	.config = transport_replay_config,
+	.irq_fd = transport_replay_irq_fd,
+	.irq_release = transport_replay_irq_release,
+	.mbox_send = transport_replay_mbox_send,
+	.query = transport_replay_query,
+	.close = transport_replay_close,
+};
+
+static int replay_load(struct transport_replay *r, const char *path)
+{
+	FILE *f = fopen(path, "r");
+	long len;
+	int ret = 0;
+
+	if (!f)
+		return -errno;
+	if (fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET)) {
+		ret = -errno;
+		goto out;
+	}
+
+	r->len = len;
+	r->buf = malloc(r->len ? r->len : 1);
+	if (!r->buf)
+		ret = -ENOMEM;
+	else if (fread(r->buf, 1, r->len, f) != r->len)
+		ret = -EIO;
+out:
+	fclose(f);
+	return ret;
+}
+
+/**
+ * transport_open_replay() - Serve a capture of transport_record()
+ * @t: filled in
+ * @path: the capture
+ *
+ * Return: 0, or -errno, -EINVAL for a file that is not a capture
+ */
+int transport_open_replay(struct transport *t, const char *path)
+{
+	struct transport_replay *r;
+	const struct record_hdr *hdr;
+	unsigned int i;
+	int ret;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return -ENOMEM;
+	r->scale = 1;
+
+	ret = replay_load(r, path);
+	hdr = (const void *)r->buf;
+	if (!ret && (r->len < sizeof(*hdr) ||
+		     memcmp(hdr->magic, RECORD_MAGIC, sizeof(hdr->magic)) ||
+		     hdr->n_cfg > ARRAY_SIZE(r->cfg) || hdr->n_doe > DOE_MAX_MB ||
+		     r->len < sizeof(*hdr) + hdr->n_cfg * sizeof(u32)))
+		ret = -EINVAL;
+	if (ret)
+		goto err;
+
+	r->hdr = hdr;
+	memcpy(r->cfg, hdr + 1, hdr->n_cfg * sizeof(u32));
+	for (i = 0; i < hdr->n_doe; i++) {
+		r->doe[r->n_doe].cap = hdr->doe_cap[i];
+		r->doe[r->n_doe].x = -1;
+		r->doe[r->n_doe++].irq_fd = !(hdr->caps & TRANSPORT_ASYNC) ? -1 :
+			timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	}
+
+	ret = replay_parse(r);
+	if (ret)
+		goto err;
+
+	memset(t, 0, sizeof(*t));
+	t->ops = &transport_replay_ops;
+	t->caps = (hdr->caps & (TRANSPORT_CFG_ABS | TRANSPORT_ASYNC)) |
+		  TRANSPORT_BATCH | (r->n_mbox || r->n_query ? TRANSPORT_MBOX : 0);
+	t->fd = -1;
+	t->priv = r;
+	snprintf(t->path, sizeof(t->path), "%s", path);
+	return 0;
+
+err:
+	t->priv = r;
+	transport_replay_close(t);
+	t->priv = NULL;
+	return ret;
+}
+
+/**
+ * transport_replay_scale() - Scale the times a replay takes
+ * @t: opened by transport_open_replay()
+ * @scale: 1 for the times captured, 0 for none
+ *
+ * Return: 0, or -EINVAL when @t is not a replay
+ */
+int transport_replay_scale(struct transport *t, double scale)
+{
+	struct transport_replay *r = t->priv;
+
+	if (t->ops != &transport_replay_ops || scale < 0)
+		return -EINVAL;
+
+	r->scale = scale;
+	return 0;
+}
@@ -0,0 +1,452 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include "include/linux/pci_regs.h"
+
+#include <regs.h>
+#include <cxlmem.h>
+#include <mbox.h>
+#include <pci.h>
+#include <doe.h>
+#include <transport.h>
+#include <bitfield.h>
+
+/**
+ * DOC: regs
+ *
+ * The CXL memory device registers, the mailbox among them, reached
+ * directly in a mapped BAR instead of through the driver. The Register
+ * Locator DVSEC in config space names the BAR and the offset of the
+ * block, and the Device Capabilities Array at its start where each
+ * capability is. Which transport maps the BAR is up to it: vfio from
+ * the device fd, sysfs from the resourceN file, the sim from the
+ * simulated device.
+ *
+ * The mailbox there is then driven the way the driver does, without
+ * CXL_MEM_SEND_COMMAND: the command and its payload written, the
+ * doorbell rung and spun on until the device clears it, a background
+ * command followed through its status register to completion. The
+ * transports whose mailbox this is get TRANSPORT_MBOX from
+ * cxl_regs_attach(). Nothing keeps the driver, if bound, off the same
+ * registers; a doorbell found set is -EBUSY.
+ */
+
+/**
+ * cxl_regloc_find() - Where a register block is, per the Register Locator
+ * @t: transport to the config space
+ * @type: the block, CXL_REGLOC_RBI_*
+ * @bar: its BAR
+ * @offset: its offset in the BAR
+ *
+ * Return: 0, or -ENODEV when the device has no such block
+ */
+int cxl_regloc_find(struct transport *t, enum cxl_regloc_type type, int *bar,
+		    u64 *offset)
+{
+	u16 pos = pci_find_dvsec(t, PCI_DVSEC_VENDOR_ID_CXL,
+				 CXL_DVSEC_REG_LOCATOR);
+	u32 len, lo, hi;
+	u16 i;
+
+	if (!pos)
+		return -ENODEV;
+
+	len = PCI_DVSEC_HEADER1_LEN(pci_cfg_read(t, pos + PCI_DVSEC_HEADER1));
+	for (i = CXL_DVSEC_REG_LOCATOR_BLOCK1_OFFSET; i + 8 <= len; i += 8) {
+		lo = pci_cfg_read(t, pos + i);
+		hi = pci_cfg_read(t, pos + i + 4);
+		if (FIELD_GET(CXL_DVSEC_REG_LOCATOR_BLOCK_ID_MASK, lo) != type)
+			continue;
+
+		*bar = FIELD_GET(CXL_DVSEC_REG_LOCATOR_BIR_MASK, lo);
+		*offset = (u64)hi << 32 |
+			  (lo & CXL_DVSEC_REG_LOCATOR_BLOCK_OFF_LOW_MASK);
+		return 0;
+	}
+
+	return -ENODEV;
+}
+
+/**
+ * cxl_regs_probe() - Find the capabilities of a mapped register block
+ * @r: filled in
+ * @base: the memory device register block
+ * @len: bytes mapped at @base
+ *
+ * Return: 0, or -ENODEV when the block has no Device Capabilities Array
+ */
+int cxl_regs_probe(struct cxl_regs *r, volatile u8 *base, size_t len)
+{
+	u64 array = cxl_readq(base + CXLDEV_CAP_ARRAY_OFFSET);
+	volatile u8 *hdr;
+	u32 id, off, n, i;
+
+	r->base = base;
+	r->len = len;
+	r->status = r->mbox = r->memdev = NULL;
+	r->payload_size = 0;
+	r->ring = NULL;
+
+	if (FIELD_GET(CXLDEV_CAP_ARRAY_ID_MASK, array) != CXLDEV_CAP_ARRAY_CAP_ID)
+		return -ENODEV;
+
+	n = FIELD_GET(CXLDEV_CAP_ARRAY_COUNT_MASK, array);
+	for (i = 1; i <= n && (i + 1) * CXLDEV_CAP_HDR_SIZE <= len; i++) {
+		hdr = base + i * CXLDEV_CAP_HDR_SIZE;
+		id = FIELD_GET(CXLDEV_CAP_HDR_CAP_ID_MASK, cxl_readl(hdr));
+		off = cxl_readl(hdr + CXLDEV_CAP_HDR_OFFSET);
+		if (off + cxl_readl(hdr + CXLDEV_CAP_HDR_LENGTH) > len)
+			continue;
+
+		switch (id) {
+		case CXLDEV_CAP_CAP_ID_DEVICE_STATUS:
+			r->status = base + off;
+			break;
+		case CXLDEV_CAP_CAP_ID_PRIMARY_MAILBOX:
+			r->mbox = base + off;
+			break;
+		case CXLDEV_CAP_CAP_ID_MEMDEV:
+			r->memdev = base + off;
+			break;
+		}
+	}
+
+	if (r->mbox)
+		r->payload_size = 1UL << FIELD_GET(CXLDEV_MBOX_CAP_PAYLOAD_SIZE_MASK,
+				cxl_readl(r->mbox + CXLDEV_MBOX_CAPS_OFFSET));
+
+	return 0;
+}
+
+/**
+ * cxl_regs_map() - Map the memory device register block of a device
+ * @r: filled in
+ * @t: transport to the device, with TRANSPORT_CFG_ABS and TRANSPORT_MMIO
+ *
+ * The mapping belongs to @t, it goes when @t is closed.
+ *
+ * Return: 0, or -errno
+ */
+int cxl_regs_map(struct cxl_regs *r, struct transport *t)
+{
+	void *bar;
+	size_t len;
+	int ret;
+
+	ret = cxl_regloc_find(t, CXL_REGLOC_RBI_MEMDEV, &r->bar, &r->offset);
+	if (ret)
+		return ret;
+
+	ret = transport_bar_map(t, r->bar, &bar, &len);
+	if (ret)
+		return ret;
+	if (r->offset >= len)
+		return -ERANGE;
+
+	return cxl_regs_probe(r, (volatile u8 *)bar + r->offset, len - r->offset);
+}
+
+void cxl_regs_print(FILE *f, const struct cxl_regs *r)
+{
+	u32 st;
+
+	fprintf(f, "memory device registers: BAR%d offset 0x%llx, %zu bytes mapped\n",
+		r->bar, (unsigned long long)r->offset, r->len);
+	if (r->status)
+		fprintf(f, "  device status    @0x%04lx\n",
+			(unsigned long)(r->status - r->base));
+	if (r->mbox)
+		fprintf(f, "  primary mailbox  @0x%04lx payload %zu bytes%s\n",
+			(unsigned long)(r->mbox - r->base), r->payload_size,
+			cxl_readl(r->mbox + CXLDEV_MBOX_CTRL_OFFSET) &
+			CXLDEV_MBOX_CTRL_DOORBELL ? ", doorbell set" : "");
+	if (r->memdev) {
+		st = cxl_readl(r->memdev + CXLMDEV_STATUS_OFFSET);
+		fprintf(f, "  memdev status    @0x%04lx %08x%s%s%s%s\n",
+			(unsigned long)(r->memdev - r->base), st,
+			st & CXLMDEV_DEV_FATAL ? " fatal" : "",
+			st & CXLMDEV_FW_HALT ? " fw-halt" : "",
+			FIELD_GET(CXLMDEV_MEDIA_STATUS_MASK, st) == CXLMDEV_MS_READY ?
+			" media-ready" : "",
+			st & CXLMDEV_MBOX_IF_READY ? " mailbox-ready" : "");
+	}
+}
+
+static u64 cxl_regs_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* Payload registers a dword at a time, the tail a byte at a time */
+static void cxl_memcpy_toio(volatile u8 *dst, const u8 *src, size_t n)
+{
+	size_t i;
+	u32 v;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		memcpy(&v, src + i, 4);
+		cxl_writel(v, dst + i);
+	}
+	for (; i < n; i++)
+		dst[i] = src[i];
+}
+
+static void cxl_memcpy_fromio(u8 *dst, const volatile u8 *src, size_t n)
+{
+	size_t i;
+	u32 v;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = cxl_readl(src + i);
+		memcpy(dst + i, &v, 4);
+	}
+	for (; i < n; i++)
+		dst[i] = src[i];
+}
+
+/*
+ * Spun on rather than slept on, what the command costs is the point;
+ * past the first few microseconds the CPU is yielded between reads, to
+ * whatever answers on this same CPU, the sim.
+ */
+static int cxl_mbox_wait_doorbell(volatile u8 *mbox)
+{
+	u64 start = cxl_regs_now_us(), now;
+
+	while (cxl_readl(mbox + CXLDEV_MBOX_CTRL_OFFSET) &
+	       CXLDEV_MBOX_CTRL_DOORBELL) {
+		now = cxl_regs_now_us();
+		if (now - start > CXL_MAILBOX_TIMEOUT_US)
+			return -ETIMEDOUT;
+		if (now - start > CXL_MAILBOX_SPIN_US)
+			sched_yield();
+	}
+
+	/* The status and the payload once the doorbell is seen clear */
+	__sync_synchronize();
+	return 0;
+}
+
+/* A background command, done when the Background Operation bit clears */
+static int cxl_mbox_wait_bg(volatile u8 *mbox, u16 *return_code)
+{
+	u64 end = cxl_regs_now_us() + CXL_MAILBOX_BG_TIMEOUT_US;
+	u64 bg;
+
+	while (cxl_readq(mbox + CXLDEV_MBOX_STATUS_OFFSET) &
+	       CXLDEV_MBOX_STATUS_BG_CMD) {
+		if (cxl_regs_now_us() > end)
+			return -ETIMEDOUT;
+		usleep(100);
+	}
+
+	__sync_synchronize();
+	bg = cxl_readq(mbox + CXLDEV_MBOX_BG_CMD_STATUS_OFFSET);
+	*return_code = FIELD_GET(CXLDEV_MBOX_BG_CMD_RET_CODE_MASK, bg);
+	return 0;
+}
+
+/**
+ * cxl_regs_mbox_send() - Execute a mailbox command on the registers
+ * @r: the mapped registers, with a mailbox
+ * @cmd: the command, @cmd->return_code and @cmd->size_out filled in
+ *
+ * CXL 2.0 8.2.8.4, as the driver's __cxl_mem_mbox_send_cmd(). A command
+ * the device runs in the background is waited for, its return code
+ * that of the Background Command Status register.
+ *
+ * Return: 0 when the device answered, whatever its return code; -EBUSY
+ * when the doorbell is already set, -ETIMEDOUT when it did not clear
+ */
+int cxl_regs_mbox_send(struct cxl_regs *r, struct cxl_mbox_cmd *cmd)
+{
+	volatile u8 *mbox = r->mbox;
+	u64 cmd_reg, status;
+	size_t n;
+	int ret;
+
+	if (!mbox)
+		return -ENODEV;
+	if (cmd->size_in > r->payload_size)
+		return -E2BIG;
+	if (cxl_readl(mbox + CXLDEV_MBOX_CTRL_OFFSET) & CXLDEV_MBOX_CTRL_DOORBELL)
+		return -EBUSY;
+
+	cmd_reg = FIELD_PREP(CXLDEV_MBOX_CMD_COMMAND_OPCODE_MASK, cmd->opcode);
+	if (cmd->size_in) {
+		cxl_memcpy_toio(mbox + CXLDEV_MBOX_PAYLOAD_OFFSET,
+				cmd->payload_in, cmd->size_in);
+		cmd_reg |= FIELD_PREP(CXLDEV_MBOX_CMD_PAYLOAD_LENGTH_MASK,
+				      cmd->size_in);
+	}
+	cxl_writeq(cmd_reg, mbox + CXLDEV_MBOX_CMD_OFFSET);
+
+	/* The command and its payload before the doorbell */
+	__sync_synchronize();
+	cxl_writel(CXLDEV_MBOX_CTRL_DOORBELL, mbox + CXLDEV_MBOX_CTRL_OFFSET);
+	if (r->ring)
+		r->ring(r->ring_priv);
+
+	ret = cxl_mbox_wait_doorbell(mbox);
+	if (ret)
+		return ret;
+
+	status = cxl_readq(mbox + CXLDEV_MBOX_STATUS_OFFSET);
+	cmd->return_code = FIELD_GET(CXLDEV_MBOX_STATUS_RET_CODE_MASK, status);
+	if (cmd->return_code == CXL_MBOX_CMD_RC_BACKGROUND) {
+		ret = cxl_mbox_wait_bg(mbox, &cmd->return_code);
+		if (ret)
+			return ret;
+		cmd->size_out = 0;
+		return 0;
+	}
+	if (cmd->return_code != CXL_MBOX_CMD_RC_SUCCESS) {
+		cmd->size_out = 0;
+		return 0;
+	}
+
+	cmd_reg = cxl_readq(mbox + CXLDEV_MBOX_CMD_OFFSET);
+	n = FIELD_GET(CXLDEV_MBOX_CMD_PAYLOAD_LENGTH_MASK, cmd_reg);
+	if (n > r->payload_size)
+		n = r->payload_size;
+	if (n > cmd->size_out)
+		n = cmd->size_out;
+	cxl_memcpy_fromio(cmd->payload_out, mbox + CXLDEV_MBOX_PAYLOAD_OFFSET, n);
+	cmd->size_out = n;
+	return 0;
+}
+
+/**
+ * cxl_regs_attach() - Send the mailbox commands of a transport through
+ *		       the registers
+ * @t: a transport whose mbox_send is cxl_regs_send_command()
+ *
+ * Maps the memory device registers, kept until @t is closed, and gives
+ * @t TRANSPORT_MBOX.
+ *
+ * Return: 0, or -errno, -ENODEV when the device has no mailbox
+ */
+int cxl_regs_attach(struct transport *t)
+{
+	struct cxl_regs *r;
+	int ret;
+
+	if (t->regs)
+		return 0;
+	if (!t->ops || t->ops->mbox_send != cxl_regs_send_command)
+		return -EOPNOTSUPP;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return -ENOMEM;
+	ret = cxl_regs_map(r, t);
+	if (!ret && !r->mbox)
+		ret = -ENODEV;
+	if (ret) {
+		free(r);
+		return ret;
+	}
+
+	t->regs = r;
+	t->caps |= TRANSPORT_MBOX;
+	return 0;
+}
+
+/* The mbox_send of the transports that map the registers */
+int cxl_regs_send_command(struct transport *t, struct cxl_send_command *send)
+{
+	struct cxl_mbox_cmd cmd;
+	int ret;
+
+	ret = cxl_mem_validate(send, t->regs->payload_size, &cmd);
+	if (ret)
+		return ret;
+
+	ret = cxl_regs_mbox_send(t->regs, &cmd);
+	if (ret)
+		return ret;
+
+	send->retval = cmd.return_code;
+	send->out.size = cmd.size_out;
+	return 0;
+}
+
+/*
+ * The commands the Command Effects Log lists, as the driver enables
+ * them: GET_SUPPORTED_LOGS and GET_LOG it takes to read it, and RAW,
+ * any opcode, besides.
+ */
+static int cxl_regs_cel(struct transport *t, u64 *ids)
+{
+	static const u8 cel_uuid[16] = CXL_CEL_UUID;
+	struct cxl_mbox_get_supported_logs *gsl;
+	const struct cxl_mem_command *c;
+	const struct cxl_cel_entry *e;
+	size_t n, size = t->regs->payload_size;
+	u32 i, cel_size = 0, off;
+	void *buf;
+	int ret;
+
+	*ids = 1ULL << CXL_MEM_COMMAND_ID_GET_SUPPORTED_LOGS |
+	       1ULL << CXL_MEM_COMMAND_ID_GET_LOG |
+	       1ULL << CXL_MEM_COMMAND_ID_RAW;
+
+	buf = malloc(size);
+	if (!buf)
+		return -ENOMEM;
+
+	gsl = buf;
+	n = size;
+	ret = cxl_get_supported_logs(t, gsl, &n);
+	for (i = 0; !ret && i < gsl->entries &&
+	     sizeof(*gsl) + (i + 1) * sizeof(gsl->entry[0]) <= n; i++)
+		if (!memcmp(gsl->entry[i].uuid, cel_uuid, sizeof(cel_uuid)))
+			cel_size = gsl->entry[i].size;
+	if (!ret && !cel_size)
+		ret = -ENOENT;
+
+	for (off = 0; !ret && off < cel_size; off += n) {
+		n = cel_size - off < size ? cel_size - off : size;
+		ret = cxl_get_log(t, cel_uuid, off, buf, &n);
+		if (!ret && !n)
+			ret = -EIO;
+		for (e = buf; !ret && (void *)(e + 1) <= buf + n; e++) {
+			c = cxl_mem_find_command(e->opcode);
+			if (c)
+				*ids |= 1ULL << c->info.id;
+		}
+	}
+
+	free(buf);
+	return ret;
+}
+
+/*
+ * Their query, the commands the tool knows that the device lists in its
+ * Command Effects Log, read on the first one
+ */
+int cxl_regs_query(struct transport *t, struct cxl_mem_query_commands *q)
+{
+	u64 ids;
+	int ret;
+
+	if (!t->regs->cel_ids) {
+		ret = cxl_regs_cel(t, &ids);
+		if (ret) {
+			printf("Can not read the Command Effects Log: %s\n",
+			       strerror(-ret));
+			return ret;
+		}
+		t->regs->cel_ids = ids;
+	}
+
+	return cxl_mem_query_ids(q, t->regs->cel_ids);
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+
+#include "include/linux/pci_regs.h"
+
+#include <trace.h>
+#include <bitfield.h>
+
+/**
+ * DOC: trace
+ *
+ * Printing every config space access as it happens is what a DOE
+ * exchange spends most of its time on. Instead, each access is recorded
+ * in a ring of binary records, a slot taken with one atomic add, and
+ * only decoded when asked for, after the work is done. What is printed
+ * as it happens is up to debug_level, checked before any formatting.
+ */
+
+int debug_level = DEBUG_LEVEL_OFF;
+struct trace_ring trace_ring;
+
+void trace_start(void)
+{
+	trace_ring.head = 0;
+	trace_ring.on = true;
+}
+
+static const char *trace_reg_name(const struct trace_rec *r)
+{
+	switch (r->offset - r->cap) {
+	case 0:
+		return "DOE cap header";
+	case PCI_DOE_CAP:
+		return "DOE Capabilities";
+	case PCI_DOE_CTRL:
+		return "DOE Control";
+	case PCI_DOE_STATUS:
+		return "DOE Status";
+	case PCI_DOE_WRITE:
+		return "DOE Write Mailbox";
+	case PCI_DOE_READ:
+		return "DOE Read Mailbox";
+	default:
+		return "";
+	}
+}
+
+static void trace_print_flags(FILE *f, const struct trace_rec *r)
+{
+	switch (r->offset - r->cap) {
+	case PCI_DOE_CTRL:
+		if (FIELD_GET(PCI_DOE_CTRL_ABORT, r->val))
+			fprintf(f, " ABORT");
+		if (FIELD_GET(PCI_DOE_CTRL_INT_EN, r->val))
+			fprintf(f, " INT_EN");
+		if (FIELD_GET(PCI_DOE_CTRL_GO, r->val))
+			fprintf(f, " GO");
+		break;
+	case PCI_DOE_STATUS:
+		if (FIELD_GET(PCI_DOE_STATUS_BUSY, r->val))
+			fprintf(f, " BUSY");
+		if (FIELD_GET(PCI_DOE_STATUS_INT_STATUS, r->val))
+			fprintf(f, " INT_STATUS");
+		if (FIELD_GET(PCI_DOE_STATUS_ERROR, r->val))
+			fprintf(f, " ERROR");
+		if (FIELD_GET(PCI_DOE_STATUS_DATA_OBJECT_READY, r->val))
+			fprintf(f, " READY");
+		break;
+	}
+}
+
+/*
+ * The records still in the ring, oldest first, times relative to the
+ * first of them.
+ */
+void trace_dump(FILE *f)
+{
+	u64 head = __atomic_load_n(&trace_ring.head, __ATOMIC_ACQUIRE);
+	u64 first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+	const struct trace_rec *r;
+	u64 t0, i;
+
+	fprintf(f, "%llu config space accesses traced",
+		(unsigned long long)head);
+	if (first)
+		fprintf(f, ", the first %llu overwritten",
+			(unsigned long long)first);
+	fprintf(f, "\n");
+	if (head == first)
+		return;
+
+	fprintf(f, "%12s %9s %2s %5s %8s  %s\n",
+		"time [us]", "dur [ns]", "", "off", "value", "register");
+
+	t0 = trace_ring.rec[first & (TRACE_RING_SIZE - 1)].ts_ns;
+	for (i = first; i < head; i++) {
+		r = &trace_ring.rec[i & (TRACE_RING_SIZE - 1)];
+		fprintf(f, "%12.3f %9u %2s %5x %08x  %s",
+			(double)(r->ts_ns - t0) / 1000, r->dur_ns,
+			r->is_write ? "WR" : "RD", r->offset, r->val,
+			trace_reg_name(r));
+		trace_print_flags(f, r);
+		fprintf(f, "%s\n", r->err ? " failed" : "");
+	}
+}
@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+
+#include <transport.h>
+#include <doe_sim.h>
+#include <regs.h>
+
+#define DEBUG
+#include <debug_or_not.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+/**
+ * DOC: transport
+ *
+ * Everything the tool does to a device goes through a transport: config
+ * space accesses for the DOE mailboxes, and the CXL mailbox commands.
+ * Each backend advertises what it can do in its caps:
+ *
+ *  - ioctl, /dev/cxl/memN: CXL_MEM_CONFIG_WR relative to the driver's
+ *    DOE instance, batched with CXL_MEM_CONFIG_BATCH and completing on
+ *    CXL_MEM_DOE_IRQ_EVENTFD where the patched kernel has them, probed at
+ *    open, and the mailbox commands
+ *  - sysfs, the config file of the PCI function: the whole config space
+ *    on a stock kernel, runs of consecutive dwords in one vectored call
+ *  - uring, the same file through io_uring: a batch in one linked chain
+ *  - vfio, the config region of a function bound to vfio-pci: the whole
+ *    config space and the BARs mapped, without any CXL driver
+ *  - sim, the in-process simulated device: everything but the mailbox
+ *  - replay, a capture of transport_record(): the config space, the DOE
+ *    exchanges and the mailbox commands as they were, see DOC: record
+ *
+ * transport_open() picks, out of the backends that open and have the
+ * caps asked for, the one that batches and completes asynchronously,
+ * the first in transport_names[] on a tie.
+ */
+
+static int transport_ioctl_config(struct transport *t,
+				  struct cxl_pdev_config *ops, unsigned int n)
+{
+	struct cxl_pdev_config_batch batch = {
+		.n_ops = n,
+		.ops = (unsigned long)ops,
+	};
+	unsigned int i;
+	int ret = 0;
+
+	if (n > 1 && (t->caps & TRANSPORT_BATCH)) {
+		transport_count_syscall(t);
+		if (!ioctl(t->fd, CXL_MEM_CONFIG_BATCH, &batch))
+			return 0;
+		/*
+		 * Only a kernel without it is retried an access at a time:
+		 * otherwise @n_ops may have run, a mailbox write or ack that
+		 * must not happen twice. Probed at open, EINVAL is a failure.
+		 */
+		if (errno != ENOTTY) {
+			ret = -errno;
+			pr_debug("CXL_MEM_CONFIG_BATCH %m after %u of %u\n",
+				 batch.n_ops, n);
+			return ret;
+		}
+		pr_debug("CXL_MEM_CONFIG_BATCH %m, one ioctl per access\n");
+	}
+
+	for (i = 0; i < n; i++) {
+		transport_count_syscall(t);
+		if (ioctl(t->fd, CXL_MEM_CONFIG_WR, &ops[i]) < 0 && !ret)
+			ret = -errno;
+	}
+
+	return ret;
+}
+
+static int transport_ioctl_irq_fd(struct transport *t, u16 cap)
+{
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (fd < 0)
+		return -errno;
+
+	if (ioctl(t->fd, CXL_MEM_DOE_IRQ_EVENTFD, &fd) < 0) {
+		pr_debug("CXL_MEM_DOE_IRQ_EVENTFD %m, polling\n");
+		close(fd);
+		return -EOPNOTSUPP;
+	}
+
+	return fd;
+}
+
+static void transport_ioctl_irq_release(struct transport *t, u16 cap, int fd)
+{
+	int off = -1;
+
+	ioctl(t->fd, CXL_MEM_DOE_IRQ_EVENTFD, &off);
+	close(fd);
+}
+
+static int transport_ioctl_mbox_send(struct transport *t,
+				     struct cxl_send_command *cmd)
+{
+	transport_count_syscall(t);
+	return ioctl(t->fd, CXL_MEM_SEND_COMMAND, cmd) < 0 ? -errno : 0;
+}
+
+static int transport_ioctl_query(struct transport *t,
+				 struct cxl_mem_query_commands *q)
+{
+	transport_count_syscall(t);
+	return ioctl(t->fd, CXL_MEM_QUERY_COMMANDS, q) < 0 ? -errno : 0;
+}
+
+static void transport_fd_close(struct transport *t)
+{
+	if (t->fd >= 0)
+		close(t->fd);
+}
+
+const struct transport_ops transport_ioctl_ops = {
+	.name = "ioctl",
+	.config = transport_ioctl_config,
+	.irq_fd = transport_ioctl_irq_fd,
+	.irq_release = transport_ioctl_irq_release,
+	.mbox_send = transport_ioctl_mbox_send,
+	.query = transport_ioctl_query,
+	.close = transport_fd_close,
+};
+
+/*
+ * Whether the kernel has @cmd, asked with @arg that does nothing: a
+ * batch of no access, or no eventfd to signal.
+ */
+static bool transport_ioctl_has(struct transport *t, unsigned long cmd,
+				void *arg)
+{
+	if (!ioctl(t->fd, cmd, arg) || errno != ENOTTY)
+		return true;
+
+	pr_debug("ioctl 0x%lx not in this kernel\n", cmd);
+	return false;
+}
+
+/* /dev/cxl/memN; batching and the DOE interrupt where the kernel has them */
+int transport_open_ioctl(struct transport *t, const char *memdev)
+{
+	struct cxl_pdev_config_batch batch = { .n_ops = 0 };
+	char dev[PATH_MAX];
+	int off = -1;
+
+	memset(t, 0, sizeof(*t));
+	snprintf(dev, sizeof(dev), "/dev/cxl/%s", memdev);
+	t->fd = open(dev, O_RDWR | O_CLOEXEC);
+	if (t->fd < 0)
+		return -errno;
+
+	t->ops = &transport_ioctl_ops;
+	t->caps = TRANSPORT_MBOX;
+	if (transport_ioctl_has(t, CXL_MEM_CONFIG_BATCH, &batch))
+		t->caps |= TRANSPORT_BATCH;
+	if (transport_ioctl_has(t, CXL_MEM_DOE_IRQ_EVENTFD, &off))
+		t->caps |= TRANSPORT_ASYNC;
+	return 0;
+}
+
+static int transport_sim_config(struct transport *t,
+				struct cxl_pdev_config *ops, unsigned int n)
+{
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < n; i++) {
+		doe_sim_config(t->sim, &ops[i]);
+		if (ops[i].retval && !ret)
+			ret = -EIO;
+	}
+
+	return ret;
+}
+
+static int transport_sim_irq_fd(struct transport *t, u16 cap)
+{
+	int fd = doe_sim_irq_fd(t->sim, cap);
+
+	return fd < 0 ? -ENODEV : fd;
+}
+
+/* The simulated device has its memory device registers in one BAR */
+static int transport_sim_bar_map(struct transport *t, int bar, void **base,
+				 size_t *len)
+{
+	if (bar != DOE_SIM_REGS_BAR)
+		return -ENODEV;
+
+	*base = t->sim->regs;
+	*len = sizeof(t->sim->regs);
+	return 0;
+}
+
+/* The timerfd belongs to the simulated mailbox */
+static void transport_sim_irq_release(struct transport *t, u16 cap, int fd)
+{
+}
+
+static void transport_sim_close(struct transport *t)
+{
+}
+
+const struct transport_ops transport_sim_ops = {
+	.name = "sim",
+	.config = transport_sim_config,
+	.irq_fd = transport_sim_irq_fd,
+	.irq_release = transport_sim_irq_release,
+	.mbox_send = cxl_regs_send_command,
+	.query = cxl_regs_query,
+	.bar_map = transport_sim_bar_map,
+	.close = transport_sim_close,
+};
+
+void transport_open_sim(struct transport *t, struct doe_sim_dev *sim)
+{
+	memset(t, 0, sizeof(*t));
+	t->ops = &transport_sim_ops;
+	t->caps = TRANSPORT_CFG_ABS | TRANSPORT_BATCH | TRANSPORT_ASYNC |
+		  TRANSPORT_MMIO;
+	t->fd = -1;
+	t->sim = sim;
+	snprintf(t->path, sizeof(t->path), "sim");
+}
+
+void transport_close(struct transport *t)
+{
+	if (t->ops) {
+		/* Before the backend, whose mapping it points into */
+		free(t->regs);
+		t->ops->close(t);
+	}
+	t->ops = NULL;
+	t->regs = NULL;
+	t->caps = 0;
+	t->fd = -1;
+	t->sim = NULL;
+}
+
+const char *transport_name(const struct transport *t)
+{
+	return t->ops ? t->ops->name : "none";
+}
+
+void transport_print_caps(const struct transport *t)
+{
+	printf("transport %s:%s%s%s%s%s\n", transport_name(t),
+	       t->caps & TRANSPORT_CFG_ABS ? " config-space" : " DOE-only",
+	       t->caps & TRANSPORT_BATCH ? " batch" : "",
+	       t->caps & TRANSPORT_ASYNC ? " async" : "",
+	       t->caps & TRANSPORT_MBOX ? " mailbox" : "",
+	       t->caps & TRANSPORT_MMIO ? " mmio" : "");
+}
+
+/* Faster first: fewer calls per exchange, then no polling */
+static int transport_score(const struct transport *t)
+{
+	return (t->caps & TRANSPORT_BATCH ? 2 : 0) +
+	       (t->caps & TRANSPORT_ASYNC ? 1 : 0);
+}
+
+/* What transport_open() tries when given no name, best first */
+static const char *const transport_names[] = { "ioctl", "uring", "sysfs" };
+
+/* <name>:<arg> names a device other than the memdev, a sysfs directory */
+static int transport_open_one(struct transport *t, const char *name,
+			      const char *memdev)
+{
+	const char *arg = strchr(name, ':');
+
+	if (!strcmp(name, "ioctl"))
+		return transport_open_ioctl(t, memdev);
+	if (!strcmp(name, "sysfs"))
+		return transport_open_sysfs(t, memdev);
+	if (!strcmp(name, "uring"))
+		return transport_open_uring(t, memdev);
+	if (!arg)
+		return -EINVAL;
+	arg++;
+	if (!strncmp(name, "sysfs:", arg - name))
+		return transport_open_sysfs_dev(t, arg);
+	if (!strncmp(name, "uring:", arg - name))
+		return transport_open_uring_dev(t, arg);
+	if (!strncmp(name, "vfio:", arg - name))
+		return transport_open_vfio(t, arg);
+	if (!strncmp(name, "vfio-file:", arg - name))
+		return transport_open_vfio_file(t, arg);
+	if (!strncmp(name, "replay:", arg - name))
+		return transport_open_replay(t, arg);
+
+	return -EINVAL;
+}
+
+/**
+ * transport_open() - Open a transport to a memdev
+ * @t: filled in
+ * @name: ioctl, uring, sysfs, uring:<dir> or sysfs:<dir> for the config
+ *	  file in another directory, vfio:<PCI address>, vfio-file:<path>
+ *	  for a file laid out as a VFIO device, replay:<path> for a
+ *	  capture, or NULL for the fastest
+ * @memdev: memN
+ * @need: TRANSPORT_* the transport must have
+ *
+ * Return: 0, or -errno when no backend opens with @need
+ */
+int transport_open(struct transport *t, const char *name, const char *memdev,
+		   unsigned int need)
+{
+	struct transport try;
+	unsigned int i;
+	int ret;
+
+	if (name) {
+		ret = transport_open_one(t, name, memdev);
+		if (!ret && (t->caps & need) != need) {
+			transport_close(t);
+			ret = -EOPNOTSUPP;
+		}
+		return ret;
+	}
+
+	t->ops = NULL;
+	ret = -ENODEV;
+	for (i = 0; i < ARRAY_SIZE(transport_names); i++) {
+		if (transport_open_one(&try, transport_names[i], memdev))
+			continue;
+		if ((try.caps & need) != need ||
+		    (t->ops && transport_score(&try) <= transport_score(t))) {
+			transport_close(&try);
+			continue;
+		}
+		if (t->ops)
+			transport_close(t);
+		*t = try;
+		ret = 0;
+	}
+
+	return ret;
+}
+
+int transport_irq_fd(struct transport *t, u16 cap)
+{
+	if (!t->ops || !(t->caps & TRANSPORT_ASYNC) || !t->ops->irq_fd)
+		return -EOPNOTSUPP;
+
+	return t->ops->irq_fd(t, cap);
+}
+
+void transport_irq_release(struct transport *t, u16 cap, int fd)
+{
+	if (t->ops && t->ops->irq_release)
+		t->ops->irq_release(t, cap, fd);
+}
+
+int transport_mbox_send(struct transport *t, struct cxl_send_command *cmd)
+{
+	if (!t->ops || !(t->caps & TRANSPORT_MBOX) || !t->ops->mbox_send)
+		return -EOPNOTSUPP;
+
+	return t->ops->mbox_send(t, cmd);
+}
+
+int transport_query(struct transport *t, struct cxl_mem_query_commands *q)
+{
+	if (!t->ops || !(t->caps & TRANSPORT_MBOX) || !t->ops->query)
+		return -EOPNOTSUPP;
+
+	return t->ops->query(t, q);
+}
+
+int transport_bar_map(struct transport *t, int bar, void **base, size_t *len)
+{
+	if (!t->ops || !(t->caps & TRANSPORT_MMIO) || !t->ops->bar_map)
+		return -EOPNOTSUPP;
+
+	return t->ops->bar_map(t, bar, base, len);
+}
@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "include/linux/io_uring.h"
+#include "include/linux/pci_regs.h"
+
+#include <transport.h>
+#include <pci.h>
+
+/**
+ * DOC: uring
+ *
+ * The uring backend of the transports, over the same config file as
+ * sysfs. A batch of accesses, a whole DOE request or response drain,
+ * becomes one chain of IORING_OP_READ/WRITE linked with IOSQE_IO_LINK,
+ * so the kernel runs them in order, and goes in with one io_uring_enter.
+ * Unlike the vectored sysfs calls, the drain's read and ack pairs need
+ * no system call each.
+ *
+ * Every uring transport of the process shares one ring. Chains are
+ * queued under its lock, so they never interleave, and whichever thread
+ * waits reaps the completions of all of them, waking the others. With a
+ * single transport open the submission and the wait are one call.
+ *
+ * The ring is set up with the raw system calls, no liburing.
+ */
+
+/* Ring size, and the most accesses in one chain */
+#define URING_ENTRIES		1024
+#define URING_CHAIN_MAX		256
+
+struct uring_chain {
+	unsigned int pending;
+	int err;
+};
+
+/* What a completion's user_data points to */
+struct uring_req {
+	struct uring_chain *chain;
+	struct cxl_pdev_config *op;
+};
+
+/**
+ * struct uring - The ring every uring transport shares
+ * @lock: held to queue, to submit and to reap
+ * @cond: signalled when a waiter has reaped
+ * @users: transports open on it
+ * @fd: the io_uring, -1 when not set up
+ * @inflight: accesses submitted and not reaped, kept to the CQ size
+ * @waiting: a thread is in io_uring_enter waiting for completions
+ * @sq_*, @cq_*: the rings, mapped
+ * @sqes: the submission queue entries, mapped
+ */
+struct uring {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int users;
+	int fd;
+	unsigned int inflight;
+	bool waiting;
+	void *sq_ring;
+	size_t sq_len;
+	u32 *sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	void *cq_ring;
+	size_t cq_len;
+	u32 *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+static struct uring uring = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.fd = -1,
+};
+
+static int uring_enter(unsigned int to_submit, unsigned int min_complete,
+		       unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, uring.fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static void uring_unmap(void)
+{
+	if (uring.sqes && uring.sqes != MAP_FAILED)
+		munmap(uring.sqes, uring.sqes_len);
+	if (uring.cq_ring && uring.cq_ring != MAP_FAILED &&
+	    uring.cq_ring != uring.sq_ring)
+		munmap(uring.cq_ring, uring.cq_len);
+	if (uring.sq_ring && uring.sq_ring != MAP_FAILED)
+		munmap(uring.sq_ring, uring.sq_len);
+	if (uring.fd >= 0)
+		close(uring.fd);
+	uring.sq_ring = uring.cq_ring = NULL;
+	uring.sqes = NULL;
+	uring.fd = -1;
+}
+
+/* With uring.lock held */
+static int uring_setup(void)
+{
+	struct io_uring_params p;
+	u8 *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	uring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (uring.fd < 0)
+		return -errno;
+
+	uring.sq_len = p.sq_off.array + p.sq_entries * sizeof(u32);
+	uring.cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (uring.cq_len > uring.sq_len)
+			uring.sq_len = uring.cq_len;
+		uring.cq_len = uring.sq_len;
+	}
+
+	uring.sq_ring = mmap(NULL, uring.sq_len, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, uring.fd,
+			     IORING_OFF_SQ_RING);
+	if (uring.sq_ring == MAP_FAILED)
+		goto err;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		uring.cq_ring = uring.sq_ring;
+	else
+		uring.cq_ring = mmap(NULL, uring.cq_len, PROT_READ | PROT_WRITE,
+				     MAP_SHARED | MAP_POPULATE, uring.fd,
+				     IORING_OFF_CQ_RING);
+	if (uring.cq_ring == MAP_FAILED)
+		goto err;
+
+	uring.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	uring.sqes = mmap(NULL, uring.sqes_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQES);
+	if (uring.sqes == MAP_FAILED)
+		goto err;
+
+	sq = uring.sq_ring;
+	uring.sq_head = (u32 *)(sq + p.sq_off.head);
+	uring.sq_tail = (u32 *)(sq + p.sq_off.tail);
+	uring.sq_mask = (u32 *)(sq + p.sq_off.ring_mask);
+	uring.sq_array = (u32 *)(sq + p.sq_off.array);
+
+	cq = uring.cq_ring;
+	uring.cq_head = (u32 *)(cq + p.cq_off.head);
+	uring.cq_tail = (u32 *)(cq + p.cq_off.tail);
+	uring.cq_mask = (u32 *)(cq + p.cq_off.ring_mask);
+	uring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	uring.inflight = 0;
+	return 0;
+
+err:
+	uring_unmap();
+	return -errno;
+}
+
+/* Every completion there, with uring.lock held */
+static void uring_reap(void)
+{
+	u32 head = *uring.cq_head;
+	u32 tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+	struct io_uring_cqe *cqe;
+	struct uring_req *req;
+
+	for (; head != tail; head++) {
+		cqe = &uring.cqes[head & *uring.cq_mask];
+		req = (struct uring_req *)(uintptr_t)cqe->user_data;
+
+		req->op->retval = cqe->res == sizeof(req->op->val) ? 0 : -1;
+		if (req->op->retval && !req->chain->err)
+			req->chain->err = cqe->res < 0 ? cqe->res : -EIO;
+		req->chain->pending--;
+		uring.inflight--;
+	}
+
+	__atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Wait for completions, any chain's, with uring.lock held. One thread
+ * at a time blocks in the kernel, the others on @cond.
+ */
+static int uring_wait(struct transport *t)
+{
+	int ret = 0;
+
+	if (uring.waiting) {
+		pthread_cond_wait(&uring.cond, &uring.lock);
+		return 0;
+	}
+
+	uring.waiting = true;
+	pthread_mutex_unlock(&uring.lock);
+	transport_count_syscall(t);
+	if (uring_enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+		ret = -errno;
+	pthread_mutex_lock(&uring.lock);
+	uring.waiting = false;
+	uring_reap();
+	pthread_cond_broadcast(&uring.cond);
+
+	return ret;
+}
+
+/* @n accesses, at most URING_CHAIN_MAX, as one linked chain */
+static int uring_chain(struct transport *t, struct cxl_pdev_config *ops,
+		       unsigned int n)
+{
+	struct uring_req req[URING_CHAIN_MAX];
+	struct uring_chain chain = { .pending = n };
+	struct io_uring_sqe *sqe;
+	unsigned int i, flags;
+	u32 tail, idx;
+	int ret = 0, err;
+
+	pthread_mutex_lock(&uring.lock);
+
+	/* Room for the chain's completions, so the CQ never overflows */
+	while (uring.inflight + n > URING_ENTRIES && !ret) {
+		uring_reap();
+		if (uring.inflight + n > URING_ENTRIES)
+			ret = uring_wait(t);
+	}
+	if (ret)
+		goto out;
+
+	tail = *uring.sq_tail;
+	for (i = 0; i < n; i++, tail++) {
+		idx = tail & *uring.sq_mask;
+		sqe = &uring.sqes[idx];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = ops[i].is_write ? IORING_OP_WRITE : IORING_OP_READ;
+		sqe->fd = t->fd;
+		sqe->addr = (uintptr_t)&ops[i].val;
+		sqe->len = sizeof(ops[i].val);
+		sqe->off = ops[i].offset;
+		/* The last one ends the chain */
+		sqe->flags = i + 1 < n ? IOSQE_IO_LINK : 0;
+		req[i].chain = &chain;
+		req[i].op = &ops[i];
+		sqe->user_data = (uintptr_t)&req[i];
+		uring.sq_array[idx] = idx;
+	}
+	__atomic_store_n(uring.sq_tail, tail, __ATOMIC_RELEASE);
+	uring.inflight += n;
+
+	/*
+	 * Submitted with the lock held, so no other chain gets in the
+	 * middle. Alone on the ring, it waits for the chain in the same call.
+	 */
+	flags = uring.users == 1 && !uring.waiting ? IORING_ENTER_GETEVENTS : 0;
+	for (i = 0; i < n; i += ret) {
+		transport_count_syscall(t);
+		ret = uring_enter(n - i, flags ? n - i : 0, flags);
+		if (ret >= 0 || errno == EINTR || errno == EAGAIN ||
+		    errno == EBUSY) {
+			/* Taken short, the rest still in the SQ: again */
+			ret = ret > 0 ? ret : 0;
+			continue;
+		}
+
+		/* The kernel has not seen the rest of the chain, take it back */
+		ret = -errno;
+		*uring.sq_tail = tail - (n - i);
+		uring.inflight -= n - i;
+		chain.pending -= n - i;
+		chain.err = ret;
+		break;
+	}
+
+	/* The SQEs point at @req and @chain: never leave before the last */
+	ret = 0;
+	for (;;) {
+		uring_reap();
+		if (!chain.pending)
+			break;
+		err = uring_wait(t);
+		if (err && !ret)
+			ret = err;
+	}
+	if (!ret)
+		ret = chain.err;
+out:
+	pthread_mutex_unlock(&uring.lock);
+	return ret;
+}
+
+static int transport_uring_config(struct transport *t,
+				  struct cxl_pdev_config *ops, unsigned int n)
+{
+	unsigned int todo;
+	int ret, err = 0;
+
+	/* Longer batches go as chains one after the other */
+	for (; n; n -= todo, ops += todo) {
+		todo = n < URING_CHAIN_MAX ? n : URING_CHAIN_MAX;
+		ret = uring_chain(t, ops, todo);
+		if (ret && !err)
+			err = ret;
+	}
+
+	return err;
+}
+
+static void transport_uring_close(struct transport *t)
+{
+	if (t->fd >= 0)
+		close(t->fd);
+
+	pthread_mutex_lock(&uring.lock);
+	if (!--uring.users)
+		uring_unmap();
+	pthread_mutex_unlock(&uring.lock);
+}
+
+const struct transport_ops transport_uring_ops = {
+	.name = "uring",
+	.config = transport_uring_config,
+	.close = transport_uring_close,
+};
+
+/**
+ * transport_open_uring_dev() - The config file of a PCI function, through
+ *				io_uring
+ * @t: filled in
+ * @dir: sysfs directory of the PCI function, or any directory with a
+ *	 config file
+ *
+ * A kernel without io_uring, or without IORING_OP_READ, fails the open
+ * so that transport_open() falls back to the plain sysfs backend.
+ *
+ * Return: 0, or -errno
+ */
+int transport_open_uring_dev(struct transport *t, const char *dir)
+{
+	struct cxl_pdev_config op = { .offset = PCI_VENDOR_ID };
+	int ret;
+
+	ret = transport_open_sysfs_dev(t, dir);
+	if (ret)
+		return ret;
+
+	pthread_mutex_lock(&uring.lock);
+	ret = uring.users ? 0 : uring_setup();
+	if (!ret)
+		uring.users++;
+	pthread_mutex_unlock(&uring.lock);
+	if (ret) {
+		transport_close(t);
+		return ret;
+	}
+
+	t->ops = &transport_uring_ops;
+	t->caps = TRANSPORT_CFG_ABS | TRANSPORT_BATCH;
+
+	ret = transport_config(t, &op, 1);
+	if (ret) {
+		transport_close(t);
+		return ret == -EINVAL ? -EOPNOTSUPP : ret;
+	}
+
+	return 0;
+}
+
+int transport_open_uring(struct transport *t, const char *memdev)
+{
+	char dir[PATH_MAX];
+	int ret;
+
+	t->ops = NULL;
+	t->fd = -1;
+	ret = pci_memdev_dir(memdev, dir, sizeof(dir));
+	if (ret)
+		return ret;
+
+	return transport_open_uring_dev(t, dir);
+}
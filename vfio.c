@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "include/linux/vfio.h"
+#include "include/linux/pci_regs.h"
+
+#include <transport.h>
+#include <pci.h>
+#include <regs.h>
+#include <bitfield.h>
+
+/**
+ * DOC: vfio
+ *
+ * The vfio backend of the transports, for a PCI function bound to
+ * vfio-pci rather than to the CXL driver. Its config space is a region
+ * of the VFIO device fd, read and written at the region offset, runs
+ * of consecutive dwords merged as for sysfs, and the DOE interrupt is an
+ * MSI-X or MSI vector VFIO signals on an eventfd. The BARs are regions
+ * too, mapped whole on first use and kept until the transport closes.
+ *
+ * With no device at hand, vfio-file: opens a plain file laid out the
+ * way a VFIO device fd is, region N at N << 20, config space and the
+ * BARs only, no IOMMU and no interrupts. -sim_vfio_file writes one from
+ * the simulated device.
+ */
+
+#define VFIO_FILE_REGION_SHIFT	20
+#define VFIO_FILE_BAR_SIZE	0x10000
+
+/**
+ * struct transport_vfio - What the vfio backend keeps
+ * @container: /dev/vfio/vfio
+ * @group: /dev/vfio/<IOMMU group>
+ * @cfg_off: offset of the config region in the device fd
+ * @irq_index: VFIO_PCI_MSIX_IRQ_INDEX or VFIO_PCI_MSI_IRQ_INDEX in use,
+ *	       -1 for none
+ * @file: a vfio-file:, regions at fixed offsets
+ * @bar: the BARs mapped so far
+ */
+struct transport_vfio {
+	int container;
+	int group;
+	u64 cfg_off;
+	int irq_index;
+	bool file;
+	struct {
+		void *base;
+		size_t len;
+	} bar[PCI_STD_NUM_BARS];
+};
+
+static int transport_vfio_config(struct transport *t,
+				 struct cxl_pdev_config *ops, unsigned int n)
+{
+	struct transport_vfio *v = t->priv;
+
+	return pci_cfg_rw(t, v->cfg_off, ops, n);
+}
+
+static int transport_vfio_set_irq(struct transport *t, int index, u32 vector,
+				  int fd)
+{
+	struct {
+		struct vfio_irq_set set;
+		s32 fd;
+	} irq = {
+		.set = {
+			.argsz = sizeof(irq),
+			.flags = VFIO_IRQ_SET_ACTION_TRIGGER |
+				 (fd >= 0 ? VFIO_IRQ_SET_DATA_EVENTFD :
+					    VFIO_IRQ_SET_DATA_NONE),
+			.index = index,
+			.start = fd >= 0 ? vector : 0,
+			.count = fd >= 0 ? 1 : 0,
+		},
+		.fd = fd,
+	};
+
+	return ioctl(t->fd, VFIO_DEVICE_SET_IRQS, &irq) < 0 ? -errno : 0;
+}
+
+/* The vector is the DOE capability's Interrupt Message Number */
+static int transport_vfio_irq_fd(struct transport *t, u16 cap)
+{
+	static const int index[] = {
+		VFIO_PCI_MSIX_IRQ_INDEX, VFIO_PCI_MSI_IRQ_INDEX,
+	};
+	struct transport_vfio *v = t->priv;
+	u32 vector;
+	unsigned int i;
+	int fd;
+
+	vector = FIELD_GET(PCI_DOE_CAP_INT_MSG_NUM,
+			   pci_cfg_read(t, cap + PCI_DOE_CAP));
+
+	fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	for (i = 0; i < sizeof(index) / sizeof(index[0]); i++) {
+		struct vfio_irq_info info = {
+			.argsz = sizeof(info),
+			.index = index[i],
+		};
+
+		if (ioctl(t->fd, VFIO_DEVICE_GET_IRQ_INFO, &info) < 0 ||
+		    vector >= info.count)
+			continue;
+		if (!transport_vfio_set_irq(t, index[i], vector, fd)) {
+			v->irq_index = index[i];
+			return fd;
+		}
+	}
+
+	close(fd);
+	return -EOPNOTSUPP;
+}
+
+static void transport_vfio_irq_release(struct transport *t, u16 cap, int fd)
+{
+	struct transport_vfio *v = t->priv;
+
+	if (v->irq_index >= 0)
+		transport_vfio_set_irq(t, v->irq_index, 0, -1);
+	v->irq_index = -1;
+	close(fd);
+}
+
+static int transport_vfio_bar_map(struct transport *t, int bar, void **base,
+				  size_t *len)
+{
+	struct transport_vfio *v = t->priv;
+	struct vfio_region_info region = {
+		.argsz = sizeof(region),
+		.index = VFIO_PCI_BAR0_REGION_INDEX + bar,
+	};
+	void *p;
+
+	if (bar < 0 || bar >= PCI_STD_NUM_BARS)
+		return -EINVAL;
+	if (v->bar[bar].base)
+		goto out;
+
+	if (v->file) {
+		region.offset = (u64)region.index << VFIO_FILE_REGION_SHIFT;
+		region.size = VFIO_FILE_BAR_SIZE;
+		region.flags = VFIO_REGION_INFO_FLAG_MMAP;
+	} else if (ioctl(t->fd, VFIO_DEVICE_GET_REGION_INFO, &region) < 0) {
+		return -errno;
+	}
+	/* Sparse mmap capabilities are not looked at, the whole BAR or none */
+	if (!region.size || !(region.flags & VFIO_REGION_INFO_FLAG_MMAP))
+		return -EOPNOTSUPP;
+
+	p = mmap(NULL, region.size, PROT_READ | PROT_WRITE, MAP_SHARED, t->fd,
+		 region.offset);
+	if (p == MAP_FAILED)
+		return -errno;
+	v->bar[bar].base = p;
+	v->bar[bar].len = region.size;
+out:
+	*base = v->bar[bar].base;
+	*len = v->bar[bar].len;
+	return 0;
+}
+
+static void transport_vfio_close(struct transport *t)
+{
+	struct transport_vfio *v = t->priv;
+	int i;
+
+	if (v)
+		for (i = 0; i < PCI_STD_NUM_BARS; i++)
+			if (v->bar[i].base)
+				munmap(v->bar[i].base, v->bar[i].len);
+	if (t->fd >= 0)
+		close(t->fd);
+	if (v) {
+		if (v->group >= 0)
+			close(v->group);
+		if (v->container >= 0)
+			close(v->container);
+		free(v);
+	}
+	t->priv = NULL;
+}
+
+const struct transport_ops transport_vfio_ops = {
+	.name = "vfio",
+	.config = transport_vfio_config,
+	.irq_fd = transport_vfio_irq_fd,
+	.irq_release = transport_vfio_irq_release,
+	.mbox_send = cxl_regs_send_command,
+	.query = cxl_regs_query,
+	.bar_map = transport_vfio_bar_map,
+	.close = transport_vfio_close,
+};
+
+/* The IOMMU group of @bdf, the number /sys/bus/pci/devices/<bdf>/iommu_group links to */
+static int transport_vfio_group(const char *bdf)
+{
+	char link[PATH_MAX], target[PATH_MAX];
+	ssize_t n;
+
+	snprintf(link, sizeof(link), "/sys/bus/pci/devices/%s/iommu_group", bdf);
+	n = readlink(link, target, sizeof(target) - 1);
+	if (n < 0)
+		return -errno;
+	target[n] = '\0';
+
+	return atoi(basename(target));
+}
+
+/**
+ * transport_open_vfio() - Open a PCI function bound to vfio-pci
+ * @t: filled in
+ * @bdf: its PCI address, 0000:35:00.0
+ *
+ * Return: 0, or -errno
+ */
+int transport_open_vfio(struct transport *t, const char *bdf)
+{
+	struct vfio_group_status status = { .argsz = sizeof(status) };
+	struct vfio_region_info region = {
+		.argsz = sizeof(region),
+		.index = VFIO_PCI_CONFIG_REGION_INDEX,
+	};
+	struct transport_vfio *v;
+	char path[PATH_MAX];
+	int group, ret;
+
+	memset(t, 0, sizeof(*t));
+	t->fd = -1;
+
+	group = transport_vfio_group(bdf);
+	if (group < 0)
+		return group;
+
+	v = calloc(1, sizeof(*v));
+	if (!v)
+		return -ENOMEM;
+	v->group = -1;
+	v->irq_index = -1;
+	t->priv = v;
+	t->ops = &transport_vfio_ops;
+
+	v->container = open("/dev/vfio/vfio", O_RDWR | O_CLOEXEC);
+	if (v->container < 0)
+		goto err;
+	if (ioctl(v->container, VFIO_GET_API_VERSION) != VFIO_API_VERSION) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	snprintf(path, sizeof(path), "/dev/vfio/%d", group);
+	v->group = open(path, O_RDWR | O_CLOEXEC);
+	if (v->group < 0)
+		goto err;
+	if (ioctl(v->group, VFIO_GROUP_GET_STATUS, &status) < 0)
+		goto err;
+	if (!(status.flags & VFIO_GROUP_FLAGS_VIABLE)) {
+		/* Another function of the group is not bound to vfio-pci */
+		errno = EBUSY;
+		goto err;
+	}
+
+	if (ioctl(v->group, VFIO_GROUP_SET_CONTAINER, &v->container) < 0 ||
+	    ioctl(v->container, VFIO_SET_IOMMU,
+		  ioctl(v->container, VFIO_CHECK_EXTENSION, VFIO_TYPE1v2_IOMMU) > 0 ?
+		  VFIO_TYPE1v2_IOMMU : VFIO_TYPE1_IOMMU) < 0)
+		goto err;
+
+	t->fd = ioctl(v->group, VFIO_GROUP_GET_DEVICE_FD, bdf);
+	if (t->fd < 0)
+		goto err;
+	if (ioctl(t->fd, VFIO_DEVICE_GET_REGION_INFO, &region) < 0)
+		goto err;
+
+	v->cfg_off = region.offset;
+	t->caps = TRANSPORT_CFG_ABS | TRANSPORT_BATCH | TRANSPORT_ASYNC |
+		  TRANSPORT_MMIO;
+	snprintf(t->path, sizeof(t->path), "/sys/bus/pci/devices/%s", bdf);
+	return 0;
+
+err:
+	ret = -errno;
+	transport_close(t);
+	return ret;
+}
+
+/**
+ * transport_open_vfio_file() - Open a file laid out as a VFIO device fd
+ * @t: filled in
+ * @path: the file, as transport_vfio_file_create() writes it
+ *
+ * Return: 0, or -errno
+ */
+int transport_open_vfio_file(struct transport *t, const char *path)
+{
+	struct transport_vfio *v;
+
+	memset(t, 0, sizeof(*t));
+	t->fd = open(path, O_RDWR | O_CLOEXEC);
+	if (t->fd < 0)
+		return -errno;
+
+	v = calloc(1, sizeof(*v));
+	if (!v) {
+		close(t->fd);
+		return -ENOMEM;
+	}
+	v->container = v->group = v->irq_index = -1;
+	v->file = true;
+	v->cfg_off = (u64)VFIO_PCI_CONFIG_REGION_INDEX << VFIO_FILE_REGION_SHIFT;
+	t->priv = v;
+	t->ops = &transport_vfio_ops;
+	t->caps = TRANSPORT_CFG_ABS | TRANSPORT_BATCH | TRANSPORT_MMIO;
+	snprintf(t->path, sizeof(t->path), "%s", path);
+	return 0;
+}
+
+/**
+ * transport_vfio_file_create() - Write a file for transport_open_vfio_file()
+ * @path: the file, replaced
+ * @cfg: config space
+ * @cfg_len: bytes of @cfg, at most PCI_CFG_SPACE_EXP_SIZE
+ * @bar: the BAR @regs are
+ * @regs: its contents
+ * @regs_len: bytes of @regs, at most 64K
+ *
+ * Return: 0, or -errno
+ */
+int transport_vfio_file_create(const char *path, const void *cfg,
+			       size_t cfg_len, int bar, const void *regs,
+			       size_t regs_len)
+{
+	off_t cfg_off = (off_t)VFIO_PCI_CONFIG_REGION_INDEX <<
+			VFIO_FILE_REGION_SHIFT;
+	off_t bar_off = (off_t)(VFIO_PCI_BAR0_REGION_INDEX + bar) <<
+			VFIO_FILE_REGION_SHIFT;
+	int fd, ret = 0;
+
+	if (cfg_len > PCI_CFG_SPACE_EXP_SIZE || regs_len > VFIO_FILE_BAR_SIZE ||
+	    bar < 0 || bar >= PCI_STD_NUM_BARS)
+		return -EINVAL;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -errno;
+
+	/* Every BAR is VFIO_FILE_BAR_SIZE, the config region last */
+	if (ftruncate(fd, cfg_off + PCI_CFG_SPACE_EXP_SIZE) < 0 ||
+	    pwrite(fd, cfg, cfg_len, cfg_off) != (ssize_t)cfg_len ||
+	    pwrite(fd, regs, regs_len, bar_off) != (ssize_t)regs_len)
+		ret = errno ? -errno : -EIO;
+
+	close(fd);
+	return ret;
+}
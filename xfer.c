@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <xfer.h>
+#include <dev.h>
+#include <mbox.h>
+#include <cxlmem.h>
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+/**
+ * DOC: xfer
+ *
+ * The mailbox commands whose payloads vary in size move more than one
+ * payload holds in chunks: GET_LOG and GET_LSA read, SET_LSA writes, a
+ * range at a time by offset and length, and GET_POISON and
+ * GET_SCAN_MEDIA repeat while the device says it has more records.
+ * Every chunk is as large as the mailbox of the device takes, what
+ * struct cxl_dev learnt it to be, and goes through the one buffer of
+ * its pool, handed to a cxl_xfer_fn to stream wherever the caller
+ * wants, a file with cxl_xfer_to_fd() and cxl_xfer_from_fd().
+ *
+ * Each returns the bytes moved, or -errno: of the first command that
+ * failed, or of the cxl_xfer_fn that stopped it. The chunks before
+ * that are the caller's already.
+ */
+
+int cxl_xfer_to_fd(void *priv, u64 off, void *buf, size_t len)
+{
+	int fd = *(int *)priv;
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		buf = (u8 *)buf + n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+int cxl_xfer_from_fd(void *priv, u64 off, void *buf, size_t len)
+{
+	int fd = *(int *)priv;
+	ssize_t n;
+
+	while (len) {
+		n = read(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		/* Short of what was asked for */
+		if (!n)
+			return -ENODATA;
+		buf = (u8 *)buf + n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* The buffer of the pool a transfer goes through */
+static int cxl_xfer_buf(struct cxl_dev *d, void **buf)
+{
+	int ret = cxl_dev_mbox_open(d);
+
+	if (ret)
+		return ret;
+
+	*buf = cxl_dev_buf_get(d);
+	return *buf ? 0 : -EBUSY;
+}
+
+/* GET_LOG of @uuid, or GET_LSA without, @len bytes from @off */
+static ssize_t cxl_xfer_read(struct cxl_dev *d, const u8 *uuid, u32 off,
+			     u32 len, cxl_xfer_fn fn, void *priv)
+{
+	struct transport *t = cxl_dev_mbox(d);
+	size_t n, want;
+	u32 done = 0;
+	void *buf;
+	int ret;
+
+	ret = cxl_xfer_buf(d, &buf);
+	if (ret)
+		return ret;
+
+	while (done < len) {
+		want = n = min(len - done, d->payload_size);
+		ret = uuid ? cxl_get_log(t, uuid, off + done, buf, &n) :
+			     cxl_get_lsa(t, off + done, buf, &n);
+		if (ret || !n)
+			break;
+		ret = fn(priv, done, buf, n);
+		if (ret)
+			break;
+		done += n;
+		/* Short: the end of the log */
+		if (n < want)
+			break;
+	}
+
+	cxl_dev_buf_put(d, buf);
+	return ret ? ret : (ssize_t)done;
+}
+
+/**
+ * cxl_xfer_get_log() - Read a log, a payload at a time
+ * @d: the device
+ * @uuid: of the log, as GET_SUPPORTED_LOGS lists it
+ * @off: where to start in the log
+ * @len: bytes to read at most; fewer when the log ends before
+ * @fn: handed each chunk
+ * @priv: for @fn
+ *
+ * Return: the bytes read, or -errno
+ */
+ssize_t cxl_xfer_get_log(struct cxl_dev *d, const u8 uuid[16], u32 off,
+			 u32 len, cxl_xfer_fn fn, void *priv)
+{
+	return cxl_xfer_read(d, uuid, off, len, fn, priv);
+}
+
+/* As cxl_xfer_get_log(), from the Label Storage Area */
+ssize_t cxl_xfer_get_lsa(struct cxl_dev *d, u32 off, u32 len,
+			 cxl_xfer_fn fn, void *priv)
+{
+	return cxl_xfer_read(d, NULL, off, len, fn, priv);
+}
+
+/**
+ * cxl_xfer_set_lsa() - Write the Label Storage Area, a payload at a time
+ * @d: the device
+ * @off: where to start in the LSA
+ * @len: bytes to write
+ * @fn: fills in each chunk, of what the payload has room for after the
+ *	SET_LSA header
+ * @priv: for @fn
+ *
+ * Return: the bytes written, or -errno
+ */
+ssize_t cxl_xfer_set_lsa(struct cxl_dev *d, u32 off, u32 len,
+			 cxl_xfer_fn fn, void *priv)
+{
+	struct transport *t = cxl_dev_mbox(d);
+	struct cxl_mbox_set_lsa *lsa;
+	size_t n, max;
+	u32 done = 0;
+	int ret;
+
+	ret = cxl_xfer_buf(d, (void **)&lsa);
+	if (ret)
+		return ret;
+
+	max = d->payload_size - sizeof(*lsa);
+	while (done < len) {
+		n = min(len - done, max);
+		ret = fn(priv, done, lsa->data, n);
+		if (ret)
+			break;
+		lsa->offset = off + done;
+		ret = cxl_set_lsa(t, lsa, n);
+		if (ret)
+			break;
+		done += n;
+	}
+
+	cxl_dev_buf_put(d, lsa);
+	return ret ? ret : (ssize_t)done;
+}
+
+/*
+ * GET_POISON of @in, or GET_SCAN_MEDIA without: the records of each
+ * response, again for as long as the device says it has more.
+ */
+static ssize_t cxl_xfer_records(struct cxl_dev *d,
+				const struct cxl_mbox_poison_in *in,
+				cxl_xfer_fn fn, void *priv)
+{
+	struct transport *t = cxl_dev_mbox(d);
+	struct cxl_mbox_get_scan_media *sm;
+	struct cxl_mbox_poison_out *po;
+	struct cxl_poison_record *rec;
+	size_t n, hdr, count;
+	u64 done = 0;
+	bool more;
+	void *buf;
+	int ret;
+
+	ret = cxl_xfer_buf(d, &buf);
+	if (ret)
+		return ret;
+	po = buf;
+	sm = buf;
+
+	for (;;) {
+		n = d->payload_size;
+		if (in) {
+			ret = cxl_get_poison(t, in->offset, in->length, po, &n);
+			hdr = sizeof(*po);
+			rec = po->record;
+			count = po->count;
+			more = po->flags & CXL_POISON_FLAG_MORE;
+		} else {
+			ret = cxl_get_scan_media(t, sm, &n);
+			hdr = sizeof(*sm);
+			rec = sm->record;
+			count = sm->count;
+			more = sm->flags & CXL_SCAN_MEDIA_FLAG_MORE;
+		}
+		if (!ret && n < hdr)
+			ret = -EIO;
+		if (ret)
+			break;
+
+		count = min(count, (n - hdr) / sizeof(*rec));
+		if (count) {
+			ret = fn(priv, done, rec, count * sizeof(*rec));
+			if (ret)
+				break;
+			done += count * sizeof(*rec);
+		}
+		if (!more)
+			break;
+		/* More, of none: it would never end */
+		if (!count) {
+			ret = -EIO;
+			break;
+		}
+	}
+
+	cxl_dev_buf_put(d, buf);
+	return ret ? ret : (ssize_t)done;
+}
+
+/**
+ * cxl_xfer_get_poison() - The poison list of a DPA range, in full
+ * @d: the device
+ * @dpa: start of the range, 64-byte aligned
+ * @len: of the range, in 64-byte units
+ * @fn: handed the struct cxl_poison_record of each response
+ * @priv: for @fn
+ *
+ * Return: the bytes of records, or -errno
+ */
+ssize_t cxl_xfer_get_poison(struct cxl_dev *d, u64 dpa, u64 len,
+			    cxl_xfer_fn fn, void *priv)
+{
+	struct cxl_mbox_poison_in in = { .offset = dpa, .length = len };
+
+	return cxl_xfer_records(d, &in, fn, priv);
+}
+
+/* As cxl_xfer_get_poison(), the results of the last SCAN_MEDIA */
+ssize_t cxl_xfer_get_scan_media(struct cxl_dev *d, cxl_xfer_fn fn,
+				void *priv)
+{
+	return cxl_xfer_records(d, NULL, fn, priv);
+}